@@ -0,0 +1,387 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include "codec.h"
+
+#include <stdint.h>
+
+#include "utils.h"
+
+/* LZ stream, made of sequences of:
+ * - A token byte, with the literal count in the high nibble, and the match length (minus `LZ_MIN_MATCH`) in the low one;
+ * - If a nibble is 15, extra bytes added to it, up to the first byte below 255;
+ * - The literals;
+ * - The match offset (2 bytes, little endian), and extra match length bytes.
+ * The last sequence only has literals. */
+#define LZ_MIN_MATCH 4
+#define LZ_MAX_OFFSET 0xffff
+#define LZ_HASH_BITS 12
+
+/* Words are shuffled and XORed in 4 byte units, bytes are left in place if the element size is not a multiple of it. */
+#define CODEC_WORD 4
+
+/* Buffers */
+
+/* Get a buffer of at least `size` bytes (aligned to `ALIGN_SIZE`), previous contents are lost. */
+void *codec_buffer_get(codec_buffer *buffer, size_t size)
+{
+	if (size > buffer->size || !buffer->data) {
+		alignfree(buffer->data);
+
+		buffer->size = MAX(size, ALIGN_SIZE);
+		buffer->data = alignalloc(buffer->size, ALIGN_SIZE);
+	}
+
+	return buffer->data;
+}
+
+void codec_buffer_free(codec_buffer *buffer)
+{
+	alignfree(buffer->data);
+
+	buffer->data = NULL;
+	buffer->size = 0;
+}
+
+/* LZ */
+
+static uint32_t lz_read32(const uint8_t *ptr)
+{
+	uint32_t val;
+
+	memcpy(&val, ptr, sizeof(val));
+
+	return val;
+}
+
+static uint lz_hash(uint32_t val)
+{
+	return (val * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+static uint8_t *lz_write_length(uint8_t *op, size_t len)
+{
+	while (len >= 255) {
+		*op++ = 255;
+		len -= 255;
+	}
+
+	*op++ = (uint8_t)len;
+
+	return op;
+}
+
+static bool lz_read_length(const uint8_t **ip, const uint8_t *iend, size_t *len)
+{
+	uint8_t byte;
+
+	do {
+		if (*ip >= iend) {
+			return false;
+		}
+
+		byte = *(*ip)++;
+		*len += byte;
+	} while (byte == 255);
+
+	return true;
+}
+
+static uint8_t *lz_write_sequence(uint8_t *op, const uint8_t *lit, size_t num_lit, size_t offset, size_t len)
+{
+	uint8_t *token = op++;
+
+	*token = (uint8_t)(MIN(num_lit, 15) << 4);
+
+	if (num_lit >= 15) {
+		op = lz_write_length(op, num_lit - 15);
+	}
+
+	memcpy(op, lit, num_lit);
+	op += num_lit;
+
+	if (len) {
+		len -= LZ_MIN_MATCH;
+		*token |= (uint8_t)MIN(len, 15);
+
+		*op++ = (uint8_t)(offset & 0xff);
+		*op++ = (uint8_t)(offset >> 8);
+
+		if (len >= 15) {
+			op = lz_write_length(op, len - 15);
+		}
+	}
+
+	return op;
+}
+
+static size_t lz_bound(size_t size)
+{
+	return size + (size / 255) + 16;
+}
+
+/* Compress `size` bytes (at most `UINT32_MAX`) into `dst`, which must hold `lz_bound(size)` bytes. */
+static size_t lz_compress(const void *src, size_t size, void *dst)
+{
+	const uint8_t *base = src;
+	const uint8_t *end = base + size;
+	const uint8_t *ip = base;
+	const uint8_t *anchor = base;
+	uint8_t *op = dst;
+	uint32_t table[1 << LZ_HASH_BITS] = {0};
+
+	while (ip + LZ_MIN_MATCH <= end) {
+		uint32_t seq = lz_read32(ip);
+		uint hash = lz_hash(seq);
+		const uint8_t *ref = base + table[hash];
+
+		table[hash] = (uint32_t)(ip - base);
+
+		if (ref < ip && (ip - ref) <= LZ_MAX_OFFSET && lz_read32(ref) == seq) {
+			size_t len = LZ_MIN_MATCH;
+
+			while (ip + len < end && ref[len] == ip[len]) {
+				len++;
+			}
+
+			op = lz_write_sequence(op, anchor, (size_t)(ip - anchor), (size_t)(ip - ref), len);
+
+			ip += len;
+			anchor = ip;
+		}
+		else {
+			/* Skip faster through data that does not compress. */
+			ip += 1 + ((size_t)(ip - anchor) >> 6);
+		}
+	}
+
+	op = lz_write_sequence(op, anchor, (size_t)(end - anchor), 0, 0);
+
+	return (size_t)(op - (uint8_t *)dst);
+}
+
+/* Decompress exactly `size` bytes, failing on any malformed input. */
+static bool lz_decompress(const void *src, size_t csize, void *dst, size_t size)
+{
+	const uint8_t *ip = src;
+	const uint8_t *iend = ip + csize;
+	uint8_t *base = dst;
+	uint8_t *op = base;
+	uint8_t *oend = base + size;
+
+	while (ip < iend) {
+		uint token = *ip++;
+		size_t num_lit = token >> 4;
+		size_t len = token & 15;
+		size_t offset;
+
+		if (num_lit == 15 && !lz_read_length(&ip, iend, &num_lit)) {
+			return false;
+		}
+
+		if (num_lit > (size_t)(iend - ip) || num_lit > (size_t)(oend - op)) {
+			return false;
+		}
+
+		memcpy(op, ip, num_lit);
+		op += num_lit;
+		ip += num_lit;
+
+		/* Last sequence. */
+		if (ip == iend) {
+			break;
+		}
+
+		if ((iend - ip) < 2) {
+			return false;
+		}
+
+		offset = (size_t)ip[0] | ((size_t)ip[1] << 8);
+		ip += 2;
+
+		if (len == 15 && !lz_read_length(&ip, iend, &len)) {
+			return false;
+		}
+
+		len += LZ_MIN_MATCH;
+
+		if (offset == 0 || offset > (size_t)(op - base) || len > (size_t)(oend - op)) {
+			return false;
+		}
+
+		/* Matches can overlap the output. */
+		for (const uint8_t *ref = op - offset; len > 0; len--) {
+			*op++ = *ref++;
+		}
+	}
+
+	return op == oend;
+}
+
+/* Transforms */
+
+/* Group the bytes of 4 byte words by position (trailing bytes are kept in place).
+ * delta: if not 0, XOR each word with the same word of the previous element (`delta` bytes before) first. */
+static void shuffle(const uint8_t *src, size_t size, uint delta, uint8_t *dst)
+{
+	size_t num_words = size / CODEC_WORD;
+	size_t num_delta = delta / CODEC_WORD;
+
+	for (size_t i = 0; i < num_words; i++) {
+		uint32_t word = lz_read32(src + (i * CODEC_WORD));
+
+		if (delta && i >= num_delta) {
+			word ^= lz_read32(src + ((i - num_delta) * CODEC_WORD));
+		}
+
+		for (uint b = 0; b < CODEC_WORD; b++) {
+			dst[(b * num_words) + i] = ((const uint8_t *)&word)[b];
+		}
+	}
+
+	memcpy(dst + (num_words * CODEC_WORD), src + (num_words * CODEC_WORD), size % CODEC_WORD);
+}
+
+static void unshuffle(const uint8_t *src, size_t size, uint8_t *dst)
+{
+	size_t num_words = size / CODEC_WORD;
+
+	for (size_t i = 0; i < num_words; i++) {
+		for (uint b = 0; b < CODEC_WORD; b++) {
+			dst[(i * CODEC_WORD) + b] = src[(b * num_words) + i];
+		}
+	}
+
+	memcpy(dst + (num_words * CODEC_WORD), src + (num_words * CODEC_WORD), size % CODEC_WORD);
+}
+
+/* Undo the delta of `shuffle`, in place. */
+static void xor_undelta(uint8_t *data, size_t size, uint stride)
+{
+	for (size_t i = stride / CODEC_WORD; i < size / CODEC_WORD; i++) {
+		uint32_t word = lz_read32(data + (i * CODEC_WORD)) ^ lz_read32(data + (i * CODEC_WORD) - stride);
+
+		memcpy(data + (i * CODEC_WORD), &word, sizeof(word));
+	}
+}
+
+/* Codecs
+ * Encoded data starts with the codec that was used, followed by the LZ stream. */
+
+/* Size `dst` must have for `codec_encode`. */
+size_t codec_bound(size_t size)
+{
+	return 1 + lz_bound(size);
+}
+
+/* Encode `size` bytes of elements of `stride` bytes.
+ * work: buffer of `size` bytes.
+ * Returns the encoded size, or 0 if the data can't be made smaller. */
+size_t codec_encode(OmniCodec codec, uint stride, const void *src, size_t size, void *dst, void *work)
+{
+	uint8_t *out = dst;
+	size_t csize;
+
+	if (codec == OMNI_CODEC_NONE || size == 0 || size > UINT32_MAX) {
+		return 0;
+	}
+
+	if (codec == OMNI_CODEC_FLOAT_XOR && (stride == 0 || stride % CODEC_WORD)) {
+		codec = OMNI_CODEC_SHUFFLE_LZ;
+	}
+
+	shuffle(src, size, (codec == OMNI_CODEC_FLOAT_XOR) ? stride : 0, work);
+
+	out[0] = (uint8_t)codec;
+	csize = 1 + lz_compress(work, size, out + 1);
+
+	return csize < size ? csize : 0;
+}
+
+/* Decode data encoded with `codec_encode` into `size` bytes.
+ * work: buffer of `size` bytes.
+ * Returns false if the data is malformed. */
+bool codec_decode(const void *src, size_t csize, void *dst, size_t size, uint stride, void *work)
+{
+	const uint8_t *in = src;
+	uint codec;
+
+	if (csize < 1) {
+		return false;
+	}
+
+	codec = in[0];
+
+	if (codec != OMNI_CODEC_SHUFFLE_LZ && codec != OMNI_CODEC_FLOAT_XOR) {
+		return false;
+	}
+
+	if (codec == OMNI_CODEC_FLOAT_XOR && (stride == 0 || stride % CODEC_WORD)) {
+		return false;
+	}
+
+	if (!lz_decompress(in + 1, csize - 1, work, size)) {
+		return false;
+	}
+
+	unshuffle(work, size, dst);
+
+	if (codec == OMNI_CODEC_FLOAT_XOR) {
+		xor_undelta(dst, size, stride);
+	}
+
+	return true;
+}
+
+/* Deltas */
+
+/* XOR `size` bytes of `data` with `other`. */
+void codec_xor(void *data, const void *other, size_t size)
+{
+	uint8_t *bytes = data;
+	const uint8_t *other_bytes = other;
+	size_t i = 0;
+
+	for (; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t)) {
+		uint64_t val, other_val;
+
+		memcpy(&val, bytes + i, sizeof(val));
+		memcpy(&other_val, other_bytes + i, sizeof(other_val));
+
+		val ^= other_val;
+
+		memcpy(bytes + i, &val, sizeof(val));
+	}
+
+	for (; i < size; i++) {
+		bytes[i] ^= other_bytes[i];
+	}
+}
+
+/* XOR `size` bytes of `data` with `other`, and replace `other` with the original `data`. */
+void codec_xor_swap(void *data, void *other, size_t size)
+{
+	uint8_t *bytes = data;
+	uint8_t *other_bytes = other;
+	size_t i = 0;
+
+	for (; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t)) {
+		uint64_t val, other_val;
+
+		memcpy(&val, bytes + i, sizeof(val));
+		memcpy(&other_val, other_bytes + i, sizeof(other_val));
+
+		other_val ^= val;
+
+		memcpy(bytes + i, &other_val, sizeof(other_val));
+		memcpy(other_bytes + i, &val, sizeof(val));
+	}
+
+	for (; i < size; i++) {
+		uint8_t val = bytes[i];
+
+		bytes[i] ^= other_bytes[i];
+		other_bytes[i] = val;
+	}
+}
@@ -0,0 +1,29 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#ifndef __OMNI_CODEC_H__
+#define __OMNI_CODEC_H__
+
+#include <stddef.h>
+
+#include "types.h"
+#include "omnicache.h"
+
+/* Reusable buffer, grown as needed by `codec_buffer_get`. */
+typedef struct codec_buffer {
+	void *data;
+	size_t size;
+} codec_buffer;
+
+void *codec_buffer_get(codec_buffer *buffer, size_t size);
+void codec_buffer_free(codec_buffer *buffer);
+
+size_t codec_bound(size_t size);
+size_t codec_encode(OmniCodec codec, uint stride, const void *src, size_t size, void *dst, void *work);
+bool codec_decode(const void *src, size_t csize, void *dst, size_t size, uint stride, void *work);
+
+void codec_xor(void *data, const void *other, size_t size);
+void codec_xor_swap(void *data, void *other, size_t size);
+
+#endif /* __OMNI_CODEC_H__ */
@@ -0,0 +1,57 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include "cpu.h"
+
+#if defined(CPU_X86) && defined(_MSC_VER)
+#  include <intrin.h>
+
+static bool cpuid_bit(int leaf, int reg, int bit)
+{
+	int info[4];
+
+	__cpuidex(info, leaf, 0);
+
+	return (info[reg] >> bit) & 1;
+}
+
+/* Check that the OS saves AVX registers. */
+static bool os_has_avx(void)
+{
+	return cpuid_bit(1, 2, 27) && ((_xgetbv(0) & 6) == 6);
+}
+#endif
+
+bool cpu_has_sse2(void)
+{
+#if defined(CPU_X86) && defined(__GNUC__)
+	return __builtin_cpu_supports("sse2");
+#elif defined(CPU_X86) && defined(_MSC_VER)
+	return cpuid_bit(1, 3, 26);
+#else
+	return false;
+#endif
+}
+
+bool cpu_has_avx2(void)
+{
+#if defined(CPU_X86) && defined(__GNUC__)
+	return __builtin_cpu_supports("avx2");
+#elif defined(CPU_X86) && defined(_MSC_VER)
+	return os_has_avx() && cpuid_bit(7, 1, 5);
+#else
+	return false;
+#endif
+}
+
+bool cpu_has_f16c(void)
+{
+#if defined(CPU_X86) && defined(__GNUC__)
+	return __builtin_cpu_supports("avx") && __builtin_cpu_supports("f16c");
+#elif defined(CPU_X86) && defined(_MSC_VER)
+	return os_has_avx() && cpuid_bit(1, 2, 29);
+#else
+	return false;
+#endif
+}
@@ -0,0 +1,34 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#ifndef __OMNI_CPU_H__
+#define __OMNI_CPU_H__
+
+#include "types.h"
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#  define CPU_X86
+#endif
+
+/* Functions using instruction sets beyond the compiler baseline must be marked with these,
+ * and only called after checking the matching `cpu_has_*` function. */
+#if defined(CPU_X86) && defined(__GNUC__)
+#  define TARGET_SSE2 __attribute__((target("sse2")))
+#  define TARGET_AVX2 __attribute__((target("avx2")))
+#  define TARGET_F16C __attribute__((target("avx,f16c")))
+#else
+#  define TARGET_SSE2
+#  define TARGET_AVX2
+#  define TARGET_F16C
+#endif
+
+#ifdef CPU_X86
+#  include <immintrin.h>
+#endif
+
+bool cpu_has_sse2(void);
+bool cpu_has_avx2(void);
+bool cpu_has_f16c(void);
+
+#endif /* __OMNI_CPU_H__ */
@@ -0,0 +1,228 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include "hash.h"
+
+#include "cpu.h"
+#include "utils.h"
+
+/* Fast hash of bulk data, for finding identical data (not cryptographic, and only stable within a process,
+ * as it reads words in native byte order).
+ * Data is read in stripes of `HASH_STRIPE` bytes, each 64 bit word added to a lane of accumulators,
+ * along with the product of its halves (mixed with a key), so lanes map directly onto vector registers.
+ * Accumulators are scrambled after every `HASH_BLOCK_STRIPES` stripes, and merged at the end. */
+#define HASH_LANES 8
+#define HASH_STRIPE (HASH_LANES * sizeof(uint64_t))
+#define HASH_BLOCK_STRIPES 16
+
+#define PRIME32_1 0x9e3779b1u
+#define PRIME32_2 0x85ebca77u
+#define PRIME32_3 0xc2b2ae3du
+#define PRIME64_1 0x9e3779b185ebca87ULL
+#define PRIME64_2 0xc2b2ae3d27d4eb4fULL
+#define PRIME64_3 0x165667b19e3779f9ULL
+#define PRIME64_4 0x85ebca77c2b2ae63ULL
+#define PRIME64_5 0x27d4eb2f165667c5ULL
+
+/* Fractional parts of the square roots of the first primes. */
+static const uint64_t hash_key[HASH_LANES] = {
+    0x6a09e667f3bcc908ULL, 0xbb67ae8584caa73bULL, 0x3c6ef372fe94f82bULL, 0xa54ff53a5f1d36f1ULL,
+    0x510e527fade682d1ULL, 0x9b05688c2b3e6c1fULL, 0x1f83d9abfb41bd6bULL, 0x5be0cd19137e2179ULL,
+};
+
+typedef struct hash_kernels {
+	void (*accumulate)(uint64_t acc[HASH_LANES], const char *data, size_t num_stripes);
+	void (*scramble)(uint64_t acc[HASH_LANES]);
+} hash_kernels;
+
+/* Scalar kernels */
+
+static void accumulate_scalar(uint64_t acc[HASH_LANES], const char *data, size_t num_stripes)
+{
+	for (size_t s = 0; s < num_stripes; s++, data += HASH_STRIPE) {
+		for (uint i = 0; i < HASH_LANES; i++) {
+			uint64_t val, key;
+
+			memcpy(&val, &data[i * sizeof(uint64_t)], sizeof(val));
+
+			key = val ^ hash_key[i];
+
+			/* Swapping neighbour lanes keeps each word, should its product be zero. */
+			acc[i ^ 1] += val;
+			acc[i] += (key & 0xffffffffu) * (key >> 32);
+		}
+	}
+}
+
+static void scramble_scalar(uint64_t acc[HASH_LANES])
+{
+	for (uint i = 0; i < HASH_LANES; i++) {
+		uint64_t val = acc[i];
+
+		val ^= val >> 47;
+		val ^= hash_key[i];
+		acc[i] = val * PRIME32_1;
+	}
+}
+
+#ifdef CPU_X86
+/* SSE2 kernels */
+
+TARGET_SSE2 static void accumulate_sse2(uint64_t acc[HASH_LANES], const char *data, size_t num_stripes)
+{
+	__m128i vacc[HASH_LANES / 2];
+	__m128i vkey[HASH_LANES / 2];
+
+	for (uint j = 0; j < HASH_LANES / 2; j++) {
+		vacc[j] = _mm_loadu_si128((const __m128i *)&acc[2 * j]);
+		vkey[j] = _mm_loadu_si128((const __m128i *)&hash_key[2 * j]);
+	}
+
+	for (size_t s = 0; s < num_stripes; s++, data += HASH_STRIPE) {
+		for (uint j = 0; j < HASH_LANES / 2; j++) {
+			__m128i val = _mm_loadu_si128((const __m128i *)&data[j * 16]);
+			__m128i key = _mm_xor_si128(val, vkey[j]);
+			__m128i prod = _mm_mul_epu32(key, _mm_srli_epi64(key, 32));
+
+			vacc[j] = _mm_add_epi64(vacc[j], _mm_shuffle_epi32(val, _MM_SHUFFLE(1, 0, 3, 2)));
+			vacc[j] = _mm_add_epi64(vacc[j], prod);
+		}
+	}
+
+	for (uint j = 0; j < HASH_LANES / 2; j++) {
+		_mm_storeu_si128((__m128i *)&acc[2 * j], vacc[j]);
+	}
+}
+
+TARGET_SSE2 static void scramble_sse2(uint64_t acc[HASH_LANES])
+{
+	__m128i prime = _mm_set1_epi32((int)PRIME32_1);
+
+	for (uint j = 0; j < HASH_LANES / 2; j++) {
+		__m128i val = _mm_loadu_si128((const __m128i *)&acc[2 * j]);
+		__m128i lo, hi;
+
+		val = _mm_xor_si128(val, _mm_srli_epi64(val, 47));
+		val = _mm_xor_si128(val, _mm_loadu_si128((const __m128i *)&hash_key[2 * j]));
+
+		/* 64 by 32 bit products. */
+		lo = _mm_mul_epu32(val, prime);
+		hi = _mm_mul_epu32(_mm_srli_epi64(val, 32), prime);
+
+		_mm_storeu_si128((__m128i *)&acc[2 * j], _mm_add_epi64(lo, _mm_slli_epi64(hi, 32)));
+	}
+}
+
+/* AVX2 kernels */
+
+TARGET_AVX2 static void accumulate_avx2(uint64_t acc[HASH_LANES], const char *data, size_t num_stripes)
+{
+	__m256i vacc[HASH_LANES / 4];
+	__m256i vkey[HASH_LANES / 4];
+
+	for (uint j = 0; j < HASH_LANES / 4; j++) {
+		vacc[j] = _mm256_loadu_si256((const __m256i *)&acc[4 * j]);
+		vkey[j] = _mm256_loadu_si256((const __m256i *)&hash_key[4 * j]);
+	}
+
+	for (size_t s = 0; s < num_stripes; s++, data += HASH_STRIPE) {
+		for (uint j = 0; j < HASH_LANES / 4; j++) {
+			__m256i val = _mm256_loadu_si256((const __m256i *)&data[j * 32]);
+			__m256i key = _mm256_xor_si256(val, vkey[j]);
+			__m256i prod = _mm256_mul_epu32(key, _mm256_srli_epi64(key, 32));
+
+			vacc[j] = _mm256_add_epi64(vacc[j], _mm256_shuffle_epi32(val, _MM_SHUFFLE(1, 0, 3, 2)));
+			vacc[j] = _mm256_add_epi64(vacc[j], prod);
+		}
+	}
+
+	for (uint j = 0; j < HASH_LANES / 4; j++) {
+		_mm256_storeu_si256((__m256i *)&acc[4 * j], vacc[j]);
+	}
+}
+#endif
+
+/* Kernels for the best instruction set supported by the CPU. */
+static const hash_kernels *kernels_get(void)
+{
+	static const hash_kernels kernels_scalar = {
+	    accumulate_scalar, scramble_scalar,
+	};
+#ifdef CPU_X86
+	static const hash_kernels kernels_sse2 = {
+	    accumulate_sse2, scramble_sse2,
+	};
+	static const hash_kernels kernels_avx2 = {
+	    accumulate_avx2, scramble_sse2,
+	};
+#endif
+	static const hash_kernels *kernels = NULL;
+
+	if (!kernels) {
+		kernels = &kernels_scalar;
+
+#ifdef CPU_X86
+		if (cpu_has_avx2()) {
+			kernels = &kernels_avx2;
+		}
+		else if (cpu_has_sse2()) {
+			kernels = &kernels_sse2;
+		}
+#endif
+	}
+
+	return kernels;
+}
+
+static uint64_t hash_round(uint64_t val)
+{
+	val *= PRIME64_2;
+	val = (val << 31) | (val >> 33);
+
+	return val * PRIME64_1;
+}
+
+/* Hash `size` bytes of data. */
+uint64_t hash_data(const void *data, size_t size)
+{
+	const hash_kernels *kernels = kernels_get();
+	uint64_t acc[HASH_LANES] = {PRIME32_3, PRIME64_1, PRIME64_2, PRIME64_3, PRIME64_4, PRIME32_2, PRIME64_5, PRIME32_1};
+	const char *bytes = data;
+	size_t num_stripes = size / HASH_STRIPE;
+	size_t tail = size % HASH_STRIPE;
+	uint64_t hash = size * PRIME64_1;
+
+	while (num_stripes > 0) {
+		size_t num = MIN(num_stripes, HASH_BLOCK_STRIPES);
+
+		kernels->accumulate(acc, bytes, num);
+
+		if (num == HASH_BLOCK_STRIPES) {
+			kernels->scramble(acc);
+		}
+
+		bytes += num * HASH_STRIPE;
+		num_stripes -= num;
+	}
+
+	/* The last partial stripe is padded with zeros (the size is part of the hash). */
+	if (tail) {
+		char last[HASH_STRIPE] = {0};
+
+		memcpy(last, bytes, tail);
+		kernels->accumulate(acc, last, 1);
+	}
+
+	for (uint i = 0; i < HASH_LANES; i++) {
+		hash = ((hash ^ hash_round(acc[i])) * PRIME64_1) + PRIME64_4;
+	}
+
+	hash ^= hash >> 33;
+	hash *= PRIME64_2;
+	hash ^= hash >> 29;
+	hash *= PRIME64_3;
+	hash ^= hash >> 32;
+
+	return hash;
+}
@@ -0,0 +1,15 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#ifndef __OMNI_HASH_H__
+#define __OMNI_HASH_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "types.h"
+
+uint64_t hash_data(const void *data, size_t size);
+
+#endif /* __OMNI_HASH_H__ */
@@ -0,0 +1,159 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include "mapping.h"
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <assert.h>
+
+#ifdef _WIN32
+#  include <windows.h>
+#else
+#  include <fcntl.h>
+#  include <unistd.h>
+#  include <sys/mman.h>
+#  include <sys/stat.h>
+#endif
+
+/* Map the file at `path`, or return NULL on failure (including empty files). */
+mapping *mapping_open(const char *path)
+{
+	mapping *map;
+	const void *data;
+	size_t size;
+	void *handle = NULL;
+
+#ifdef _WIN32
+	LARGE_INTEGER file_size;
+	HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+
+	if (file == INVALID_HANDLE_VALUE) {
+		return NULL;
+	}
+
+	if (!GetFileSizeEx(file, &file_size) || file_size.QuadPart == 0) {
+		CloseHandle(file);
+
+		return NULL;
+	}
+
+	size = (size_t)file_size.QuadPart;
+	handle = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+
+	/* The mapping keeps the file open. */
+	CloseHandle(file);
+
+	if (!handle) {
+		return NULL;
+	}
+
+	data = MapViewOfFile(handle, FILE_MAP_READ, 0, 0, 0);
+
+	if (!data) {
+		CloseHandle(handle);
+
+		return NULL;
+	}
+#else
+	struct stat st;
+	int fd = open(path, O_RDONLY);
+
+	if (fd < 0) {
+		return NULL;
+	}
+
+	if (fstat(fd, &st) != 0 || st.st_size == 0) {
+		close(fd);
+
+		return NULL;
+	}
+
+	size = (size_t)st.st_size;
+	data = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+
+	/* The mapping keeps the file open. */
+	close(fd);
+
+	if (data == MAP_FAILED) {
+		return NULL;
+	}
+#endif
+
+	map = malloc(sizeof(mapping));
+
+	map->data = data;
+	map->size = size;
+	map->users = 1;
+	map->handle = handle;
+
+	return map;
+}
+
+void mapping_ref(mapping *map)
+{
+	map->users++;
+}
+
+void mapping_release(mapping *map)
+{
+	assert(map->users > 0);
+
+	if (--map->users > 0) {
+		return;
+	}
+
+#ifdef _WIN32
+	UnmapViewOfFile(map->data);
+	CloseHandle(map->handle);
+#else
+	munmap((void *)(uintptr_t)map->data, map->size);
+#endif
+
+	free(map);
+}
+
+/* Whether `data` points into the mapping. */
+bool mapping_contains(const mapping *map, const void *data)
+{
+	uintptr_t start = (uintptr_t)map->data;
+
+	return (uintptr_t)data >= start && (uintptr_t)data < start + map->size;
+}
+
+/* Hint that a range of the mapping will be read soon, so the OS starts reading it in without blocking. */
+void mapping_prefetch(const mapping *map, const void *data, size_t size)
+{
+#ifdef _WIN32
+	(void)map;
+	(void)data;
+	(void)size;
+#else
+	uintptr_t page_size = (uintptr_t)sysconf(_SC_PAGESIZE);
+	uintptr_t start = (uintptr_t)data & ~(page_size - 1);
+
+	if (mapping_contains(map, data)) {
+		madvise((void *)start, size + ((uintptr_t)data - start), MADV_WILLNEED);
+	}
+#endif
+}
+
+/* Read a range of the mapping (one byte per page), blocking until it is paged in. */
+void mapping_load(const mapping *map, const void *data, size_t size)
+{
+	const volatile char *bytes = data;
+	char sum = 0;
+
+	if (!mapping_contains(map, data) || size == 0) {
+		return;
+	}
+
+	for (size_t offset = 0; offset < size; offset += MAPPING_PAGE_SIZE) {
+		sum ^= bytes[offset];
+	}
+
+	sum ^= bytes[size - 1];
+
+	(void)sum;
+}
@@ -0,0 +1,33 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#ifndef __OMNI_MAPPING_H__
+#define __OMNI_MAPPING_H__
+
+#include <stddef.h>
+
+#include "types.h"
+
+/* Smallest page size of supported platforms, to touch every page of a range. */
+#define MAPPING_PAGE_SIZE 4096
+
+/* Read-only memory mapping of a whole file, shared by reference counting. */
+typedef struct mapping {
+	const void *data;
+	size_t size;
+
+	uint users;
+
+	void *handle; /* Platform specific mapping handle (Windows only). */
+} mapping;
+
+mapping *mapping_open(const char *path);
+void mapping_ref(mapping *map);
+void mapping_release(mapping *map);
+
+bool mapping_contains(const mapping *map, const void *data);
+void mapping_prefetch(const mapping *map, const void *data, size_t size);
+void mapping_load(const mapping *map, const void *data, size_t size);
+
+#endif /* __OMNI_MAPPING_H__ */
@@ -0,0 +1,514 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include "omni_budget.h"
+
+#include "omni_codec.h"
+#include "omni_dedup.h"
+#include "omni_utils.h"
+#include "thread.h"
+
+/* Memory accounting and budgets.
+ * The data of each sample (see `sample_mem_update`) and the sample index are accounted to their cache,
+ * and to a process-wide total. Allocator overhead, and data handed over to views, are not accounted.
+ * When a write takes a cache with a budget over its limit (or the total over the global limit),
+ * samples of that cache are evicted by policy. Evicted samples are either dropped, or spilled:
+ * their data is written to a file, which is mapped back in its place (as with `file_open`),
+ * so the data is paged back in by reading it, and can be reclaimed by the OS meanwhile.
+ * Each block (and metadata) borrowing from a spill file holds a reference to its mapping
+ * (`OMNI_BLOCK_STATUS_SPILLED`), so the file is unmapped once all its samples are rewritten or dropped. */
+
+struct budget {
+	size_t max_bytes;
+	OmniEvictPolicy policy;
+
+	/* Access pattern */
+	uint tick;
+	bool has_playhead;
+	float playhead;
+
+	/* Spilling */
+	char *spill_path;
+	bool spill_failed;
+	uint num_spills; /* Number of spill files written (used to name them). */
+};
+
+typedef struct budget_candidate {
+	OmniSample *sample;
+	double score; /* Lowest is evicted first. */
+} budget_candidate;
+
+/* Memory of all caches, and its limit. */
+static size_t global_used = 0;
+static size_t global_max = 0;
+
+/* Accounting */
+
+void budget_mem_add(OmniCache *cache, size_t size)
+{
+	cache->mem_used += size;
+	atomic_add_z(&global_used, size);
+}
+
+void budget_mem_sub(OmniCache *cache, size_t size)
+{
+	assert(size <= cache->mem_used);
+
+	cache->mem_used -= size;
+	atomic_sub_z(&global_used, size);
+}
+
+size_t budget_mem_global(void)
+{
+	return atomic_add_z(&global_used, 0);
+}
+
+/* Settings */
+
+void budget_set(OmniCache *cache, size_t max_bytes, OmniEvictPolicy policy, const char *spill_path)
+{
+	budget *bgt = cache->budget;
+
+	/* Kept once created, as spilled samples borrow its files. */
+	if (!bgt) {
+		if (policy == OMNI_EVICT_NONE) {
+			return;
+		}
+
+		bgt = calloc(1, sizeof(budget));
+		cache->budget = bgt;
+	}
+
+	bgt->max_bytes = max_bytes;
+	bgt->policy = policy;
+	bgt->spill_failed = false;
+
+	free(bgt->spill_path);
+	bgt->spill_path = NULL;
+
+	if (spill_path) {
+		size_t len = strlen(spill_path) + 1;
+
+		bgt->spill_path = malloc(len);
+		memcpy(bgt->spill_path, spill_path, len);
+	}
+}
+
+void budget_set_global(size_t max_bytes)
+{
+	size_t old_max = atomic_add_z(&global_max, 0);
+
+	if (max_bytes >= old_max) {
+		atomic_add_z(&global_max, max_bytes - old_max);
+	}
+	else {
+		atomic_sub_z(&global_max, old_max - max_bytes);
+	}
+}
+
+void budget_free(OmniCache *cache)
+{
+	budget *bgt = cache->budget;
+
+	if (!bgt) {
+		return;
+	}
+
+	budget_spill_reset(cache);
+
+	free(bgt->spill_path);
+	free(bgt);
+
+	cache->budget = NULL;
+}
+
+/* Access tracking */
+
+/* Record a read at `time` (the playhead). */
+void budget_access(OmniCache *cache, float_or_uint time)
+{
+	budget *bgt = cache->budget;
+
+	if (bgt) {
+		bgt->playhead = fu_float(time);
+		bgt->has_playhead = true;
+	}
+}
+
+/* Record an access to the data of a sample. */
+void budget_touch(OmniSample *sample)
+{
+	budget *bgt = sample ? sample->parent->budget : NULL;
+
+	if (bgt) {
+		sample->access = ++bgt->tick;
+	}
+}
+
+/* Eviction */
+
+/* Whether a sample has data of its own that could be evicted. */
+static bool budget_evictable(const OmniSample *sample)
+{
+	const OmniCache *cache = sample->parent;
+
+	if (!SAMPLE_IS_VALID(sample) || sample->view || !sample->blocks) {
+		return false;
+	}
+
+	if (sample->meta.data && !(sample->meta.status & OMNI_BLOCK_STATUS_BORROWED)) {
+		return true;
+	}
+
+	for (uint i = 0; i < cache->def.num_blocks; i++) {
+		const OmniBlock *block = &sample->blocks[i];
+
+		if (block->data && !(block->status & (OMNI_BLOCK_STATUS_BORROWED | OMNI_BLOCK_STATUS_SHARED))) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+/* Whether reading a sample would interpolate it just as well from its neighbours, were it missing. */
+static bool budget_interpolatable(OmniSample *sample)
+{
+	const OmniCache *cache = sample->parent;
+	OmniSample *prev, *next;
+
+	if (!(cache->def.flags & OMNICACHE_FLAG_INTERP_ANY) &&
+	    !((cache->def.flags & OMNICACHE_FLAG_INTERP_SUB) && !SAMPLE_IS_ROOT(sample)))
+	{
+		return false;
+	}
+
+	prev = sample_prev(sample);
+	next = sample_next(sample);
+
+	if (!SAMPLE_IS_VALID(prev) || !SAMPLE_IS_VALID(next)) {
+		return false;
+	}
+
+	for (uint i = 0; i < cache->def.num_blocks; i++) {
+		uint dcount = sample->blocks[i].dcount;
+
+		if (!(cache->block_index[i].def.flags & OMNI_BLOCK_FLAG_CONTINUOUS) ||
+		    prev->blocks[i].dcount != dcount || next->blocks[i].dcount != dcount)
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+/* Memory expected to be freed by evicting a sample: its own data, and its pool slots
+ * (only freed along with their slab, but consecutive samples share slabs). */
+static size_t budget_sample_size(const OmniSample *sample)
+{
+	const OmniCache *cache = sample->parent;
+	size_t size = sample->mem;
+
+	for (uint i = 0; i < cache->def.num_blocks; i++) {
+		const OmniBlock *block = &sample->blocks[i];
+
+		if (block->status & OMNI_BLOCK_STATUS_POOLED) {
+			size += block->pool->pool.elem_size;
+		}
+	}
+
+	return size;
+}
+
+static double budget_score(const budget *bgt, const OmniSample *sample)
+{
+	if (bgt->policy == OMNI_EVICT_LRU) {
+		return sample->access;
+	}
+
+	if (!bgt->has_playhead) {
+		return 0.0;
+	}
+
+	return -fabs(fu_float(sample_time_get(sample)) - bgt->playhead);
+}
+
+static int budget_candidate_cmp(const void *a, const void *b)
+{
+	const budget_candidate *ca = a;
+	const budget_candidate *cb = b;
+
+	return (ca->score > cb->score) - (ca->score < cb->score);
+}
+
+/* Write a range of data to a spill file (aligned to `ALIGN_SIZE`), returning its offset. */
+static uint64_t budget_spill_write(FILE *file, uint64_t *pos, const void *data, size_t size, bool *success)
+{
+	static const char zeros[ALIGN_SIZE] = {0};
+	uint64_t offset = ALIGN_UP(*pos, ALIGN_SIZE);
+
+	if (!*success || !data || size == 0) {
+		return offset;
+	}
+
+	if (fwrite(zeros, 1, offset - *pos, file) != offset - *pos ||
+	    fwrite(data, 1, size, file) != size)
+	{
+		*success = false;
+	}
+
+	*pos = offset + size;
+
+	return offset;
+}
+
+/* Point the data of a spilled sample into the spill file, freeing its own (shared data is kept). */
+static void budget_sample_borrow(OmniSample *sample, mapping *map, const uint64_t *offsets)
+{
+	const char *base = map->data;
+	OmniCache *cache = sample->parent;
+	OmniSampleStatusFlags status = sample->status & (OMNI_STATUS_VALID | OMNI_STATUS_CURRENT);
+	OmniBlockStatusFlags meta_status = sample->meta.status & (OMNI_STATUS_VALID | OMNI_STATUS_CURRENT);
+	OmniBlock *blocks = dupalloc(sample->blocks, sizeof(OmniBlock) * cache->def.num_blocks);
+	bool has_meta = (sample->meta.data != NULL);
+
+	for (uint i = 0; i < cache->def.num_blocks; i++) {
+		if (blocks[i].status & OMNI_BLOCK_STATUS_SHARED) {
+			dedup_ref(blocks[i].data);
+		}
+	}
+
+	sample_data_reset(sample);
+	init_sample_blocks(sample, NULL);
+
+	/* The data is never written through these pointers; rewriting a sample reallocates it. */
+	if (has_meta) {
+		sample->meta.data = (void *)(uintptr_t)(base + offsets[0]);
+		sample->meta.spill = map;
+		sample->meta.status |= OMNI_BLOCK_STATUS_BORROWED | OMNI_BLOCK_STATUS_SPILLED;
+
+		mapping_ref(map);
+
+		meta_set_status(sample, meta_status);
+	}
+
+	for (uint i = 0; i < cache->def.num_blocks; i++) {
+		OmniBlock *block = &sample->blocks[i];
+
+		if (blocks[i].status & OMNI_BLOCK_STATUS_SHARED) {
+			block->data = blocks[i].data;
+			block->dcount = blocks[i].dcount;
+			block->csize = blocks[i].csize;
+			block->status |= blocks[i].status & (OMNI_BLOCK_STATUS_SHARED | OMNI_BLOCK_STATUS_ENCODED);
+		}
+		else if (blocks[i].data) {
+			block->data = (void *)(uintptr_t)(base + offsets[i + 1]);
+			block->dcount = blocks[i].dcount;
+			block->dcount_alloc = block->dcount;
+			block->csize = blocks[i].csize;
+			block->spill = map;
+			block->status |= OMNI_BLOCK_STATUS_BORROWED | OMNI_BLOCK_STATUS_SPILLED |
+			                 (blocks[i].status & OMNI_BLOCK_STATUS_ENCODED);
+
+			mapping_ref(map);
+		}
+
+		block_set_status(block, blocks[i].status & (OMNI_STATUS_VALID | OMNI_STATUS_CURRENT));
+	}
+
+	sample_set_status(sample, status);
+	sample_mem_update(sample);
+
+	free(blocks);
+}
+
+/* Move the data of samples to a new spill file. */
+static bool budget_spill(OmniCache *cache, budget *bgt, const budget_candidate *candidates, uint num)
+{
+	uint stride = cache->def.num_blocks + 1;
+	uint64_t *offsets = malloc(sizeof(uint64_t) * stride * MAX(num, 1));
+	char *path = malloc(strlen(bgt->spill_path) + 16);
+	mapping *map = NULL;
+	uint64_t pos = 0;
+	bool success;
+	FILE *file;
+
+	sprintf(path, "%s.%u", bgt->spill_path, bgt->num_spills++);
+
+	file = fopen(path, "wb");
+	success = (file != NULL);
+
+	for (uint i = 0; i < num && success; i++) {
+		const OmniSample *sample = candidates[i].sample;
+		uint64_t *s_offsets = &offsets[i * stride];
+
+		s_offsets[0] = budget_spill_write(file, &pos, sample->meta.data, cache->def.msize, &success);
+
+		for (uint j = 0; j < cache->def.num_blocks; j++) {
+			const OmniBlock *block = &sample->blocks[j];
+			const void *data = (block->status & OMNI_BLOCK_STATUS_SHARED) ? NULL : block->data;
+
+			s_offsets[j + 1] = budget_spill_write(file, &pos, data, block_data_size(&cache->block_index[j], block), &success);
+		}
+	}
+
+	if (file) {
+		/* Empty files can't be mapped. */
+		if (pos == 0) {
+			static const char zero = 0;
+
+			success = success && (fwrite(&zero, 1, 1, file) == 1);
+		}
+
+		success = (fclose(file) == 0) && success;
+	}
+
+	if (success) {
+		map = mapping_open(path);
+	}
+
+	/* The mapping keeps the data (the file can only be removed once unmapped on Windows). */
+	remove(path);
+
+	if (!map) {
+		fprintf(stderr, "OmniCache: Failed to write spill file \"%s\", evicted samples are dropped instead.\n", path);
+
+		bgt->spill_failed = true;
+	}
+	else {
+		for (uint i = 0; i < num; i++) {
+			budget_sample_borrow(candidates[i].sample, map, &offsets[i * stride]);
+		}
+
+		/* Only the borrowing blocks keep it mapped. */
+		mapping_release(map);
+	}
+
+	free(path);
+	free(offsets);
+
+	return map != NULL;
+}
+
+static void budget_evict(OmniCache *cache, budget *bgt, const OmniSample *keep, size_t max_global)
+{
+	size_t target = bgt->max_bytes ? bgt->max_bytes - (bgt->max_bytes / BUDGET_TARGET) : SIZE_MAX;
+	size_t target_global = max_global ? max_global - (max_global / BUDGET_TARGET) : SIZE_MAX;
+	size_t used = cache->mem_used;
+	size_t used_global = budget_mem_global();
+	budget_candidate *candidates = malloc(sizeof(budget_candidate) * MAX(cache->def.num_samples_tot, 1));
+	bool prev_selected = false;
+	uint num = 0;
+	uint num_evicted = 0;
+
+	for (OmniSample *sample = SAMPLE_FIRST(cache); sample; sample = sample_next(sample)) {
+		bool selected = (sample != keep) && budget_evictable(sample);
+
+		/* Never two neighbours, so each evicted sample can be interpolated from kept ones. */
+		if (bgt->policy == OMNI_EVICT_INTERP) {
+			selected = selected && !prev_selected && budget_interpolatable(sample);
+			prev_selected = selected;
+		}
+
+		if (selected) {
+			candidates[num].sample = sample;
+			candidates[num].score = budget_score(bgt, sample);
+			num++;
+		}
+	}
+
+	qsort(candidates, num, sizeof(budget_candidate), budget_candidate_cmp);
+
+	while (num_evicted < num && (used > target || used_global > target_global)) {
+		size_t size = budget_sample_size(candidates[num_evicted++].sample);
+
+		used -= MIN(size, used);
+		used_global -= MIN(size, used_global);
+	}
+
+	if (num_evicted > 0 && !(bgt->spill_path && !bgt->spill_failed && budget_spill(cache, bgt, candidates, num_evicted))) {
+		for (uint i = 0; i < num_evicted; i++) {
+			sample_delta_detach(candidates[i].sample);
+			sample_data_reset(candidates[i].sample);
+		}
+	}
+
+	free(candidates);
+}
+
+/* Enforce the budget after a write.
+ * keep: sample just written, not to be evicted (optional). */
+void budget_check(OmniCache *cache, OmniSample *keep)
+{
+	budget *bgt = cache->budget;
+	size_t max_global;
+
+	if (!bgt || bgt->policy == OMNI_EVICT_NONE) {
+		return;
+	}
+
+	if (keep) {
+		budget_touch(keep);
+
+		bgt->playhead = fu_float(sample_time_get(keep));
+		bgt->has_playhead = true;
+	}
+
+	max_global = atomic_add_z(&global_max, 0);
+
+	if ((bgt->max_bytes && cache->mem_used > bgt->max_bytes) ||
+	    (max_global && budget_mem_global() > max_global))
+	{
+		budget_evict(cache, bgt, keep, max_global);
+	}
+}
+
+/* Spill files */
+
+/* Whether samples of the cache might borrow data from spill files. */
+bool budget_spills(const OmniCache *cache)
+{
+	return cache->budget && cache->budget->num_spills > 0;
+}
+
+/* Spill file that the data of a sample was moved to, or NULL (all of its spilled data is in the same file). */
+mapping *budget_sample_mapping(const OmniSample *sample)
+{
+	const OmniCache *cache = sample->parent;
+
+	if (sample->meta.status & OMNI_BLOCK_STATUS_SPILLED) {
+		return sample->meta.spill;
+	}
+
+	for (uint i = 0; sample->blocks && i < cache->def.num_blocks; i++) {
+		if (sample->blocks[i].status & OMNI_BLOCK_STATUS_SPILLED) {
+			return sample->blocks[i].spill;
+		}
+	}
+
+	return NULL;
+}
+
+/* Forget the spill files, once no sample uses them (views keep their own references). */
+void budget_spill_reset(OmniCache *cache)
+{
+	budget *bgt = cache->budget;
+
+	if (!bgt) {
+		return;
+	}
+
+	/* Files can't be removed while mapped on Windows (see `budget_spill`). */
+#ifdef _WIN32
+	for (uint i = 0; i < bgt->num_spills && bgt->spill_path; i++) {
+		char *path = malloc(strlen(bgt->spill_path) + 16);
+
+		sprintf(path, "%s.%u", bgt->spill_path, i);
+		remove(path);
+
+		free(path);
+	}
+#endif
+}
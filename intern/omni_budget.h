@@ -0,0 +1,29 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#ifndef __OMNI_OMNI_BUDGET_H__
+#define __OMNI_OMNI_BUDGET_H__
+
+#include "omni_types.h"
+
+/* Evict down to `max_bytes * (BUDGET_TARGET - 1) / BUDGET_TARGET`, so a write does not evict every time. */
+#define BUDGET_TARGET 8
+
+void budget_mem_add(OmniCache *cache, size_t size);
+void budget_mem_sub(OmniCache *cache, size_t size);
+size_t budget_mem_global(void);
+
+void budget_set(OmniCache *cache, size_t max_bytes, OmniEvictPolicy policy, const char *spill_path);
+void budget_set_global(size_t max_bytes);
+void budget_free(OmniCache *cache);
+
+void budget_access(OmniCache *cache, float_or_uint time);
+void budget_touch(OmniSample *sample);
+void budget_check(OmniCache *cache, OmniSample *keep);
+
+bool budget_spills(const OmniCache *cache);
+mapping *budget_sample_mapping(const OmniSample *sample);
+void budget_spill_reset(OmniCache *cache);
+
+#endif /* __OMNI_OMNI_BUDGET_H__ */
@@ -0,0 +1,481 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include "omni_codec.h"
+
+#include "omni_dedup.h"
+#include "omni_utils.h"
+#include "omni_view.h"
+#include "quant.h"
+
+/* Blocks are encoded in up to three steps, decoded in reverse order:
+ * quantization (`OMNI_BLOCK_STATUS_QUANTIZED`), delta (`OMNI_BLOCK_STATUS_DELTA`) and codec (`OMNI_BLOCK_STATUS_COMPRESSED`).
+ * The data between the first and last step is the plain data of the block (see `block_plain_size`).
+ * Blocks that are not delta encoded can then be shared with identical ones (see `omni_dedup.c`).
+ *
+ * Delta encoding (`OmniBlockInfoDef.delta_interval`):
+ * A delta block holds its data XORed with the data of the same block in its base, the previous sample holding data
+ * for that block. Chains of deltas start from a block stored in full (keyframe), and are at most `delta_interval - 1`
+ * long. Decoding walks back to the keyframe, or to the last decoded sample of the chain (`OmniBlockInfo.delta_sample`),
+ * so sequential reads only apply one delta each.
+ * Before the data of a sample is changed or freed, or a sample gets data (becoming the base of the next delta),
+ * the following delta is stored in full (see `sample_delta_detach`). */
+
+static bool block_has_data(const OmniSample *sample, uint index)
+{
+	return sample->blocks && sample->blocks[index].data;
+}
+
+static OmniSample *delta_prev(OmniSample *sample, uint index)
+{
+	do {
+		sample = sample_prev(sample);
+	} while (sample && !block_has_data(sample, index));
+
+	return sample;
+}
+
+static OmniSample *delta_next(OmniSample *sample, uint index)
+{
+	do {
+		sample = sample_next(sample);
+	} while (sample && !block_has_data(sample, index));
+
+	return sample;
+}
+
+/* Size of the elements of the plain data of a block. */
+static uint block_plain_stride(const OmniBlockInfo *b_info, const OmniBlock *block)
+{
+	if (block->status & OMNI_BLOCK_STATUS_QUANTIZED) {
+		return (uint)(sizeof(uint16_t) * (b_info->def.dsize / sizeof(float)));
+	}
+
+	return b_info->def.dsize;
+}
+
+/* Replace the data of a block with `data`, encoded with `status` (`OMNI_BLOCK_STATUS_ENCODED` flags,
+ * and `OMNI_BLOCK_STATUS_SHARED` for shared data).
+ * Returns the block, as detaching from a view can move the block array. */
+static OmniBlock *block_data_replace(OmniSample *sample, uint index, void *data, uint csize, OmniBlockStatusFlags status)
+{
+	OmniBlock *block = &sample->blocks[index];
+
+	block_data_detach(block);
+
+	block = &sample->blocks[index];
+
+	block->data = data;
+	block->csize = csize;
+	block->dcount_alloc = (status & (OMNI_BLOCK_STATUS_PACKED | OMNI_BLOCK_STATUS_SHARED)) ? 0 : block->dcount;
+	block->status |= status;
+
+	return block;
+}
+
+/* Decode the stored data of a block (ignoring deltas) into `target`, as plain data. */
+static bool block_payload_decode(const OmniBlockInfo *b_info, const OmniBlock *block, void *target)
+{
+	OmniCache *cache = b_info->parent;
+	size_t size = block_plain_size(b_info, block->status, block->dcount);
+	void *work;
+
+	if (!(block->status & OMNI_BLOCK_STATUS_COMPRESSED)) {
+		memcpy(target, block->data, size);
+
+		return true;
+	}
+
+	work = codec_buffer_get(&cache->work_buffers[0], size);
+
+	return codec_decode(block->data, block->csize, target, size, block_plain_stride(b_info, block), work);
+}
+
+/* Decode the plain data of a block into `OmniBlockInfo.delta_data`, making `sample` the last decoded sample. */
+static bool delta_load(OmniBlockInfo *b_info, uint index, OmniSample *sample)
+{
+	OmniCache *cache = b_info->parent;
+	uint dcount = sample->blocks[index].dcount;
+	OmniBlockStatusFlags quantized = sample->blocks[index].status & OMNI_BLOCK_STATUS_QUANTIZED;
+	size_t size = block_plain_size(b_info, quantized, dcount);
+	OmniSample *start = sample;
+	void *target;
+
+	/* Walk back to the keyframe, or the last decoded sample. */
+	while (start != b_info->delta_sample && (start->blocks[index].status & OMNI_BLOCK_STATUS_DELTA)) {
+		start = delta_prev(start, index);
+
+		if (!start || start->blocks[index].dcount != dcount ||
+		    (start->blocks[index].status & OMNI_BLOCK_STATUS_QUANTIZED) != quantized)
+		{
+			return false;
+		}
+	}
+
+	if (start == b_info->delta_sample) {
+		target = b_info->delta_data.data;
+	}
+	else {
+		b_info->delta_sample = NULL;
+		target = codec_buffer_get(&b_info->delta_data, size);
+
+		if (!block_payload_decode(b_info, &start->blocks[index], target)) {
+			return false;
+		}
+	}
+
+	b_info->delta_sample = NULL;
+
+	while (start != sample) {
+		const OmniBlock *block;
+		const void *delta;
+
+		start = delta_next(start, index);
+		block = &start->blocks[index];
+		delta = block->data;
+
+		if (block->status & OMNI_BLOCK_STATUS_COMPRESSED) {
+			void *buffer = codec_buffer_get(&cache->work_buffers[1], size);
+
+			if (!block_payload_decode(b_info, block, buffer)) {
+				return false;
+			}
+
+			delta = buffer;
+		}
+
+		codec_xor(target, delta, size);
+	}
+
+	b_info->delta_sample = sample;
+
+	return true;
+}
+
+/* Ensure the data of a block can be changed in place: not viewed, shared, nor owned by the user. */
+static OmniBlock *block_data_private(OmniSample *sample, uint index)
+{
+	OmniCache *cache = sample->parent;
+	OmniBlock *block = &sample->blocks[index];
+	void *data;
+
+	if (!sample->view && !(block->status & (OMNI_BLOCK_STATUS_ADOPTED | OMNI_BLOCK_STATUS_SHARED))) {
+		return block;
+	}
+
+	data = aligndup(block->data, block_data_size(&cache->block_index[index], block), ALIGN_SIZE);
+
+	return block_data_replace(sample, index, data, block->csize, block->status & OMNI_BLOCK_STATUS_ENCODED);
+}
+
+/* Quantize the data of a block, if it can be within the error bound. */
+static void block_quantize(OmniSample *sample, uint index)
+{
+	OmniCache *cache = sample->parent;
+	OmniBlockInfo *b_info = &cache->block_index[index];
+	OmniBlock *block = &sample->blocks[index];
+	uint num_comps = b_info->def.dsize / sizeof(float);
+	void *data = alignalloc(quant_size(b_info->def.quant, num_comps, block->dcount), ALIGN_SIZE);
+
+	if (!quant_encode(b_info->def.quant, b_info->def.quant_error, num_comps, block->data, block->dcount, data)) {
+		alignfree(data);
+
+		return;
+	}
+
+	block_data_replace(sample, index, data, 0, OMNI_BLOCK_STATUS_QUANTIZED);
+}
+
+/* Replace the data of a delta block with its own data XORed with its base, if allowed by the delta interval.
+ * The uncompressed data is kept as the last decoded, for the next sample. */
+static void block_delta_encode(OmniSample *sample, uint index)
+{
+	OmniCache *cache = sample->parent;
+	OmniBlockInfo *b_info = &cache->block_index[index];
+	OmniBlock *block = &sample->blocks[index];
+	size_t size = block_plain_size(b_info, block->status, block->dcount);
+	OmniSample *base = delta_prev(sample, index);
+	uint depth = 0;
+
+	/* Number of deltas the base itself follows. */
+	for (OmniSample *prev = base;
+	     prev && (prev->blocks[index].status & OMNI_BLOCK_STATUS_DELTA) && depth < b_info->def.delta_interval;
+	     prev = delta_prev(prev, index))
+	{
+		depth++;
+	}
+
+	/* Bases being written (invalid) could still change. */
+	if (base && IS_VALID((&base->blocks[index])) && base->blocks[index].dcount == block->dcount &&
+	    ((base->blocks[index].status ^ block->status) & OMNI_BLOCK_STATUS_QUANTIZED) == 0 &&
+	    depth + 1 < b_info->def.delta_interval && delta_load(b_info, index, base))
+	{
+		block = block_data_private(sample, index);
+
+		codec_xor_swap(block->data, b_info->delta_data.data, size);
+		block->status |= OMNI_BLOCK_STATUS_DELTA;
+	}
+	else {
+		memcpy(codec_buffer_get(&b_info->delta_data, size), block->data, size);
+	}
+
+	b_info->delta_sample = sample;
+}
+
+/* Compress the data of a block with its codec, if that makes it smaller. */
+static void block_compress(OmniSample *sample, uint index)
+{
+	OmniCache *cache = sample->parent;
+	OmniBlockInfo *b_info = &cache->block_index[index];
+	OmniBlock *block = &sample->blocks[index];
+	OmniCodec codec = b_info->def.codec;
+	size_t size = block_plain_size(b_info, block->status, block->dcount);
+	void *work, *out;
+	size_t csize;
+
+	if ((block->status & OMNI_BLOCK_STATUS_DELTA) && codec == OMNI_CODEC_NONE) {
+		codec = OMNI_CODEC_SHUFFLE_LZ;
+	}
+
+	if (codec == OMNI_CODEC_NONE || !block->data ||
+	    (block->status & (OMNI_BLOCK_STATUS_ARENA | OMNI_BLOCK_STATUS_BORROWED | OMNI_BLOCK_STATUS_COMPRESSED)))
+	{
+		return;
+	}
+
+	work = codec_buffer_get(&cache->work_buffers[0], size);
+	out = codec_buffer_get(&cache->work_buffers[1], codec_bound(size));
+	csize = codec_encode(codec, block_plain_stride(b_info, block), block->data, size, out, work);
+
+	if (csize == 0) {
+		return;
+	}
+
+	block_data_replace(sample, index, aligndup(out, csize, ALIGN_SIZE), (uint)csize,
+	                   OMNI_BLOCK_STATUS_COMPRESSED | (block->status & OMNI_BLOCK_STATUS_ENCODED));
+}
+
+static bool block_delta_enabled(const OmniBlockInfo *b_info)
+{
+	return (b_info->def.delta_interval > 1) && (b_info->def.flags & OMNI_BLOCK_FLAG_CONTINUOUS) &&
+	       !(b_info->def.flags & OMNI_BLOCK_FLAG_DEDUP);
+}
+
+/* Point the data of a block to shared data, identical to it. */
+static void block_share(OmniSample *sample, uint index)
+{
+	OmniCache *cache = sample->parent;
+	OmniBlock *block = &sample->blocks[index];
+	size_t size = block_data_size(&cache->block_index[index], block);
+
+	if (size == 0) {
+		return;
+	}
+
+	block_data_replace(sample, index, dedup_acquire(cache, index, block, size), block->csize,
+	                   OMNI_BLOCK_STATUS_SHARED | (block->status & OMNI_BLOCK_STATUS_PACKED));
+}
+
+/* Encode the blocks of a sample that was just written, with their quantization, deltas and codec,
+ * then share them if deduplicated.
+ * Data in the sample arena is left as is, as its space could not be reused. */
+void sample_encode(OmniSample *sample)
+{
+	OmniCache *cache = sample->parent;
+
+	for (uint i = 0; i < cache->def.num_blocks; i++) {
+		OmniBlockInfo *b_info = &cache->block_index[i];
+		OmniBlock *block = &sample->blocks[i];
+
+		if (!IS_VALID(block) || !block->data ||
+		    (block->status & (OMNI_BLOCK_STATUS_ARENA | OMNI_BLOCK_STATUS_BORROWED | OMNI_BLOCK_STATUS_ENCODED)))
+		{
+			continue;
+		}
+
+		if (b_info->def.quant != OMNI_QUANT_NONE) {
+			block_quantize(sample, i);
+		}
+
+		if (block_delta_enabled(b_info)) {
+			block_delta_encode(sample, i);
+		}
+
+		block_compress(sample, i);
+
+		if (b_info->def.flags & OMNI_BLOCK_FLAG_DEDUP) {
+			block_share(sample, i);
+		}
+	}
+}
+
+/* Store a delta block in full, as the data it follows is about to change.
+ * Returns false if it can't be decoded, leaving it invalid. */
+static bool block_delta_materialize(OmniSample *sample, uint index)
+{
+	OmniCache *cache = sample->parent;
+	OmniBlockInfo *b_info = &cache->block_index[index];
+	OmniBlock *block = &sample->blocks[index];
+	void *data;
+
+	if (!delta_load(b_info, index, sample)) {
+		block_unset_status(block, (OmniBlockStatusFlags)OMNI_STATUS_VALID);
+		sample_unset_status(sample, (OmniSampleStatusFlags)OMNI_STATUS_VALID);
+
+		return false;
+	}
+
+	data = aligndup(b_info->delta_data.data, block_plain_size(b_info, block->status, block->dcount), ALIGN_SIZE);
+
+	block_data_replace(sample, index, data, 0, block->status & OMNI_BLOCK_STATUS_QUANTIZED);
+	block_compress(sample, index);
+	sample_mem_update(sample);
+
+	return true;
+}
+
+/* Prepare for the data of a block of `sample` to change, be freed, or be added. */
+void block_delta_detach(OmniSample *sample, uint index)
+{
+	OmniCache *cache = sample->parent;
+	OmniBlockInfo *b_info = &cache->block_index[index];
+	OmniSample *next;
+
+	if (b_info->delta_sample == sample) {
+		b_info->delta_sample = NULL;
+	}
+
+	if (b_info->def.delta_interval <= 1) {
+		return;
+	}
+
+	next = delta_next(sample, index);
+
+	/* Blocks that fail to decode are left invalid, and so are the ones following them. */
+	while (next && (next->blocks[index].status & OMNI_BLOCK_STATUS_DELTA) && !block_delta_materialize(next, index)) {
+		next = delta_next(next, index);
+	}
+}
+
+/* Prepare for the data of `sample` to change, be freed, or be added. */
+void sample_delta_detach(OmniSample *sample)
+{
+	OmniCache *cache = sample->parent;
+
+	for (uint i = 0; i < cache->def.num_blocks; i++) {
+		block_delta_detach(sample, i);
+	}
+}
+
+/* Drop any decoding state referring to `sample`, whose data is being freed. */
+void sample_delta_forget(OmniSample *sample)
+{
+	OmniCache *cache = sample->parent;
+
+	for (uint i = 0; i < cache->def.num_blocks; i++) {
+		if (cache->block_index[i].delta_sample == sample) {
+			cache->block_index[i].delta_sample = NULL;
+		}
+	}
+}
+
+/* Decode the data of an encoded block into `target`. */
+static bool block_decode_into(OmniBlockInfo *b_info, const OmniBlock *block, void *target)
+{
+	OmniCache *cache = b_info->parent;
+	uint index = (uint)(b_info - cache->block_index);
+	const void *plain = block->data;
+
+	/* Quantization settings come from the cache definition, which could be corrupted. */
+	if ((block->status & OMNI_BLOCK_STATUS_QUANTIZED) &&
+	    !quant_valid(b_info->def.quant, b_info->def.dsize / sizeof(float)))
+	{
+		return false;
+	}
+
+	if (block->status & OMNI_BLOCK_STATUS_DELTA) {
+		if (!delta_load(b_info, index, block->parent)) {
+			return false;
+		}
+
+		plain = b_info->delta_data.data;
+	}
+	else if (block->status & OMNI_BLOCK_STATUS_COMPRESSED) {
+		void *buffer = target;
+
+		if (block->status & OMNI_BLOCK_STATUS_QUANTIZED) {
+			buffer = codec_buffer_get(&cache->work_buffers[1], block_plain_size(b_info, block->status, block->dcount));
+		}
+
+		if (!block_payload_decode(b_info, block, buffer)) {
+			return false;
+		}
+
+		plain = buffer;
+	}
+
+	if (block->status & OMNI_BLOCK_STATUS_QUANTIZED) {
+		quant_decode(b_info->def.quant, b_info->def.dsize / sizeof(float), plain, block->dcount, target);
+	}
+	else if (plain != target) {
+		memcpy(target, plain, (size_t)b_info->def.dsize * block->dcount);
+	}
+
+	return true;
+}
+
+/* Fill an `OmniData` with the decoded data of a block.
+ * Encoded data is decoded into `OmniCache.read_buffers[buffer]`, valid until the buffer is used again.
+ * Returns false if the data can't be decoded. */
+bool block_data_decode(OmniData *omni_data, OmniBlockInfo *b_info, const OmniBlock *block, uint buffer)
+{
+	OmniCache *cache = b_info->parent;
+	void *target;
+
+	assert(buffer < CODEC_READ_BUFFERS);
+
+	block_data_get(omni_data, b_info, block);
+
+	if (!(block->status & OMNI_BLOCK_STATUS_ENCODED)) {
+		return true;
+	}
+
+	target = codec_buffer_get(&cache->read_buffers[buffer], (size_t)b_info->def.dsize * block->dcount);
+	omni_data->data = target;
+
+	return block_decode_into(b_info, block, target);
+}
+
+/* Decode the data of an encoded block into a new allocation (freed with `alignfree`).
+ * Returns NULL if the data can't be decoded. */
+void *block_data_decode_dup(OmniBlockInfo *b_info, const OmniBlock *block)
+{
+	void *target = alignalloc((size_t)b_info->def.dsize * block->dcount, ALIGN_SIZE);
+
+	assert(block->status & OMNI_BLOCK_STATUS_ENCODED);
+
+	if (!block_decode_into(b_info, block, target)) {
+		alignfree(target);
+
+		return NULL;
+	}
+
+	return target;
+}
+
+void codec_buffers_free(OmniCache *cache)
+{
+	for (uint i = 0; i < CODEC_READ_BUFFERS; i++) {
+		codec_buffer_free(&cache->read_buffers[i]);
+	}
+
+	codec_buffer_free(&cache->work_buffers[0]);
+	codec_buffer_free(&cache->work_buffers[1]);
+	codec_buffer_free(&cache->interp_buffer);
+
+	for (uint i = 0; i < cache->def.num_blocks; i++) {
+		cache->block_index[i].delta_sample = NULL;
+		codec_buffer_free(&cache->block_index[i].delta_data);
+	}
+}
@@ -0,0 +1,18 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#ifndef __OMNI_OMNI_CODEC_H__
+#define __OMNI_OMNI_CODEC_H__
+
+#include "omni_types.h"
+
+void sample_encode(OmniSample *sample);
+void block_delta_detach(OmniSample *sample, uint index);
+void sample_delta_detach(OmniSample *sample);
+void sample_delta_forget(OmniSample *sample);
+bool block_data_decode(OmniData *omni_data, OmniBlockInfo *b_info, const OmniBlock *block, uint buffer);
+void *block_data_decode_dup(OmniBlockInfo *b_info, const OmniBlock *block);
+void codec_buffers_free(OmniCache *cache);
+
+#endif /* __OMNI_OMNI_CODEC_H__ */
@@ -0,0 +1,97 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include "omni_column.h"
+
+#include "omni_utils.h"
+
+/* Columns (`OMNI_CONSOL_COLUMNS`).
+ * Consolidating into columns moves the plain data of each block, for all samples, into a single allocation
+ * per block (a column), in time order, so scanning a block across time reads memory sequentially.
+ * Blocks in a column are flagged with `OMNI_BLOCK_STATUS_COLUMN`, and are rewritten in place while their data fits.
+ * Each of them holds a reference to its column, which is freed with the last one (possibly by a view, after the cache).
+ * The space of blocks leaving a column is only reclaimed along with the whole column. */
+
+struct column {
+	uint refs;
+};
+
+/* Size of the header before the data, keeping the data aligned. */
+#define COLUMN_HEADER_SIZE ALIGN_UP(sizeof(column), ALIGN_SIZE)
+
+/* Data pinned by a view can't move, and encoded, shared or borrowed data is left as is. */
+static bool column_packable(const OmniSample *sample, const OmniBlock *block)
+{
+	return block->data && block->dcount && !sample->view &&
+	       !(block->status & (OMNI_BLOCK_STATUS_ARENA | OMNI_BLOCK_STATUS_BORROWED | OMNI_BLOCK_STATUS_SHARED |
+	                          OMNI_BLOCK_STATUS_ENCODED));
+}
+
+static void column_pack(OmniCache *cache, uint index)
+{
+	OmniBlockInfo *b_info = &cache->block_index[index];
+	size_t size = 0;
+	uint num_blocks = 0;
+	column *col;
+	char *data;
+
+	for (OmniSample *sample = SAMPLE_FIRST(cache); sample; sample = sample_next(sample)) {
+		if (sample->blocks && column_packable(sample, &sample->blocks[index])) {
+			size += ALIGN_UP((size_t)b_info->def.dsize * sample->blocks[index].dcount, ALIGN_SIZE);
+			num_blocks++;
+		}
+	}
+
+	if (num_blocks == 0) {
+		return;
+	}
+
+	col = alignalloc(COLUMN_HEADER_SIZE + size, ALIGN_SIZE);
+	col->refs = num_blocks;
+
+	data = (char *)col + COLUMN_HEADER_SIZE;
+
+	for (OmniSample *sample = SAMPLE_FIRST(cache); sample; sample = sample_next(sample)) {
+		OmniBlock *block = sample->blocks ? &sample->blocks[index] : NULL;
+		uint dcount;
+
+		if (!block || !column_packable(sample, block)) {
+			continue;
+		}
+
+		dcount = block->dcount;
+		size = (size_t)b_info->def.dsize * dcount;
+
+		/* Blocks already in a column move to the new one, releasing the old one once emptied. */
+		memcpy(data, block->data, size);
+		block_data_free(block);
+
+		block->data = data;
+		block->column = col;
+		block->dcount_alloc = dcount;
+		block->status |= OMNI_BLOCK_STATUS_COLUMN;
+
+		data += ALIGN_UP(size, ALIGN_SIZE);
+
+		sample_mem_update(sample);
+	}
+}
+
+/* Move the plain data of each block into a column. */
+void columns_pack(OmniCache *cache)
+{
+	for (uint i = 0; i < cache->def.num_blocks; i++) {
+		column_pack(cache, i);
+	}
+}
+
+/* Release the reference of a block to its column, freeing it with the last one. */
+void column_release(column *col)
+{
+	assert(col->refs > 0);
+
+	if (--col->refs == 0) {
+		alignfree(col);
+	}
+}
@@ -0,0 +1,13 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#ifndef __OMNI_OMNI_COLUMN_H__
+#define __OMNI_OMNI_COLUMN_H__
+
+#include "omni_types.h"
+
+void columns_pack(OmniCache *cache);
+void column_release(column *col);
+
+#endif /* __OMNI_OMNI_COLUMN_H__ */
@@ -0,0 +1,244 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include "omni_dedup.h"
+
+#include <stdint.h>
+
+#include "hash.h"
+#include "omni_budget.h"
+#include "omni_utils.h"
+
+/* Deduplication (`OMNI_BLOCK_FLAG_DEDUP`).
+ * Blocks holding identical data (as stored, after quantization and codec) point to a single shared copy,
+ * flagged with `OMNI_BLOCK_STATUS_SHARED`. Shared data is allocated along with a reference counted header
+ * (`dedup_entry`), placed right before the data, and indexed by hash in the store of the cache.
+ * Shared data is accounted to the cache once, not to the samples using it.
+ * Views taking over shared data keep a reference, and as they can outlive the cache,
+ * the store only forgets its entries when freed (they are then freed with their last reference). */
+
+typedef struct dedup_entry {
+	dedup *store; /* NULL once the store is freed. */
+	struct dedup_entry *next; /* Next entry in the same bucket. */
+
+	uint64_t hash;
+	size_t size;
+	uint refs;
+	uint index; /* Position in `dedup.entries`. */
+
+	/* Block data shared, besides its contents. */
+	uint block;
+	uint dcount;
+	uint csize;
+	OmniBlockStatusFlags encoding;
+} dedup_entry;
+
+/* Size of the header before the shared data, keeping the data aligned. */
+#define DEDUP_HEADER_SIZE ALIGN_UP(sizeof(dedup_entry), ALIGN_SIZE)
+
+#define DEDUP_MIN_BUCKETS 64
+
+struct dedup {
+	OmniCache *cache;
+
+	dedup_entry **buckets; /* Entries by hash (a power of two of them). */
+	uint num_buckets;
+
+	dedup_entry **entries; /* All entries, in no particular order. */
+	uint num_entries;
+	uint num_entries_alloc;
+};
+
+static dedup_entry *entry_get(const void *data)
+{
+	return (dedup_entry *)(uintptr_t)((const char *)data - DEDUP_HEADER_SIZE);
+}
+
+static void *entry_data(dedup_entry *entry)
+{
+	return (char *)entry + DEDUP_HEADER_SIZE;
+}
+
+static size_t entry_mem_size(const dedup_entry *entry)
+{
+	return ALIGN_UP(DEDUP_HEADER_SIZE + entry->size, ALIGN_SIZE);
+}
+
+static dedup *dedup_ensure(OmniCache *cache)
+{
+	dedup *store = cache->dedup;
+
+	if (!store) {
+		store = calloc(1, sizeof(dedup));
+		store->cache = cache;
+		store->num_buckets = DEDUP_MIN_BUCKETS;
+		store->buckets = calloc(store->num_buckets, sizeof(dedup_entry *));
+
+		cache->dedup = store;
+	}
+
+	return store;
+}
+
+/* Double the bucket count, once there are more entries than buckets. */
+static void dedup_grow(dedup *store)
+{
+	free(store->buckets);
+
+	store->num_buckets *= 2;
+	store->buckets = calloc(store->num_buckets, sizeof(dedup_entry *));
+
+	for (uint i = 0; i < store->num_entries; i++) {
+		dedup_entry *entry = store->entries[i];
+		dedup_entry **bucket = &store->buckets[entry->hash & (store->num_buckets - 1)];
+
+		entry->next = *bucket;
+		*bucket = entry;
+	}
+}
+
+static void dedup_insert(dedup *store, dedup_entry *entry)
+{
+	dedup_entry **bucket;
+
+	if (store->num_entries == store->num_entries_alloc) {
+		store->num_entries_alloc = min_array_size(store->num_entries);
+		store->entries = realloc(store->entries, sizeof(dedup_entry *) * store->num_entries_alloc);
+	}
+
+	entry->store = store;
+	entry->index = store->num_entries;
+	store->entries[store->num_entries++] = entry;
+
+	if (store->num_entries > store->num_buckets) {
+		dedup_grow(store);
+	}
+	else {
+		bucket = &store->buckets[entry->hash & (store->num_buckets - 1)];
+
+		entry->next = *bucket;
+		*bucket = entry;
+	}
+
+	budget_mem_add(store->cache, entry_mem_size(entry));
+}
+
+static void dedup_remove(dedup *store, dedup_entry *entry)
+{
+	dedup_entry **link = &store->buckets[entry->hash & (store->num_buckets - 1)];
+	dedup_entry *last = store->entries[--store->num_entries];
+
+	while (*link != entry) {
+		link = &(*link)->next;
+	}
+
+	*link = entry->next;
+
+	last->index = entry->index;
+	store->entries[last->index] = last;
+
+	entry->store = NULL;
+
+	budget_mem_sub(store->cache, entry_mem_size(entry));
+}
+
+/* Get a reference to shared data identical to the data of a block (`size` bytes, as stored),
+ * adding a copy of it to the store of the cache if there is none. */
+void *dedup_acquire(OmniCache *cache, uint index, const OmniBlock *block, size_t size)
+{
+	dedup *store = dedup_ensure(cache);
+	uint64_t hash = hash_data(block->data, size);
+	OmniBlockStatusFlags encoding = block->status & OMNI_BLOCK_STATUS_PACKED;
+	dedup_entry *entry;
+
+	for (entry = store->buckets[hash & (store->num_buckets - 1)]; entry; entry = entry->next) {
+		if (entry->hash == hash && entry->size == size && entry->block == index && entry->dcount == block->dcount &&
+		    entry->csize == block->csize && entry->encoding == encoding &&
+		    memcmp(entry_data(entry), block->data, size) == 0)
+		{
+			entry->refs++;
+
+			return entry_data(entry);
+		}
+	}
+
+	entry = alignalloc(DEDUP_HEADER_SIZE + size, ALIGN_SIZE);
+
+	memset(entry, 0, sizeof(dedup_entry));
+
+	entry->hash = hash;
+	entry->size = size;
+	entry->refs = 1;
+	entry->block = index;
+	entry->dcount = block->dcount;
+	entry->csize = block->csize;
+	entry->encoding = encoding;
+
+	memcpy(entry_data(entry), block->data, size);
+
+	dedup_insert(store, entry);
+
+	return entry_data(entry);
+}
+
+/* Add a reference to shared data. */
+void *dedup_ref(void *data)
+{
+	entry_get(data)->refs++;
+
+	return data;
+}
+
+/* Release a reference to shared data, freeing it with the last one. */
+void dedup_release(void *data)
+{
+	dedup_entry *entry = entry_get(data);
+
+	assert(entry->refs > 0);
+
+	if (--entry->refs > 0) {
+		return;
+	}
+
+	if (entry->store) {
+		dedup_remove(entry->store, entry);
+	}
+
+	alignfree(entry);
+}
+
+/* Number of shared data entries, indexed by `dedup_entry_index`. */
+uint dedup_num_entries(const OmniCache *cache)
+{
+	return cache->dedup ? cache->dedup->num_entries : 0;
+}
+
+/* Index of shared data among the entries of its cache (changes as entries are removed). */
+uint dedup_entry_index(const void *data)
+{
+	return entry_get(data)->index;
+}
+
+/* Free the store, once samples no longer use it (entries still referenced by views are left to them). */
+void dedup_free(OmniCache *cache)
+{
+	dedup *store = cache->dedup;
+
+	if (!store) {
+		return;
+	}
+
+	for (uint i = 0; i < store->num_entries; i++) {
+		store->entries[i]->store = NULL;
+
+		/* Data handed over to views is not accounted. */
+		budget_mem_sub(cache, entry_mem_size(store->entries[i]));
+	}
+
+	free(store->entries);
+	free(store->buckets);
+	free(store);
+
+	cache->dedup = NULL;
+}
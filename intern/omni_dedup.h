@@ -0,0 +1,19 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#ifndef __OMNI_OMNI_DEDUP_H__
+#define __OMNI_OMNI_DEDUP_H__
+
+#include "omni_types.h"
+
+void *dedup_acquire(OmniCache *cache, uint index, const OmniBlock *block, size_t size);
+void *dedup_ref(void *data);
+void dedup_release(void *data);
+
+uint dedup_num_entries(const OmniCache *cache);
+uint dedup_entry_index(const void *data);
+
+void dedup_free(OmniCache *cache);
+
+#endif /* __OMNI_OMNI_DEDUP_H__ */
@@ -0,0 +1,430 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include "omni_file.h"
+
+#include <stdint.h>
+
+#include "omnicache.h"
+#include "omni_dedup.h"
+#include "omni_serial.h"
+#include "omni_utils.h"
+
+/* File layout:
+ * - `OmniFileHeader`;
+ * - `OmniCacheDef` and `OmniBlockInfoDef` for each block (as in serialized caches);
+ * - The index, at `OmniFileHeader.index_offset`: an `OmniFileSample` for each initialized sample,
+ *   ordered by time, each followed by an `OmniFileBlock` for each block;
+ * - The data of each sample, starting on a `FILE_PAGE_SIZE` boundary, with its metadata and
+ *   blocks aligned to `ALIGN_SIZE` (block data is stored as encoded by the block codec if `OmniFileBlock.csize` is set,
+ *   against the previous block holding data if `OMNI_BLOCK_STATUS_DELTA` is set, and quantized if
+ *   `OMNI_BLOCK_STATUS_QUANTIZED` is set). Blocks sharing identical data point to a single copy of it.
+ * All offsets are relative to the start of the file. */
+
+#define FILE_VERSION 4
+
+static const char file_magic[8] = {'O', 'M', 'N', 'I', 'C', 'A', 'C', 'H'};
+
+typedef struct OmniFileHeader {
+	char magic[8];
+	uint version;
+	uint pad;
+
+	uint64_t index_offset;
+	uint64_t size; /* Size of the whole file. */
+} OmniFileHeader;
+
+typedef struct OmniFileSample {
+	uint tindex;
+	float_or_uint toffset;
+
+	OmniSampleStatusFlags status;
+	OmniBlockStatusFlags meta_status;
+	uint64_t meta_offset; /* Only if the metadata is valid. */
+} OmniFileSample;
+
+typedef struct OmniFileBlock {
+	OmniBlockStatusFlags status;
+	uint dcount;
+	uint csize; /* Size of the data if compressed (0 if not). */
+	uint pad;
+	uint64_t offset; /* Only if the block is valid. */
+} OmniFileBlock;
+
+/* Status flags preserved in cache files (runtime flags are dropped). */
+#define FILE_STATUS_MASK (OMNI_STATUS_INITED | OMNI_STATUS_VALID | OMNI_STATUS_CURRENT)
+#define FILE_BLOCK_STATUS_MASK (FILE_STATUS_MASK | OMNI_BLOCK_STATUS_DELTA | OMNI_BLOCK_STATUS_QUANTIZED)
+
+/* Writing */
+
+static bool file_write_cb(const void *data, size_t size, void *user_data)
+{
+	return fwrite(data, 1, size, user_data) == size;
+}
+
+static OmniSample *file_sample_next(OmniSample *sample)
+{
+	do {
+		sample = sample_next(sample);
+	} while (sample && SAMPLE_IS_SKIPPED(sample));
+
+	return sample;
+}
+
+static OmniSample *file_sample_first(const OmniCache *cache)
+{
+	OmniSample *sample = SAMPLE_FIRST(cache);
+
+	if (sample && SAMPLE_IS_SKIPPED(sample)) {
+		sample = file_sample_next(sample);
+	}
+
+	return sample;
+}
+
+/* Lay out the data of a sample starting at `offset`, filling its index records.
+ * Shared data is only laid out once, at the offsets in `shared_offsets` (by `dedup_entry_index`, 0 until laid out).
+ * Returns the offset past the end of the sample data. */
+static size_t file_sample_layout(const OmniSample *sample, size_t offset, OmniFileSample *f_sample, OmniFileBlock *f_blocks,
+                                 uint64_t *shared_offsets)
+{
+	const OmniCache *cache = sample->parent;
+
+	offset = ALIGN_UP(offset, FILE_PAGE_SIZE);
+
+	memset(f_sample, 0, sizeof(OmniFileSample));
+
+	f_sample->tindex = sample->tindex;
+	f_sample->toffset = sample->toffset;
+	f_sample->status = sample->status & FILE_STATUS_MASK;
+
+	if (META_IS_VALID(sample)) {
+		f_sample->meta_status = sample->meta.status & FILE_STATUS_MASK;
+		f_sample->meta_offset = offset;
+
+		offset = ALIGN_UP(offset + cache->def.msize, ALIGN_SIZE);
+	}
+
+	for (uint i = 0; i < cache->def.num_blocks; i++) {
+		const OmniBlock *block = sample->blocks ? &sample->blocks[i] : NULL;
+
+		memset(&f_blocks[i], 0, sizeof(OmniFileBlock));
+
+		if (IS_VALID(block)) {
+			uint64_t *shared = NULL;
+
+			if (block->status & OMNI_BLOCK_STATUS_SHARED) {
+				shared = &shared_offsets[dedup_entry_index(block->data)];
+			}
+
+			f_blocks[i].status = block->status & FILE_BLOCK_STATUS_MASK;
+			f_blocks[i].dcount = block->dcount;
+			f_blocks[i].csize = block->csize;
+
+			if (shared && *shared) {
+				f_blocks[i].offset = *shared;
+				continue;
+			}
+
+			f_blocks[i].offset = offset;
+
+			if (shared) {
+				*shared = offset;
+			}
+
+			offset = ALIGN_UP(offset + block_data_size(&cache->block_index[i], block), ALIGN_SIZE);
+		}
+	}
+
+	return offset;
+}
+
+bool file_write(const OmniCache *cache, const char *path)
+{
+	FILE *file = fopen(path, "wb");
+	serial_writer writer = {
+	    .buffer = NULL,
+	    .write = file_write_cb,
+	    .user_data = file,
+	};
+	OmniFileHeader header;
+	OmniFileSample f_sample;
+	OmniFileBlock *f_blocks;
+	uint num_shared = dedup_num_entries(cache);
+	uint64_t *shared_offsets;
+	size_t def_size = sizeof(OmniCacheDef) + sizeof(OmniBlockInfoDef) * cache->def.num_blocks;
+	size_t index_size = (sizeof(OmniFileSample) + sizeof(OmniFileBlock) * cache->def.num_blocks) * cache->def.num_samples_tot;
+	size_t data_offset;
+	size_t offset;
+
+	if (!file) {
+		fprintf(stderr, "OmniCache: Failed to create cache file \"%s\".\n", path);
+
+		return false;
+	}
+
+	writer.buffer = malloc(SERIAL_CHUNK_SIZE);
+	f_blocks = malloc(sizeof(OmniFileBlock) * MAX(cache->def.num_blocks, 1));
+	shared_offsets = calloc(MAX(num_shared, 1), sizeof(uint64_t));
+
+	memset(&header, 0, sizeof(OmniFileHeader));
+	memcpy(header.magic, file_magic, sizeof(file_magic));
+
+	header.version = FILE_VERSION;
+	header.index_offset = ALIGN_UP(sizeof(OmniFileHeader) + def_size, SERIAL_ALIGN);
+
+	data_offset = header.index_offset + index_size;
+
+	/* The index is computed before the data is written, so the data layout is computed twice. */
+	offset = data_offset;
+
+	for (OmniSample *sample = file_sample_first(cache); sample; sample = file_sample_next(sample)) {
+		offset = file_sample_layout(sample, offset, &f_sample, f_blocks, shared_offsets);
+	}
+
+	header.size = offset;
+
+	serial_write(&writer, &header, sizeof(OmniFileHeader));
+	serialize_def(&writer, cache, true);
+	serial_write_pad(&writer, header.index_offset);
+
+	/* index */
+	offset = data_offset;
+	memset(shared_offsets, 0, sizeof(uint64_t) * num_shared);
+
+	for (OmniSample *sample = file_sample_first(cache); sample; sample = file_sample_next(sample)) {
+		offset = file_sample_layout(sample, offset, &f_sample, f_blocks, shared_offsets);
+
+		serial_write(&writer, &f_sample, sizeof(OmniFileSample));
+		serial_write(&writer, f_blocks, sizeof(OmniFileBlock) * cache->def.num_blocks);
+	}
+
+	/* data */
+	offset = data_offset;
+	memset(shared_offsets, 0, sizeof(uint64_t) * num_shared);
+
+	for (OmniSample *sample = file_sample_first(cache); sample; sample = file_sample_next(sample)) {
+		offset = file_sample_layout(sample, offset, &f_sample, f_blocks, shared_offsets);
+
+		if (f_sample.meta_status & OMNI_STATUS_VALID) {
+			serial_write_pad(&writer, f_sample.meta_offset);
+			serial_write(&writer, sample->meta.data, cache->def.msize);
+		}
+
+		for (uint i = 0; i < cache->def.num_blocks; i++) {
+			/* Shared data laid out earlier is already written. */
+			if ((f_blocks[i].status & OMNI_STATUS_VALID) && f_blocks[i].offset >= writer.size) {
+				serial_write_pad(&writer, f_blocks[i].offset);
+				serial_write(&writer, sample->blocks[i].data, block_data_size(&cache->block_index[i], &sample->blocks[i]));
+			}
+		}
+	}
+
+	serial_write_pad(&writer, header.size);
+	serial_flush(&writer);
+
+	free(f_blocks);
+	free(shared_offsets);
+	free(writer.buffer);
+
+	if (fclose(file) != 0 || writer.failed) {
+		fprintf(stderr, "OmniCache: Failed to write cache file \"%s\".\n", path);
+
+		return false;
+	}
+
+	return true;
+}
+
+/* Opening */
+
+/* Check that a range lies within the mapped file. */
+static bool file_range_valid(const mapping *map, uint64_t offset, uint64_t size)
+{
+	return offset <= map->size && size <= map->size - offset;
+}
+
+/* Add the sample described by an index record to the cache, pointing its data into the mapping. */
+static bool file_open_sample(OmniCache *cache, const OmniFileSample *f_sample, const OmniFileBlock *f_blocks)
+{
+	const mapping *map = cache->map;
+	const char *base = map->data;
+	OmniSample *sample;
+
+	if ((f_sample->meta_status & OMNI_STATUS_VALID) &&
+	    !file_range_valid(map, f_sample->meta_offset, cache->def.msize))
+	{
+		return false;
+	}
+
+	for (uint i = 0; i < cache->def.num_blocks; i++) {
+		uint64_t size = block_plain_size(&cache->block_index[i], f_blocks[i].status, f_blocks[i].dcount);
+
+		if (f_blocks[i].csize) {
+			size = f_blocks[i].csize;
+		}
+
+		if ((f_blocks[i].status & OMNI_STATUS_VALID) && !file_range_valid(map, f_blocks[i].offset, size)) {
+			return false;
+		}
+	}
+
+	sample = sample_insert(cache, f_sample->tindex, f_sample->toffset);
+
+	sample_set_status(sample, f_sample->status);
+	init_sample_blocks(sample, NULL);
+
+	/* The data is never written through these pointers; rewriting a sample reallocates it. */
+	if (f_sample->meta_status & OMNI_STATUS_VALID) {
+		sample->meta.data = (void *)(uintptr_t)(base + f_sample->meta_offset);
+		sample->meta.status |= OMNI_BLOCK_STATUS_BORROWED;
+
+		meta_set_status(sample, f_sample->meta_status);
+	}
+
+	for (uint i = 0; i < cache->def.num_blocks; i++) {
+		OmniBlock *block = &sample->blocks[i];
+
+		if (f_blocks[i].status & OMNI_STATUS_VALID) {
+			block->data = (void *)(uintptr_t)(base + f_blocks[i].offset);
+			block->dcount = f_blocks[i].dcount;
+			block->dcount_alloc = block->dcount;
+			block->status |= OMNI_BLOCK_STATUS_BORROWED;
+
+			if (f_blocks[i].csize) {
+				block->csize = f_blocks[i].csize;
+				block->status |= OMNI_BLOCK_STATUS_COMPRESSED;
+			}
+
+			block->status |= f_blocks[i].status & (OMNI_BLOCK_STATUS_DELTA | OMNI_BLOCK_STATUS_QUANTIZED);
+
+			block_set_status(block, f_blocks[i].status & (OMNI_STATUS_VALID | OMNI_STATUS_CURRENT));
+		}
+	}
+
+	sample_mem_update(sample);
+
+	return true;
+}
+
+/* Bounded read over the definition section of a mapped file. */
+typedef struct file_def_reader {
+	const char *data;
+	size_t pos;
+	size_t end;
+} file_def_reader;
+
+static size_t file_def_read_cb(void *data, size_t size, void *user_data)
+{
+	file_def_reader *def_reader = user_data;
+
+	size = MIN(size, def_reader->end - def_reader->pos);
+
+	memcpy(data, def_reader->data + def_reader->pos, size);
+	def_reader->pos += size;
+
+	return size;
+}
+
+/* Check the header, and read the cache definition from it. */
+static OmniCache *file_open_def(const mapping *map, const OmniCacheTemplate *cache_temp, uint64_t *r_index_offset, uint *r_num_samples)
+{
+	OmniFileHeader header;
+	file_def_reader def_reader = {
+	    .data = map->data,
+	    .pos = sizeof(OmniFileHeader),
+	};
+	serial_reader reader = {
+	    .read = file_def_read_cb,
+	    .user_data = &def_reader,
+	};
+	OmniCache *cache;
+
+	if (map->size < sizeof(OmniFileHeader)) {
+		return NULL;
+	}
+
+	memcpy(&header, map->data, sizeof(OmniFileHeader));
+
+	if (memcmp(header.magic, file_magic, sizeof(file_magic)) != 0 ||
+	    header.version != FILE_VERSION ||
+	    header.size != map->size ||
+	    header.index_offset % SERIAL_ALIGN ||
+	    header.index_offset < sizeof(OmniFileHeader) ||
+	    header.index_offset > map->size)
+	{
+		return NULL;
+	}
+
+	def_reader.end = header.index_offset;
+
+	cache = deserialize_def(&reader, cache_temp, r_num_samples);
+
+	if (cache && reader.failed) {
+		OMNI_free(cache);
+
+		return NULL;
+	}
+
+	*r_index_offset = header.index_offset;
+
+	return cache;
+}
+
+OmniCache *file_open(const char *path, const OmniCacheTemplate *cache_temp)
+{
+	mapping *map = mapping_open(path);
+	OmniCache *cache;
+	uint64_t index_offset;
+	uint num_samples;
+	size_t record_size;
+	bool valid;
+
+	if (!map) {
+		fprintf(stderr, "OmniCache: Failed to open cache file \"%s\".\n", path);
+
+		return NULL;
+	}
+
+	cache = file_open_def(map, cache_temp, &index_offset, &num_samples);
+
+	if (!cache) {
+		fprintf(stderr, "OmniCache: Invalid cache file \"%s\".\n", path);
+
+		mapping_release(map);
+
+		return NULL;
+	}
+
+	/* The cache holds the reference to the mapping from here on. */
+	cache->map = map;
+
+	record_size = sizeof(OmniFileSample) + sizeof(OmniFileBlock) * cache->def.num_blocks;
+	valid = file_range_valid(map, index_offset, (uint64_t)record_size * num_samples);
+
+	if (valid) {
+		const char *index = (const char *)map->data + index_offset;
+		OmniFileSample f_sample;
+		OmniFileBlock *f_blocks = malloc(sizeof(OmniFileBlock) * MAX(cache->def.num_blocks, 1));
+
+		for (uint i = 0; i < num_samples && valid; i++, index += record_size) {
+			memcpy(&f_sample, index, sizeof(OmniFileSample));
+			memcpy(f_blocks, index + sizeof(OmniFileSample), sizeof(OmniFileBlock) * cache->def.num_blocks);
+
+			valid = file_open_sample(cache, &f_sample, f_blocks);
+		}
+
+		free(f_blocks);
+	}
+
+	if (!valid) {
+		fprintf(stderr, "OmniCache: Invalid cache file \"%s\".\n", path);
+
+		OMNI_free(cache);
+
+		return NULL;
+	}
+
+	return cache;
+}
@@ -0,0 +1,16 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#ifndef __OMNI_OMNI_FILE_H__
+#define __OMNI_OMNI_FILE_H__
+
+#include "omni_types.h"
+
+/* Alignment of the data of each sample in cache files, so that samples are paged in independently. */
+#define FILE_PAGE_SIZE 4096
+
+bool file_write(const OmniCache *cache, const char *path);
+OmniCache *file_open(const char *path, const OmniCacheTemplate *cache_temp);
+
+#endif /* __OMNI_OMNI_FILE_H__ */
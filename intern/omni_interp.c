@@ -0,0 +1,444 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include "omni_interp.h"
+
+#include "cpu.h"
+#include "omni_utils.h"
+
+typedef void (*lerp_kernel)(float *target, const float *prev, const float *next, size_t num, float fac);
+typedef void (*cubic_kernel)(float *target, const float *p0, const float *p1, const float *p2, const float *p3,
+                             size_t num, const float weights[4]);
+
+typedef struct interp_kernels {
+	lerp_kernel lerp;
+	cubic_kernel cubic;
+} interp_kernels;
+
+/* Scalar kernels */
+
+static void lerp_scalar(float *target, const float *prev, const float *next, size_t num, float fac)
+{
+	for (size_t i = 0; i < num; i++) {
+		target[i] = prev[i] + ((next[i] - prev[i]) * fac);
+	}
+}
+
+static void cubic_scalar(float *target, const float *p0, const float *p1, const float *p2, const float *p3,
+                         size_t num, const float weights[4])
+{
+	for (size_t i = 0; i < num; i++) {
+		target[i] = (p0[i] * weights[0]) + (p1[i] * weights[1]) + (p2[i] * weights[2]) + (p3[i] * weights[3]);
+	}
+}
+
+#ifdef CPU_X86
+/* SSE2 kernels */
+
+TARGET_SSE2 static void lerp_sse2(float *target, const float *prev, const float *next, size_t num, float fac)
+{
+	__m128 vfac = _mm_set1_ps(fac);
+	size_t i = 0;
+
+	for (; i + 4 <= num; i += 4) {
+		__m128 vprev = _mm_loadu_ps(&prev[i]);
+		__m128 vnext = _mm_loadu_ps(&next[i]);
+
+		_mm_storeu_ps(&target[i], _mm_add_ps(vprev, _mm_mul_ps(_mm_sub_ps(vnext, vprev), vfac)));
+	}
+
+	lerp_scalar(&target[i], &prev[i], &next[i], num - i, fac);
+}
+
+TARGET_SSE2 static void cubic_sse2(float *target, const float *p0, const float *p1, const float *p2, const float *p3,
+                                   size_t num, const float weights[4])
+{
+	__m128 w0 = _mm_set1_ps(weights[0]);
+	__m128 w1 = _mm_set1_ps(weights[1]);
+	__m128 w2 = _mm_set1_ps(weights[2]);
+	__m128 w3 = _mm_set1_ps(weights[3]);
+	size_t i = 0;
+
+	for (; i + 4 <= num; i += 4) {
+		__m128 r = _mm_mul_ps(_mm_loadu_ps(&p0[i]), w0);
+
+		r = _mm_add_ps(r, _mm_mul_ps(_mm_loadu_ps(&p1[i]), w1));
+		r = _mm_add_ps(r, _mm_mul_ps(_mm_loadu_ps(&p2[i]), w2));
+		r = _mm_add_ps(r, _mm_mul_ps(_mm_loadu_ps(&p3[i]), w3));
+
+		_mm_storeu_ps(&target[i], r);
+	}
+
+	cubic_scalar(&target[i], &p0[i], &p1[i], &p2[i], &p3[i], num - i, weights);
+}
+
+/* AVX2 kernels */
+
+TARGET_AVX2 static void lerp_avx2(float *target, const float *prev, const float *next, size_t num, float fac)
+{
+	__m256 vfac = _mm256_set1_ps(fac);
+	size_t i = 0;
+
+	for (; i + 8 <= num; i += 8) {
+		__m256 vprev = _mm256_loadu_ps(&prev[i]);
+		__m256 vnext = _mm256_loadu_ps(&next[i]);
+
+		_mm256_storeu_ps(&target[i], _mm256_add_ps(vprev, _mm256_mul_ps(_mm256_sub_ps(vnext, vprev), vfac)));
+	}
+
+	lerp_scalar(&target[i], &prev[i], &next[i], num - i, fac);
+}
+
+TARGET_AVX2 static void cubic_avx2(float *target, const float *p0, const float *p1, const float *p2, const float *p3,
+                                   size_t num, const float weights[4])
+{
+	__m256 w0 = _mm256_set1_ps(weights[0]);
+	__m256 w1 = _mm256_set1_ps(weights[1]);
+	__m256 w2 = _mm256_set1_ps(weights[2]);
+	__m256 w3 = _mm256_set1_ps(weights[3]);
+	size_t i = 0;
+
+	for (; i + 8 <= num; i += 8) {
+		__m256 r = _mm256_mul_ps(_mm256_loadu_ps(&p0[i]), w0);
+
+		r = _mm256_add_ps(r, _mm256_mul_ps(_mm256_loadu_ps(&p1[i]), w1));
+		r = _mm256_add_ps(r, _mm256_mul_ps(_mm256_loadu_ps(&p2[i]), w2));
+		r = _mm256_add_ps(r, _mm256_mul_ps(_mm256_loadu_ps(&p3[i]), w3));
+
+		_mm256_storeu_ps(&target[i], r);
+	}
+
+	cubic_scalar(&target[i], &p0[i], &p1[i], &p2[i], &p3[i], num - i, weights);
+}
+#endif
+
+/* Kernels for the best instruction set supported by the CPU. */
+static const interp_kernels *kernels_get(void)
+{
+	static const interp_kernels kernels_scalar = {lerp_scalar, cubic_scalar};
+#ifdef CPU_X86
+	static const interp_kernels kernels_sse2 = {lerp_sse2, cubic_sse2};
+	static const interp_kernels kernels_avx2 = {lerp_avx2, cubic_avx2};
+#endif
+	static const interp_kernels *kernels = NULL;
+
+	if (!kernels) {
+		kernels = &kernels_scalar;
+
+#ifdef CPU_X86
+		if (cpu_has_avx2()) {
+			kernels = &kernels_avx2;
+		}
+		else if (cpu_has_sse2()) {
+			kernels = &kernels_sse2;
+		}
+#endif
+	}
+
+	return kernels;
+}
+
+/* Linearly interpolate `num` floats. */
+void interp_lerp(float *target, const float *prev, const float *next, size_t num, float fac)
+{
+	kernels_get()->lerp(target, prev, next, num, fac);
+}
+
+/* Catmull-Rom interpolation of `num` floats between `p1` and `p2`, at times `t1` and `t2`.
+ * p0, p3: surrounding values at times `t0` and `t3`, or NULL to use one-sided tangents.
+ * Tangents are three-point derivatives, so unevenly spaced samples are weighted by their distance,
+ * while uniform spacing reduces to the standard Catmull-Rom spline. */
+void interp_cubic(float *target, const float *p0, const float *p1, const float *p2, const float *p3,
+                  size_t num, float t0, float t1, float t2, float t3, float t)
+{
+	float h = t2 - t1;
+	float s = (t - t1) / h;
+	float s2 = s * s;
+	float s3 = s2 * s;
+	float h00 = (2.0f * s3) - (3.0f * s2) + 1.0f;
+	float h10 = s3 - (2.0f * s2) + s;
+	float h01 = (3.0f * s2) - (2.0f * s3);
+	float h11 = s3 - s2;
+	/* Tangents (scaled to the interval) as weights of the four values:
+	 * m1 = c1[0] * p0 + c1[1] * p1 + c1[2] * p2
+	 * m2 = c2[0] * p1 + c2[1] * p2 + c2[2] * p3 */
+	float c1[3] = {0.0f, -1.0f, 1.0f};
+	float c2[3] = {-1.0f, 1.0f, 0.0f};
+	float weights[4];
+
+	if (p0) {
+		float a = t1 - t0;
+
+		c1[0] = -(h * h) / (a * (a + h));
+		c1[2] = a / (a + h);
+		c1[1] = -c1[0] - c1[2];
+	}
+	else {
+		p0 = p1;
+	}
+
+	if (p3) {
+		float b = t3 - t2;
+
+		c2[2] = (h * h) / (b * (h + b));
+		c2[0] = -b / (h + b);
+		c2[1] = -c2[0] - c2[2];
+	}
+	else {
+		p3 = p2;
+	}
+
+	weights[0] = h10 * c1[0];
+	weights[1] = h00 + (h10 * c1[1]) + (h11 * c2[0]);
+	weights[2] = h01 + (h10 * c1[2]) + (h11 * c2[1]);
+	weights[3] = h11 * c2[2];
+
+	kernels_get()->cubic(target, p0, p1, p2, p3, num, weights);
+}
+
+/* Rotation-aware matrix interpolation
+ *
+ * Matrices are decomposed into translation, scale and a rotation quaternion, which are interpolated
+ * separately (the quaternion with an approximated slerp), and then recomposed.
+ * Instances are processed in batches, laid out as structures of arrays, and all per-instance math is
+ * branchless, so the loops over a batch can be vectorized by the compiler. */
+
+#define XFORM_BATCH 64
+
+typedef struct xform_batch {
+	float loc[3][XFORM_BATCH];
+	float scale[3][XFORM_BATCH];
+	float quat[4][XFORM_BATCH]; /* w, x, y, z */
+	float row[4][XFORM_BATCH]; /* Projective row (`mat[i][3]`), interpolated linearly. */
+} xform_batch;
+
+static void xform_decompose(xform_batch *xf, const void *base, size_t stride, uint num)
+{
+	float axis[3][3][XFORM_BATCH];
+
+	for (uint i = 0; i < num; i++) {
+		const float *mat = (const float *)((const char *)base + (stride * i));
+
+		for (uint c = 0; c < 3; c++) {
+			for (uint r = 0; r < 3; r++) {
+				axis[c][r][i] = mat[(c * 4) + r];
+			}
+
+			xf->loc[c][i] = mat[12 + c];
+		}
+
+		for (uint c = 0; c < 4; c++) {
+			xf->row[c][i] = mat[(c * 4) + 3];
+		}
+	}
+
+	for (uint i = 0; i < num; i++) {
+		float m[3][3];
+		float det, len;
+
+		/* Scale is the length of each axis, with a negative determinant flipping the X axis. */
+		det = (axis[0][0][i] * ((axis[1][1][i] * axis[2][2][i]) - (axis[1][2][i] * axis[2][1][i]))) +
+		      (axis[0][1][i] * ((axis[1][2][i] * axis[2][0][i]) - (axis[1][0][i] * axis[2][2][i]))) +
+		      (axis[0][2][i] * ((axis[1][0][i] * axis[2][1][i]) - (axis[1][1][i] * axis[2][0][i])));
+
+		for (uint c = 0; c < 3; c++) {
+			float scale = sqrtf((axis[c][0][i] * axis[c][0][i]) +
+			                    (axis[c][1][i] * axis[c][1][i]) +
+			                    (axis[c][2][i] * axis[c][2][i]));
+			float inv;
+
+			if (c == 0) {
+				scale = copysignf(scale, det);
+			}
+
+			inv = (fabsf(scale) > 1e-20f) ? (1.0f / scale) : 0.0f;
+
+			xf->scale[c][i] = scale;
+
+			/* Rotation matrix in row, column order. */
+			m[0][c] = axis[c][0][i] * inv;
+			m[1][c] = axis[c][1][i] * inv;
+			m[2][c] = axis[c][2][i] * inv;
+		}
+
+		/* Branchless matrix to quaternion conversion. */
+		xf->quat[0][i] = 0.5f * sqrtf(fmaxf(0.0f, 1.0f + m[0][0] + m[1][1] + m[2][2]));
+		xf->quat[1][i] = copysignf(0.5f * sqrtf(fmaxf(0.0f, 1.0f + m[0][0] - m[1][1] - m[2][2])), m[2][1] - m[1][2]);
+		xf->quat[2][i] = copysignf(0.5f * sqrtf(fmaxf(0.0f, 1.0f - m[0][0] + m[1][1] - m[2][2])), m[0][2] - m[2][0]);
+		xf->quat[3][i] = copysignf(0.5f * sqrtf(fmaxf(0.0f, 1.0f - m[0][0] - m[1][1] + m[2][2])), m[1][0] - m[0][1]);
+
+		len = sqrtf((xf->quat[0][i] * xf->quat[0][i]) + (xf->quat[1][i] * xf->quat[1][i]) +
+		            (xf->quat[2][i] * xf->quat[2][i]) + (xf->quat[3][i] * xf->quat[3][i]));
+		len = (len > 1e-20f) ? (1.0f / len) : 0.0f;
+
+		for (uint c = 0; c < 4; c++) {
+			xf->quat[c][i] *= len;
+		}
+	}
+}
+
+/* Interpolate `next` into `prev`. */
+static void xform_interp(xform_batch *prev, const xform_batch *next, uint num, float fac)
+{
+	for (uint c = 0; c < 3; c++) {
+		lerp_scalar(prev->loc[c], prev->loc[c], next->loc[c], num, fac);
+		lerp_scalar(prev->scale[c], prev->scale[c], next->scale[c], num, fac);
+	}
+
+	for (uint c = 0; c < 4; c++) {
+		lerp_scalar(prev->row[c], prev->row[c], next->row[c], num, fac);
+	}
+
+	for (uint i = 0; i < num; i++) {
+		float dot = (prev->quat[0][i] * next->quat[0][i]) + (prev->quat[1][i] * next->quat[1][i]) +
+		            (prev->quat[2][i] * next->quat[2][i]) + (prev->quat[3][i] * next->quat[3][i]);
+		float sign = copysignf(1.0f, dot);
+		float d = fabsf(dot);
+		float len = 0.0f;
+		float a, b, k, t;
+
+		/* Slerp approximated by adjusting the nlerp factor (max error around 1e-4 radians). */
+		a = 1.0904f + (d * (-3.2452f + (d * (3.55645f - (d * 1.43519f)))));
+		b = 0.848013f + (d * (-1.06021f + (d * 0.215638f)));
+		k = (a * (fac - 0.5f) * (fac - 0.5f)) + b;
+		t = fac + (fac * (fac - 0.5f) * (fac - 1.0f) * k);
+
+		for (uint c = 0; c < 4; c++) {
+			prev->quat[c][i] = (prev->quat[c][i] * (1.0f - t)) + (next->quat[c][i] * sign * t);
+			len += prev->quat[c][i] * prev->quat[c][i];
+		}
+
+		len = (len > 1e-20f) ? (1.0f / sqrtf(len)) : 0.0f;
+
+		for (uint c = 0; c < 4; c++) {
+			prev->quat[c][i] *= len;
+		}
+	}
+}
+
+static void xform_compose(const xform_batch *xf, void *base, size_t stride, uint num)
+{
+	for (uint i = 0; i < num; i++) {
+		float (*mat)[4] = (float (*)[4])((char *)base + (stride * i));
+		float w = xf->quat[0][i];
+		float x = xf->quat[1][i];
+		float y = xf->quat[2][i];
+		float z = xf->quat[3][i];
+
+		mat[0][0] = (1.0f - (2.0f * ((y * y) + (z * z)))) * xf->scale[0][i];
+		mat[0][1] = (2.0f * ((x * y) + (w * z))) * xf->scale[0][i];
+		mat[0][2] = (2.0f * ((x * z) - (w * y))) * xf->scale[0][i];
+
+		mat[1][0] = (2.0f * ((x * y) - (w * z))) * xf->scale[1][i];
+		mat[1][1] = (1.0f - (2.0f * ((x * x) + (z * z)))) * xf->scale[1][i];
+		mat[1][2] = (2.0f * ((y * z) + (w * x))) * xf->scale[1][i];
+
+		mat[2][0] = (2.0f * ((x * z) + (w * y))) * xf->scale[2][i];
+		mat[2][1] = (2.0f * ((y * z) - (w * x))) * xf->scale[2][i];
+		mat[2][2] = (1.0f - (2.0f * ((x * x) + (y * y)))) * xf->scale[2][i];
+
+		for (uint c = 0; c < 3; c++) {
+			mat[3][c] = xf->loc[c][i];
+		}
+
+		for (uint c = 0; c < 4; c++) {
+			mat[c][3] = xf->row[c][i];
+		}
+	}
+}
+
+/* Interpolate `num` matrices, laid out with a stride of `stride` bytes. */
+static void interp_rotation(void *target, const void *prev, const void *next,
+                            size_t stride, uint num, float fac)
+{
+	xform_batch *xprev = malloc(sizeof(xform_batch) * 2);
+	xform_batch *xnext = xprev + 1;
+
+	for (uint i = 0; i < num; i += XFORM_BATCH) {
+		uint batch = MIN(XFORM_BATCH, num - i);
+		size_t offset = stride * i;
+
+		xform_decompose(xprev, (const char *)prev + offset, stride, batch);
+		xform_decompose(xnext, (const char *)next + offset, stride, batch);
+
+		xform_interp(xprev, xnext, batch, fac);
+
+		xform_compose(xprev, (char *)target + offset, stride, batch);
+	}
+
+	free(xprev);
+}
+
+/* Interpolate transformed references.
+ * References to different library blocks can't be interpolated, so the nearest one is used. */
+static void interp_tref(OmniTRef *target, const OmniTRef *prev, const OmniTRef *next,
+                        uint num, float fac, OmniInterpMode mode)
+{
+	if (mode == OMNI_INTERP_ROTATION) {
+		interp_rotation(target->mat, prev->mat, next->mat, sizeof(OmniTRef), num, fac);
+	}
+
+	for (uint i = 0; i < num; i++) {
+		if (prev[i].index != next[i].index) {
+			target[i] = (fac < 0.5f) ? prev[i] : next[i];
+		}
+		else {
+			target[i].index = prev[i].index;
+
+			if (mode != OMNI_INTERP_ROTATION) {
+				lerp_scalar(&target[i].mat[0][0], &prev[i].mat[0][0], &next[i].mat[0][0], 16, fac);
+			}
+		}
+	}
+}
+
+/* Built-in interpolation, used for continuous blocks without an `interp` callback.
+ * Returns false if the data type is not supported. */
+bool interp_builtin(OmniInterpData *interp_data, OmniInterpMode mode)
+{
+	OmniData *target = interp_data->target;
+	OmniData *prev = interp_data->prev;
+	OmniData *next = interp_data->next;
+	float tprev = fu_float(interp_data->tprev);
+	float fac = (fu_float(interp_data->ttarget) - tprev) / (fu_float(interp_data->tnext) - tprev);
+
+	assert(prev->dcount == next->dcount);
+	assert(target->dcount == prev->dcount);
+
+	switch (target->dtype) {
+		case OMNI_DATA_FLOAT:
+		case OMNI_DATA_FLOAT3:
+			if (mode == OMNI_INTERP_CUBIC) {
+				interp_cubic(target->data,
+				             interp_data->prev2 ? interp_data->prev2->data : NULL,
+				             prev->data, next->data,
+				             interp_data->next2 ? interp_data->next2->data : NULL,
+				             ((size_t)target->dsize / sizeof(float)) * target->dcount,
+				             interp_data->prev2 ? fu_float(interp_data->tprev2) : 0.0f,
+				             tprev, fu_float(interp_data->tnext),
+				             interp_data->next2 ? fu_float(interp_data->tnext2) : 0.0f,
+				             fu_float(interp_data->ttarget));
+				return true;
+			}
+			ATTR_FALLTHROUGH;
+		case OMNI_DATA_MAT3:
+			interp_lerp(target->data, prev->data, next->data,
+			            ((size_t)target->dsize / sizeof(float)) * target->dcount, fac);
+			return true;
+		case OMNI_DATA_MAT4:
+			if (mode == OMNI_INTERP_ROTATION) {
+				interp_rotation(target->data, prev->data, next->data, sizeof(float[4][4]), target->dcount, fac);
+				return true;
+			}
+
+			interp_lerp(target->data, prev->data, next->data,
+			            ((size_t)target->dsize / sizeof(float)) * target->dcount, fac);
+			return true;
+		case OMNI_DATA_TREF:
+			interp_tref(target->data, prev->data, next->data, target->dcount, fac, mode);
+			return true;
+		default:
+			return false;
+	}
+}
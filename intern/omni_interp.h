@@ -0,0 +1,16 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#ifndef __OMNI_OMNI_INTERP_H__
+#define __OMNI_OMNI_INTERP_H__
+
+#include "omni_types.h"
+
+void interp_lerp(float *target, const float *prev, const float *next, size_t num, float fac);
+void interp_cubic(float *target, const float *p0, const float *p1, const float *p2, const float *p3,
+                  size_t num, float t0, float t1, float t2, float t3, float t);
+
+bool interp_builtin(OmniInterpData *interp_data, OmniInterpMode mode);
+
+#endif /* __OMNI_OMNI_INTERP_H__ */
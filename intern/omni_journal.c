@@ -0,0 +1,799 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include "omni_journal.h"
+
+#include <stdint.h>
+
+#ifdef _WIN32
+#  include <io.h>
+#  define file_seek(file, offset) _fseeki64(file, (__int64)(offset), SEEK_SET)
+#  define file_seek_end(file) _fseeki64(file, 0, SEEK_END)
+#  define file_tell(file) ((uint64_t)_ftelli64(file))
+#  define file_truncate(file, size) _chsize_s(_fileno(file), (__int64)(size))
+#else
+#  include <unistd.h>
+#  include <sys/types.h>
+#  define file_seek(file, offset) fseeko(file, (off_t)(offset), SEEK_SET)
+#  define file_seek_end(file) fseeko(file, 0, SEEK_END)
+#  define file_tell(file) ((uint64_t)ftello(file))
+#  define file_truncate(file, size) ftruncate(fileno(file), (off_t)(size))
+#endif
+
+#include "omnicache.h"
+#include "omni_serial.h"
+#include "omni_utils.h"
+#include "omni_view.h"
+#include "thread.h"
+
+/* Journal layout:
+ * - `OmniJournalHeader`;
+ * - `OmniCacheDef` and `OmniBlockInfoDef` for each block (as in serialized caches, without samples);
+ * - Records, each made of an `OmniJournalRecord`, its payload, and an `OmniJournalCheck`:
+ *   - `JOURNAL_RECORD_SAMPLE`: a sample, in the serialized sample format;
+ *   - `JOURNAL_RECORD_OP`: an `OmniJournalOp` (tombstones for invalidated or cleared samples, and range moves);
+ * - When the journal is closed cleanly, a `JOURNAL_RECORD_FOOTER` record with the offset of each
+ *   record (as `uint64_t`), followed by an `OmniJournalTrailer`.
+ * Records and payloads are aligned to `SERIAL_ALIGN`, and are only ever appended.
+ * A journal without a valid footer (e.g. after a crash) is replayed by scanning the records up to
+ * the first incomplete or corrupt one. */
+
+#define JOURNAL_VERSION 2
+
+static const char journal_magic[8] = {'O', 'M', 'N', 'I', 'J', 'R', 'N', 'L'};
+static const char journal_end_magic[8] = {'O', 'M', 'N', 'I', 'J', 'E', 'N', 'D'};
+
+typedef enum JournalRecordType {
+	JOURNAL_RECORD_SAMPLE = 1,
+	JOURNAL_RECORD_OP = 2,
+	JOURNAL_RECORD_FOOTER = 3,
+} JournalRecordType;
+
+typedef struct OmniJournalHeader {
+	char magic[8];
+	uint version;
+	uint pad;
+} OmniJournalHeader;
+
+typedef struct OmniJournalRecord {
+	uint type;
+	uint pad;
+	uint64_t size; /* Size of the payload. */
+} OmniJournalRecord;
+
+typedef struct OmniJournalCheck {
+	uint64_t hash; /* Hash of the record header and padded payload. */
+	uint64_t pad;
+} OmniJournalCheck;
+
+typedef struct OmniJournalOp {
+	uint op;
+	uint flags;
+	float_or_uint time;
+} OmniJournalOp;
+
+typedef struct OmniJournalTrailer {
+	uint64_t footer_offset;
+	char magic[8];
+} OmniJournalTrailer;
+
+/* A record to be written. Sample data is pinned by a view until the record is written. */
+typedef struct journal_job {
+	struct journal_job *next;
+
+	JournalRecordType type;
+	OmniJournalOp op;
+
+	OmniView *view;
+	OmniSampleSerial s_sample;
+	OmniBlockSerial s_blocks[];
+} journal_job;
+
+/* Unless the journal is asynchronous, everything runs on the thread using the cache.
+ * Otherwise, the writing state is only used by the worker thread, and the queue is shared under `mutex`.
+ * Views are only ever released by the thread using the cache, as they are linked to its samples. */
+struct journal {
+	/* Writing state */
+	FILE *file;
+	uint64_t size; /* End of the last record. */
+	uint64_t hash; /* Running hash of the record being written. */
+
+	uint64_t *index; /* Offset of each record, for the footer. */
+	uint num_records;
+	uint num_records_alloc;
+
+	serial_writer writer;
+	bool failed;
+
+	/* Asynchronous writing */
+	bool async;
+	bool quit;
+	thread worker;
+	thread_mutex mutex;
+	thread_cond cond_work; /* Signaled when jobs are queued, or the worker should quit. */
+	thread_cond cond_space; /* Signaled when a job has been written. */
+
+	journal_job *queue_head;
+	journal_job *queue_tail;
+	journal_job *done; /* Written jobs, whose views are yet to be released. */
+	uint num_queued; /* Jobs queued or being written. */
+	uint max_queued;
+};
+
+/* Writing */
+
+static bool journal_write_cb(const void *data, size_t size, void *user_data)
+{
+	journal *jrnl = user_data;
+
+	jrnl->hash = hash_bytes(jrnl->hash, data, size);
+
+	return fwrite(data, 1, size, jrnl->file) == size;
+}
+
+static journal *journal_new(FILE *file)
+{
+	journal *jrnl = calloc(1, sizeof(journal));
+
+	jrnl->file = file;
+
+	jrnl->writer.buffer = malloc(SERIAL_CHUNK_SIZE);
+	jrnl->writer.write = journal_write_cb;
+	jrnl->writer.user_data = jrnl;
+
+	return jrnl;
+}
+
+static void journal_free(journal *jrnl)
+{
+	fclose(jrnl->file);
+
+	free(jrnl->writer.buffer);
+	free(jrnl->index);
+	free(jrnl);
+}
+
+static void journal_index_add(journal *jrnl, uint64_t offset)
+{
+	if (jrnl->num_records == jrnl->num_records_alloc) {
+		jrnl->num_records_alloc = min_array_size(jrnl->num_records);
+		jrnl->index = realloc(jrnl->index, sizeof(uint64_t) * jrnl->num_records_alloc);
+	}
+
+	jrnl->index[jrnl->num_records++] = offset;
+}
+
+static void journal_record_begin(journal *jrnl, JournalRecordType type, size_t size)
+{
+	OmniJournalRecord record;
+
+	memset(&record, 0, sizeof(OmniJournalRecord));
+
+	record.type = type;
+	record.size = size;
+
+	jrnl->hash = HASH_INIT;
+	jrnl->writer.size = 0;
+
+	serial_write(&jrnl->writer, &record, sizeof(OmniJournalRecord));
+}
+
+/* Write the check of the record, and push it to the OS, so it survives the process crashing. */
+static void journal_record_end(journal *jrnl)
+{
+	OmniJournalCheck check;
+
+	serial_write_align(&jrnl->writer);
+	serial_flush(&jrnl->writer);
+
+	memset(&check, 0, sizeof(OmniJournalCheck));
+	check.hash = jrnl->hash;
+
+	if (jrnl->writer.failed ||
+	    fwrite(&check, sizeof(OmniJournalCheck), 1, jrnl->file) != 1 ||
+	    fflush(jrnl->file) != 0)
+	{
+		fprintf(stderr, "OmniCache: Journal write failed, no further changes are recorded.\n");
+
+		jrnl->failed = true;
+
+		return;
+	}
+
+	jrnl->size += jrnl->writer.size + sizeof(OmniJournalCheck);
+}
+
+static void journal_job_write(journal *jrnl, const journal_job *job)
+{
+	if (jrnl->failed) {
+		return;
+	}
+
+	journal_index_add(jrnl, jrnl->size);
+
+	if (job->type == JOURNAL_RECORD_SAMPLE) {
+		serial_writer counter = {
+		    .buffer = NULL,
+		};
+
+		serialize_sample_view(&counter, &job->s_sample, job->s_blocks, job->view);
+
+		journal_record_begin(jrnl, JOURNAL_RECORD_SAMPLE, counter.size);
+		serialize_sample_view(&jrnl->writer, &job->s_sample, job->s_blocks, job->view);
+	}
+	else {
+		journal_record_begin(jrnl, JOURNAL_RECORD_OP, sizeof(OmniJournalOp));
+		serial_write(&jrnl->writer, &job->op, sizeof(OmniJournalOp));
+	}
+
+	journal_record_end(jrnl);
+}
+
+/* Release a list of written jobs. */
+static void journal_jobs_free(journal_job *job)
+{
+	while (job) {
+		journal_job *next = job->next;
+
+		if (job->view) {
+			view_release(job->view);
+		}
+
+		free(job);
+
+		job = next;
+	}
+}
+
+static void journal_worker(void *user_data)
+{
+	journal *jrnl = user_data;
+
+	mutex_lock(&jrnl->mutex);
+
+	while (true) {
+		journal_job *job;
+
+		while (!jrnl->queue_head && !jrnl->quit) {
+			cond_wait(&jrnl->cond_work, &jrnl->mutex);
+		}
+
+		/* Only quit once the queue is empty. */
+		if (!jrnl->queue_head) {
+			break;
+		}
+
+		job = jrnl->queue_head;
+		jrnl->queue_head = job->next;
+
+		if (!jrnl->queue_head) {
+			jrnl->queue_tail = NULL;
+		}
+
+		mutex_unlock(&jrnl->mutex);
+
+		journal_job_write(jrnl, job);
+
+		mutex_lock(&jrnl->mutex);
+
+		job->next = jrnl->done;
+		jrnl->done = job;
+		jrnl->num_queued--;
+
+		cond_signal(&jrnl->cond_space);
+	}
+
+	mutex_unlock(&jrnl->mutex);
+}
+
+/* Write a job, or queue it for the worker thread (blocking while the queue is full). */
+static void journal_submit(journal *jrnl, journal_job *job)
+{
+	journal_job *done;
+
+	if (!jrnl->async) {
+		journal_job_write(jrnl, job);
+		journal_jobs_free(job);
+
+		return;
+	}
+
+	job->next = NULL;
+
+	mutex_lock(&jrnl->mutex);
+
+	while (jrnl->num_queued >= jrnl->max_queued) {
+		cond_wait(&jrnl->cond_space, &jrnl->mutex);
+	}
+
+	if (jrnl->queue_tail) {
+		jrnl->queue_tail->next = job;
+	}
+	else {
+		jrnl->queue_head = job;
+	}
+
+	jrnl->queue_tail = job;
+	jrnl->num_queued++;
+
+	done = jrnl->done;
+	jrnl->done = NULL;
+
+	cond_signal(&jrnl->cond_work);
+
+	mutex_unlock(&jrnl->mutex);
+
+	journal_jobs_free(done);
+}
+
+void journal_write_sample(journal *jrnl, OmniSample *sample)
+{
+	OmniCache *cache = sample->parent;
+	OmniView *view;
+	journal_job *job;
+
+	if (!jrnl || (!jrnl->async && jrnl->failed)) {
+		return;
+	}
+
+	/* Pins the data until it is written, even if the sample is rewritten or freed in the meantime. */
+	view = view_acquire(sample);
+
+	/* Data that can't be decoded is recorded as missing, rather than leaving earlier records of the sample. */
+	if (!view) {
+		journal_write_op(jrnl, JOURNAL_OP_SAMPLE_CLEAR, 0, sample_time_get(sample));
+
+		return;
+	}
+
+	job = calloc(1, sizeof(journal_job) + sizeof(OmniBlockSerial) * cache->def.num_blocks);
+
+	job->type = JOURNAL_RECORD_SAMPLE;
+
+	serial_sample_record(sample, &job->s_sample);
+
+	for (uint i = 0; i < cache->def.num_blocks; i++) {
+		serial_block_record(sample->blocks ? &sample->blocks[i] : NULL, &job->s_blocks[i]);
+
+		/* Written from the view, which holds decoded (and private) data. */
+		job->s_blocks[i].status &= ~(OMNI_BLOCK_STATUS_ENCODED | OMNI_BLOCK_STATUS_SHARED);
+		job->s_blocks[i].csize = 0;
+	}
+
+	job->view = view;
+
+	journal_submit(jrnl, job);
+}
+
+void journal_write_op(journal *jrnl, JournalOp op, uint flags, float_or_uint time)
+{
+	journal_job *job;
+
+	if (!jrnl || (!jrnl->async && jrnl->failed)) {
+		return;
+	}
+
+	job = calloc(1, sizeof(journal_job));
+
+	job->type = JOURNAL_RECORD_OP;
+	job->op.op = op;
+	job->op.flags = flags;
+	job->op.time = time;
+
+	journal_submit(jrnl, job);
+}
+
+void journal_flush(journal *jrnl)
+{
+	journal_job *done;
+
+	if (!jrnl || !jrnl->async) {
+		return;
+	}
+
+	mutex_lock(&jrnl->mutex);
+
+	while (jrnl->num_queued > 0) {
+		cond_wait(&jrnl->cond_space, &jrnl->mutex);
+	}
+
+	done = jrnl->done;
+	jrnl->done = NULL;
+
+	mutex_unlock(&jrnl->mutex);
+
+	journal_jobs_free(done);
+}
+
+void journal_set_async(journal *jrnl, uint max_queued)
+{
+	if (!jrnl) {
+		return;
+	}
+
+	if (jrnl->async) {
+		journal_flush(jrnl);
+
+		mutex_lock(&jrnl->mutex);
+		jrnl->quit = true;
+		cond_signal(&jrnl->cond_work);
+		mutex_unlock(&jrnl->mutex);
+
+		thread_join(&jrnl->worker);
+
+		cond_free(&jrnl->cond_space);
+		cond_free(&jrnl->cond_work);
+		mutex_free(&jrnl->mutex);
+
+		jrnl->async = false;
+		jrnl->quit = false;
+	}
+
+	if (max_queued > 0) {
+		mutex_init(&jrnl->mutex);
+		cond_init(&jrnl->cond_work);
+		cond_init(&jrnl->cond_space);
+
+		jrnl->max_queued = max_queued;
+		jrnl->async = thread_create(&jrnl->worker, journal_worker, jrnl);
+
+		if (!jrnl->async) {
+			cond_free(&jrnl->cond_space);
+			cond_free(&jrnl->cond_work);
+			mutex_free(&jrnl->mutex);
+		}
+	}
+}
+
+/* Write the footer index and trailer, after which nothing can be appended. */
+static void journal_write_footer(journal *jrnl)
+{
+	OmniJournalTrailer trailer;
+
+	if (jrnl->failed) {
+		return;
+	}
+
+	memset(&trailer, 0, sizeof(OmniJournalTrailer));
+	memcpy(trailer.magic, journal_end_magic, sizeof(journal_end_magic));
+
+	trailer.footer_offset = jrnl->size;
+
+	journal_record_begin(jrnl, JOURNAL_RECORD_FOOTER, sizeof(uint64_t) * jrnl->num_records);
+	serial_write(&jrnl->writer, jrnl->index, sizeof(uint64_t) * jrnl->num_records);
+	journal_record_end(jrnl);
+
+	if (!jrnl->failed) {
+		fwrite(&trailer, sizeof(OmniJournalTrailer), 1, jrnl->file);
+	}
+}
+
+bool journal_start(OmniCache *cache, const char *path)
+{
+	OmniJournalHeader header;
+	journal *jrnl;
+	FILE *file;
+
+	journal_stop(cache);
+
+	file = fopen(path, "wb");
+
+	if (!file) {
+		fprintf(stderr, "OmniCache: Failed to create journal \"%s\".\n", path);
+
+		return false;
+	}
+
+	jrnl = journal_new(file);
+
+	memset(&header, 0, sizeof(OmniJournalHeader));
+	memcpy(header.magic, journal_magic, sizeof(journal_magic));
+
+	header.version = JOURNAL_VERSION;
+
+	serial_write(&jrnl->writer, &header, sizeof(OmniJournalHeader));
+	serialize_def(&jrnl->writer, cache, false);
+	serial_write_align(&jrnl->writer);
+	serial_flush(&jrnl->writer);
+
+	jrnl->size = jrnl->writer.size;
+
+	if (jrnl->writer.failed) {
+		fprintf(stderr, "OmniCache: Failed to create journal \"%s\".\n", path);
+
+		journal_free(jrnl);
+
+		return false;
+	}
+
+	/* The journal starts with the current state of the cache. */
+	for (OmniSample *root = SAMPLE_FIRST(cache); root; root = sample_root_next(cache, root->tindex + 1)) {
+		if (!SAMPLE_IS_SKIPPED(root)) {
+			journal_write_sample(jrnl, root);
+		}
+
+		for (uint i = 0; i < root->num_subs; i++) {
+			journal_write_sample(jrnl, root->subs[i].sample);
+		}
+	}
+
+	cache->journal = jrnl;
+
+	return !jrnl->failed;
+}
+
+void journal_stop(OmniCache *cache)
+{
+	if (cache->journal) {
+		journal_set_async(cache->journal, 0);
+		journal_write_footer(cache->journal);
+		journal_free(cache->journal);
+
+		cache->journal = NULL;
+	}
+}
+
+/* Replay */
+
+static size_t journal_read_cb(void *data, size_t size, void *user_data)
+{
+	return fread(data, 1, size, user_data);
+}
+
+/* Read and check the record at the current position of the file.
+ * Returns the payload (padded to `SERIAL_ALIGN`), or NULL if the record is incomplete or corrupt. */
+static char *journal_record_read(FILE *file, uint64_t offset, uint64_t file_size, OmniJournalRecord *r_record)
+{
+	OmniJournalCheck check;
+	uint64_t hash;
+	size_t size;
+	char *payload;
+
+	if (file_size - offset < sizeof(OmniJournalRecord) + sizeof(OmniJournalCheck) ||
+	    fread(r_record, sizeof(OmniJournalRecord), 1, file) != 1)
+	{
+		return NULL;
+	}
+
+	if (r_record->size > file_size - offset - sizeof(OmniJournalRecord) - sizeof(OmniJournalCheck)) {
+		return NULL;
+	}
+
+	size = ALIGN_UP((size_t)r_record->size, SERIAL_ALIGN);
+	payload = malloc(MAX(size, 1));
+
+	if (fread(payload, 1, size, file) != size ||
+	    fread(&check, sizeof(OmniJournalCheck), 1, file) != 1)
+	{
+		free(payload);
+
+		return NULL;
+	}
+
+	hash = hash_bytes(HASH_INIT, r_record, sizeof(OmniJournalRecord));
+	hash = hash_bytes(hash, payload, size);
+
+	if (hash != check.hash) {
+		free(payload);
+
+		return NULL;
+	}
+
+	return payload;
+}
+
+static void journal_replay_op(OmniCache *cache, const OmniJournalOp *j_op)
+{
+	switch (j_op->op) {
+		case JOURNAL_OP_MARK_OUTDATED:
+			OMNI_mark_outdated(cache);
+			break;
+		case JOURNAL_OP_MARK_INVALID:
+			OMNI_mark_invalid(cache);
+			break;
+		case JOURNAL_OP_CLEAR:
+			OMNI_clear(cache);
+			break;
+		case JOURNAL_OP_CONSOLIDATE:
+			OMNI_consolidate(cache, j_op->flags);
+			break;
+		case JOURNAL_OP_SAMPLE_MARK_OUTDATED:
+			OMNI_sample_mark_outdated(cache, j_op->time);
+			break;
+		case JOURNAL_OP_SAMPLE_MARK_INVALID:
+			OMNI_sample_mark_invalid(cache, j_op->time);
+			break;
+		case JOURNAL_OP_SAMPLE_CLEAR:
+			OMNI_sample_clear(cache, j_op->time);
+			break;
+		case JOURNAL_OP_SAMPLE_MARK_OUTDATED_FROM:
+			OMNI_sample_mark_outdated_from(cache, j_op->time);
+			break;
+		case JOURNAL_OP_SAMPLE_MARK_INVALID_FROM:
+			OMNI_sample_mark_invalid_from(cache, j_op->time);
+			break;
+		case JOURNAL_OP_SAMPLE_CLEAR_FROM:
+			OMNI_sample_clear_from(cache, j_op->time);
+			break;
+		case JOURNAL_OP_MOVE_START:
+			OMNI_move_start(cache, j_op->time);
+			break;
+		case JOURNAL_OP_MOVE_END:
+			OMNI_move_end(cache, j_op->time);
+			break;
+	}
+}
+
+/* Find the footer index of a cleanly closed journal.
+ * Returns the number of records (and their offsets in `r_index`), or -1 if there is no valid footer. */
+static int journal_footer_read(FILE *file, uint64_t data_offset, uint64_t file_size, uint64_t **r_index)
+{
+	OmniJournalTrailer trailer;
+	OmniJournalRecord record;
+	char *payload;
+	uint num_records;
+
+	if (file_size < data_offset + sizeof(OmniJournalTrailer) ||
+	    file_seek(file, file_size - sizeof(OmniJournalTrailer)) != 0 ||
+	    fread(&trailer, sizeof(OmniJournalTrailer), 1, file) != 1 ||
+	    memcmp(trailer.magic, journal_end_magic, sizeof(journal_end_magic)) != 0 ||
+	    trailer.footer_offset < data_offset ||
+	    trailer.footer_offset > file_size - sizeof(OmniJournalTrailer) ||
+	    file_seek(file, trailer.footer_offset) != 0)
+	{
+		return -1;
+	}
+
+	payload = journal_record_read(file, trailer.footer_offset, file_size - sizeof(OmniJournalTrailer), &record);
+
+	if (!payload) {
+		return -1;
+	}
+
+	if (record.type != JOURNAL_RECORD_FOOTER || record.size % sizeof(uint64_t)) {
+		free(payload);
+
+		return -1;
+	}
+
+	num_records = (uint)(record.size / sizeof(uint64_t));
+
+	/* Records are in file order, all before the footer. */
+	for (uint i = 0; i < num_records; i++) {
+		uint64_t offset = ((uint64_t *)payload)[i];
+
+		if (offset < (i ? ((uint64_t *)payload)[i - 1] + sizeof(OmniJournalRecord) : data_offset) ||
+		    offset >= trailer.footer_offset)
+		{
+			free(payload);
+
+			return -1;
+		}
+	}
+
+	*r_index = (uint64_t *)payload;
+
+	return (int)num_records;
+}
+
+OmniCache *journal_resume(const char *path, const OmniCacheTemplate *cache_temp)
+{
+	FILE *file = fopen(path, "r+b");
+	OmniJournalHeader header;
+	OmniBlockSerial *s_blocks;
+	OmniCache *cache;
+	journal *jrnl;
+	uint64_t *index = NULL;
+	uint64_t file_size;
+	uint num_samples;
+	uint64_t offset;
+	int num_indexed;
+
+	if (!file) {
+		fprintf(stderr, "OmniCache: Failed to open journal \"%s\".\n", path);
+
+		return NULL;
+	}
+
+	if (fread(&header, sizeof(OmniJournalHeader), 1, file) != 1 ||
+	    memcmp(header.magic, journal_magic, sizeof(journal_magic)) != 0 ||
+	    header.version != JOURNAL_VERSION)
+	{
+		fprintf(stderr, "OmniCache: Invalid journal \"%s\".\n", path);
+
+		fclose(file);
+
+		return NULL;
+	}
+
+	{
+		serial_reader reader = {
+		    .read = journal_read_cb,
+		    .user_data = file,
+		};
+
+		cache = deserialize_def(&reader, cache_temp, &num_samples);
+
+		if (!cache || reader.failed) {
+			fprintf(stderr, "OmniCache: Invalid journal \"%s\".\n", path);
+
+			if (cache) {
+				OMNI_free(cache);
+			}
+
+			fclose(file);
+
+			return NULL;
+		}
+
+		offset = ALIGN_UP(sizeof(OmniJournalHeader) + reader.pos, SERIAL_ALIGN);
+	}
+
+	file_seek_end(file);
+	file_size = file_tell(file);
+
+	jrnl = journal_new(file);
+
+	/* Replay the records listed in the footer index, or all complete records if there is none. */
+	num_indexed = journal_footer_read(file, offset, file_size, &index);
+	s_blocks = malloc(sizeof(OmniBlockSerial) * MAX(cache->def.num_blocks, 1));
+
+	for (uint i = 0; num_indexed < 0 || i < (uint)num_indexed; i++) {
+		OmniJournalRecord record;
+		char *payload;
+
+		if (num_indexed >= 0) {
+			offset = index[i];
+		}
+
+		if (file_seek(file, offset) != 0) {
+			break;
+		}
+
+		payload = journal_record_read(file, offset, file_size, &record);
+
+		if (!payload) {
+			break;
+		}
+
+		if (record.type == JOURNAL_RECORD_SAMPLE) {
+			serial_reader reader = {
+			    .buffer = payload,
+			};
+
+			deserialize_sample(&reader, cache, s_blocks);
+			deserialize_shared_free(&reader);
+		}
+		else if (record.type == JOURNAL_RECORD_OP && record.size == sizeof(OmniJournalOp)) {
+			journal_replay_op(cache, (OmniJournalOp *)payload);
+		}
+		else {
+			free(payload);
+
+			break;
+		}
+
+		free(payload);
+
+		journal_index_add(jrnl, offset);
+
+		offset += sizeof(OmniJournalRecord) + ALIGN_UP(record.size, SERIAL_ALIGN) + sizeof(OmniJournalCheck);
+	}
+
+	free(s_blocks);
+	free(index);
+
+	/* Drop the footer and anything after the last complete record, to append from there. */
+	jrnl->size = offset;
+
+	if (fflush(file) != 0 || file_truncate(file, offset) != 0 || file_seek(file, offset) != 0) {
+		fprintf(stderr, "OmniCache: Failed to reopen journal \"%s\" for writing.\n", path);
+
+		jrnl->failed = true;
+	}
+
+	cache->journal = jrnl;
+
+	return cache;
+}
@@ -0,0 +1,37 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#ifndef __OMNI_OMNI_JOURNAL_H__
+#define __OMNI_OMNI_JOURNAL_H__
+
+#include "omni_types.h"
+
+/* Operations recorded in journals (besides sample writes), replayed through the public API. */
+typedef enum JournalOp {
+	JOURNAL_OP_MARK_OUTDATED = 0,
+	JOURNAL_OP_MARK_INVALID,
+	JOURNAL_OP_CLEAR,
+	JOURNAL_OP_CONSOLIDATE,
+	JOURNAL_OP_SAMPLE_MARK_OUTDATED,
+	JOURNAL_OP_SAMPLE_MARK_INVALID,
+	JOURNAL_OP_SAMPLE_CLEAR,
+	JOURNAL_OP_SAMPLE_MARK_OUTDATED_FROM,
+	JOURNAL_OP_SAMPLE_MARK_INVALID_FROM,
+	JOURNAL_OP_SAMPLE_CLEAR_FROM,
+	JOURNAL_OP_MOVE_START,
+	JOURNAL_OP_MOVE_END,
+} JournalOp;
+
+bool journal_start(OmniCache *cache, const char *path);
+OmniCache *journal_resume(const char *path, const OmniCacheTemplate *cache_temp);
+void journal_stop(OmniCache *cache);
+
+/* These do nothing if `jrnl` is NULL. */
+void journal_write_sample(journal *jrnl, OmniSample *sample);
+void journal_write_op(journal *jrnl, JournalOp op, uint flags, float_or_uint time);
+
+void journal_set_async(journal *jrnl, uint max_queued);
+void journal_flush(journal *jrnl);
+
+#endif /* __OMNI_OMNI_JOURNAL_H__ */
@@ -0,0 +1,279 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include "omni_load.h"
+
+#include "omni_utils.h"
+#include "omni_view.h"
+#include "thread.h"
+
+/* Asynchronous loads page in the data that samples borrow from a cache file (see `OMNI_file_open`)
+ * or a spill file (see `omni_budget.c`).
+ * Kernel readahead is started for all the requested samples on submission, and loader threads then touch
+ * their data, blocking on page faults instead of the caller. In-memory data is already loaded.
+ * The requested samples are pinned by views, released (by the thread using the cache) with the load. */
+
+typedef struct load_job {
+	struct load_job *next;
+
+	OmniLoad *load;
+	uint index;
+} load_job;
+
+struct OmniLoad {
+	OmniLoadCallback callback;
+	void *user_data;
+
+	thread_mutex mutex;
+	thread_cond cond_done;
+	uint num_done;
+
+	uint num_views;
+	OmniView *views[];
+};
+
+struct loader {
+	thread workers[LOAD_THREADS];
+	uint num_workers;
+
+	thread_mutex mutex;
+	thread_cond cond_work;
+	load_job *queue_head;
+	load_job *queue_tail;
+	bool quit;
+};
+
+static void load_job_run(const load_job *job)
+{
+	OmniLoad *load = job->load;
+	const OmniView *view = load->views[job->index];
+
+	if (view && view->map) {
+		mapping_load(view->map, view->meta, view->meta ? view->msize : 0);
+
+		for (uint i = 0; i < view->num_blocks; i++) {
+			mapping_load(view->map, view->blocks[i].data, (size_t)view->blocks[i].dsize * view->blocks[i].dcount);
+		}
+	}
+
+	if (load->callback) {
+		load->callback(load, job->index, view != NULL, load->user_data);
+	}
+
+	mutex_lock(&load->mutex);
+
+	load->num_done++;
+	cond_broadcast(&load->cond_done);
+
+	mutex_unlock(&load->mutex);
+}
+
+static void loader_worker(void *user_data)
+{
+	loader *ldr = user_data;
+
+	mutex_lock(&ldr->mutex);
+
+	while (true) {
+		load_job *job;
+
+		while (!ldr->queue_head && !ldr->quit) {
+			cond_wait(&ldr->cond_work, &ldr->mutex);
+		}
+
+		/* Only quit once the queue is empty. */
+		if (!ldr->queue_head) {
+			break;
+		}
+
+		job = ldr->queue_head;
+		ldr->queue_head = job->next;
+
+		if (!ldr->queue_head) {
+			ldr->queue_tail = NULL;
+		}
+
+		mutex_unlock(&ldr->mutex);
+
+		load_job_run(job);
+		free(job);
+
+		mutex_lock(&ldr->mutex);
+	}
+
+	mutex_unlock(&ldr->mutex);
+}
+
+static loader *loader_get(OmniCache *cache)
+{
+	loader *ldr = cache->loader;
+
+	if (ldr) {
+		return ldr;
+	}
+
+	ldr = calloc(1, sizeof(loader));
+
+	mutex_init(&ldr->mutex);
+	cond_init(&ldr->cond_work);
+
+	for (uint i = 0; i < LOAD_THREADS; i++) {
+		if (thread_create(&ldr->workers[ldr->num_workers], loader_worker, ldr)) {
+			ldr->num_workers++;
+		}
+	}
+
+	cache->loader = ldr;
+
+	return ldr;
+}
+
+/* Wait for all queued jobs to finish, and stop the loader threads. */
+void loader_free(OmniCache *cache)
+{
+	loader *ldr = cache->loader;
+
+	if (!ldr) {
+		return;
+	}
+
+	mutex_lock(&ldr->mutex);
+	ldr->quit = true;
+	cond_broadcast(&ldr->cond_work);
+	mutex_unlock(&ldr->mutex);
+
+	for (uint i = 0; i < ldr->num_workers; i++) {
+		thread_join(&ldr->workers[i]);
+	}
+
+	cond_free(&ldr->cond_work);
+	mutex_free(&ldr->mutex);
+
+	free(ldr);
+
+	cache->loader = NULL;
+}
+
+/* Start loading the data pinned by `views` (NULL entries for samples that can't be loaded). */
+OmniLoad *load_submit(OmniCache *cache, OmniView **views, uint num_views, OmniLoadCallback callback, void *user_data)
+{
+	OmniLoad *load = calloc(1, sizeof(OmniLoad) + sizeof(OmniView *) * num_views);
+	loader *ldr = loader_get(cache);
+	load_job *head = NULL;
+	load_job *tail = NULL;
+
+	load->callback = callback;
+	load->user_data = user_data;
+	load->num_views = num_views;
+
+	memcpy(load->views, views, sizeof(OmniView *) * num_views);
+
+	mutex_init(&load->mutex);
+	cond_init(&load->cond_done);
+
+	for (uint i = 0; i < num_views; i++) {
+		load_job *job = malloc(sizeof(load_job));
+
+		job->next = NULL;
+		job->load = load;
+		job->index = i;
+
+		if (tail) {
+			tail->next = job;
+		}
+		else {
+			head = job;
+		}
+
+		tail = job;
+
+		/* Get all reads in flight right away. */
+		if (views[i] && views[i]->map) {
+			const OmniView *view = views[i];
+
+			if (view->meta) {
+				mapping_prefetch(view->map, view->meta, view->msize);
+			}
+
+			for (uint j = 0; j < view->num_blocks; j++) {
+				mapping_prefetch(view->map, view->blocks[j].data, (size_t)view->blocks[j].dsize * view->blocks[j].dcount);
+			}
+		}
+	}
+
+	if (!ldr->num_workers) {
+		/* No threads available, load synchronously. */
+		while (head) {
+			load_job *next = head->next;
+
+			load_job_run(head);
+			free(head);
+
+			head = next;
+		}
+
+		return load;
+	}
+
+	if (head) {
+		mutex_lock(&ldr->mutex);
+
+		if (ldr->queue_tail) {
+			ldr->queue_tail->next = head;
+		}
+		else {
+			ldr->queue_head = head;
+		}
+
+		ldr->queue_tail = tail;
+
+		cond_broadcast(&ldr->cond_work);
+		mutex_unlock(&ldr->mutex);
+	}
+
+	return load;
+}
+
+uint load_poll(OmniLoad *load)
+{
+	uint num_done;
+
+	mutex_lock(&load->mutex);
+	num_done = load->num_done;
+	mutex_unlock(&load->mutex);
+
+	return num_done;
+}
+
+uint load_num_samples(const OmniLoad *load)
+{
+	return load->num_views;
+}
+
+void load_wait(OmniLoad *load)
+{
+	mutex_lock(&load->mutex);
+
+	while (load->num_done < load->num_views) {
+		cond_wait(&load->cond_done, &load->mutex);
+	}
+
+	mutex_unlock(&load->mutex);
+}
+
+void load_release(OmniLoad *load)
+{
+	load_wait(load);
+
+	for (uint i = 0; i < load->num_views; i++) {
+		if (load->views[i]) {
+			view_release(load->views[i]);
+		}
+	}
+
+	cond_free(&load->cond_done);
+	mutex_free(&load->mutex);
+
+	free(load);
+}
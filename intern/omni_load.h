@@ -0,0 +1,21 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#ifndef __OMNI_OMNI_LOAD_H__
+#define __OMNI_OMNI_LOAD_H__
+
+#include "omni_types.h"
+
+/* Number of threads paging sample data in for asynchronous loads. */
+#define LOAD_THREADS 4
+
+OmniLoad *load_submit(OmniCache *cache, OmniView **views, uint num_views, OmniLoadCallback callback, void *user_data);
+uint load_poll(OmniLoad *load);
+uint load_num_samples(const OmniLoad *load);
+void load_wait(OmniLoad *load);
+void load_release(OmniLoad *load);
+
+void loader_free(OmniCache *cache);
+
+#endif /* __OMNI_OMNI_LOAD_H__ */
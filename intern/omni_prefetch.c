@@ -0,0 +1,262 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include "omni_prefetch.h"
+
+#include "omni_budget.h"
+#include "omni_load.h"
+#include "omni_utils.h"
+
+/* The prefetcher follows the reads of a cache. Once consecutive reads move by the same step in the same
+ * direction (playback, or steady scrubbing), the next samples along that step are loaded asynchronously
+ * (see `OMNI_load_submit`), within a window of samples and bytes. A new window is loaded once half of the
+ * previous one has been read and loaded, or once it has been read entirely. */
+
+/* Consecutive reads with a matching step needed before prefetching. */
+#define PREFETCH_MIN_STREAK 2
+
+/* Tolerance (relative to the step) when matching steps and sample times. */
+#define PREFETCH_STEP_EPSILON 1e-3f
+
+struct prefetcher {
+	uint max_samples;
+	size_t max_bytes;
+
+	/* Access pattern */
+	bool has_last;
+	float last;
+	float step;
+	bool forward;
+	uint streak;
+
+	/* Current window */
+	OmniLoad *load;
+	uint num_loaded;
+	uint num_ahead; /* Loaded samples not read yet (assuming reads keep following the step). */
+
+	/* Windows left behind when the pattern changed, released once loaded. */
+	OmniLoad **retired;
+	uint num_retired;
+};
+
+static void prefetch_retire(prefetcher *pf)
+{
+	if (pf->load) {
+		pf->retired = realloc(pf->retired, sizeof(OmniLoad *) * (pf->num_retired + 1));
+		pf->retired[pf->num_retired++] = pf->load;
+
+		pf->load = NULL;
+		pf->num_ahead = 0;
+	}
+}
+
+/* Release retired loads that completed (without waiting for the others). */
+static void prefetch_release_retired(prefetcher *pf)
+{
+	uint num = 0;
+
+	for (uint i = 0; i < pf->num_retired; i++) {
+		OmniLoad *load = pf->retired[i];
+
+		if (load_poll(load) == load_num_samples(load)) {
+			load_release(load);
+		}
+		else {
+			pf->retired[num++] = load;
+		}
+	}
+
+	pf->num_retired = num;
+}
+
+/* Sample at `time`, or the closest one before it (possibly skipped), or NULL. */
+static OmniSample *prefetch_sample_at(OmniCache *cache, float_or_uint time)
+{
+	sample_time stime = gen_sample_time(cache, time);
+	OmniSample *root = NULL;
+	uint pos;
+
+	if (!TTYPE_VALID(stime.ttype)) {
+		return NULL;
+	}
+
+	if (stime.index < cache->def.num_samples_array) {
+		root = sample_root_get(cache, stime.index, false);
+	}
+
+	if (!root) {
+		return sample_last_before(cache, stime.index);
+	}
+
+	pos = sample_sub_search(root, stime.offset);
+
+	if (pos < root->num_subs && FU_EQ(root->subs[pos].toffset, stime.offset)) {
+		return root->subs[pos].sample;
+	}
+
+	return pos > 0 ? root->subs[pos - 1].sample : root;
+}
+
+static size_t prefetch_sample_size(const OmniSample *sample)
+{
+	const OmniCache *cache = sample->parent;
+	size_t size = META_IS_VALID(sample) ? cache->def.msize : 0;
+
+	for (uint i = 0; i < cache->def.num_blocks; i++) {
+		size += block_data_size(&cache->block_index[i], &sample->blocks[i]);
+	}
+
+	return size;
+}
+
+/* Load the window of samples following `time` along the access pattern. */
+static void prefetch_window(OmniCache *cache, prefetcher *pf, float_or_uint time)
+{
+	OmniSample *sample = prefetch_sample_at(cache, time);
+	float_or_uint *times = malloc(sizeof(float_or_uint) * pf->max_samples);
+	float next = pf->last + (pf->forward ? pf->step : -pf->step);
+	float epsilon = pf->step * PREFETCH_STEP_EPSILON;
+	size_t bytes = 0;
+	uint num = 0;
+
+	/* Reads before the first sample start from it. */
+	if (!sample && pf->forward) {
+		sample = SAMPLE_FIRST(cache);
+	}
+
+	while (sample && num < pf->max_samples) {
+		float stime = fu_float(sample_time_get(sample));
+
+		if (SAMPLE_IS_VALID(sample) &&
+		    (pf->forward ? (stime >= next - epsilon) : (stime <= next + epsilon)))
+		{
+			size_t size = prefetch_sample_size(sample);
+
+			if (pf->max_bytes && bytes + size > pf->max_bytes) {
+				break;
+			}
+
+			bytes += size;
+			times[num++] = sample_time_get(sample);
+
+			next = stime + (pf->forward ? pf->step : -pf->step);
+		}
+
+		sample = pf->forward ? sample_next(sample) : sample_prev(sample);
+	}
+
+	if (num > 0) {
+		pf->load = OMNI_load_submit(cache, times, num, NULL, NULL);
+		pf->num_loaded = num;
+		pf->num_ahead = num;
+	}
+
+	free(times);
+}
+
+void prefetch_access(OmniCache *cache, float_or_uint time)
+{
+	prefetcher *pf = cache->prefetch;
+	float t = fu_float(time);
+	bool forward;
+	float step;
+
+	/* In-memory data needs no loading. */
+	if (!pf || !(cache->map || budget_spills(cache))) {
+		return;
+	}
+
+	prefetch_release_retired(pf);
+
+	if (!pf->has_last) {
+		pf->has_last = true;
+		pf->last = t;
+
+		return;
+	}
+
+	forward = (t > pf->last);
+	step = forward ? (t - pf->last) : (pf->last - t);
+
+	/* Repeated reads of the same time don't affect the pattern. */
+	if (step == 0.0f) {
+		return;
+	}
+
+	if (forward == pf->forward && fabsf(step - pf->step) <= pf->step * PREFETCH_STEP_EPSILON) {
+		pf->streak++;
+
+		if (pf->num_ahead > 0) {
+			pf->num_ahead--;
+		}
+	}
+	else {
+		prefetch_retire(pf);
+
+		pf->forward = forward;
+		pf->step = step;
+		pf->streak = 1;
+	}
+
+	pf->last = t;
+
+	if (pf->streak < PREFETCH_MIN_STREAK) {
+		return;
+	}
+
+	if (pf->load) {
+		bool done = (load_poll(pf->load) == pf->num_loaded);
+
+		/* Reads that overtook the window move on without it. */
+		if (pf->num_ahead > pf->num_loaded / 2 || (!done && pf->num_ahead > 0)) {
+			return;
+		}
+
+		if (done) {
+			load_release(pf->load);
+			pf->load = NULL;
+		}
+		else {
+			prefetch_retire(pf);
+		}
+	}
+
+	prefetch_window(cache, pf, time);
+}
+
+/* Configure prefetching (0 samples to disable). */
+void prefetch_set(OmniCache *cache, uint max_samples, size_t max_bytes)
+{
+	prefetch_free(cache);
+
+	if (max_samples > 0) {
+		prefetcher *pf = calloc(1, sizeof(prefetcher));
+
+		pf->max_samples = max_samples;
+		pf->max_bytes = max_bytes;
+
+		cache->prefetch = pf;
+	}
+}
+
+/* Release all prefetched samples (waiting for loads in flight). */
+void prefetch_free(OmniCache *cache)
+{
+	prefetcher *pf = cache->prefetch;
+
+	if (!pf) {
+		return;
+	}
+
+	prefetch_retire(pf);
+
+	for (uint i = 0; i < pf->num_retired; i++) {
+		load_release(pf->retired[i]);
+	}
+
+	free(pf->retired);
+	free(pf);
+
+	cache->prefetch = NULL;
+}
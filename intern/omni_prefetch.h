@@ -0,0 +1,14 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#ifndef __OMNI_OMNI_PREFETCH_H__
+#define __OMNI_OMNI_PREFETCH_H__
+
+#include "omni_types.h"
+
+void prefetch_set(OmniCache *cache, uint max_samples, size_t max_bytes);
+void prefetch_access(OmniCache *cache, float_or_uint time);
+void prefetch_free(OmniCache *cache);
+
+#endif /* __OMNI_OMNI_PREFETCH_H__ */
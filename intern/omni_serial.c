@@ -4,76 +4,553 @@
 
 #include "omni_serial.h"
 
+#include <stdint.h>
+
 #include "omnicache.h"
+#include "omni_codec.h"
+#include "omni_dedup.h"
 #include "omni_utils.h"
 
+/* Serialized layout:
+ * - `OmniCacheDef`;
+ * - `OmniBlockInfoDef` for each block;
+ * - If data is serialized, a record for each initialized sample (`OmniCacheDef.num_samples_tot`),
+ *   ordered by time (root sample first, then its list samples), laid out as:
+ *   - `OmniSampleSerial`, followed by `OmniBlockSerial` for each block;
+ *   - The metadata, if valid;
+ *   - The data of each valid block (as encoded by the block codec if `OmniBlockSerial.csize` is set,
+ *     against the previous block holding data if `OMNI_BLOCK_STATUS_DELTA` is set,
+ *     and quantized if `OMNI_BLOCK_STATUS_QUANTIZED` is set).
+ *     With `OMNI_BLOCK_STATUS_SHARED`, the data is preceded by its number among shared data (a `uint`, aligned),
+ *     and only follows the first time, later blocks sharing it only having the number.
+ *   Sample records, metadata and block data are aligned to `SERIAL_ALIGN` (relative to the start). */
+
+/* Status flags preserved by serialization (runtime flags are dropped). */
+#define SERIAL_STATUS_MASK (OMNI_STATUS_INITED | OMNI_STATUS_VALID | OMNI_STATUS_CURRENT)
+#define SERIAL_BLOCK_STATUS_MASK (SERIAL_STATUS_MASK | OMNI_BLOCK_STATUS_DELTA | OMNI_BLOCK_STATUS_QUANTIZED | \
+                                  OMNI_BLOCK_STATUS_SHARED)
+
+static const char serial_zeros[SERIAL_ALIGN] = {0};
+
+/* Writer */
+
+/* Pass the data gathered in the chunk buffer to the write callback. */
+void serial_flush(serial_writer *writer)
+{
+	if (writer->chunk_used && !writer->failed) {
+		writer->failed = !writer->write(writer->buffer, writer->chunk_used, writer->user_data);
+	}
+
+	writer->chunk_used = 0;
+}
+
+static void serial_stream_write(serial_writer *writer, const char *data, size_t size)
+{
+	if (writer->chunk_used + size > SERIAL_CHUNK_SIZE) {
+		serial_flush(writer);
+	}
+
+	if (size < SERIAL_CHUNK_SIZE) {
+		memcpy(writer->buffer + writer->chunk_used, data, size);
+		writer->chunk_used += size;
+
+		return;
+	}
+
+	/* Large data is passed directly, without going through the chunk buffer. */
+	while (size > 0 && !writer->failed) {
+		size_t chunk = MIN(size, SERIAL_CHUNK_SIZE);
+
+		writer->failed = !writer->write(data, chunk, writer->user_data);
+
+		data += chunk;
+		size -= chunk;
+	}
+}
+
+void serial_write(serial_writer *writer, const void *data, size_t size)
+{
+	if (writer->write) {
+		serial_stream_write(writer, data, size);
+	}
+	else if (writer->buffer) {
+		memcpy(writer->buffer + writer->size, data, size);
+	}
+
+	writer->size += size;
+}
+
+void serial_write_align(serial_writer *writer)
+{
+	serial_write(writer, serial_zeros, ALIGN_UP(writer->size, SERIAL_ALIGN) - writer->size);
+}
+
+/* Write zeros up to `offset`. */
+void serial_write_pad(serial_writer *writer, size_t offset)
+{
+	while (writer->size < offset) {
+		serial_write(writer, serial_zeros, MIN(offset - writer->size, SERIAL_ALIGN));
+	}
+}
+
+/* Reader */
+
+/* Read exactly `size` bytes from the read callback, in chunks of at most `SERIAL_CHUNK_SIZE`.
+ * Data is zeroed once reading fails. */
+static void serial_stream_read(serial_reader *reader, char *data, size_t size)
+{
+	while (size > 0 && !reader->failed) {
+		size_t read = reader->read(data, MIN(size, SERIAL_CHUNK_SIZE), reader->user_data);
+
+		if (read == 0) {
+			reader->failed = true;
+		}
+
+		data += read;
+		size -= read;
+	}
+
+	memset(data, 0, size);
+}
+
+static void serial_read(serial_reader *reader, void *data, size_t size)
+{
+	if (reader->read) {
+		serial_stream_read(reader, data, size);
+	}
+	else {
+		memcpy(data, reader->buffer + reader->pos, size);
+	}
+
+	reader->pos += size;
+}
+
+/* Get a pointer to the next `size` bytes of the input buffer.
+ * The data is never written to (see `OMNI_BLOCK_STATUS_BORROWED`), despite the pointer not being const. */
+static void *serial_borrow(serial_reader *reader, size_t size)
+{
+	void *data = (void *)(uintptr_t)(reader->buffer + reader->pos);
 
-#define INCREMENT_SERIAL() s = (OmniSerial *)(++temp)
+	assert(reader->borrow && reader->buffer);
+
+	reader->pos += size;
+
+	return data;
+}
 
-uint serial_calc_size(const OmniCache *cache, bool UNUSED(serialize_data))
+static void serial_read_align(serial_reader *reader)
 {
-	return sizeof(OmniCacheDef) + (sizeof(OmniBlockInfoDef) * cache->def.num_blocks);
+	char pad[SERIAL_ALIGN];
+
+	serial_read(reader, pad, ALIGN_UP(reader->pos, SERIAL_ALIGN) - reader->pos);
 }
 
-/* TODO: Data serialization. */
-void serialize(OmniSerial *serial, const OmniCache *cache, bool UNUSED(serialize_data))
+/* Serialization */
+
+/* Fill the record describing a sample. */
+void serial_sample_record(const OmniSample *sample, OmniSampleSerial *s_sample)
 {
-	OmniSerial *s = serial;
+	memset(s_sample, 0, sizeof(OmniSampleSerial));
 
+	s_sample->tindex = sample->tindex;
+	s_sample->toffset = sample->toffset;
+	s_sample->status = sample->status & SERIAL_STATUS_MASK;
+
+	if (META_IS_VALID(sample)) {
+		s_sample->meta_status = sample->meta.status & SERIAL_STATUS_MASK;
+	}
+}
+
+/* Fill the record describing a block (NULL if the sample has no blocks). */
+void serial_block_record(const OmniBlock *block, OmniBlockSerial *s_block)
+{
+	memset(s_block, 0, sizeof(OmniBlockSerial));
+
+	if (IS_VALID(block)) {
+		s_block->status = block->status & SERIAL_BLOCK_STATUS_MASK;
+		s_block->dcount = block->dcount;
+		s_block->csize = block->csize;
+	}
+}
+
+void serialize_sample(serial_writer *writer, const OmniSample *sample)
+{
+	const OmniCache *cache = sample->parent;
+	OmniSampleSerial s_sample;
+
+	serial_sample_record(sample, &s_sample);
+
+	serial_write_align(writer);
+	serial_write(writer, &s_sample, sizeof(OmniSampleSerial));
+
+	for (uint i = 0; i < cache->def.num_blocks; i++) {
+		OmniBlockSerial s_block;
+
+		serial_block_record(sample->blocks ? &sample->blocks[i] : NULL, &s_block);
+		serial_write(writer, &s_block, sizeof(OmniBlockSerial));
+	}
+
+	if (META_IS_VALID(sample)) {
+		serial_write_align(writer);
+		serial_write(writer, sample->meta.data, cache->def.msize);
+	}
+
+	for (uint i = 0; i < cache->def.num_blocks; i++) {
+		const OmniBlock *block = sample->blocks ? &sample->blocks[i] : NULL;
+
+		if (!IS_VALID(block)) {
+			continue;
+		}
+
+		if (block->status & OMNI_BLOCK_STATUS_SHARED) {
+			uint *number = &writer->shared[dedup_entry_index(block->data)];
+			bool written = (*number != 0);
+			uint shared_index;
+
+			if (!written) {
+				*number = ++writer->num_shared;
+			}
+
+			shared_index = *number - 1;
+
+			serial_write_align(writer);
+			serial_write(writer, &shared_index, sizeof(uint));
+
+			if (written) {
+				continue;
+			}
+		}
+
+		serial_write_align(writer);
+		serial_write(writer, block->data, block_data_size(&cache->block_index[i], block));
+	}
+}
+
+/* Same as `serialize_sample`, from previously filled records and the data pinned by a view of the sample.
+ * Only reads the records and view, so can run concurrently with changes to the cache.
+ * Views hold decoded data, so `OmniBlockSerial.csize` must be 0, and no `OMNI_BLOCK_STATUS_ENCODED` flag set. */
+void serialize_sample_view(serial_writer *writer, const OmniSampleSerial *s_sample, const OmniBlockSerial *s_blocks,
+                           const OmniView *view)
+{
+	serial_write_align(writer);
+	serial_write(writer, s_sample, sizeof(OmniSampleSerial));
+	serial_write(writer, s_blocks, sizeof(OmniBlockSerial) * view->num_blocks);
+
+	if (s_sample->meta_status & OMNI_STATUS_VALID) {
+		serial_write_align(writer);
+		serial_write(writer, view->meta, view->msize);
+	}
+
+	for (uint i = 0; i < view->num_blocks; i++) {
+		if (s_blocks[i].status & OMNI_STATUS_VALID) {
+			serial_write_align(writer);
+			serial_write(writer, view->blocks[i].data, (size_t)view->blocks[i].dsize * s_blocks[i].dcount);
+		}
+	}
+}
+
+/* Write the cache definition and block index. */
+void serialize_def(serial_writer *writer, const OmniCache *cache, bool serialize_data)
+{
 	/* cache */
 	{
-		OmniCacheDef *temp = (OmniCacheDef *)s;
+		OmniCacheDef def;
 
-		memcpy(temp, cache, sizeof(OmniCacheDef));
+		memcpy(&def, &cache->def, sizeof(OmniCacheDef));
 
-		/* TODO: Respect serialize_data. */
-		temp->num_samples_array = 0;
-		temp->num_samples_tot = 0;
+		if (!serialize_data) {
+			def.num_samples_array = 0;
+			def.num_samples_tot = 0;
+		}
 
-		INCREMENT_SERIAL();
+		serial_write(writer, &def, sizeof(OmniCacheDef));
 	}
 
 	/* block_index */
-	{
-		OmniBlockInfoDef *temp = (OmniBlockInfoDef *)s;
+	for (uint i = 0; i < cache->def.num_blocks; i++) {
+		serial_write(writer, &cache->block_index[i].def, sizeof(OmniBlockInfoDef));
+	}
+}
+
+void serialize(serial_writer *writer, const OmniCache *cache, bool serialize_data)
+{
+	serialize_def(writer, cache, serialize_data);
+
+	if (serialize_data) {
+		writer->shared = calloc(MAX(dedup_num_entries(cache), 1), sizeof(uint));
+		writer->num_shared = 0;
+
+		for (OmniSample *root = SAMPLE_FIRST(cache); root; root = sample_root_next(cache, root->tindex + 1)) {
+			if (!SAMPLE_IS_SKIPPED(root)) {
+				serialize_sample(writer, root);
+			}
+
+			for (uint i = 0; i < root->num_subs; i++) {
+				serialize_sample(writer, root->subs[i].sample);
+			}
+		}
+
+		free(writer->shared);
+		writer->shared = NULL;
+	}
+}
+
+size_t serial_calc_size(const OmniCache *cache, bool serialize_data)
+{
+	serial_writer writer = {
+	    .buffer = NULL,
+	};
+
+	serialize(&writer, cache, serialize_data);
+
+	return writer.size;
+}
+
+/* Deserialization */
+
+/* Remember the shared data just read into a block, for the blocks sharing it later.
+ * Unless borrowed, the data is moved to the store of the cache. */
+static void deserialize_shared_add(serial_reader *reader, OmniCache *cache, uint index, OmniBlock *block, size_t size)
+{
+	if (!reader->borrow) {
+		void *data = dedup_acquire(cache, index, block, size);
+
+		alignfree(block->data);
+
+		block->data = data;
+		block->dcount_alloc = 0;
+		block->status |= OMNI_BLOCK_STATUS_SHARED;
+	}
+
+	if (reader->num_shared == reader->num_shared_alloc) {
+		reader->num_shared_alloc = min_array_size(reader->num_shared);
+		reader->shared = realloc(reader->shared, sizeof(serial_shared) * reader->num_shared_alloc);
+	}
+
+	reader->shared[reader->num_shared].data = reader->borrow ? block->data : dedup_ref(block->data);
+	reader->shared[reader->num_shared].size = size;
+	reader->num_shared++;
+}
+
+/* Add the sample described by a record to the cache (replacing any existing data at its time), and read its data.
+ * s_blocks: storage for `num_blocks` block records. */
+void deserialize_sample(serial_reader *reader, OmniCache *cache, OmniBlockSerial *s_blocks)
+{
+	OmniSampleSerial s_sample;
+	OmniSample *sample;
+	OmniSample *prev = NULL;
+
+	serial_read_align(reader);
+	serial_read(reader, &s_sample, sizeof(OmniSampleSerial));
+	serial_read(reader, s_blocks, sizeof(OmniBlockSerial) * cache->def.num_blocks);
 
+	sample = sample_insert(cache, s_sample.tindex, s_sample.toffset);
+
+	sample_delta_detach(sample);
+	sample_data_reset(sample);
+	sample_set_status(sample, s_sample.status);
+
+	if (reader->borrow || !(cache->def.flags & OMNICACHE_FLAG_ARENA)) {
+		init_sample_blocks(sample, NULL);
+	}
+	else {
+		/* Single allocation for all the data of the sample (packed and shared data is allocated separately). */
 		for (uint i = 0; i < cache->def.num_blocks; i++) {
-			OmniBlockInfo *block = &cache->block_index[i];
+			bool in_arena = (s_blocks[i].status & OMNI_STATUS_VALID) && !s_blocks[i].csize &&
+			                !(s_blocks[i].status & (OMNI_BLOCK_STATUS_QUANTIZED | OMNI_BLOCK_STATUS_SHARED));
+
+			cache->block_index[i].wcount = in_arena ? s_blocks[i].dcount : 0;
+		}
+
+		sample_arena_alloc(sample);
+		init_sample_blocks(sample, NULL);
+	}
+
+	if (s_sample.meta_status & OMNI_STATUS_VALID) {
+		serial_read_align(reader);
+
+		if (reader->borrow) {
+			sample->meta.data = serial_borrow(reader, cache->def.msize);
+			sample->meta.status |= OMNI_BLOCK_STATUS_BORROWED;
+		}
+		else {
+			if (!sample->meta.data) {
+				sample->meta.data = alignalloc(cache->def.msize, ALIGN_SIZE);
+			}
+
+			serial_read(reader, sample->meta.data, cache->def.msize);
+		}
 
-			memcpy(temp, block, sizeof(OmniBlockInfoDef));
+		meta_set_status(sample, s_sample.meta_status);
+	}
+
+	for (uint i = 0; i < cache->def.num_blocks; i++) {
+		OmniBlockInfo *b_info = &cache->block_index[i];
+		OmniBlock *block = &sample->blocks[i];
+		OmniBlockStatusFlags encoding = s_blocks[i].status & (OMNI_BLOCK_STATUS_DELTA | OMNI_BLOCK_STATUS_QUANTIZED);
+		size_t size = block_plain_size(b_info, encoding, s_blocks[i].dcount);
+		bool shared = (s_blocks[i].status & OMNI_BLOCK_STATUS_SHARED);
+		uint shared_index = 0;
+
+		if (s_blocks[i].csize) {
+			encoding |= OMNI_BLOCK_STATUS_COMPRESSED;
+			size = s_blocks[i].csize;
+		}
+
+		if (!(s_blocks[i].status & OMNI_STATUS_VALID)) {
+			continue;
+		}
+
+		if (!block_count_valid(b_info, s_blocks[i].dcount)) {
+			reader->failed = true;
+
+			continue;
+		}
+
+		if (shared) {
+			serial_read_align(reader);
+			serial_read(reader, &shared_index, sizeof(uint));
+
+			if (shared_index > reader->num_shared ||
+			    (shared_index < reader->num_shared && reader->shared[shared_index].size != size))
+			{
+				reader->failed = true;
+
+				continue;
+			}
+		}
+
+		block->dcount = s_blocks[i].dcount;
 
-			INCREMENT_SERIAL();
+		if (shared && shared_index < reader->num_shared) {
+			/* Shared data read earlier. */
+			if (reader->borrow) {
+				block->data = reader->shared[shared_index].data;
+				block->dcount_alloc = block->dcount;
+				block->status |= OMNI_BLOCK_STATUS_BORROWED;
+			}
+			else {
+				block_data_free(block);
+				block->data = dedup_ref(reader->shared[shared_index].data);
+				block->status |= OMNI_BLOCK_STATUS_SHARED;
+			}
+		}
+		else {
+			serial_read_align(reader);
+
+			if (reader->borrow) {
+				block->data = serial_borrow(reader, size);
+				block->dcount_alloc = block->dcount;
+				block->status |= OMNI_BLOCK_STATUS_BORROWED;
+			}
+			else {
+				if ((encoding & OMNI_BLOCK_STATUS_PACKED) || shared) {
+					block_data_free(block);
+					block->data = alignalloc(size, ALIGN_SIZE);
+				}
+				else if (!block->data) {
+					if ((b_info->def.flags & OMNI_BLOCK_FLAG_CONST_COUNT) && !prev) {
+						prev = sample_prev(sample);
+					}
+
+					block_data_alloc(b_info, block, block->dcount, (prev && prev->blocks) ? &prev->blocks[i] : NULL);
+				}
+
+				serial_read(reader, block->data, size);
+			}
 		}
+
+		block->csize = s_blocks[i].csize;
+		block->status |= encoding;
+
+		if (shared && shared_index == reader->num_shared) {
+			deserialize_shared_add(reader, cache, i, block, size);
+		}
+
+		block_set_status(block, s_blocks[i].status & (OMNI_STATUS_VALID | OMNI_STATUS_CURRENT));
 	}
+
+	sample_mem_update(sample);
 }
 
-OmniCache *deserialize(OmniSerial *serial, const OmniCacheTemplate *cache_temp)
+/* Release the shared data remembered while reading. */
+void deserialize_shared_free(serial_reader *reader)
+{
+	for (uint i = 0; i < reader->num_shared && !reader->borrow; i++) {
+		dedup_release(reader->shared[i].data);
+	}
+
+	free(reader->shared);
+
+	reader->shared = NULL;
+	reader->num_shared = 0;
+	reader->num_shared_alloc = 0;
+}
+
+/* Check a block definition read from serialized data, against the template block it refers to (if any). */
+static bool deserialize_block_valid(const OmniBlockInfoDef *def, const OmniCacheTemplate *cache_temp)
+{
+	const OmniBlockTemplate *b_temp;
+
+	if (def->dtype >= OMNI_NUM_DTYPES || def->dsize == 0 ||
+	    (def->dtype != OMNI_DATA_GENERIC && def->dsize != OMNI_DATA_TYPE_SIZE[def->dtype]))
+	{
+		return false;
+	}
+
+	if (!cache_temp) {
+		return true;
+	}
+
+	if (def->index >= cache_temp->num_blocks) {
+		return false;
+	}
+
+	b_temp = &cache_temp->blocks[def->index];
+
+	return strncmp(def->id, b_temp->id, MAX_NAME) == 0 && def->dtype == b_temp->data_type &&
+	       (def->dtype != OMNI_DATA_GENERIC || def->dsize == b_temp->data_size);
+}
+
+/* Read the cache definition and block index, into a new cache without samples.
+ * r_num_samples: number of samples in the serialized cache. */
+OmniCache *deserialize_def(serial_reader *reader, const OmniCacheTemplate *cache_temp, uint *r_num_samples)
 {
-	OmniSerial *s = (OmniSerial *)serial;
 	OmniCache *cache;
 
 	/* cache */
 	{
-		OmniCacheDef *temp = (OmniCacheDef *)s;
+		OmniCacheDef def;
+
+		serial_read(reader, &def, sizeof(OmniCacheDef));
+
+		if (reader->failed) {
+			fprintf(stderr, "OmniCache: Deserialization falied, unexpected end of data.\n");
+
+			return NULL;
+		}
 
 		if (cache_temp &&
-		    strncmp(temp->id, cache_temp->id, MAX_NAME) != 0)
+		    (strncmp(def.id, cache_temp->id, MAX_NAME) != 0 ||
+		     def.num_blocks > cache_temp->num_blocks ||
+		     def.msize != cache_temp->meta_size))
 		{
 			fprintf(stderr, "OmniCache: Deserialization falied, cache type mismatch.\n");
 
 			return NULL;
 		}
 
-		cache = malloc(sizeof(OmniCache));
+		cache = calloc(1, sizeof(OmniCache));
 
-		memcpy(cache, temp, sizeof(OmniCacheDef));
+		memcpy(&cache->def, &def, sizeof(OmniCacheDef));
 
 		cache_set_status(cache, OMNI_STATUS_CURRENT);
 
-		/* TODO: Data deserialization. */
-		cache->num_samples_alloc = 0;
+		/* Rebuilt from the sample records. */
+		*r_num_samples = cache->def.num_samples_tot;
 
-		cache->samples = NULL;
+		cache->def.num_samples_array = 0;
+		cache->def.num_samples_tot = 0;
 
 		if (cache_temp) {
 			cache->meta_gen = cache_temp->meta_gen;
@@ -81,35 +558,101 @@ OmniCache *deserialize(OmniSerial *serial, const OmniCacheTemplate *cache_temp)
 		else {
 			cache->meta_gen = NULL;
 		}
-
-		INCREMENT_SERIAL();
 	}
 
 	/* block_index */
 	{
-		OmniBlockInfoDef *temp = (OmniBlockInfoDef *)s;
-
-		cache->block_index = malloc(sizeof(OmniBlockInfo) * cache->def.num_blocks);
+		cache->block_index = calloc(cache->def.num_blocks, sizeof(OmniBlockInfo));
 
 		for (uint i = 0; i < cache->def.num_blocks; i++) {
 			OmniBlockInfo *b_info = &cache->block_index[i];
 
-			memcpy(b_info, temp, sizeof(OmniBlockInfoDef));
+			serial_read(reader, &b_info->def, sizeof(OmniBlockInfoDef));
 
 			b_info->parent = cache;
 
+			/* Left to the caller. */
+			if (reader->failed) {
+				break;
+			}
+
+			if (!deserialize_block_valid(&b_info->def, cache_temp)) {
+				fprintf(stderr, "OmniCache: Deserialization falied, invalid block definition.\n");
+
+				OMNI_free(cache);
+
+				return NULL;
+			}
+
 			if (cache_temp) {
-				const OmniBlockTemplate *b_temp = &cache_temp->blocks[temp->index];
+				const OmniBlockTemplate *b_temp = &cache_temp->blocks[b_info->def.index];
 
 				b_info->count = b_temp->count;
 				b_info->read = b_temp->read;
 				b_info->write = b_temp->write;
 				b_info->interp = b_temp->interp;
 			}
+		}
+	}
+
+	return cache;
+}
+
+OmniCache *deserialize(serial_reader *reader, const OmniCacheTemplate *cache_temp)
+{
+	uint num_samples;
+	OmniCache *cache = deserialize_def(reader, cache_temp, &num_samples);
+
+	if (!cache) {
+		return NULL;
+	}
+
+	if (num_samples) {
+		OmniBlockSerial *s_blocks = malloc(sizeof(OmniBlockSerial) * cache->def.num_blocks);
 
-			INCREMENT_SERIAL();
+		for (uint i = 0; i < num_samples && !reader->failed; i++) {
+			deserialize_sample(reader, cache, s_blocks);
 		}
+
+		free(s_blocks);
+		deserialize_shared_free(reader);
+	}
+
+	if (reader->failed) {
+		fprintf(stderr, "OmniCache: Deserialization falied, unexpected end of data.\n");
+
+		OMNI_free(cache);
+
+		return NULL;
 	}
 
 	return cache;
 }
+
+/* Streaming */
+
+bool serialize_stream(const OmniCache *cache, bool serialize_data, OmniStreamWriteCallback write, void *user_data)
+{
+	serial_writer writer = {
+	    .buffer = malloc(SERIAL_CHUNK_SIZE),
+	    .write = write,
+	    .user_data = user_data,
+	};
+
+	serialize(&writer, cache, serialize_data);
+	serial_flush(&writer);
+
+	free(writer.buffer);
+
+	return !writer.failed;
+}
+
+OmniCache *deserialize_stream(OmniStreamReadCallback read, void *user_data, const OmniCacheTemplate *cache_temp)
+{
+	serial_reader reader = {
+	    .read = read,
+	    .user_data = user_data,
+	};
+
+	return deserialize(&reader, cache_temp);
+}
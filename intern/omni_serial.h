@@ -7,8 +7,81 @@
 
 #include "omni_types.h"
 
-uint serial_calc_size(const OmniCache *cache, bool serialize_data);
-void serialize(OmniSerial *serial, const OmniCache *cache, bool serialize_data);
-OmniCache *deserialize(OmniSerial *serial, const OmniCacheTemplate *cache_temp);
+/* Alignment of sample records and data in serialized caches. */
+#define SERIAL_ALIGN 16
+
+/* Size of the chunks passed to stream callbacks. */
+#define SERIAL_CHUNK_SIZE (1 << 20)
+
+typedef struct OmniSampleSerial {
+	uint tindex;
+	float_or_uint toffset;
+
+	OmniSampleStatusFlags status;
+	OmniBlockStatusFlags meta_status; /* Metadata follows if valid. */
+} OmniSampleSerial;
+
+typedef struct OmniBlockSerial {
+	OmniBlockStatusFlags status; /* Data follows if valid. */
+	uint dcount;
+	uint csize; /* Size of the data if compressed with the block codec (0 if not). */
+} OmniBlockSerial;
+
+/* Shared data read (see `OMNI_BLOCK_STATUS_SHARED`), referred to by later blocks. */
+typedef struct serial_shared {
+	void *data; /* Referenced by the reader, unless borrowed. */
+	size_t size;
+} serial_shared;
+
+typedef struct serial_writer {
+	char *buffer; /* Output buffer, or chunk buffer if streaming (NULL to only compute the size). */
+	size_t size; /* Number of bytes written. */
+
+	/* Number of each shared data written (plus one, 0 if not yet written), by `dedup_entry_index`. */
+	uint *shared;
+	uint num_shared;
+
+	/* Streaming */
+	OmniStreamWriteCallback write;
+	void *user_data;
+	size_t chunk_used;
+	bool failed;
+} serial_writer;
+
+typedef struct serial_reader {
+	const char *buffer; /* Input buffer (NULL if streaming). */
+	size_t pos; /* Number of bytes read. */
+	bool borrow; /* Point the sample data into `buffer` instead of copying it. */
+
+	serial_shared *shared;
+	uint num_shared;
+	uint num_shared_alloc;
+
+	/* Streaming */
+	OmniStreamReadCallback read;
+	void *user_data;
+	bool failed;
+} serial_reader;
+
+void serial_write(serial_writer *writer, const void *data, size_t size);
+void serial_write_align(serial_writer *writer);
+void serial_write_pad(serial_writer *writer, size_t offset);
+void serial_flush(serial_writer *writer);
+
+size_t serial_calc_size(const OmniCache *cache, bool serialize_data);
+void serialize_def(serial_writer *writer, const OmniCache *cache, bool serialize_data);
+void serial_sample_record(const OmniSample *sample, OmniSampleSerial *s_sample);
+void serial_block_record(const OmniBlock *block, OmniBlockSerial *s_block);
+void serialize_sample(serial_writer *writer, const OmniSample *sample);
+void serialize_sample_view(serial_writer *writer, const OmniSampleSerial *s_sample, const OmniBlockSerial *s_blocks,
+                           const OmniView *view);
+void serialize(serial_writer *writer, const OmniCache *cache, bool serialize_data);
+OmniCache *deserialize_def(serial_reader *reader, const OmniCacheTemplate *cache_temp, uint *r_num_samples);
+void deserialize_sample(serial_reader *reader, OmniCache *cache, OmniBlockSerial *s_blocks);
+void deserialize_shared_free(serial_reader *reader);
+OmniCache *deserialize(serial_reader *reader, const OmniCacheTemplate *cache_temp);
+
+bool serialize_stream(const OmniCache *cache, bool serialize_data, OmniStreamWriteCallback write, void *user_data);
+OmniCache *deserialize_stream(OmniStreamReadCallback read, void *user_data, const OmniCacheTemplate *cache_temp);
 
 #endif /* __OMNI_OMNI_SERIAL_H__ */
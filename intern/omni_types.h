@@ -6,6 +6,9 @@
 #define __OMNI_OMNI_TYPES_H__
 
 #include "types.h"
+#include "pool.h"
+#include "mapping.h"
+#include "codec.h"
 #include "omnicache.h"
 
 /* enum OmniTimeType */
@@ -52,8 +55,24 @@ typedef struct OmniBlockInfoDef {
 	uint dsize;
 
 	OmniBlockFlags flags;
+	OmniInterpMode imode;
+	OmniCodec codec;
+	uint delta_interval;
+	OmniQuantization quant;
+	float quant_error;
 } OmniBlockInfoDef;
 
+/* Fixed size slots holding the data of a block with `OMNI_BLOCK_FLAG_CONST_COUNT`, for all samples of a cache.
+ * Each slot in use holds a reference, as does the cache, so slots taken over by views outlive the cache.
+ * Its slabs are accounted to the cache as a whole, rather than the slots to their samples. */
+typedef struct OmniDataPool {
+	mempool pool;
+	uint refs;
+
+	struct OmniCache *cache; /* Cache the slabs are accounted to (NULL once released by it). */
+	size_t mem; /* Memory accounted to the cache (see `data_pool_mem_update`). */
+} OmniDataPool;
+
 /* Block runtime data. */
 typedef struct OmniBlockInfo {
 	OmniBlockInfoDef def;
@@ -64,26 +83,62 @@ typedef struct OmniBlockInfo {
 	OmniReadCallback read;
 	OmniWriteCallback write;
 	OmniInterpCallback interp;
+
+	uint wcount; /* Element count of the sample currently being written. */
+
+	/* With `OMNI_BLOCK_FLAG_CONST_COUNT`, element count of all samples (0 until first written),
+	 * and the pool their data is allocated from (created on first use). */
+	uint ccount;
+	OmniDataPool *pool;
+
+	/* Last sample decoded from a delta chain, and its data (see `omni_codec.c`). */
+	struct OmniSample *delta_sample;
+	codec_buffer delta_data;
 } OmniBlockInfo;
 
 /* Bits 0-15 are used for OmniStatusFlags. */
 typedef enum OmniBlockStatusFlags {
-	OMNI_BLOCK_STATUS_FLAGS	= (1 << 15), /* End of range reserved by OmniStatusFlags. */
+	OMNI_BLOCK_STATUS_FLAGS		= (1 << 15), /* End of range reserved by OmniStatusFlags. */
+	OMNI_BLOCK_STATUS_ARENA		= (1 << 16), /* Data lives in the sample arena (not individually allocated). */
+	OMNI_BLOCK_STATUS_ADOPTED	= (1 << 17), /* Data allocated by the user, and freed with `OmniBlock.dfree`. */
+	OMNI_BLOCK_STATUS_BORROWED	= (1 << 18), /* Data points into memory owned by the user (never freed or written to). */
+	OMNI_BLOCK_STATUS_SPILLED	= (1 << 19), /* Borrowed data lives in the spill file `OmniBlock.spill` (see `omni_budget.c`). */
+	OMNI_BLOCK_STATUS_COMPRESSED	= (1 << 20), /* Data encoded with the block codec, `OmniBlock.csize` bytes long. */
+	OMNI_BLOCK_STATUS_DELTA		= (1 << 21), /* Data XORed with the same block of the previous sample holding data for it. */
+	OMNI_BLOCK_STATUS_QUANTIZED	= (1 << 22), /* Data quantized with `OmniBlockInfoDef.quant` (before any delta or codec). */
+	OMNI_BLOCK_STATUS_SHARED	= (1 << 23), /* Data shared with other blocks holding identical data (see `omni_dedup.c`). */
+	OMNI_BLOCK_STATUS_POOLED	= (1 << 24), /* Data allocated from `OmniBlock.pool` (see `OmniDataPool`). */
+	OMNI_BLOCK_STATUS_COLUMN	= (1 << 25), /* Data lives in `OmniBlock.column` (see `omni_column.c`). */
 } OmniBlockStatusFlags;
 
+/* Data stored in fewer bytes than its elements take. */
+#define OMNI_BLOCK_STATUS_PACKED (OMNI_BLOCK_STATUS_COMPRESSED | OMNI_BLOCK_STATUS_QUANTIZED)
+
+/* Data that must be decoded before use (see `block_data_decode`). */
+#define OMNI_BLOCK_STATUS_ENCODED (OMNI_BLOCK_STATUS_PACKED | OMNI_BLOCK_STATUS_DELTA)
+
 typedef struct OmniBlock {
 	struct OmniSample *parent;
 
 	OmniBlockStatusFlags status;
 	uint dcount;
+	uint dcount_alloc; /* Number of elements that fit in the allocated data. */
+	uint csize; /* Size of compressed data (see `OMNI_BLOCK_STATUS_COMPRESSED`). */
 
 	void *data;
+	union {
+		OmniFreeCallback dfree; /* Only used with `OMNI_BLOCK_STATUS_ADOPTED`. */
+		OmniDataPool *pool; /* Only used with `OMNI_BLOCK_STATUS_POOLED`. */
+		struct column *column; /* Only used with `OMNI_BLOCK_STATUS_COLUMN`. */
+		mapping *spill; /* Only used with `OMNI_BLOCK_STATUS_SPILLED`. */
+	};
 } OmniBlock;
 
 typedef struct OmniMetaBlock {
 	OmniBlockStatusFlags status;
 
 	void *data;
+	mapping *spill; /* Only used with `OMNI_BLOCK_STATUS_SPILLED`. */
 } OmniMetaBlock;
 
 
@@ -93,10 +148,18 @@ typedef struct OmniMetaBlock {
 typedef enum OmniSampleStatusFlags {
 	OMNI_SAMPLE_STATUS_FLAGS	= (1 << 15), /* End of range reserved by OmniStatusFlags. */
 	OMNI_SAMPLE_STATUS_SKIP		= (1 << 16), /* Unused sample. */
+	OMNI_SAMPLE_STATUS_POOLED	= (1 << 17), /* Sample (and its blocks) allocated from `OmniCache.sample_pool`. */
+	OMNI_SAMPLE_STATUS_ACQUIRED	= (1 << 18), /* Data acquired for writing, waiting to be committed. */
 } OmniSampleStatusFlags;
 
+/* Entry of the sorted sub-sample index of a root sample.
+ * The offset is duplicated here, so searching does not touch the samples. */
+typedef struct OmniSampleRef {
+	float_or_uint toffset;
+	struct OmniSample *sample;
+} OmniSampleRef;
+
 typedef struct OmniSample {
-	struct OmniSample *next;
 	struct OmniCache *parent;
 	OmniMetaBlock meta;
 
@@ -109,9 +172,45 @@ typedef struct OmniSample {
 	uint num_blocks_outdated;
 
 	OmniBlock *blocks;
+
+	/* List (non-root) samples at this index, sorted by offset (only used by root samples). */
+	OmniSampleRef *subs;
+	uint num_subs;
+	uint num_subs_alloc;
+
+	void *arena; /* Single allocation holding blocks, metadata and data (`OMNICACHE_FLAG_ARENA`). */
+
+	struct OmniView *view; /* View pinning the data of this sample (NULL if none). */
+
+	size_t mem; /* Memory accounted to the data of this sample (see `sample_mem_update`). */
+	uint access; /* Budget tick of the last access, for LRU eviction. */
 } OmniSample;
 
 
+/* View */
+
+/* Read-only view of the data of a sample.
+ * While attached, the data belongs to the sample, and any change that would free or overwrite it
+ * first moves it over to the view (see `sample_view_detach`). */
+typedef struct OmniView {
+	OmniSample *sample; /* NULL once detached from the sample. */
+	uint users;
+
+	/* Data owned by the view, handed over by the sample. */
+	OmniBlock *owned;
+	uint num_owned;
+	void *meta_owned;
+	void *arena;
+	mapping *map; /* Keeps data borrowed from a cache file mapped. */
+
+	const void *meta;
+	size_t msize;
+
+	uint num_blocks;
+	OmniData blocks[];
+} OmniView;
+
+
 /* Cache */
 
 /* Bits 0-15 are used for OmniStatusFlags. */
@@ -132,22 +231,48 @@ typedef struct OmniCacheDef {
 	OmniCacheFlags flags;
 
 	uint num_blocks;
-	uint num_samples_array; /* Number of samples initialized in the array. */
+	uint num_samples_array; /* Number of root samples in use (index of the last one plus one). */
 	uint num_samples_tot; /* Total number of non-skipped initialized samples (including sub-samples) */
 
 	uint msize;
 } OmniCacheDef;
 
 /* Cache runtime data. */
+typedef struct journal journal;
+typedef struct loader loader;
+typedef struct prefetcher prefetcher;
+typedef struct budget budget;
+typedef struct dedup dedup;
+typedef struct column column;
+
+/* Buffers for the decoded data of each sample used by an interpolated read (see `block_data_decode`). */
+#define CODEC_READ_BUFFERS 4
+
 typedef struct OmniCache {
 	OmniCacheDef def;
 
 	OmniCacheStatusFlags status;
 
-	uint num_samples_alloc; /* Number of samples allocated in the array. */
+	uint num_pages; /* Number of entries in the page directory. */
 
 	OmniBlockInfo *block_index;
-	OmniSample *samples;
+	OmniSample **pages; /* Root samples, in pages of `SAMPLE_PAGE_SIZE` (NULL where no samples are in use). */
+
+	mempool sample_pool; /* Allocator for list (non-root) samples, with their blocks stored inline. */
+
+	mapping *map; /* Cache file that sample data is borrowed from (NULL if none). */
+	journal *journal; /* Journal that changes are appended to (NULL if none). */
+	loader *loader; /* Threads for asynchronous loads (created on first use). */
+	prefetcher *prefetch; /* Read-ahead following the access pattern (NULL if disabled). */
+	budget *budget; /* Memory budget and eviction state (NULL if none). */
+	dedup *dedup; /* Store of data shared between samples (created on first use). */
+
+	size_t mem_used; /* Memory accounted to samples and their index (see `omni_budget.c`). */
+
+	/* Scratch buffers for decoding, which is why reads are not thread safe (see `OMNI_sample_read`). */
+	codec_buffer read_buffers[CODEC_READ_BUFFERS];
+	codec_buffer work_buffers[2]; /* Codec input and output. */
+	codec_buffer interp_buffer; /* Interpolated data of the block being read (see `sample_read_interp`). */
 
 	OmniMetaGenCallback meta_gen;
 } OmniCache;
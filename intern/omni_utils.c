@@ -4,6 +4,13 @@
 
 #include "omni_utils.h"
 
+#include "omni_budget.h"
+#include "omni_codec.h"
+#include "omni_column.h"
+#include "omni_dedup.h"
+#include "omni_view.h"
+#include "quant.h"
+
 /* Flagging utils */
 
 void block_set_status(OmniBlock *block, OmniBlockStatusFlags status)
@@ -140,97 +147,500 @@ sample_time gen_sample_time(OmniCache *cache, float_or_uint time)
 	return result;
 }
 
+/* Call `list` for the list samples of `root`, starting at position `pos`.
+ * The callback may remove the sample it is called with. */
+static void subs_iterate(OmniSample *root, uint pos, iter_callback list)
+{
+	while (pos < root->num_subs) {
+		OmniSample *curr = root->subs[pos].sample;
+
+		list(curr);
+
+		/* Only advance if the sample was not removed from the index. */
+		if (pos < root->num_subs && root->subs[pos].sample == curr) {
+			pos++;
+		}
+	}
+}
+
 /* Call a function for each sample in the cache, starting from an arbitrary sample.
  * start: sample at which to start iterating.
  * list: function called for all listed samples (non-root).
  * root: function called for all root samples.
- * first: function called for the `start` sample in addition to the `list` or `root` function. */
-void samples_iterate(OmniSample *start, iter_callback list,
-                     iter_callback root, iter_callback first)
+ * Callbacks may remove the sample they are called with from the cache. */
+void samples_iterate(OmniSample *start, iter_callback list, iter_callback root)
 {
 	assert(list);
 
 	if (start) {
 		OmniCache *cache = start->parent;
-		OmniSample *curr = start;
-		OmniSample *next = curr->next;
-		uint index = curr->tindex;
-
-		if (first) first(curr);
+		OmniSample *curr = SAMPLE_ROOT(start);
 
-		if (SAMPLE_IS_ROOT(curr)) {
+		if (SAMPLE_IS_ROOT(start)) {
 			if (root) root(curr);
+
+			subs_iterate(curr, 0, list);
 		}
 		else {
-			if (list) list(curr);
+			subs_iterate(curr, sample_sub_search(curr, start->toffset), list);
 		}
 
-		if (list) {
-			for (curr = next; curr; curr = next) {
-				next = curr->next;
+		for (curr = sample_root_next(cache, start->tindex + 1); curr; curr = sample_root_next(cache, curr->tindex + 1)) {
+			if (root) root(curr);
 
-				list(curr);
-			}
+			subs_iterate(curr, 0, list);
 		}
+	}
+}
 
-		for (uint i = index + 1; i < cache->def.num_samples_array; i++) {
-			curr = &cache->samples[i];
-			next = curr->next;
+/* Absolute time of a sample. */
+float_or_uint sample_time_get(const OmniSample *sample)
+{
+	OmniCache *cache = sample->parent;
+	float_or_uint time = cache->def.tstep;
 
-			if (root) root(curr);
+	if (time.isf) {
+		time.f *= sample->tindex;
+	}
+	else {
+		time.u *= sample->tindex;
+	}
+
+	time = fu_add(cache->def.tinitial, time);
+
+	if (!SAMPLE_IS_ROOT(sample)) {
+		time = fu_add(time, sample->toffset);
+	}
+
+	return time;
+}
+
+/* Root sample index */
+
+static void sample_page_alloc(OmniCache *cache, uint page)
+{
+	OmniSample *samples;
+
+	if (page >= cache->num_pages) {
+		uint num_pages = min_array_size(page);
+
+		cache->pages = realloc(cache->pages, sizeof(OmniSample *) * num_pages);
+		memset(&cache->pages[cache->num_pages], 0, sizeof(OmniSample *) * (num_pages - cache->num_pages));
+
+		budget_mem_add(cache, sizeof(OmniSample *) * (num_pages - cache->num_pages));
+
+		cache->num_pages = num_pages;
+	}
+
+	samples = calloc(SAMPLE_PAGE_SIZE, sizeof(OmniSample));
+	budget_mem_add(cache, sizeof(OmniSample) * SAMPLE_PAGE_SIZE);
+
+	for (uint i = 0; i < SAMPLE_PAGE_SIZE; i++) {
+		OmniSample *samp = &samples[i];
+
+		samp->parent = cache;
+		samp->tindex = (page * SAMPLE_PAGE_SIZE) + i;
+		sample_set_status(samp, OMNI_SAMPLE_STATUS_SKIP);
+	}
+
+	cache->pages[page] = samples;
+}
+
+/* Get the root sample at `index`.
+ * Returns NULL if its page is not allocated, unless `create` is set.
+ * Root samples never move once their page is allocated. */
+OmniSample *sample_root_get(OmniCache *cache, uint index, bool create)
+{
+	uint page = index / SAMPLE_PAGE_SIZE;
+
+	if (page >= cache->num_pages || !cache->pages[page]) {
+		if (!create) {
+			return NULL;
+		}
+
+		sample_page_alloc(cache, page);
+	}
+
+	return &cache->pages[page][index % SAMPLE_PAGE_SIZE];
+}
 
-			if (list) {
-				for (curr = next; curr; curr = next) {
-					next = curr->next;
+/* Last root sample before `index` (possibly skipped), or NULL. */
+OmniSample *sample_root_prev(OmniCache *cache, uint index)
+{
+	index = MIN(index, cache->def.num_samples_array);
+
+	while (index > 0) {
+		uint page = (index - 1) / SAMPLE_PAGE_SIZE;
+
+		if (page < cache->num_pages && cache->pages[page]) {
+			return &cache->pages[page][(index - 1) % SAMPLE_PAGE_SIZE];
+		}
+
+		index = page * SAMPLE_PAGE_SIZE;
+	}
+
+	return NULL;
+}
+
+/* First root sample at or after `index` (possibly skipped), or NULL. */
+OmniSample *sample_root_next(const OmniCache *cache, uint index)
+{
+	while (index < cache->def.num_samples_array) {
+		uint page = index / SAMPLE_PAGE_SIZE;
+
+		if (cache->pages[page]) {
+			return &cache->pages[page][index % SAMPLE_PAGE_SIZE];
+		}
 
-					list(curr);
-				}
+		index = (page + 1) * SAMPLE_PAGE_SIZE;
+	}
+
+	return NULL;
+}
+
+/* Free pages where all samples are skipped, and drop trailing skipped samples. */
+void samples_trim(OmniCache *cache)
+{
+	uint num_samples = 0;
+
+	for (uint page = 0; page < cache->num_pages; page++) {
+		OmniSample *samples = cache->pages[page];
+		bool used = false;
+
+		if (!samples) {
+			continue;
+		}
+
+		for (uint i = 0; i < SAMPLE_PAGE_SIZE; i++) {
+			if (!SAMPLE_IS_SKIPPED((&samples[i])) || samples[i].num_subs) {
+				num_samples = samples[i].tindex + 1;
+				used = true;
 			}
 		}
+
+		if (!used) {
+			free(samples);
+			cache->pages[page] = NULL;
+
+			budget_mem_sub(cache, sizeof(OmniSample) * SAMPLE_PAGE_SIZE);
+		}
+	}
+
+	cache->def.num_samples_array = num_samples;
+}
+
+/* Sub-sample index */
+
+/* Position of the first list sample of `root` with an offset not less than `offset`. */
+uint sample_sub_search(const OmniSample *root, float_or_uint offset)
+{
+	uint low = 0;
+	uint high = root->num_subs;
+
+	while (low < high) {
+		uint mid = low + ((high - low) / 2);
+
+		if (FU_LT(root->subs[mid].toffset, offset)) {
+			low = mid + 1;
+		}
+		else {
+			high = mid;
+		}
+	}
+
+	return low;
+}
+
+/* Position of a list sample in the index of its root. */
+uint sample_sub_position(const OmniSample *sample)
+{
+	OmniSample *root = SAMPLE_ROOT(sample);
+	uint pos = sample_sub_search(root, sample->toffset);
+
+	assert(pos < root->num_subs && root->subs[pos].sample == sample);
+
+	return pos;
+}
+
+void sample_sub_insert(OmniSample *root, uint pos, OmniSample *sample)
+{
+	assert(pos <= root->num_subs);
+
+	if (root->num_subs == root->num_subs_alloc) {
+		uint num_alloc = root->num_subs_alloc ? root->num_subs_alloc * 2 : MIN_SUBS;
+
+		budget_mem_add(root->parent, sizeof(OmniSampleRef) * (num_alloc - root->num_subs_alloc));
+
+		root->num_subs_alloc = num_alloc;
+		root->subs = realloc(root->subs, sizeof(OmniSampleRef) * root->num_subs_alloc);
+	}
+
+	memmove(&root->subs[pos + 1], &root->subs[pos], sizeof(OmniSampleRef) * (root->num_subs - pos));
+
+	root->subs[pos].toffset = sample->toffset;
+	root->subs[pos].sample = sample;
+	root->num_subs++;
+}
+
+/* Remove list samples from the index of `root`, without freeing them. */
+void sample_sub_remove(OmniSample *root, uint pos, uint count)
+{
+	assert(pos + count <= root->num_subs);
+
+	memmove(&root->subs[pos], &root->subs[pos + count], sizeof(OmniSampleRef) * (root->num_subs - pos - count));
+
+	root->num_subs -= count;
+
+	if (root->num_subs == 0) {
+		budget_mem_sub(root->parent, sizeof(OmniSampleRef) * root->num_subs_alloc);
+
+		free(root->subs);
+		root->subs = NULL;
+		root->num_subs_alloc = 0;
 	}
 }
 
+/* Previous sample in time (including skipped root samples), or NULL. */
 OmniSample *sample_prev(OmniSample *sample)
 {
 	OmniCache *cache = sample->parent;
-	OmniSample *prev = &cache->samples[sample->tindex];
+	OmniSample *root = SAMPLE_ROOT(sample);
+
+	if (!SAMPLE_IS_ROOT(sample)) {
+		uint pos = sample_sub_position(sample);
+
+		return pos > 0 ? root->subs[pos - 1].sample : root;
+	}
+
+	return sample_last_before(cache, sample->tindex);
+}
+
+/* Next sample in time (including skipped root samples), or NULL. */
+OmniSample *sample_next(OmniSample *sample)
+{
+	OmniCache *cache = sample->parent;
+	OmniSample *root = SAMPLE_ROOT(sample);
+	uint pos = SAMPLE_IS_ROOT(sample) ? 0 : sample_sub_position(sample) + 1;
+
+	if (pos < root->num_subs) {
+		return root->subs[pos].sample;
+	}
+
+	return sample_root_next(cache, sample->tindex + 1);
+}
+
+/* Last sample (possibly skipped) before the root sample at `index`, or NULL. */
+OmniSample *sample_last_before(OmniCache *cache, uint index)
+{
+	OmniSample *root = sample_root_prev(cache, index);
+
+	return root ? sample_last(root) : NULL;
+}
+
+/* Find last sample at the index of a root sample. */
+OmniSample *sample_last(OmniSample *root)
+{
+	return root->num_subs ? root->subs[root->num_subs - 1].sample : root;
+}
+
+/* Get the sample at an exact time, adding it if it doesn't exist (cheapest when loading samples in time order).
+ * New samples are initialized, without blocks for root samples (but with inline blocks for list samples). */
+OmniSample *sample_insert(OmniCache *cache, uint tindex, float_or_uint toffset)
+{
+	OmniSample *root = sample_root_get(cache, tindex, true);
+	OmniSample *sample;
+
+	cache->def.num_samples_array = MAX(cache->def.num_samples_array, tindex + 1);
+
+	if (FU_FL_EQ(toffset, 0.0f)) {
+		sample = root;
 
-	while (prev->next != sample) {
-		prev = prev->next;
+		if (!SAMPLE_IS_SKIPPED(sample)) {
+			return sample;
+		}
 	}
+	else {
+		uint pos = root->num_subs;
+
+		/* Skip the search when appending. */
+		if (pos > 0 && !FU_GT(toffset, root->subs[pos - 1].toffset)) {
+			pos = sample_sub_search(root, toffset);
+
+			if (pos < root->num_subs && FU_EQ(root->subs[pos].toffset, toffset)) {
+				return root->subs[pos].sample;
+			}
+		}
+
+		sample = sample_list_alloc(cache, pos ? root->subs[pos - 1].sample : NULL);
+
+		sample->parent = cache;
+		sample->tindex = tindex;
+		sample->toffset = toffset;
+
+		init_sample_blocks(sample, SAMPLE_LIST_BLOCKS(sample));
+		sample_sub_insert(root, pos, sample);
+	}
+
+	sample_set_status(sample, (OmniSampleStatusFlags)OMNI_STATUS_INITED);
+	sample_unset_status(sample, OMNI_SAMPLE_STATUS_SKIP);
+
+	cache->def.num_samples_tot++;
 
-	return prev;
+	return sample;
 }
 
-/* Find last sample at certain index */
-OmniSample *sample_last(OmniSample *sample)
+/* Allocate a list sample, with room for its blocks.
+ * hint: list sample next to which the new one should be placed in memory (optional). */
+OmniSample *sample_list_alloc(OmniCache *cache, const OmniSample *hint)
 {
-	while (sample->next != NULL) {
-		sample = sample->next;
+	OmniSample *sample;
+
+	if (!cache->sample_pool.elem_size) {
+		mempool_init(&cache->sample_pool,
+		             ALIGN_UP(sizeof(OmniSample), sizeof(void *)) + (sizeof(OmniBlock) * cache->def.num_blocks));
 	}
 
+	sample = mempool_alloc(&cache->sample_pool, hint);
+	sample->status = OMNI_SAMPLE_STATUS_POOLED;
+
+	budget_mem_add(cache, cache->sample_pool.elem_size);
+
 	return sample;
 }
 
-void resize_sample_array(OmniCache *cache, uint size)
+void sample_list_release(OmniSample *sample)
+{
+	OmniCache *cache = sample->parent;
+
+	budget_mem_sub(cache, cache->sample_pool.elem_size);
+
+	mempool_release(&cache->sample_pool, sample);
+}
+
+/* Element count of a block for the sample being written (the count of constant count blocks is only queried once). */
+uint block_write_count(OmniBlockInfo *b_info, void *data)
+{
+	if (!(b_info->def.flags & OMNI_BLOCK_FLAG_CONST_COUNT)) {
+		return b_info->count(data);
+	}
+
+	if (!b_info->ccount) {
+		b_info->ccount = b_info->count(data);
+	}
+
+	return b_info->ccount;
+}
+
+/* Check the element count of a block written directly against the count of constant count blocks,
+ * which it sets if still unknown. */
+bool block_count_valid(OmniBlockInfo *b_info, uint count)
+{
+	if (!(b_info->def.flags & OMNI_BLOCK_FLAG_CONST_COUNT)) {
+		return true;
+	}
+
+	if (!b_info->ccount) {
+		b_info->ccount = count;
+	}
+
+	return count == b_info->ccount;
+}
+
+/* Update the memory accounted to the cache of a data pool, after slabs may have been allocated or freed. */
+static void data_pool_mem_update(OmniDataPool *pool)
 {
-	cache->samples = realloc(cache->samples, sizeof(OmniSample) * size);
+	size_t size = pool->pool.slab_size * pool->pool.num_slabs;
 
-	if (size > cache->num_samples_alloc) {
-		uint start = cache->num_samples_alloc;
-		uint length = size - start;
-		memset(&cache->samples[start], 0, sizeof(OmniSample) * length);
+	if (pool->cache) {
+		if (size > pool->mem) {
+			budget_mem_add(pool->cache, size - pool->mem);
+		}
+		else {
+			budget_mem_sub(pool->cache, pool->mem - size);
+		}
 	}
 
-	cache->num_samples_alloc = size;
+	pool->mem = size;
+}
+
+static void data_pool_unref(OmniDataPool *pool)
+{
+	assert(pool->refs > 0);
+
+	if (--pool->refs == 0) {
+		mempool_free(&pool->pool);
+		free(pool);
+	}
 }
 
-void init_sample_blocks(OmniSample *sample)
+void data_pool_release(OmniDataPool *pool, void *data)
+{
+	mempool_release(&pool->pool, data);
+	data_pool_mem_update(pool);
+	data_pool_unref(pool);
+}
+
+/* Release the data pools of the cache (once no sample uses them, slots held by views keep their pool).
+ * What is left of them is no longer accounted to the cache. */
+void data_pools_free(OmniCache *cache)
+{
+	for (uint i = 0; i < cache->def.num_blocks; i++) {
+		OmniBlockInfo *b_info = &cache->block_index[i];
+
+		if (b_info->pool) {
+			budget_mem_sub(cache, b_info->pool->mem);
+
+			b_info->pool->cache = NULL;
+			b_info->pool->mem = 0;
+
+			data_pool_unref(b_info->pool);
+		}
+
+		b_info->pool = NULL;
+		b_info->ccount = 0;
+	}
+}
+
+/* Allocate the (uninitialized) data of a block for `dcount` elements, replacing none.
+ * Blocks of constant count get a slot of the data pool of the block, next to the data of the `hint` block if possible,
+ * so the data of consecutive samples lies contiguously. */
+void block_data_alloc(OmniBlockInfo *b_info, OmniBlock *block, uint dcount, const OmniBlock *hint)
+{
+	assert(block->data == NULL);
+
+	block->dcount_alloc = dcount;
+
+	if (!(b_info->def.flags & OMNI_BLOCK_FLAG_CONST_COUNT) || !dcount || dcount != b_info->ccount) {
+		block->data = alignalloc((size_t)b_info->def.dsize * dcount, ALIGN_SIZE);
+
+		return;
+	}
+
+	if (!b_info->pool) {
+		b_info->pool = calloc(1, sizeof(OmniDataPool));
+		b_info->pool->refs = 1;
+		b_info->pool->cache = b_info->parent;
+
+		mempool_init(&b_info->pool->pool, ALIGN_UP((size_t)b_info->def.dsize * dcount, ALIGN_SIZE));
+	}
+
+	block->pool = b_info->pool;
+	block->pool->refs++;
+	block->data = mempool_alloc(&block->pool->pool,
+	                            (hint && (hint->status & OMNI_BLOCK_STATUS_POOLED)) ? hint->data : NULL);
+	block->status |= OMNI_BLOCK_STATUS_POOLED;
+
+	data_pool_mem_update(block->pool);
+}
+
+/* Initialize the block array of a sample.
+ * blocks: zeroed memory for `num_blocks` blocks, or NULL to allocate it. */
+void init_sample_blocks(OmniSample *sample, OmniBlock *blocks)
 {
 	if (!sample->blocks) {
 		OmniCache *cache = sample->parent;
 
-		sample->blocks = calloc(cache->def.num_blocks, sizeof(OmniBlock));
+		sample->blocks = blocks ? blocks : calloc(cache->def.num_blocks, sizeof(OmniBlock));
 		sample->num_blocks_invalid = cache->def.num_blocks;
 		sample->num_blocks_outdated = cache->def.num_blocks;
 
@@ -244,6 +654,375 @@ void init_sample_blocks(OmniSample *sample)
 	}
 }
 
+/* Fill an `OmniData` describing the data of a block. */
+void block_data_get(OmniData *omni_data, const OmniBlockInfo *b_info, const OmniBlock *block)
+{
+	omni_data->dtype = b_info->def.dtype;
+	omni_data->dsize = b_info->def.dsize;
+	omni_data->dcount = block->dcount;
+	omni_data->data = block->data;
+}
+
+/* Size of the data of a block before compression (quantized data is smaller than the elements). */
+size_t block_plain_size(const OmniBlockInfo *b_info, OmniBlockStatusFlags status, uint dcount)
+{
+	if (status & OMNI_BLOCK_STATUS_QUANTIZED) {
+		return quant_size(b_info->def.quant, b_info->def.dsize / sizeof(float), dcount);
+	}
+
+	return (size_t)b_info->def.dsize * dcount;
+}
+
+/* Size of the data of a block as stored (compressed or not). */
+size_t block_data_size(const OmniBlockInfo *b_info, const OmniBlock *block)
+{
+	if (block->status & OMNI_BLOCK_STATUS_COMPRESSED) {
+		return block->csize;
+	}
+
+	return block_plain_size(b_info, block->status, block->dcount);
+}
+
+void block_data_free(OmniBlock *block)
+{
+	if (block->status & OMNI_BLOCK_STATUS_ADOPTED) {
+		block->dfree(block->data);
+	}
+	else if (block->status & OMNI_BLOCK_STATUS_SHARED) {
+		dedup_release(block->data);
+	}
+	else if (block->status & OMNI_BLOCK_STATUS_POOLED) {
+		data_pool_release(block->pool, block->data);
+	}
+	else if (block->status & OMNI_BLOCK_STATUS_COLUMN) {
+		column_release(block->column);
+	}
+	else if (block->status & OMNI_BLOCK_STATUS_SPILLED) {
+		mapping_release(block->spill);
+	}
+	else if (!(block->status & (OMNI_BLOCK_STATUS_ARENA | OMNI_BLOCK_STATUS_BORROWED))) {
+		alignfree(block->data);
+	}
+
+	block->data = NULL;
+	block->dfree = NULL;
+	block->dcount_alloc = 0;
+	block->csize = 0;
+	block->status &= ~(OMNI_BLOCK_STATUS_ARENA | OMNI_BLOCK_STATUS_ADOPTED | OMNI_BLOCK_STATUS_BORROWED |
+	                   OMNI_BLOCK_STATUS_SHARED | OMNI_BLOCK_STATUS_POOLED | OMNI_BLOCK_STATUS_COLUMN |
+	                   OMNI_BLOCK_STATUS_SPILLED | OMNI_BLOCK_STATUS_ENCODED);
+}
+
+void meta_data_free(OmniSample *sample)
+{
+	if (sample->meta.status & OMNI_BLOCK_STATUS_SPILLED) {
+		mapping_release(sample->meta.spill);
+	}
+	else if (!(sample->meta.status & (OMNI_BLOCK_STATUS_ARENA | OMNI_BLOCK_STATUS_BORROWED))) {
+		alignfree(sample->meta.data);
+	}
+
+	sample->meta.data = NULL;
+	sample->meta.spill = NULL;
+	sample->meta.status &= ~(OMNI_BLOCK_STATUS_ARENA | OMNI_BLOCK_STATUS_BORROWED | OMNI_BLOCK_STATUS_SPILLED);
+}
+
+/* Ensure the metadata of a sample is allocated (if the cache generates metadata), and writable. */
+void meta_data_alloc(OmniSample *sample)
+{
+	OmniCache *cache = sample->parent;
+
+	if (sample->meta.status & OMNI_BLOCK_STATUS_BORROWED) {
+		meta_data_free(sample);
+	}
+
+	if (cache->meta_gen && !sample->meta.data) {
+		sample->meta.data = alignalloc(cache->def.msize, ALIGN_SIZE);
+	}
+}
+
+/* Allocate the arena of a sample, laid out as follows (each part aligned to `ALIGN_SIZE`):
+ * - The block array (unless the sample already has one);
+ * - The metadata (if the cache has a `meta_gen` callback);
+ * - The data of each block, sized from `OmniBlockInfo.wcount`.
+ * Any previously allocated data is freed. */
+void sample_arena_alloc(OmniSample *sample)
+{
+	OmniCache *cache = sample->parent;
+	bool has_blocks = (sample->blocks != NULL);
+	size_t size = 0;
+	size_t meta_offset;
+	char *arena;
+
+	assert(sample->arena == NULL);
+
+	if (!has_blocks) {
+		size += ALIGN_UP(sizeof(OmniBlock) * cache->def.num_blocks, ALIGN_SIZE);
+	}
+
+	meta_offset = size;
+
+	if (cache->meta_gen) {
+		size += ALIGN_UP(cache->def.msize, ALIGN_SIZE);
+	}
+
+	for (uint i = 0; i < cache->def.num_blocks; i++) {
+		OmniBlockInfo *b_info = &cache->block_index[i];
+
+		size += ALIGN_UP((size_t)b_info->def.dsize * b_info->wcount, ALIGN_SIZE);
+	}
+
+	if (size == 0) {
+		return;
+	}
+
+	arena = alignalloc(size, ALIGN_SIZE);
+	sample->arena = arena;
+
+	if (has_blocks) {
+		for (uint i = 0; i < cache->def.num_blocks; i++) {
+			block_data_free(&sample->blocks[i]);
+		}
+	}
+	else {
+		memset(arena, 0, sizeof(OmniBlock) * cache->def.num_blocks);
+		init_sample_blocks(sample, (OmniBlock *)arena);
+	}
+
+	if (cache->meta_gen) {
+		meta_data_free(sample);
+
+		sample->meta.data = arena + meta_offset;
+		sample->meta.status |= OMNI_BLOCK_STATUS_ARENA;
+	}
+
+	size = meta_offset + (cache->meta_gen ? ALIGN_UP(cache->def.msize, ALIGN_SIZE) : 0);
+
+	for (uint i = 0; i < cache->def.num_blocks; i++) {
+		OmniBlockInfo *b_info = &cache->block_index[i];
+		OmniBlock *block = &sample->blocks[i];
+
+		block->data = arena + size;
+		block->dcount_alloc = b_info->wcount;
+		block->status |= OMNI_BLOCK_STATUS_ARENA;
+
+		size += ALIGN_UP((size_t)b_info->def.dsize * b_info->wcount, ALIGN_SIZE);
+	}
+}
+
+/* Ensure the block data (and metadata) of a sample is allocated (aligned to `ALIGN_SIZE`),
+ * for the element counts reported by the `count` callbacks.
+ * Existing allocations are reused if the new data fits in them. */
+void sample_data_alloc(OmniSample *sample, void *data)
+{
+	OmniCache *cache = sample->parent;
+	OmniSample *prev = NULL;
+
+	/* Viewed data can't be overwritten, nor data others are encoded against. */
+	sample_delta_detach(sample);
+	sample_view_detach(sample);
+
+	for (uint i = 0; i < cache->def.num_blocks; i++) {
+		OmniBlockInfo *b_info = &cache->block_index[i];
+
+		b_info->wcount = block_write_count(b_info, data);
+	}
+
+	if ((cache->def.flags & OMNICACHE_FLAG_ARENA) && !sample->arena) {
+		sample_arena_alloc(sample);
+	}
+
+	init_sample_blocks(sample, NULL);
+
+	for (uint i = 0; i < cache->def.num_blocks; i++) {
+		OmniBlockInfo *b_info = &cache->block_index[i];
+		OmniBlock *block = &sample->blocks[i];
+
+		/* Data grew past its allocation (arena blocks fall back to individual allocations),
+		 * belongs to the user (might not be aligned, or writable), is shared, or is packed. */
+		if (block->data &&
+		    (b_info->wcount > block->dcount_alloc ||
+		     (block->status & (OMNI_BLOCK_STATUS_ADOPTED | OMNI_BLOCK_STATUS_BORROWED | OMNI_BLOCK_STATUS_SHARED |
+		                       OMNI_BLOCK_STATUS_PACKED))))
+		{
+			block_data_free(block);
+		}
+
+		if (!block->data) {
+			if ((b_info->def.flags & OMNI_BLOCK_FLAG_CONST_COUNT) && !prev) {
+				prev = sample_prev(sample);
+			}
+
+			block_data_alloc(b_info, block, b_info->wcount, (prev && prev->blocks) ? &prev->blocks[i] : NULL);
+		}
+
+		block->status &= ~OMNI_BLOCK_STATUS_ENCODED;
+
+		block->dcount = b_info->wcount;
+	}
+
+	meta_data_alloc(sample);
+	sample_mem_update(sample);
+}
+
+/* Free all data in a sample, including blocks and metadata. */
+void sample_data_free(OmniSample *sample)
+{
+	OmniCache *cache = sample->parent;
+
+	sample_view_detach(sample);
+	sample_delta_forget(sample);
+
+	budget_mem_sub(cache, sample->mem);
+	sample->mem = 0;
+
+	if (sample->blocks) {
+		for (uint i = 0; i < cache->def.num_blocks; i++) {
+			block_data_free(&sample->blocks[i]);
+		}
+
+		if ((void *)sample->blocks != sample->arena &&
+		    !(sample->status & OMNI_SAMPLE_STATUS_POOLED))
+		{
+			free(sample->blocks);
+		}
+
+		sample->blocks = NULL;
+	}
+
+	meta_data_free(sample);
+
+	if (sample->arena) {
+		alignfree(sample->arena);
+		sample->arena = NULL;
+	}
+}
+
+/* Free the data of a sample, leaving it initialized but invalid, to be rewritten from scratch. */
+void sample_data_reset(OmniSample *sample)
+{
+	OmniCache *cache = sample->parent;
+
+	sample_data_free(sample);
+
+	if (sample->status & OMNI_SAMPLE_STATUS_POOLED) {
+		memset(SAMPLE_LIST_BLOCKS(sample), 0, sizeof(OmniBlock) * cache->def.num_blocks);
+		init_sample_blocks(sample, SAMPLE_LIST_BLOCKS(sample));
+	}
+
+	meta_unset_status(sample, (OmniBlockStatusFlags)OMNI_STATUS_VALID);
+	sample_unset_status(sample, OMNI_STATUS_VALID | OMNI_SAMPLE_STATUS_ACQUIRED);
+}
+
+/* Replace the data of a sample (shallow copied from another sample) with a deep copy. */
+void sample_data_copy(OmniSample *sample)
+{
+	OmniCache *cache = sample->parent;
+	OmniBlock *blocks = sample->blocks;
+
+	sample->arena = NULL;
+	sample->view = NULL;
+	sample->blocks = NULL;
+
+	if (blocks) {
+		if (sample->status & OMNI_SAMPLE_STATUS_POOLED) {
+			sample->blocks = SAMPLE_LIST_BLOCKS(sample);
+			memcpy(sample->blocks, blocks, sizeof(OmniBlock) * cache->def.num_blocks);
+		}
+		else {
+			sample->blocks = dupalloc(blocks, sizeof(OmniBlock) * cache->def.num_blocks);
+		}
+
+		for (uint i = 0; i < cache->def.num_blocks; i++) {
+			OmniBlock *block = &sample->blocks[i];
+			size_t size = block_data_size(&cache->block_index[i], block);
+
+			block->parent = sample;
+			block->dfree = NULL;
+			block->dcount_alloc = 0;
+			block->status &= ~(OMNI_BLOCK_STATUS_ARENA | OMNI_BLOCK_STATUS_ADOPTED | OMNI_BLOCK_STATUS_BORROWED |
+			                   OMNI_BLOCK_STATUS_POOLED | OMNI_BLOCK_STATUS_COLUMN | OMNI_BLOCK_STATUS_SPILLED);
+
+			/* Shared again in the new cache. */
+			if (block->status & OMNI_BLOCK_STATUS_SHARED) {
+				block->data = dedup_acquire(cache, i, block, size);
+			}
+			else if (block->status & OMNI_BLOCK_STATUS_PACKED) {
+				block->data = aligndup(block->data, size, ALIGN_SIZE);
+			}
+			else if (block->data) {
+				void *data = block->data;
+
+				block->data = NULL;
+				block_data_alloc(&cache->block_index[i], block, block->dcount, NULL);
+				memcpy(block->data, data, size);
+			}
+		}
+	}
+
+	sample->meta.data = aligndup(sample->meta.data, cache->def.msize, ALIGN_SIZE);
+	sample->meta.spill = NULL;
+	sample->meta.status &= ~(OMNI_BLOCK_STATUS_ARENA | OMNI_BLOCK_STATUS_BORROWED | OMNI_BLOCK_STATUS_SPILLED);
+
+	/* Accounted to the new cache. */
+	sample->mem = 0;
+	sample_mem_update(sample);
+}
+
+/* Memory owned by the data of a sample (borrowed and shared data is not, nor pooled data, whose slabs are accounted
+ * by their pool), as accounted against memory budgets. */
+static size_t sample_mem_size(const OmniSample *sample)
+{
+	const OmniCache *cache = sample->parent;
+	size_t size = 0;
+
+	if (sample->blocks) {
+		/* Pooled blocks are part of the index. */
+		if (!(sample->status & OMNI_SAMPLE_STATUS_POOLED)) {
+			size += ALIGN_UP(sizeof(OmniBlock) * cache->def.num_blocks, ALIGN_SIZE);
+		}
+
+		for (uint i = 0; i < cache->def.num_blocks; i++) {
+			const OmniBlock *block = &sample->blocks[i];
+
+			if (!block->data ||
+			    (block->status & (OMNI_BLOCK_STATUS_BORROWED | OMNI_BLOCK_STATUS_SHARED | OMNI_BLOCK_STATUS_POOLED)))
+			{
+				continue;
+			}
+
+			if (block->status & OMNI_BLOCK_STATUS_PACKED) {
+				size += ALIGN_UP(block_data_size(&cache->block_index[i], block), ALIGN_SIZE);
+			}
+			else {
+				size += ALIGN_UP((size_t)cache->block_index[i].def.dsize * block->dcount_alloc, ALIGN_SIZE);
+			}
+		}
+	}
+
+	if (sample->meta.data && !(sample->meta.status & OMNI_BLOCK_STATUS_BORROWED)) {
+		size += ALIGN_UP(cache->def.msize, ALIGN_SIZE);
+	}
+
+	return size;
+}
+
+/* Update the memory accounted to a sample, after its data has been (re)allocated. */
+void sample_mem_update(OmniSample *sample)
+{
+	OmniCache *cache = sample->parent;
+	size_t size = sample_mem_size(sample);
+
+	if (size > sample->mem) {
+		budget_mem_add(cache, size - sample->mem);
+	}
+	else {
+		budget_mem_sub(cache, sample->mem - size);
+	}
+
+	sample->mem = size;
+}
+
 void block_info_init(OmniCache *cache, const OmniCacheTemplate *cache_temp,
                      const uint target_index, const uint source_index)
 {
@@ -255,6 +1034,19 @@ void block_info_init(OmniCache *cache, const OmniCacheTemplate *cache_temp,
 
 	b_info->def.dtype = b_temp->data_type;
 	b_info->def.flags = b_temp->flags;
+	b_info->def.imode = b_temp->interp_mode;
+	b_info->def.codec = b_temp->codec;
+	b_info->def.delta_interval = b_temp->delta_interval;
+	b_info->def.quant = OMNI_QUANT_NONE;
+	b_info->def.quant_error = b_temp->quant_error;
+
+	/* Only floats can be quantized, and fixed point needs an error bound. */
+	if ((b_temp->data_type == OMNI_DATA_FLOAT || b_temp->data_type == OMNI_DATA_FLOAT3 ||
+	     b_temp->data_type == OMNI_DATA_MAT3 || b_temp->data_type == OMNI_DATA_MAT4) &&
+	    (b_temp->quantization != OMNI_QUANT_FIXED || b_temp->quant_error > 0.0f))
+	{
+		b_info->def.quant = b_temp->quantization;
+	}
 
 	b_info->def.dsize = DATA_SIZE(b_temp->data_type, b_temp->data_size);
 
@@ -268,6 +1060,12 @@ void block_info_init(OmniCache *cache, const OmniCacheTemplate *cache_temp,
 	b_info->read = b_temp->read;
 	b_info->write = b_temp->write;
 	b_info->interp = b_temp->interp;
+
+	b_info->ccount = 0;
+	b_info->pool = NULL;
+
+	b_info->delta_sample = NULL;
+	memset(&b_info->delta_data, 0, sizeof(codec_buffer));
 }
 
 void block_info_array_init(OmniCache *cache, const OmniCacheTemplate *cache_temp, bool *mask)
@@ -281,23 +1079,6 @@ void block_info_array_init(OmniCache *cache, const OmniCacheTemplate *cache_temp
 	}
 }
 
-void update_block_parents(OmniCache *cache)
-{
-	for (uint i = 0; i < cache->def.num_samples_array; i++) {
-		OmniSample *samp = &cache->samples[i];
-
-		do {
-			if (samp->blocks) {
-				for (uint j = 0; j < cache->def.num_blocks; j++) {
-					samp->blocks[j].parent = samp;
-				}
-			}
-
-			samp = samp->next;
-		} while (samp);
-	}
-}
-
 static bool strcmp_delim(const char *str, const char *sub, char delim, uint *index)
 {
 	str += *index;
@@ -14,10 +14,18 @@
 #define IS_CURRENT(object) (IS_VALID(object) && (object->status & OMNI_STATUS_CURRENT))
 
 #define SAMPLE_IS_ROOT(sample) FU_FL_EQ(sample->toffset, 0.0f)
+#define SAMPLE_ROOT(sample) sample_root_get((sample)->parent, (sample)->tindex, false)
+#define SAMPLE_FIRST(cache) sample_root_next(cache, 0)
 #define SAMPLE_IS_SKIPPED(sample) (sample->status & OMNI_SAMPLE_STATUS_SKIP)
 #define SAMPLE_IS_VALID(sample) (IS_VALID(sample) && !(sample->status & OMNI_SAMPLE_STATUS_SKIP) && (sample->num_blocks_invalid == 0))
+#define META_IS_VALID(sample) ((sample)->meta.data && ((sample)->meta.status & OMNI_STATUS_VALID))
 #define SAMPLE_IS_CURRENT(sample) (SAMPLE_IS_VALID(sample) && (sample->status & OMNI_STATUS_CURRENT) && (sample->num_blocks_outdated == 0))
 
+/* Number of root samples per page of the root sample index. */
+#define SAMPLE_PAGE_SIZE 64
+
+#define SAMPLE_LIST_BLOCKS(sample) ((OmniBlock *)((char *)(sample) + ALIGN_UP(sizeof(OmniSample), sizeof(void *))))
+
 #define TTYPE_VALID(ttype) (ttype != OMNI_TIME_INVALID)
 #define TTYPE_FLOAT(ttype) (ttype == OMNI_TIME_FLOAT)
 #define TTYPE_INT(ttype) (ttype == OMNI_TIME_INT)
@@ -38,16 +46,52 @@ void cache_unset_status(OmniCache *cache, OmniCacheStatusFlags status);
 
 sample_time gen_sample_time(OmniCache *cache, float_or_uint time);
 
-void samples_iterate(OmniSample *start, iter_callback list, iter_callback root, iter_callback first);
-OmniSample *sample_prev(OmniSample *sample);
-OmniSample *sample_last(OmniSample *sample);
+float_or_uint sample_time_get(const OmniSample *sample);
+
+void samples_iterate(OmniSample *start, iter_callback list, iter_callback root);
 
-void resize_sample_array(OmniCache *cache, uint size);
-void init_sample_blocks(OmniSample *sample);
+OmniSample *sample_root_get(OmniCache *cache, uint index, bool create);
+OmniSample *sample_root_prev(OmniCache *cache, uint index);
+OmniSample *sample_root_next(const OmniCache *cache, uint index);
+void samples_trim(OmniCache *cache);
+
+uint sample_sub_search(const OmniSample *root, float_or_uint offset);
+uint sample_sub_position(const OmniSample *sample);
+void sample_sub_insert(OmniSample *root, uint pos, OmniSample *sample);
+void sample_sub_remove(OmniSample *root, uint pos, uint count);
+
+OmniSample *sample_prev(OmniSample *sample);
+OmniSample *sample_next(OmniSample *sample);
+OmniSample *sample_last_before(OmniCache *cache, uint index);
+OmniSample *sample_last(OmniSample *root);
+
+OmniSample *sample_insert(OmniCache *cache, uint tindex, float_or_uint toffset);
+OmniSample *sample_list_alloc(OmniCache *cache, const OmniSample *hint);
+void sample_list_release(OmniSample *sample);
+
+uint block_write_count(OmniBlockInfo *b_info, void *data);
+bool block_count_valid(OmniBlockInfo *b_info, uint count);
+void data_pool_release(OmniDataPool *pool, void *data);
+void data_pools_free(OmniCache *cache);
+
+void init_sample_blocks(OmniSample *sample, OmniBlock *blocks);
+void block_data_get(OmniData *omni_data, const OmniBlockInfo *b_info, const OmniBlock *block);
+size_t block_plain_size(const OmniBlockInfo *b_info, OmniBlockStatusFlags status, uint dcount);
+size_t block_data_size(const OmniBlockInfo *b_info, const OmniBlock *block);
+void block_data_alloc(OmniBlockInfo *b_info, OmniBlock *block, uint dcount, const OmniBlock *hint);
+void block_data_free(OmniBlock *block);
+void meta_data_free(OmniSample *sample);
+void meta_data_alloc(OmniSample *sample);
+
+void sample_arena_alloc(OmniSample *sample);
+void sample_data_alloc(OmniSample *sample, void *data);
+void sample_data_free(OmniSample *sample);
+void sample_data_reset(OmniSample *sample);
+void sample_data_copy(OmniSample *sample);
+void sample_mem_update(OmniSample *sample);
 
 void block_info_init(OmniCache *cache, const OmniCacheTemplate *cache_temp, const uint target_index, const uint source_index);
 void block_info_array_init(OmniCache *cache, const OmniCacheTemplate *cache_temp, bool *mask);
-void update_block_parents(OmniCache *cache);
 
 bool block_id_in_str(const char id_str[], const char id[]);
 bool *block_id_mask(const OmniCacheTemplate *cache_temp, const char id_str[], uint *num_blocks);
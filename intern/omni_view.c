@@ -0,0 +1,273 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include "omni_view.h"
+
+#include "omni_budget.h"
+#include "omni_codec.h"
+#include "omni_dedup.h"
+#include "omni_utils.h"
+
+/* Get the view of a (valid) sample, creating it if needed.
+ * Returns NULL if encoded data of the sample can't be decoded. */
+OmniView *view_acquire(OmniSample *sample)
+{
+	OmniCache *cache = sample->parent;
+	OmniView *view = sample->view;
+
+	if (view) {
+		view->users++;
+
+		return view;
+	}
+
+	view = calloc(1, sizeof(OmniView) + (sizeof(OmniData) * cache->def.num_blocks));
+
+	view->sample = sample;
+	view->users = 1;
+	view->meta = sample->meta.data;
+	view->msize = cache->def.msize;
+	view->num_blocks = cache->def.num_blocks;
+
+	/* Data moved to a spill file, or borrowed from the cache file. */
+	view->map = budget_sample_mapping(sample);
+
+	if (!view->map) {
+		view->map = cache->map;
+	}
+
+	if (view->map) {
+		mapping_ref(view->map);
+	}
+
+	for (uint i = 0; i < cache->def.num_blocks; i++) {
+		OmniBlockInfo *b_info = &cache->block_index[i];
+		OmniBlock *block = &sample->blocks[i];
+
+		block_data_get(&view->blocks[i], b_info, block);
+
+		/* Views always expose decoded data, which they own. */
+		if (block->status & OMNI_BLOCK_STATUS_ENCODED) {
+			OmniBlock decoded = {.data = block_data_decode_dup(b_info, block)};
+
+			if (!decoded.data) {
+				view_release(view);
+
+				return NULL;
+			}
+
+			view->blocks[i].data = decoded.data;
+			view->owned = realloc(view->owned, sizeof(OmniBlock) * (view->num_owned + 1));
+			view->owned[view->num_owned++] = decoded;
+		}
+	}
+
+	sample->view = view;
+
+	return view;
+}
+
+void view_release(OmniView *view)
+{
+	assert(view->users > 0);
+
+	if (--view->users > 0) {
+		return;
+	}
+
+	if (view->sample) {
+		view->sample->view = NULL;
+	}
+
+	for (uint i = 0; i < view->num_owned; i++) {
+		block_data_free(&view->owned[i]);
+	}
+
+	free(view->owned);
+	alignfree(view->meta_owned);
+	alignfree(view->arena);
+
+	if (view->map) {
+		mapping_release(view->map);
+	}
+
+	free(view);
+}
+
+/* Take over the data of a block (arena data is owned through `OmniView.arena`, and borrowed data not at all,
+ * spill files being kept mapped through `OmniView.map`). */
+static void view_own_block(OmniView *view, OmniBlock *block)
+{
+	if (block->status & OMNI_BLOCK_STATUS_SPILLED) {
+		mapping_release(block->spill);
+	}
+	else if (block->data && !(block->status & (OMNI_BLOCK_STATUS_ARENA | OMNI_BLOCK_STATUS_BORROWED))) {
+		view->owned = realloc(view->owned, sizeof(OmniBlock) * (view->num_owned + 1));
+		view->owned[view->num_owned++] = *block;
+	}
+
+	block->data = NULL;
+	block->dcount_alloc = 0;
+	block->csize = 0;
+	block->status &= ~(OMNI_BLOCK_STATUS_ARENA | OMNI_BLOCK_STATUS_ADOPTED | OMNI_BLOCK_STATUS_BORROWED |
+	                   OMNI_BLOCK_STATUS_SHARED | OMNI_BLOCK_STATUS_POOLED | OMNI_BLOCK_STATUS_COLUMN |
+	                   OMNI_BLOCK_STATUS_SPILLED | OMNI_BLOCK_STATUS_ENCODED);
+}
+
+/* Free the data of a block, unless it is pinned by a view.
+ * As the view can no longer follow the sample once part of its data is replaced, it takes over all the data,
+ * and the sample keeps copies of its other blocks. */
+void block_data_detach(OmniBlock *block)
+{
+	OmniSample *sample = block->parent;
+	OmniCache *cache = sample->parent;
+	OmniView *view = sample->view;
+	OmniBlock *copies;
+	OmniMetaBlock meta_copy;
+
+	if (!view) {
+		block_data_free(block);
+
+		return;
+	}
+
+	view_own_block(view, block);
+
+	copies = calloc(cache->def.num_blocks, sizeof(OmniBlock));
+
+	for (uint i = 0; i < cache->def.num_blocks; i++) {
+		const OmniBlock *other = &sample->blocks[i];
+
+		copies[i] = *other;
+
+		/* Shared data is not copied, only referenced again, and borrowed data stays borrowed
+		 * (spill files being kept mapped by a reference of their own). */
+		if (other->status & OMNI_BLOCK_STATUS_SHARED) {
+			copies[i].data = dedup_ref(other->data);
+		}
+		else if (other->status & OMNI_BLOCK_STATUS_BORROWED) {
+			if (other->status & OMNI_BLOCK_STATUS_SPILLED) {
+				mapping_ref(other->spill);
+			}
+		}
+		else if (other->status & OMNI_BLOCK_STATUS_POOLED) {
+			copies[i].data = NULL;
+			copies[i].status &= ~OMNI_BLOCK_STATUS_POOLED;
+
+			block_data_alloc(&cache->block_index[i], &copies[i], other->dcount, other);
+			memcpy(copies[i].data, other->data, block_data_size(&cache->block_index[i], other));
+		}
+		else {
+			copies[i].data = aligndup(other->data, block_data_size(&cache->block_index[i], other), ALIGN_SIZE);
+			copies[i].status &= ~(OMNI_BLOCK_STATUS_POOLED | OMNI_BLOCK_STATUS_COLUMN);
+		}
+	}
+
+	meta_copy = sample->meta;
+
+	if (meta_copy.status & OMNI_BLOCK_STATUS_SPILLED) {
+		mapping_ref(meta_copy.spill);
+	}
+	else if (!(meta_copy.status & OMNI_BLOCK_STATUS_BORROWED)) {
+		meta_copy.data = aligndup(sample->meta.data, cache->def.msize, ALIGN_SIZE);
+		meta_copy.status &= ~OMNI_BLOCK_STATUS_ARENA;
+	}
+
+	sample_view_detach(sample);
+
+	for (uint i = 0; i < cache->def.num_blocks; i++) {
+		OmniBlock *other = &sample->blocks[i];
+
+		if (copies[i].data) {
+			other->data = copies[i].data;
+			other->csize = copies[i].csize;
+			other->status |= copies[i].status & (OMNI_BLOCK_STATUS_BORROWED | OMNI_BLOCK_STATUS_SPILLED |
+			                                     OMNI_BLOCK_STATUS_SHARED | OMNI_BLOCK_STATUS_POOLED |
+			                                     OMNI_BLOCK_STATUS_ENCODED);
+			other->dcount_alloc = other->dcount;
+
+			if (other->status & OMNI_BLOCK_STATUS_POOLED) {
+				other->pool = copies[i].pool;
+			}
+			else if (other->status & OMNI_BLOCK_STATUS_SPILLED) {
+				other->spill = copies[i].spill;
+			}
+
+			if (other->status & (OMNI_BLOCK_STATUS_PACKED | OMNI_BLOCK_STATUS_SHARED)) {
+				other->dcount_alloc = 0;
+			}
+		}
+	}
+
+	/* Metadata regenerated in the meantime is kept. */
+	if (!sample->meta.data) {
+		sample->meta.data = meta_copy.data;
+		sample->meta.spill = meta_copy.spill;
+		sample->meta.status |= meta_copy.status & (OMNI_BLOCK_STATUS_BORROWED | OMNI_BLOCK_STATUS_SPILLED);
+	}
+	else if (meta_copy.status & OMNI_BLOCK_STATUS_SPILLED) {
+		mapping_release(meta_copy.spill);
+	}
+	else if (!(meta_copy.status & OMNI_BLOCK_STATUS_BORROWED)) {
+		alignfree(meta_copy.data);
+	}
+
+	free(copies);
+}
+
+/* Release the metadata of a sample before it is regenerated, unless the view still uses it. */
+void meta_data_detach(OmniSample *sample)
+{
+	OmniView *view = sample->view;
+
+	if (view && sample->meta.data && sample->meta.data == view->meta) {
+		if (sample->meta.status & OMNI_BLOCK_STATUS_SPILLED) {
+			mapping_release(sample->meta.spill);
+		}
+		else if (!(sample->meta.status & (OMNI_BLOCK_STATUS_ARENA | OMNI_BLOCK_STATUS_BORROWED))) {
+			view->meta_owned = sample->meta.data;
+		}
+
+		sample->meta.data = NULL;
+		sample->meta.spill = NULL;
+		sample->meta.status &= ~(OMNI_BLOCK_STATUS_ARENA | OMNI_BLOCK_STATUS_BORROWED | OMNI_BLOCK_STATUS_SPILLED);
+	}
+}
+
+/* Hand the data of a sample over to its view (if any), leaving the sample without viewed data.
+ * Must be called before the data of a sample is freed or overwritten. */
+void sample_view_detach(OmniSample *sample)
+{
+	OmniCache *cache = sample->parent;
+	OmniView *view = sample->view;
+
+	if (!view) {
+		return;
+	}
+
+	if (sample->blocks) {
+		for (uint i = 0; i < cache->def.num_blocks; i++) {
+			view_own_block(view, &sample->blocks[i]);
+		}
+
+		/* The block array itself stays with the sample. */
+		if ((void *)sample->blocks == sample->arena) {
+			sample->blocks = dupalloc(sample->blocks, sizeof(OmniBlock) * cache->def.num_blocks);
+		}
+	}
+
+	meta_data_detach(sample);
+
+	/* Arena metadata goes with the arena. */
+	if (sample->meta.status & OMNI_BLOCK_STATUS_ARENA) {
+		sample->meta.data = NULL;
+		sample->meta.status &= ~OMNI_BLOCK_STATUS_ARENA;
+	}
+
+	view->arena = sample->arena;
+	sample->arena = NULL;
+
+	view->sample = NULL;
+	sample->view = NULL;
+}
@@ -0,0 +1,16 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#ifndef __OMNI_OMNI_VIEW_H__
+#define __OMNI_OMNI_VIEW_H__
+
+#include "omni_types.h"
+
+OmniView *view_acquire(OmniSample *sample);
+void view_release(OmniView *view);
+void block_data_detach(OmniBlock *block);
+void meta_data_detach(OmniSample *sample);
+void sample_view_detach(OmniSample *sample);
+
+#endif /* __OMNI_OMNI_VIEW_H__ */
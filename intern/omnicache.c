@@ -5,15 +5,26 @@
 #include "omnicache.h"
 
 #include "omni_utils.h"
+#include "omni_interp.h"
 #include "omni_serial.h"
+#include "omni_file.h"
+#include "omni_journal.h"
+#include "omni_load.h"
+#include "omni_prefetch.h"
+#include "omni_budget.h"
+#include "omni_codec.h"
+#include "omni_column.h"
+#include "omni_dedup.h"
+#include "omni_view.h"
 
 static OmniSample *sample_get(OmniCache *cache, sample_time stime, bool create,
                               OmniSample **prev, OmniSample **next)
 {
-#define ASS_PREV(cache, index) (index > 0 ? sample_last(&cache->samples[index - 1]) : NULL)
-#define ASS_NEXT(next, cache, nindex) (next ? next : (nindex < cache->def.num_samples_array ? &cache->samples[nindex] : NULL))
+#define ASS_PREV(cache, index) sample_last_before(cache, index)
+#define ASS_NEXT(root, pos, cache, nindex) ((pos) < (root)->num_subs ? (root)->subs[pos].sample : sample_root_next(cache, nindex))
 
 	OmniSample *sample = NULL;
+	OmniSample *root = NULL;
 
 	if (prev) {
 		*prev = NULL;
@@ -27,39 +38,24 @@ static OmniSample *sample_get(OmniCache *cache, sample_time stime, bool create,
 		return NULL;
 	}
 
-	if (stime.index >= cache->num_samples_alloc) {
-		if (create) {
-			resize_sample_array(cache, min_array_size(stime.index));
+	if (stime.index < cache->def.num_samples_array || create) {
+		root = sample_root_get(cache, stime.index, create);
+	}
 
-			update_block_parents(cache);
+	if (!root) {
+		if (prev) {
+			*prev = ASS_PREV(cache, stime.index);
 		}
-		else {
-			if (prev) {
-				*prev = ASS_PREV(cache, cache->def.num_samples_array);
-			}
 
-			return NULL;
+		if (next) {
+			*next = sample_root_next(cache, stime.index + 1);
 		}
+
+		return NULL;
 	}
 
-	/* Increment array sample count until required sample, initializing all samples along the way. */
 	if (cache->def.num_samples_array <= stime.index) {
-		if (create) {
-			for (; cache->def.num_samples_array <= stime.index; cache->def.num_samples_array++) {
-				OmniSample *samp = &cache->samples[cache->def.num_samples_array];
-
-				samp->parent = cache;
-				samp->tindex = cache->def.num_samples_array;
-				sample_set_status(samp, OMNI_SAMPLE_STATUS_SKIP);
-			}
-		}
-		else {
-			if (prev) {
-				*prev = ASS_PREV(cache, cache->def.num_samples_array);
-			}
-
-			return NULL;
-		}
+		cache->def.num_samples_array = stime.index + 1;
 	}
 
 	/* Find or add sample. */
@@ -67,8 +63,8 @@ static OmniSample *sample_get(OmniCache *cache, sample_time stime, bool create,
 		bool new = false;
 
 		if (FU_FL_EQ(stime.offset, 0.0f)) {
-			/* Sample is at time zero (i.e. sits directly in the array). */
-			sample = &cache->samples[stime.index];
+			/* Sample is at time zero (i.e. sits directly in the index). */
+			sample = root;
 
 			if (SAMPLE_IS_SKIPPED(sample)) {
 				new = true;
@@ -77,15 +73,15 @@ static OmniSample *sample_get(OmniCache *cache, sample_time stime, bool create,
 			if (prev) {
 				*prev = ASS_PREV(cache, stime.index);
 			}
-		}
-		else {
-			OmniSample *p = &cache->samples[stime.index];
-			OmniSample *n = p->next;
 
-			while (n && FU_LT(n->toffset, stime.offset)) {
-				p = n;
-				n = n->next;
+			if (next) {
+				*next = ASS_NEXT(sample, 0, cache, stime.index + 1);
 			}
+		}
+		else {
+			uint pos = sample_sub_search(root, stime.offset);
+			OmniSample *n = (pos < root->num_subs) ? root->subs[pos].sample : NULL;
+			OmniSample *p = (pos > 0) ? root->subs[pos - 1].sample : root;
 
 			if (prev) {
 				*prev = p;
@@ -96,33 +92,38 @@ static OmniSample *sample_get(OmniCache *cache, sample_time stime, bool create,
 				sample = n;
 			}
 			else if (create) {
-				/* New sample should be created. */
-				sample = calloc(1, sizeof(OmniSample));
+				/* New sample should be created (next to its neighbours in memory). */
+				sample = sample_list_alloc(cache, SAMPLE_IS_ROOT(p) ? n : p);
 				sample->toffset = stime.offset;
 
-				p->next = sample;
-				sample->next = n;
+				sample_sub_insert(root, pos, sample);
 
 				new = true;
 			}
 			else {
 				if (next) {
-					*next = ASS_NEXT(n, cache, stime.index + 1);
+					*next = ASS_NEXT(root, pos, cache, stime.index + 1);
 				}
 
 				return NULL;
 			}
-		}
 
-		if (next) {
-			*next = ASS_NEXT(sample->next, cache, stime.index + 1);
+			if (next) {
+				*next = ASS_NEXT(root, pos + 1, cache, stime.index + 1);
+			}
 		}
 
 		if (new) {
 			sample->parent = cache;
 			sample->tindex = stime.index;
 
-			init_sample_blocks(sample);
+			/* Arena samples get their blocks on first write, once the data size is known. */
+			if (sample->status & OMNI_SAMPLE_STATUS_POOLED) {
+				init_sample_blocks(sample, SAMPLE_LIST_BLOCKS(sample));
+			}
+			else if (!(cache->def.flags & OMNICACHE_FLAG_ARENA)) {
+				init_sample_blocks(sample, NULL);
+			}
 
 			sample_set_status(sample, OMNI_STATUS_INITED);
 			sample_unset_status(sample, OMNI_SAMPLE_STATUS_SKIP);
@@ -146,27 +147,39 @@ static OmniSample *sample_get_from_time(OmniCache *cache, float_or_uint time, bo
 	return sample_get(cache, stime, create, prev, next);
 }
 
-/* Free all blocks in a sample (also frees metadata) */
-static void blocks_free(OmniSample *sample)
+/* First sample (valid or not) at or after `time`, or NULL. */
+static OmniSample *sample_first_from(OmniCache *cache, float_or_uint time)
 {
-	OmniCache *cache = sample->parent;
+	OmniSample *sample, *next;
 
-	if (sample->blocks) {
-		for (uint i = 0; i < cache->def.num_blocks; i++) {
-			free(sample->blocks[i].data);
-		}
-
-		free(sample->blocks);
-		sample->blocks = NULL;
+	if (FU_LT(time, cache->def.tinitial)) {
+		time = cache->def.tinitial;
 	}
 
-	if (sample->meta.data) {
-		free(sample->meta.data);
-		sample->meta.data = NULL;
+	sample = sample_get_from_time(cache, time, false, NULL, &next);
+
+	return sample ? sample : next;
+}
+
+/* First valid sample from `sample` (included) up to `time_end`, or NULL. */
+static OmniSample *sample_valid_until(OmniSample *sample, float_or_uint time_end)
+{
+	for (; sample && !FU_GT(sample_time_get(sample), time_end); sample = sample_next(sample)) {
+		if (SAMPLE_IS_VALID(sample)) {
+			return sample;
+		}
 	}
 
+	return NULL;
+}
+
+/* Free all blocks in a sample (also frees metadata) */
+static void blocks_free(OmniSample *sample)
+{
+	sample_data_free(sample);
+
 	meta_unset_status(sample, OMNI_STATUS_VALID);
-	sample_unset_status(sample, OMNI_STATUS_VALID);
+	sample_unset_status(sample, OMNI_STATUS_VALID | OMNI_SAMPLE_STATUS_ACQUIRED);
 }
 
 /* Sample iterator helpers */
@@ -181,22 +194,13 @@ static void sample_mark_invalid(OmniSample *sample)
 	sample_unset_status(sample, OMNI_STATUS_VALID);
 }
 
-static void sample_clear_ref(OmniSample *sample)
-{
-	if (!SAMPLE_IS_ROOT(sample)) {
-		OmniSample *prev = sample_prev(sample);
-
-		prev->next = NULL;
-	}
-}
-
 static void sample_remove_list(OmniSample *sample)
 {
 	blocks_free(sample);
 
 	sample->parent->def.num_samples_tot--;
 
-	free(sample);
+	sample_list_release(sample);
 }
 
 static void sample_remove_root(OmniSample *sample)
@@ -210,21 +214,56 @@ static void sample_remove_root(OmniSample *sample)
 	}
 }
 
+/* Remove the list samples of `root` from position `pos` onwards. */
+static void subs_remove_from(OmniSample *root, uint pos)
+{
+	for (uint i = pos; i < root->num_subs; i++) {
+		sample_remove_list(root->subs[i].sample);
+	}
+
+	if (pos < root->num_subs) {
+		sample_sub_remove(root, pos, root->num_subs - pos);
+	}
+}
+
 static void sample_remove(OmniSample *sample)
 {
 	if (sample) {
+		sample_delta_detach(sample);
+
 		if (SAMPLE_IS_ROOT(sample)) {
 			sample_remove_root(sample);
 		}
 		else {
-			OmniSample *prev = sample_prev(sample);
-			prev->next = sample->next;
+			sample_sub_remove(SAMPLE_ROOT(sample), sample_sub_position(sample), 1);
 
 			sample_remove_list(sample);
 		}
 	}
 }
 
+/* Remove all samples from `start` onwards. */
+static void samples_remove_from(OmniSample *start)
+{
+	OmniCache *cache = start->parent;
+	OmniSample *root = SAMPLE_ROOT(start);
+
+	if (SAMPLE_IS_ROOT(start)) {
+		sample_remove_root(root);
+		subs_remove_from(root, 0);
+	}
+	else {
+		subs_remove_from(root, sample_sub_position(start));
+	}
+
+	for (root = sample_root_next(cache, start->tindex + 1); root; root = sample_root_next(cache, root->tindex + 1)) {
+		sample_remove_root(root);
+		subs_remove_from(root, 0);
+	}
+
+	samples_trim(cache);
+}
+
 static void sample_remove_invalid(OmniSample *sample)
 {
 	if (!SAMPLE_IS_VALID(sample)) {
@@ -242,14 +281,34 @@ static void sample_remove_outdated(OmniSample *sample)
 
 static void samples_free(OmniCache *cache)
 {
-	if (cache->samples) {
-		samples_iterate(cache->samples, sample_remove_list, blocks_free, NULL);
+	/* List samples are released all at once with the pool. */
+	samples_iterate(SAMPLE_FIRST(cache), blocks_free, blocks_free);
+
+	for (uint page = 0; page < cache->num_pages; page++) {
+		OmniSample *samples = cache->pages[page];
+
+		if (samples) {
+			for (uint i = 0; i < SAMPLE_PAGE_SIZE; i++) {
+				free(samples[i].subs);
+			}
 
-		free(cache->samples);
-		cache->samples = NULL;
+			free(samples);
+		}
 	}
 
-	cache->num_samples_alloc = 0;
+	free(cache->pages);
+	cache->pages = NULL;
+
+	mempool_free(&cache->sample_pool);
+	codec_buffers_free(cache);
+	dedup_free(cache);
+	data_pools_free(cache);
+
+	/* All that is left accounted is the index just freed. */
+	budget_mem_sub(cache, cache->mem_used);
+	budget_spill_reset(cache);
+
+	cache->num_pages = 0;
 	cache->def.num_samples_array = 0;
 	cache->def.num_samples_tot = 0;
 
@@ -324,42 +383,78 @@ OmniCache *OMNI_duplicate(const OmniCache *source, bool copy_data)
 
 		for (uint i = 0; i < cache->def.num_blocks; i++) {
 			cache->block_index[i].parent = cache;
+			cache->block_index[i].delta_sample = NULL;
+			cache->block_index[i].pool = NULL;
+			cache->block_index[i].ccount = copy_data ? cache->block_index[i].ccount : 0;
+			memset(&cache->block_index[i].delta_data, 0, sizeof(codec_buffer));
 		}
 	}
 
-	if (copy_data) {
-		cache->samples = dupalloc(cache->samples, sizeof(OmniSample) * cache->num_samples_alloc);
+	memset(&cache->sample_pool, 0, sizeof(mempool));
 
-		for (uint i = 0; i < cache->def.num_samples_array; i++) {
-			OmniSample *sample = &cache->samples[i];
+	/* Borrowed data is copied. */
+	cache->map = NULL;
+	cache->journal = NULL;
+	cache->loader = NULL;
+	cache->prefetch = NULL;
+	cache->budget = NULL;
+	cache->dedup = NULL;
+	memset(cache->read_buffers, 0, sizeof(cache->read_buffers));
+	memset(cache->work_buffers, 0, sizeof(cache->work_buffers));
+	memset(&cache->interp_buffer, 0, sizeof(codec_buffer));
 
-			do {
-				sample->parent = cache;
+	/* Accounted again as the data is copied. */
+	cache->mem_used = 0;
 
-				sample->blocks = dupalloc(sample->blocks, sizeof(OmniBlock) * cache->def.num_blocks);
+	if (copy_data) {
+		cache->pages = dupalloc(cache->pages, sizeof(OmniSample *) * cache->num_pages);
+
+		budget_mem_add(cache, sizeof(OmniSample *) * cache->num_pages);
 
-				for (uint j = 0; j < cache->def.num_blocks; j++) {
-					OmniBlock *block = &sample->blocks[j];
+		for (uint page = 0; page < cache->num_pages; page++) {
+			OmniSample *samples = dupalloc(cache->pages[page], sizeof(OmniSample) * SAMPLE_PAGE_SIZE);
 
-					block->parent = sample;
-					block->data = dupalloc(block->data, cache->block_index[j].def.dsize * block->dcount);
+			if (samples) {
+				for (uint i = 0; i < SAMPLE_PAGE_SIZE; i++) {
+					samples[i].parent = cache;
 				}
 
-				sample->next = dupalloc(sample->next, sizeof(OmniSample));
+				budget_mem_add(cache, sizeof(OmniSample) * SAMPLE_PAGE_SIZE);
+			}
+
+			cache->pages[page] = samples;
+		}
+
+		for (OmniSample *sample = SAMPLE_FIRST(cache); sample; sample = sample_root_next(cache, sample->tindex + 1)) {
+			sample_data_copy(sample);
+
+			sample->subs = dupalloc(sample->subs, sizeof(OmniSampleRef) * sample->num_subs_alloc);
+
+			budget_mem_add(cache, sizeof(OmniSampleRef) * sample->num_subs_alloc);
+
+			for (uint j = 0; j < sample->num_subs; j++) {
+				OmniSample *src = sample->subs[j].sample;
+				OmniSample *dst = sample_list_alloc(cache, j ? sample->subs[j - 1].sample : NULL);
+
+				memcpy(dst, src, sizeof(OmniSample));
 
-				sample = sample->next;
-			} while (sample);
+				dst->parent = cache;
+
+				sample_data_copy(dst);
+
+				sample->subs[j].sample = dst;
+			}
 		}
 	}
 	else {
 		cache_set_status(cache, OMNI_STATUS_CURRENT);
 		cache_unset_status(cache, OMNI_CACHE_STATUS_COMPLETE);
 
-		cache->num_samples_alloc = 0;
+		cache->num_pages = 0;
 		cache->def.num_samples_array = 0;
 		cache->def.num_samples_tot = 0;
 
-		cache->samples = NULL;
+		cache->pages = NULL;
 	}
 
 	return cache;
@@ -367,7 +462,15 @@ OmniCache *OMNI_duplicate(const OmniCache *source, bool copy_data)
 
 void OMNI_free(OmniCache *cache)
 {
+	journal_stop(cache);
+	prefetch_free(cache);
+	loader_free(cache);
 	samples_free(cache);
+	budget_free(cache);
+
+	if (cache->map) {
+		mapping_release(cache->map);
+	}
 
 	free(cache->block_index);
 	free(cache);
@@ -388,6 +491,7 @@ void OMNI_blocks_add(OmniCache *cache, const OmniCacheTemplate *cache_temp, cons
 		}
 	}
 
+	journal_stop(cache);
 	samples_free(cache);
 
 	cache->def.num_blocks = count;
@@ -412,6 +516,7 @@ void OMNI_blocks_remove(OmniCache *cache, const char blocks[])
 		}
 	}
 
+	journal_stop(cache);
 	samples_free(cache);
 
 	block_index = malloc(sizeof(OmniBlockInfo) * num_blocks);
@@ -432,6 +537,7 @@ void OMNI_blocks_set(OmniCache *cache, const OmniCacheTemplate *cache_temp, cons
 {
 	bool *mask;
 
+	journal_stop(cache);
 	samples_free(cache);
 	free(cache->block_index);
 
@@ -457,6 +563,7 @@ void OMNI_block_add_by_index(OmniCache *cache, const OmniCacheTemplate *cache_te
 		return;
 	}
 
+	journal_stop(cache);
 	samples_free(cache);
 
 	block_index = malloc(sizeof(OmniBlockInfo) * (cache->def.num_blocks + 1));
@@ -491,6 +598,7 @@ void OMNI_block_remove_by_index(OmniCache *cache, const uint block)
 		return;
 	}
 
+	journal_stop(cache);
 	samples_free(cache);
 
 	cache->def.num_blocks--;
@@ -508,6 +616,38 @@ void OMNI_block_remove_by_index(OmniCache *cache, const uint block)
 	cache->block_index = block_index;
 }
 
+/* Generate the metadata of a sample whose blocks have been written, and validate it. */
+static OmniWriteResult sample_write_finish(OmniSample *sample, void *data)
+{
+	OmniCache *cache = sample->parent;
+
+	sample_unset_status(sample, OMNI_SAMPLE_STATUS_ACQUIRED);
+
+	sample_encode(sample);
+	sample_mem_update(sample);
+	budget_check(cache, sample);
+
+	if (cache->meta_gen) {
+		if (cache->meta_gen(data, sample->meta.data)) {
+			meta_set_status(sample, OMNI_STATUS_CURRENT);
+		}
+		else {
+			meta_unset_status(sample, OMNI_STATUS_VALID);
+			sample_unset_status(sample, OMNI_STATUS_VALID);
+
+			journal_write_op(cache->journal, JOURNAL_OP_SAMPLE_MARK_INVALID, 0, sample_time_get(sample));
+
+			return OMNI_WRITE_FAILED;
+		}
+	}
+
+	sample_set_status(sample, OMNI_STATUS_CURRENT);
+
+	journal_write_sample(cache->journal, sample);
+
+	return OMNI_WRITE_SUCCESS;
+}
+
 OmniWriteResult OMNI_sample_write(OmniCache *cache, float_or_uint time, void *data)
 {
 	OmniSample *sample = sample_get_from_time(cache, time, true, NULL, NULL);
@@ -516,27 +656,14 @@ OmniWriteResult OMNI_sample_write(OmniCache *cache, float_or_uint time, void *da
 		return OMNI_WRITE_INVALID;
 	}
 
+	sample_data_alloc(sample, data);
+
 	for (uint i = 0; i < cache->def.num_blocks; i++) {
 		OmniBlockInfo *b_info = &cache->block_index[i];
 		OmniBlock *block = &sample->blocks[i];
 		OmniData omni_data;
-		uint dcount = b_info->count(data);
 
-		if (block->data && block->dcount != dcount) {
-			free(block->data);
-			block->data = NULL;
-		}
-
-		block->dcount = dcount;
-
-		if (!block->data) {
-			block->data = malloc(b_info->def.dsize * block->dcount);
-		}
-
-		omni_data.dtype = b_info->def.dtype;
-		omni_data.dsize = b_info->def.dsize;
-		omni_data.dcount = block->dcount;
-		omni_data.data = block->data;
+		block_data_get(&omni_data, b_info, block);
 
 		if (b_info->write(&omni_data, data)) {
 			block_set_status(block, OMNI_STATUS_CURRENT);
@@ -545,6 +672,8 @@ OmniWriteResult OMNI_sample_write(OmniCache *cache, float_or_uint time, void *da
 			block_unset_status(block, OMNI_STATUS_VALID);
 			sample_unset_status(sample, OMNI_STATUS_VALID);
 
+			journal_write_op(cache->journal, JOURNAL_OP_SAMPLE_MARK_INVALID, 0, time);
+
 			return OMNI_WRITE_FAILED;
 		}
 
@@ -552,31 +681,214 @@ OmniWriteResult OMNI_sample_write(OmniCache *cache, float_or_uint time, void *da
 		assert(omni_data.data == block->data);
 	}
 
-	if (cache->meta_gen) {
-		if (!sample->meta.data) {
-			sample->meta.data = malloc(cache->def.msize);
+	return sample_write_finish(sample, data);
+}
+
+OmniWriteResult OMNI_sample_write_acquire(OmniCache *cache, float_or_uint time, void *data, OmniData r_blocks[])
+{
+	OmniSample *sample = sample_get_from_time(cache, time, true, NULL, NULL);
+
+	if (!sample) {
+		return OMNI_WRITE_INVALID;
+	}
+
+	sample_data_alloc(sample, data);
+
+	for (uint i = 0; i < cache->def.num_blocks; i++) {
+		OmniBlock *block = &sample->blocks[i];
+
+		block_unset_status(block, (OmniBlockStatusFlags)OMNI_STATUS_VALID);
+		block_data_get(&r_blocks[i], &cache->block_index[i], block);
+	}
+
+	meta_unset_status(sample, (OmniBlockStatusFlags)OMNI_STATUS_VALID);
+	sample_unset_status(sample, (OmniSampleStatusFlags)OMNI_STATUS_VALID);
+	sample_set_status(sample, OMNI_SAMPLE_STATUS_ACQUIRED);
+
+	return OMNI_WRITE_SUCCESS;
+}
+
+OmniWriteResult OMNI_sample_write_commit(OmniCache *cache, float_or_uint time, void *data)
+{
+	OmniSample *sample = sample_get_from_time(cache, time, false, NULL, NULL);
+
+	if (!sample || !(sample->status & OMNI_SAMPLE_STATUS_ACQUIRED)) {
+		return OMNI_WRITE_INVALID;
+	}
+
+	for (uint i = 0; i < cache->def.num_blocks; i++) {
+		block_set_status(&sample->blocks[i], (OmniBlockStatusFlags)OMNI_STATUS_CURRENT);
+	}
+
+	return sample_write_finish(sample, data);
+}
+
+OmniWriteResult OMNI_block_write_move(OmniCache *cache, float_or_uint time, uint block_index,
+                                      void *buffer, uint count, OmniFreeCallback free_func, void *data)
+{
+	OmniSample *sample;
+	OmniBlock *block;
+
+	assert(block_index < cache->def.num_blocks);
+
+	if (!block_count_valid(&cache->block_index[block_index], count)) {
+		return OMNI_WRITE_INVALID;
+	}
+
+	sample = sample_get_from_time(cache, time, true, NULL, NULL);
+
+	if (!sample) {
+		return OMNI_WRITE_INVALID;
+	}
+
+	init_sample_blocks(sample, NULL);
+
+	block_delta_detach(sample, block_index);
+	block_data_detach(&sample->blocks[block_index]);
+
+	/* Detaching from a view can move the block array. */
+	block = &sample->blocks[block_index];
+
+	block->data = buffer;
+	block->dfree = free_func ? free_func : free;
+	block->dcount = count;
+	block->dcount_alloc = count;
+	block->status |= OMNI_BLOCK_STATUS_ADOPTED;
+
+	block_set_status(block, (OmniBlockStatusFlags)OMNI_STATUS_CURRENT);
+	sample_mem_update(sample);
+
+	/* Wait for the remaining blocks. */
+	if (sample->num_blocks_invalid > 0) {
+		return OMNI_WRITE_SUCCESS;
+	}
+
+	meta_data_detach(sample);
+	meta_data_alloc(sample);
+
+	return sample_write_finish(sample, data);
+}
+
+/* Read data interpolated between the nearest valid samples around `time`.
+ * prev, next: samples around `time`, from which to start looking for valid samples. */
+static OmniReadResult sample_read_interp(OmniCache *cache, float_or_uint time,
+                                        OmniSample *prev, OmniSample *next,
+                                        void *data, OmniReadResult result)
+{
+	OmniSample *prev2, *next2;
+	float_or_uint tprev, tnext, tprev2, tnext2;
+	bool use_next;
+
+	while (prev && !SAMPLE_IS_VALID(prev)) {
+		prev = sample_prev(prev);
+	}
+
+	while (next && !SAMPLE_IS_VALID(next)) {
+		next = sample_next(next);
+	}
+
+	if (!prev || !next) {
+		return OMNI_READ_INVALID;
+	}
+
+	budget_touch(prev);
+	budget_touch(next);
+
+	if (!SAMPLE_IS_CURRENT(prev) || !SAMPLE_IS_CURRENT(next)) {
+		result |= OMNI_READ_OUTDATED;
+	}
+
+	/* Outer neighbours for higher order interpolation. */
+	prev2 = sample_prev(prev);
+	next2 = sample_next(next);
+
+	while (prev2 && !SAMPLE_IS_VALID(prev2)) {
+		prev2 = sample_prev(prev2);
+	}
+
+	while (next2 && !SAMPLE_IS_VALID(next2)) {
+		next2 = sample_next(next2);
+	}
+
+	tprev = sample_time_get(prev);
+	tnext = sample_time_get(next);
+	tprev2 = prev2 ? sample_time_get(prev2) : tprev;
+	tnext2 = next2 ? sample_time_get(next2) : tnext;
+
+	/* Sample used for data that can't be interpolated. */
+	use_next = (fu_float(time) - fu_float(tprev)) > (fu_float(tnext) - fu_float(time));
+
+	for (uint i = 0; i < cache->def.num_blocks; i++) {
+		OmniBlockInfo *b_info = &cache->block_index[i];
+		OmniBlock *bprev = &prev->blocks[i];
+		OmniBlock *bnext = &next->blocks[i];
+		OmniData dprev, dnext, omni_data;
+		bool success = true;
+
+		if (!block_data_decode(&dprev, b_info, bprev, 0) || !block_data_decode(&dnext, b_info, bnext, 1)) {
+			return OMNI_READ_INVALID;
 		}
 
-		if (cache->meta_gen(data, sample->meta.data)) {
-			meta_set_status(sample, OMNI_STATUS_CURRENT);
+		omni_data = use_next ? dnext : dprev;
+
+		if ((b_info->def.flags & OMNI_BLOCK_FLAG_CONTINUOUS) && (bprev->dcount == bnext->dcount)) {
+			size_t size = (size_t)b_info->def.dsize * bprev->dcount;
+			OmniData target = dprev;
+			OmniData dprev2, dnext2;
+			OmniInterpData interp_data = {
+			    .target = &target,
+			    .prev = &dprev,
+			    .next = &dnext,
+			    .ttarget = time,
+			    .tprev = tprev,
+			    .tnext = tnext,
+			    .tprev2 = tprev2,
+			    .tnext2 = tnext2,
+			};
+
+			/* Outer neighbours that can't be decoded are left out. */
+			if (prev2 && prev2->blocks[i].dcount == bprev->dcount &&
+			    block_data_decode(&dprev2, b_info, &prev2->blocks[i], 2))
+			{
+				interp_data.prev2 = &dprev2;
+			}
+
+			if (next2 && next2->blocks[i].dcount == bnext->dcount &&
+			    block_data_decode(&dnext2, b_info, &next2->blocks[i], 3))
+			{
+				interp_data.next2 = &dnext2;
+			}
+
+			target.data = codec_buffer_get(&cache->interp_buffer, size);
+
+			if (b_info->interp) {
+				success = b_info->interp(&interp_data);
+				omni_data = target;
+			}
+			else if (interp_builtin(&interp_data, b_info->def.imode)) {
+				omni_data = target;
+			}
 		}
-		else {
-			meta_unset_status(sample, OMNI_STATUS_VALID);
-			sample_unset_status(sample, OMNI_STATUS_VALID);
 
-			return OMNI_WRITE_FAILED;
+		if (!success || !b_info->read(&omni_data, data)) {
+			return OMNI_READ_INVALID;
 		}
-	}
 
-	sample_set_status(sample, OMNI_STATUS_CURRENT);
+		if (!IS_CURRENT(bprev) || !IS_CURRENT(bnext)) {
+			result |= OMNI_READ_OUTDATED;
+		}
+	}
 
-	return OMNI_WRITE_SUCCESS;
+	return result | OMNI_READ_INTERP;
 }
 
 OmniReadResult OMNI_sample_read(OmniCache *cache, float_or_uint time, void *data)
 {
 	OmniSample *sample = NULL;
+	OmniSample *prev = NULL;
+	OmniSample *next = NULL;
 	OmniReadResult result = OMNI_READ_EXACT;
+	sample_time stime;
 
 	if (!IS_VALID(cache)) {
 		return OMNI_READ_INVALID;
@@ -586,10 +898,19 @@ OmniReadResult OMNI_sample_read(OmniCache *cache, float_or_uint time, void *data
 		result |= OMNI_READ_OUTDATED;
 	}
 
-	sample = sample_get_from_time(cache, time, false, NULL, NULL);
+	prefetch_access(cache, time);
+	budget_access(cache, time);
+
+	stime = gen_sample_time(cache, time);
+	sample = sample_get(cache, stime, false, &prev, &next);
 
-	/* TODO: Interpolation. */
 	if (!SAMPLE_IS_VALID(sample)) {
+		if ((cache->def.flags & OMNICACHE_FLAG_INTERP_ANY) ||
+		    ((cache->def.flags & OMNICACHE_FLAG_INTERP_SUB) && !FU_FL_EQ(stime.offset, 0.0f)))
+		{
+			return sample_read_interp(cache, time, prev, next, data, result);
+		}
+
 		return OMNI_READ_INVALID;
 	}
 
@@ -597,6 +918,8 @@ OmniReadResult OMNI_sample_read(OmniCache *cache, float_or_uint time, void *data
 		result |= OMNI_READ_OUTDATED;
 	}
 
+	budget_touch(sample);
+
 	for (uint i = 0; i < cache->def.num_blocks; i++) {
 		OmniBlockInfo *b_info = &cache->block_index[i];
 		OmniBlock *block = &sample->blocks[i];
@@ -606,12 +929,7 @@ OmniReadResult OMNI_sample_read(OmniCache *cache, float_or_uint time, void *data
 			return OMNI_READ_INVALID;
 		}
 
-		omni_data.dtype = b_info->def.dtype;
-		omni_data.dsize = b_info->def.dsize;
-		omni_data.dcount = block->dcount;
-		omni_data.data = block->data;
-
-		if (!b_info->read(&omni_data, data)) {
+		if (!block_data_decode(&omni_data, b_info, block, 0) || !b_info->read(&omni_data, data)) {
 			return OMNI_READ_INVALID;
 		}
 
@@ -623,6 +941,206 @@ OmniReadResult OMNI_sample_read(OmniCache *cache, float_or_uint time, void *data
 	return result;
 }
 
+OmniReadResult OMNI_view_acquire(OmniCache *cache, float_or_uint time, OmniView **r_view)
+{
+	OmniSample *sample;
+	OmniReadResult result = OMNI_READ_EXACT;
+
+	*r_view = NULL;
+
+	if (!IS_VALID(cache)) {
+		return OMNI_READ_INVALID;
+	}
+
+	sample = sample_get_from_time(cache, time, false, NULL, NULL);
+
+	if (!SAMPLE_IS_VALID(sample)) {
+		return OMNI_READ_INVALID;
+	}
+
+	if (!IS_CURRENT(cache) || !SAMPLE_IS_CURRENT(sample)) {
+		result |= OMNI_READ_OUTDATED;
+	}
+
+	budget_touch(sample);
+
+	*r_view = view_acquire(sample);
+
+	if (!*r_view) {
+		return OMNI_READ_INVALID;
+	}
+
+	return result;
+}
+
+void OMNI_view_release(OmniView *view)
+{
+	view_release(view);
+}
+
+uint OMNI_view_get_num_blocks(const OmniView *view)
+{
+	return view->num_blocks;
+}
+
+const OmniData *OMNI_view_get_block(const OmniView *view, uint block)
+{
+	assert(block < view->num_blocks);
+
+	return &view->blocks[block];
+}
+
+const void *OMNI_view_get_meta(const OmniView *view)
+{
+	return view->meta;
+}
+
+uint OMNI_block_scan(OmniCache *cache, uint block, float_or_uint time_start, float_or_uint time_end,
+                     OmniScanCallback func, void *user_data, uint *r_num_failed)
+{
+	OmniBlockInfo *b_info;
+	uint num_samples = 0;
+
+	assert(block < cache->def.num_blocks);
+
+	if (r_num_failed) {
+		*r_num_failed = 0;
+	}
+
+	if (!IS_VALID(cache)) {
+		return 0;
+	}
+
+	b_info = &cache->block_index[block];
+
+	for (OmniSample *sample = sample_valid_until(sample_first_from(cache, time_start), time_end); sample;
+	     sample = sample_valid_until(sample_next(sample), time_end))
+	{
+		OmniData omni_data;
+
+		budget_touch(sample);
+
+		if (!block_data_decode(&omni_data, b_info, &sample->blocks[block], 0)) {
+			if (r_num_failed) {
+				(*r_num_failed)++;
+			}
+
+			continue;
+		}
+
+		num_samples++;
+
+		if (!func(sample_time_get(sample), &omni_data, user_data)) {
+			break;
+		}
+	}
+
+	return num_samples;
+}
+
+size_t OMNI_block_fetch(OmniCache *cache, uint block, float_or_uint time_start, float_or_uint time_end,
+                        void *buffer, uint *r_num_samples)
+{
+	OmniBlockInfo *b_info;
+	size_t size = 0;
+	uint num_samples = 0;
+
+	assert(block < cache->def.num_blocks);
+
+	if (r_num_samples) {
+		*r_num_samples = 0;
+	}
+
+	if (!IS_VALID(cache)) {
+		return 0;
+	}
+
+	b_info = &cache->block_index[block];
+
+	for (OmniSample *sample = sample_valid_until(sample_first_from(cache, time_start), time_end); sample;
+	     sample = sample_valid_until(sample_next(sample), time_end))
+	{
+		OmniData omni_data;
+
+		if (buffer) {
+			budget_touch(sample);
+
+			/* Fail as a whole, so a fetch never returns less than a size query (without `buffer`). */
+			if (!block_data_decode(&omni_data, b_info, &sample->blocks[block], 0)) {
+				return 0;
+			}
+
+			memcpy((char *)buffer + size, omni_data.data, (size_t)omni_data.dsize * omni_data.dcount);
+		}
+
+		size += (size_t)b_info->def.dsize * sample->blocks[block].dcount;
+		num_samples++;
+	}
+
+	if (r_num_samples) {
+		*r_num_samples = num_samples;
+	}
+
+	return size;
+}
+
+OmniLoad *OMNI_load_submit(OmniCache *cache, const float_or_uint times[], uint num_times,
+                           OmniLoadCallback callback, void *user_data)
+{
+	OmniView **views = malloc(sizeof(OmniView *) * MAX(num_times, 1));
+	OmniLoad *load;
+
+	for (uint i = 0; i < num_times; i++) {
+		OMNI_view_acquire(cache, times[i], &views[i]);
+	}
+
+	load = load_submit(cache, views, num_times, callback, user_data);
+
+	free(views);
+
+	return load;
+}
+
+uint OMNI_load_poll(OmniLoad *load)
+{
+	return load_poll(load);
+}
+
+void OMNI_load_wait(OmniLoad *load)
+{
+	load_wait(load);
+}
+
+void OMNI_load_release(OmniLoad *load)
+{
+	load_release(load);
+}
+
+void OMNI_prefetch_set(OmniCache *cache, uint max_samples, size_t max_bytes)
+{
+	prefetch_set(cache, max_samples, max_bytes);
+}
+
+size_t OMNI_get_memory(const OmniCache *cache)
+{
+	return sizeof(OmniCache) + (sizeof(OmniBlockInfo) * cache->def.num_blocks) + cache->mem_used;
+}
+
+size_t OMNI_get_memory_global(void)
+{
+	return budget_mem_global();
+}
+
+void OMNI_budget_set(OmniCache *cache, size_t max_bytes, OmniEvictPolicy policy, const char *spill_path)
+{
+	budget_set(cache, max_bytes, policy, spill_path);
+}
+
+void OMNI_budget_set_global(size_t max_bytes)
+{
+	budget_set_global(max_bytes);
+}
+
 void OMNI_set_range(OmniCache *cache, float_or_uint time_initial, float_or_uint time_final, float_or_uint time_step)
 {
 	bool changed = false;
@@ -653,6 +1171,8 @@ void OMNI_set_range(OmniCache *cache, float_or_uint time_initial, float_or_uint
 
 	/* TODO: Optionally clip/extend cache instead of freeing. */
 	if (changed) {
+		/* The journal can't record a new definition, so it ends with the previous one. */
+		journal_stop(cache);
 		samples_free(cache);
 	}
 }
@@ -677,6 +1197,11 @@ uint OMNI_get_num_cached(OmniCache *cache)
 	return cache->def.num_samples_tot;
 }
 
+uint OMNI_get_num_blocks(const OmniCache *cache)
+{
+	return cache->def.num_blocks;
+}
+
 void OMNI_move_start(OmniCache *cache, float_or_uint time_initial)
 {
 	float_or_uint length;
@@ -687,6 +1212,8 @@ void OMNI_move_start(OmniCache *cache, float_or_uint time_initial)
 
 	cache->def.tinitial = time_initial;
 	cache->def.tfinal = fu_add(time_initial, length);
+
+	journal_write_op(cache->journal, JOURNAL_OP_MOVE_START, 0, time_initial);
 }
 
 void OMNI_move_end(OmniCache *cache, float_or_uint time_final)
@@ -694,21 +1221,20 @@ void OMNI_move_end(OmniCache *cache, float_or_uint time_final)
 	assert(TTYPE_FLOAT(cache->def.ttype) == time_final.isf);
 	assert(FU_LE(cache->def.tinitial, time_final));
 
-	/* TODO: Clear after should call a clearing function,
-	 * instead of implementing directly here. */
 	{
 		OmniSample *sample = NULL;
 		sample_get_from_time(cache, time_final, false, NULL, &sample);
 
 		if (sample) {
-			samples_iterate(sample,
-			                sample_remove_list,
-			                sample_remove_root,
-			                sample_clear_ref);
+			journal_write_op(cache->journal, JOURNAL_OP_SAMPLE_CLEAR_FROM, 0, sample_time_get(sample));
+
+			samples_remove_from(sample);
 		}
 	}
 
 	cache->def.tfinal = time_final;
+
+	journal_write_op(cache->journal, JOURNAL_OP_MOVE_END, 0, time_final);
 }
 
 bool OMNI_is_valid(OmniCache *cache)
@@ -739,10 +1265,10 @@ bool OMNI_sample_is_current(OmniCache *cache, float_or_uint time)
 	return SAMPLE_IS_CURRENT(sample_get_from_time(cache, time, false, NULL, NULL));
 }
 
-/* TODO: Consolidation should set the num_samples_array as to ignore trailing skipped samples (without children).
- * (same applies to sample_clear_from and such) */
 void OMNI_consolidate(OmniCache *cache, OmniConsolidationFlags flags)
 {
+	journal_write_op(cache->journal, JOURNAL_OP_CONSOLIDATE, flags, cache->def.tinitial);
+
 	if ((!IS_VALID(cache) && (flags & (OMNI_CONSOL_FREE_INVALID | OMNI_CONSOL_FREE_OUTDATED))) ||
 	    (!IS_CURRENT(cache) && (flags & OMNI_CONSOL_FREE_OUTDATED)))
 	{
@@ -752,19 +1278,26 @@ void OMNI_consolidate(OmniCache *cache, OmniConsolidationFlags flags)
 
 	/* Frees outdated and invalid samples. */
 	if (flags & OMNI_CONSOL_FREE_OUTDATED) {
-		samples_iterate(cache->samples, sample_remove_outdated, NULL, NULL);
+		samples_iterate(SAMPLE_FIRST(cache), sample_remove_outdated, sample_remove_outdated);
 	}
 	/* Frees invalid samples. */
 	else if (flags & OMNI_CONSOL_FREE_INVALID) {
-		samples_iterate(cache->samples, sample_remove_invalid, NULL, NULL);
+		samples_iterate(SAMPLE_FIRST(cache), sample_remove_invalid, sample_remove_invalid);
+	}
+
+	/* Drop pages and trailing samples left empty. */
+	samples_trim(cache);
+
+	if (flags & OMNI_CONSOL_COLUMNS) {
+		columns_pack(cache);
 	}
 
 	if (flags & OMNI_CONSOL_CONSOLIDATE) {
 		if (!IS_VALID(cache)) {
-			samples_iterate(cache->samples, sample_mark_invalid, NULL, NULL);
+			samples_iterate(SAMPLE_FIRST(cache), sample_mark_invalid, sample_mark_invalid);
 		}
 		else if (!IS_CURRENT(cache)) {
-			samples_iterate(cache->samples, sample_mark_outdated, NULL, NULL);
+			samples_iterate(SAMPLE_FIRST(cache), sample_mark_outdated, sample_mark_outdated);
 		}
 
 		cache_set_status(cache, OMNI_STATUS_CURRENT);
@@ -774,16 +1307,22 @@ void OMNI_consolidate(OmniCache *cache, OmniConsolidationFlags flags)
 void OMNI_mark_outdated(OmniCache *cache)
 {
 	cache_unset_status(cache, OMNI_STATUS_CURRENT);
+
+	journal_write_op(cache->journal, JOURNAL_OP_MARK_OUTDATED, 0, cache->def.tinitial);
 }
 
 void OMNI_mark_invalid(OmniCache *cache)
 {
 	cache_unset_status(cache, OMNI_STATUS_VALID);
+
+	journal_write_op(cache->journal, JOURNAL_OP_MARK_INVALID, 0, cache->def.tinitial);
 }
 
 void OMNI_clear(OmniCache *cache)
 {
 	samples_free(cache);
+
+	journal_write_op(cache->journal, JOURNAL_OP_CLEAR, 0, cache->def.tinitial);
 }
 
 void OMNI_sample_mark_outdated(OmniCache *cache, float_or_uint time)
@@ -793,6 +1332,8 @@ void OMNI_sample_mark_outdated(OmniCache *cache, float_or_uint time)
 	if (sample) {
 		sample_mark_outdated(sample);
 	}
+
+	journal_write_op(cache->journal, JOURNAL_OP_SAMPLE_MARK_OUTDATED, 0, time);
 }
 
 void OMNI_sample_mark_invalid(OmniCache *cache, float_or_uint time)
@@ -802,23 +1343,17 @@ void OMNI_sample_mark_invalid(OmniCache *cache, float_or_uint time)
 	if (sample) {
 		sample_mark_invalid(sample);
 	}
+
+	journal_write_op(cache->journal, JOURNAL_OP_SAMPLE_MARK_INVALID, 0, time);
 }
 
 void OMNI_sample_clear(OmniCache *cache, float_or_uint time)
 {
 	OmniSample *sample = sample_get_from_time(cache, time, false, NULL, NULL);
 
-	if (sample) {
-		if (SAMPLE_IS_ROOT(sample)) {
-			sample_remove_root(sample);
-		}
-		else {
-			OmniSample *prev = sample_prev(sample);
-			prev->next = sample->next;
+	sample_remove(sample);
 
-			sample_remove_list(sample);
-		}
-	}
+	journal_write_op(cache->journal, JOURNAL_OP_SAMPLE_CLEAR, 0, time);
 }
 
 void OMNI_sample_mark_outdated_from(OmniCache *cache, float_or_uint time)
@@ -829,8 +1364,10 @@ void OMNI_sample_mark_outdated_from(OmniCache *cache, float_or_uint time)
 	sample = sample ? sample : next;
 
 	if (sample) {
-		samples_iterate(sample, sample_mark_outdated, sample_mark_outdated, NULL);
+		samples_iterate(sample, sample_mark_outdated, sample_mark_outdated);
 	}
+
+	journal_write_op(cache->journal, JOURNAL_OP_SAMPLE_MARK_OUTDATED_FROM, 0, time);
 }
 
 void OMNI_sample_mark_invalid_from(OmniCache *cache, float_or_uint time)
@@ -841,8 +1378,10 @@ void OMNI_sample_mark_invalid_from(OmniCache *cache, float_or_uint time)
 	sample = sample ? sample : next;
 
 	if (sample) {
-		samples_iterate(sample, sample_mark_invalid, sample_mark_invalid, NULL);
+		samples_iterate(sample, sample_mark_invalid, sample_mark_invalid);
 	}
+
+	journal_write_op(cache->journal, JOURNAL_OP_SAMPLE_MARK_INVALID_FROM, 0, time);
 }
 
 void OMNI_sample_clear_from(OmniCache *cache, float_or_uint time)
@@ -853,43 +1392,104 @@ void OMNI_sample_clear_from(OmniCache *cache, float_or_uint time)
 	sample = sample ? sample : next;
 
 	if (sample) {
-		samples_iterate(sample,
-		                sample_remove_list,
-		                sample_remove_root,
-		                sample_clear_ref);
+		samples_remove_from(sample);
 	}
+
+	journal_write_op(cache->journal, JOURNAL_OP_SAMPLE_CLEAR_FROM, 0, time);
 }
 
 #define INCREMENT_SERIAL(size) s = (OmniSerial *)(temp + size)
 
-uint OMNI_serial_get_size(const OmniCache *cache, bool serialize_data)
+size_t OMNI_serial_get_size(const OmniCache *cache, bool serialize_data)
 {
 	return serial_calc_size(cache, serialize_data);
 }
 
-/* TODO: Data serialization. */
-OmniSerial *OMNI_serialize(const OmniCache *cache, bool serialize_data, uint *size)
+OmniSerial *OMNI_serialize(const OmniCache *cache, bool serialize_data, size_t *size)
 {
-	uint s = serial_calc_size(cache, serialize_data);
+	size_t s = serial_calc_size(cache, serialize_data);
 	OmniSerial *serial = malloc(s);
 
 	if (size) {
 		*size = s;
 	}
 
-	serialize(serial, cache, serialize_data);
+	OMNI_serialize_to_buffer(serial, cache, serialize_data);
 
 	return serial;
 }
 
 void OMNI_serialize_to_buffer(OmniSerial *serial, const OmniCache *cache, bool serialize_data)
 {
-	serialize(serial, cache, serialize_data);
+	serial_writer writer = {
+	    .buffer = (char *)serial,
+	};
+
+	serialize(&writer, cache, serialize_data);
 }
 
 OmniCache *OMNI_deserialize(OmniSerial *serial, const OmniCacheTemplate *cache_temp)
 {
-	return deserialize(serial, cache_temp);
+	serial_reader reader = {
+	    .buffer = (const char *)serial,
+	};
+
+	return deserialize(&reader, cache_temp);
+}
+
+OmniCache *OMNI_deserialize_borrowed(const OmniSerial *serial, const OmniCacheTemplate *cache_temp)
+{
+	serial_reader reader = {
+	    .buffer = (const char *)serial,
+	    .borrow = true,
+	};
+
+	return deserialize(&reader, cache_temp);
+}
+
+bool OMNI_serialize_stream(const OmniCache *cache, bool serialize_data, OmniStreamWriteCallback write, void *user_data)
+{
+	return serialize_stream(cache, serialize_data, write, user_data);
+}
+
+OmniCache *OMNI_deserialize_stream(OmniStreamReadCallback read, void *user_data, const OmniCacheTemplate *cache_temp)
+{
+	return deserialize_stream(read, user_data, cache_temp);
+}
+
+bool OMNI_file_write(const OmniCache *cache, const char *path)
+{
+	return file_write(cache, path);
+}
+
+OmniCache *OMNI_file_open(const char *path, const OmniCacheTemplate *cache_temp)
+{
+	return file_open(path, cache_temp);
+}
+
+bool OMNI_journal_start(OmniCache *cache, const char *path)
+{
+	return journal_start(cache, path);
+}
+
+OmniCache *OMNI_journal_resume(const char *path, const OmniCacheTemplate *cache_temp)
+{
+	return journal_resume(path, cache_temp);
+}
+
+void OMNI_journal_stop(OmniCache *cache)
+{
+	journal_stop(cache);
+}
+
+void OMNI_journal_set_async(OmniCache *cache, uint max_queued)
+{
+	journal_set_async(cache->journal, max_queued);
+}
+
+void OMNI_journal_flush(OmniCache *cache)
+{
+	journal_flush(cache->journal);
 }
 
 #undef INCREMENT_SERIAL
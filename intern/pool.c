@@ -0,0 +1,202 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include "pool.h"
+
+#include "utils.h"
+
+struct mempool_slab {
+	mempool_slab *next;
+	mempool_slab *prev;
+	mempool_slab *next_partial;
+	mempool_slab *prev_partial;
+
+	void *free; /* List of released elements. */
+
+	uint num_used;
+	uint num_init; /* Elements handed out from the untouched end of the slab. */
+};
+
+#define SLAB_HEADER_SIZE ALIGN_UP(sizeof(mempool_slab), ALIGN_SIZE)
+#define SLAB_FROM_ELEM(pool, elem) ((mempool_slab *)((size_t)(elem) & ~((pool)->slab_size - 1)))
+
+static bool slab_is_full(const mempool *pool, const mempool_slab *slab)
+{
+	return slab->num_used == pool->elems_per_slab;
+}
+
+static void partial_insert(mempool *pool, mempool_slab *slab)
+{
+	slab->prev_partial = NULL;
+	slab->next_partial = pool->partial;
+
+	if (pool->partial) {
+		pool->partial->prev_partial = slab;
+	}
+
+	pool->partial = slab;
+}
+
+static void partial_remove(mempool *pool, mempool_slab *slab)
+{
+	if (slab->prev_partial) {
+		slab->prev_partial->next_partial = slab->next_partial;
+	}
+	else {
+		pool->partial = slab->next_partial;
+	}
+
+	if (slab->next_partial) {
+		slab->next_partial->prev_partial = slab->prev_partial;
+	}
+
+	slab->next_partial = NULL;
+	slab->prev_partial = NULL;
+}
+
+static mempool_slab *slab_new(mempool *pool)
+{
+	mempool_slab *slab = alignalloc(pool->slab_size, pool->slab_size);
+
+	memset(slab, 0, sizeof(mempool_slab));
+
+	slab->next = pool->slabs;
+
+	if (pool->slabs) {
+		pool->slabs->prev = slab;
+	}
+
+	pool->slabs = slab;
+	pool->num_slabs++;
+
+	partial_insert(pool, slab);
+
+	return slab;
+}
+
+/* Free a slab with no elements in use. */
+static void slab_free(mempool *pool, mempool_slab *slab)
+{
+	assert(slab->num_used == 0);
+
+	partial_remove(pool, slab);
+
+	if (slab->prev) {
+		slab->prev->next = slab->next;
+	}
+	else {
+		pool->slabs = slab->next;
+	}
+
+	if (slab->next) {
+		slab->next->prev = slab->prev;
+	}
+
+	pool->num_slabs--;
+
+	alignfree(slab);
+}
+
+static void *slab_pop(mempool *pool, mempool_slab *slab)
+{
+	void *elem;
+
+	if (slab->free) {
+		elem = slab->free;
+		slab->free = *(void **)elem;
+	}
+	else {
+		elem = (char *)slab + SLAB_HEADER_SIZE + (pool->elem_size * slab->num_init);
+		slab->num_init++;
+	}
+
+	slab->num_used++;
+
+	if (slab_is_full(pool, slab)) {
+		partial_remove(pool, slab);
+	}
+
+	memset(elem, 0, pool->elem_size);
+
+	return elem;
+}
+
+void mempool_init(mempool *pool, size_t elem_size)
+{
+	memset(pool, 0, sizeof(mempool));
+
+	pool->elem_size = ALIGN_UP(MAX(elem_size, sizeof(void *)), sizeof(void *));
+	pool->slab_size = MEMPOOL_SLAB_SIZE;
+
+	/* Ensure a reasonable number of elements per slab for large elements,
+	 * without very large elements taking huge slabs (at least one still fits). */
+	while (pool->slab_size < SLAB_HEADER_SIZE + (pool->elem_size * MEMPOOL_SLAB_ELEMS) &&
+	       pool->slab_size < MEMPOOL_SLAB_SIZE_MAX)
+	{
+		pool->slab_size <<= 1;
+	}
+
+	while (pool->slab_size < SLAB_HEADER_SIZE + pool->elem_size) {
+		pool->slab_size <<= 1;
+	}
+
+	pool->elems_per_slab = (uint)((pool->slab_size - SLAB_HEADER_SIZE) / pool->elem_size);
+}
+
+/* Allocate a zeroed element.
+ * hint: element allocated from the same pool, next to which the new element should preferably be placed (optional). */
+void *mempool_alloc(mempool *pool, const void *hint)
+{
+	mempool_slab *slab = NULL;
+
+	assert(pool->elem_size);
+
+	if (hint) {
+		slab = SLAB_FROM_ELEM(pool, hint);
+
+		if (slab_is_full(pool, slab)) {
+			slab = NULL;
+		}
+	}
+
+	if (!slab) {
+		slab = pool->partial ? pool->partial : slab_new(pool);
+	}
+
+	return slab_pop(pool, slab);
+}
+
+void mempool_release(mempool *pool, void *elem)
+{
+	mempool_slab *slab = SLAB_FROM_ELEM(pool, elem);
+
+	if (slab_is_full(pool, slab)) {
+		partial_insert(pool, slab);
+	}
+
+	*(void **)elem = slab->free;
+	slab->free = elem;
+	slab->num_used--;
+
+	/* The last slab with free elements is kept, so alternating allocations and releases do not churn slabs. */
+	if (slab->num_used == 0 && (pool->partial != slab || slab->next_partial)) {
+		slab_free(pool, slab);
+	}
+}
+
+/* Free all slabs at once (elements need no individual release), leaving the pool uninitialized. */
+void mempool_free(mempool *pool)
+{
+	mempool_slab *slab = pool->slabs;
+
+	while (slab) {
+		mempool_slab *next = slab->next;
+
+		alignfree(slab);
+
+		slab = next;
+	}
+
+	memset(pool, 0, sizeof(mempool));
+}
@@ -0,0 +1,40 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#ifndef __OMNI_POOL_H__
+#define __OMNI_POOL_H__
+
+#include <stddef.h>
+
+#include "types.h"
+
+/* Minimum slab size (slabs are aligned to their size, so elements can find their slab). */
+#define MEMPOOL_SLAB_SIZE (1 << 16)
+/* Size up to which slabs grow to hold `MEMPOOL_SLAB_ELEMS` elements (larger elements get fewer per slab). */
+#define MEMPOOL_SLAB_SIZE_MAX (1 << 22)
+#define MEMPOOL_SLAB_ELEMS 16
+
+typedef struct mempool_slab mempool_slab;
+
+/* Fixed size element allocator, handing out elements from large slabs.
+ * Elements are zeroed on allocation. Slabs are freed once all their elements are released
+ * (except for the last one with free elements, to avoid churning), or all at once by `mempool_free`.
+ * Elements sized in multiples of `ALIGN_SIZE` are aligned to it.
+ * A pool is initialized when `elem_size` is non-zero. */
+typedef struct mempool {
+	size_t elem_size;
+	size_t slab_size;
+	uint elems_per_slab;
+	uint num_slabs;
+
+	mempool_slab *slabs; /* All slabs. */
+	mempool_slab *partial; /* Slabs with free elements. */
+} mempool;
+
+void mempool_init(mempool *pool, size_t elem_size);
+void *mempool_alloc(mempool *pool, const void *hint);
+void mempool_release(mempool *pool, void *elem);
+void mempool_free(mempool *pool);
+
+#endif /* __OMNI_POOL_H__ */
@@ -0,0 +1,416 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include "quant.h"
+
+#include <float.h>
+#include <stdint.h>
+
+#include "cpu.h"
+#include "utils.h"
+
+/* Half-floats are IEEE 754 binary16, rounded to nearest. */
+#define HALF_MAX 65504.0f
+#define HALF_EPSILON (1.0f / 2048.0f) /* Largest rounding error, relative to the value. */
+#define HALF_SUBNORMAL_ERROR (1.0f / 33554432.0f) /* Largest rounding error below 2^-14 (half of 2^-24, absolute). */
+
+/* Fixed point data starts with the minimum, then the step, of each component (floats),
+ * followed by a 16 bit value per float, decoded as `min + (value * step)`.
+ * Steps are slightly less than twice the error bound, leaving room for float rounding,
+ * which grows with the magnitude of the component. */
+#define FIXED_MAX 65535.0f
+#define FIXED_STEP_MARGIN 0.999f
+#define FIXED_ROUNDING (8.0f * FLT_EPSILON)
+
+typedef struct quant_kernels {
+	bool (*bounds)(const float *src, size_t num, uint num_comps, float *min, float *max);
+	void (*half_encode)(const float *src, size_t num, uint16_t *dst);
+	void (*half_decode)(const uint16_t *src, size_t num, float *dst);
+	void (*fixed_encode)(const float *src, size_t num, uint num_comps, const float *min, const float *inv, uint16_t *dst);
+	void (*fixed_decode)(const uint16_t *src, size_t num, uint num_comps, const float *min, const float *step, float *dst);
+} quant_kernels;
+
+static uint32_t float_bits(float val)
+{
+	uint32_t bits;
+
+	memcpy(&bits, &val, sizeof(bits));
+
+	return bits;
+}
+
+static float bits_float(uint32_t bits)
+{
+	float val;
+
+	memcpy(&val, &bits, sizeof(val));
+
+	return val;
+}
+
+/* Scalar kernels
+ * `num` is the number of floats, starting with the first component. */
+
+/* Extend `min` and `max` (per component) with the values in `src`.
+ * Returns false if any value is not finite. */
+static bool bounds_scalar(const float *src, size_t num, uint num_comps, float *min, float *max)
+{
+	bool finite = true;
+
+	for (size_t i = 0, c = 0; i < num; i++) {
+		float val = src[i];
+
+		finite = finite && isfinite(val);
+		min[c] = MIN(min[c], val);
+		max[c] = MAX(max[c], val);
+
+		c = (c + 1 == num_comps) ? 0 : c + 1;
+	}
+
+	return finite;
+}
+
+/* Values must be within the half-float range. */
+static void half_encode_scalar(const float *src, size_t num, uint16_t *dst)
+{
+	for (size_t i = 0; i < num; i++) {
+		uint32_t bits = float_bits(src[i]);
+		uint32_t sign = bits & 0x80000000u;
+		uint16_t half;
+
+		bits ^= sign;
+
+		if (bits < 0x38800000u) {
+			/* Subnormal or zero, rounded by the float addition. */
+			half = (uint16_t)(float_bits(bits_float(bits) + 0.5f) - 0x3f000000u);
+		}
+		else {
+			/* Rebias the exponent, and round the mantissa to nearest even. */
+			bits += 0xc8000fffu + ((bits >> 13) & 1);
+			half = (uint16_t)(bits >> 13);
+		}
+
+		dst[i] = half | (uint16_t)(sign >> 16);
+	}
+}
+
+static void half_decode_scalar(const uint16_t *src, size_t num, float *dst)
+{
+	for (size_t i = 0; i < num; i++) {
+		uint32_t bits = (uint32_t)(src[i] & 0x7fff) << 13;
+		uint32_t exp = bits & 0x0f800000u;
+
+		bits += 0x38000000u;
+
+		if (exp == 0x0f800000u) {
+			/* Infinity or NaN. */
+			bits += 0x38000000u;
+		}
+		else if (exp == 0) {
+			/* Subnormal or zero. */
+			bits = float_bits(bits_float(bits + 0x00800000u) - bits_float(0x38800000u));
+		}
+
+		dst[i] = bits_float(bits | ((uint32_t)(src[i] & 0x8000) << 16));
+	}
+}
+
+static void fixed_encode_scalar(const float *src, size_t num, uint num_comps, const float *min, const float *inv, uint16_t *dst)
+{
+	for (size_t i = 0, c = 0; i < num; i++) {
+		float val = (src[i] - min[c]) * inv[c];
+
+		val = MAX(val, 0.0f);
+		val = MIN(val, FIXED_MAX);
+
+		dst[i] = (uint16_t)(val + 0.5f);
+
+		c = (c + 1 == num_comps) ? 0 : c + 1;
+	}
+}
+
+static void fixed_decode_scalar(const uint16_t *src, size_t num, uint num_comps, const float *min, const float *step, float *dst)
+{
+	for (size_t i = 0, c = 0; i < num; i++) {
+		dst[i] = min[c] + ((float)src[i] * step[c]);
+
+		c = (c + 1 == num_comps) ? 0 : c + 1;
+	}
+}
+
+#ifdef CPU_X86
+/* SSE2 kernels
+ * Floats are processed in runs of `num_comps` vectors, so lane `l` of vector `j` always holds
+ * component `((4 * j) + l) % num_comps`. */
+
+static void lanes_set(const float *values, uint num_comps, float lanes[][4])
+{
+	for (uint j = 0; j < num_comps; j++) {
+		for (uint l = 0; l < 4; l++) {
+			lanes[j][l] = values[((4 * j) + l) % num_comps];
+		}
+	}
+}
+
+TARGET_SSE2 static bool bounds_sse2(const float *src, size_t num, uint num_comps, float *min, float *max)
+{
+	__m128 vmin[QUANT_MAX_COMPS], vmax[QUANT_MAX_COMPS];
+	__m128 vbad = _mm_setzero_ps();
+	size_t run = 4 * (size_t)num_comps;
+	size_t i = 0;
+
+	for (uint j = 0; j < num_comps; j++) {
+		vmin[j] = _mm_set1_ps(INFINITY);
+		vmax[j] = _mm_set1_ps(-INFINITY);
+	}
+
+	for (; i + run <= num; i += run) {
+		for (uint j = 0; j < num_comps; j++) {
+			__m128 val = _mm_loadu_ps(&src[i + (4 * j)]);
+			__m128 zero = _mm_sub_ps(val, val);
+
+			/* Not zero (NaN) for infinities and NaNs. */
+			vbad = _mm_or_ps(vbad, _mm_cmpunord_ps(zero, zero));
+			vmin[j] = _mm_min_ps(vmin[j], val);
+			vmax[j] = _mm_max_ps(vmax[j], val);
+		}
+	}
+
+	for (uint j = 0; j < num_comps; j++) {
+		float lmin[4], lmax[4];
+
+		_mm_storeu_ps(lmin, vmin[j]);
+		_mm_storeu_ps(lmax, vmax[j]);
+
+		for (uint l = 0; l < 4; l++) {
+			uint c = ((4 * j) + l) % num_comps;
+
+			min[c] = MIN(min[c], lmin[l]);
+			max[c] = MAX(max[c], lmax[l]);
+		}
+	}
+
+	return bounds_scalar(&src[i], num - i, num_comps, min, max) && !_mm_movemask_ps(vbad);
+}
+
+TARGET_SSE2 static void fixed_encode_sse2(const float *src, size_t num, uint num_comps, const float *min, const float *inv, uint16_t *dst)
+{
+	float lmin[QUANT_MAX_COMPS][4], linv[QUANT_MAX_COMPS][4];
+	__m128 vzero = _mm_setzero_ps();
+	__m128 vtop = _mm_set1_ps(FIXED_MAX);
+	/* Signed packing, biased to the unsigned range. */
+	__m128i vbias = _mm_set1_epi32(32768);
+	__m128i vflip = _mm_set1_epi16((short)0x8000);
+	size_t run = 4 * (size_t)num_comps;
+	size_t i = 0;
+
+	lanes_set(min, num_comps, lmin);
+	lanes_set(inv, num_comps, linv);
+
+	for (; i + run <= num; i += run) {
+		for (uint j = 0; j < num_comps; j++) {
+			__m128 val = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(&src[i + (4 * j)]), _mm_loadu_ps(lmin[j])), _mm_loadu_ps(linv[j]));
+			__m128i q;
+
+			val = _mm_min_ps(_mm_max_ps(val, vzero), vtop);
+			q = _mm_sub_epi32(_mm_cvtps_epi32(val), vbias);
+			q = _mm_xor_si128(_mm_packs_epi32(q, q), vflip);
+
+			_mm_storel_epi64((__m128i *)&dst[i + (4 * j)], q);
+		}
+	}
+
+	fixed_encode_scalar(&src[i], num - i, num_comps, min, inv, &dst[i]);
+}
+
+TARGET_SSE2 static void fixed_decode_sse2(const uint16_t *src, size_t num, uint num_comps, const float *min, const float *step, float *dst)
+{
+	float lmin[QUANT_MAX_COMPS][4], lstep[QUANT_MAX_COMPS][4];
+	__m128i vzero = _mm_setzero_si128();
+	size_t run = 4 * (size_t)num_comps;
+	size_t i = 0;
+
+	lanes_set(min, num_comps, lmin);
+	lanes_set(step, num_comps, lstep);
+
+	for (; i + run <= num; i += run) {
+		for (uint j = 0; j < num_comps; j++) {
+			__m128i q = _mm_unpacklo_epi16(_mm_loadl_epi64((const __m128i *)&src[i + (4 * j)]), vzero);
+			__m128 val = _mm_add_ps(_mm_loadu_ps(lmin[j]), _mm_mul_ps(_mm_cvtepi32_ps(q), _mm_loadu_ps(lstep[j])));
+
+			_mm_storeu_ps(&dst[i + (4 * j)], val);
+		}
+	}
+
+	fixed_decode_scalar(&src[i], num - i, num_comps, min, step, &dst[i]);
+}
+
+/* F16C kernels */
+
+TARGET_F16C static void half_encode_f16c(const float *src, size_t num, uint16_t *dst)
+{
+	size_t i = 0;
+
+	for (; i + 8 <= num; i += 8) {
+		_mm_storeu_si128((__m128i *)&dst[i], _mm256_cvtps_ph(_mm256_loadu_ps(&src[i]), _MM_FROUND_TO_NEAREST_INT));
+	}
+
+	half_encode_scalar(&src[i], num - i, &dst[i]);
+}
+
+TARGET_F16C static void half_decode_f16c(const uint16_t *src, size_t num, float *dst)
+{
+	size_t i = 0;
+
+	for (; i + 8 <= num; i += 8) {
+		_mm256_storeu_ps(&dst[i], _mm256_cvtph_ps(_mm_loadu_si128((const __m128i *)&src[i])));
+	}
+
+	half_decode_scalar(&src[i], num - i, &dst[i]);
+}
+#endif
+
+/* Kernels for the best instruction set supported by the CPU. */
+static const quant_kernels *kernels_get(void)
+{
+	static const quant_kernels kernels_scalar = {
+	    bounds_scalar, half_encode_scalar, half_decode_scalar, fixed_encode_scalar, fixed_decode_scalar,
+	};
+#ifdef CPU_X86
+	static const quant_kernels kernels_sse2 = {
+	    bounds_sse2, half_encode_scalar, half_decode_scalar, fixed_encode_sse2, fixed_decode_sse2,
+	};
+	static const quant_kernels kernels_f16c = {
+	    bounds_sse2, half_encode_f16c, half_decode_f16c, fixed_encode_sse2, fixed_decode_sse2,
+	};
+#endif
+	static const quant_kernels *kernels = NULL;
+
+	if (!kernels) {
+		kernels = &kernels_scalar;
+
+#ifdef CPU_X86
+		if (cpu_has_f16c()) {
+			kernels = &kernels_f16c;
+		}
+		else if (cpu_has_sse2()) {
+			kernels = &kernels_sse2;
+		}
+#endif
+	}
+
+	return kernels;
+}
+
+/* Check that elements of `num_comps` floats can be quantized with `quant`. */
+bool quant_valid(OmniQuantization quant, uint num_comps)
+{
+	return (quant == OMNI_QUANT_HALF || quant == OMNI_QUANT_FIXED) && num_comps > 0 && num_comps <= QUANT_MAX_COMPS;
+}
+
+/* Size of `num` elements of `num_comps` floats once quantized. */
+size_t quant_size(OmniQuantization quant, uint num_comps, size_t num)
+{
+	switch (quant) {
+		case OMNI_QUANT_HALF:
+			return sizeof(uint16_t) * num_comps * num;
+		case OMNI_QUANT_FIXED:
+			return (sizeof(float) * 2 * num_comps) + (sizeof(uint16_t) * num_comps * num);
+		default:
+			return sizeof(float) * num_comps * num;
+	}
+}
+
+/* Quantize `num` elements of `num_comps` floats into `dst` (`quant_size` bytes).
+ * error: largest difference allowed between a value and its decoded value (for `OMNI_QUANT_HALF`, 0 for no bound).
+ * Returns false if the values are not finite, or can't be quantized within the bound. */
+bool quant_encode(OmniQuantization quant, float error, uint num_comps, const float *src, size_t num, void *dst)
+{
+	const quant_kernels *kernels = kernels_get();
+	float min[QUANT_MAX_COMPS], max[QUANT_MAX_COMPS];
+	size_t num_floats = (size_t)num_comps * num;
+
+	assert(num_comps > 0 && num_comps <= QUANT_MAX_COMPS);
+
+	if (num == 0) {
+		return false;
+	}
+
+	if (quant == OMNI_QUANT_HALF) {
+		float bound;
+
+		min[0] = INFINITY;
+		max[0] = -INFINITY;
+
+		if (!kernels->bounds(src, num_floats, 1, min, max)) {
+			return false;
+		}
+
+		bound = MAX(-min[0], max[0]);
+
+		if (bound > HALF_MAX || (error > 0.0f && MAX(bound * HALF_EPSILON, HALF_SUBNORMAL_ERROR) > error)) {
+			return false;
+		}
+
+		kernels->half_encode(src, num_floats, dst);
+
+		return true;
+	}
+
+	if (quant == OMNI_QUANT_FIXED) {
+		float header[QUANT_MAX_COMPS * 2];
+		float inv[QUANT_MAX_COMPS];
+
+		for (uint c = 0; c < num_comps; c++) {
+			min[c] = INFINITY;
+			max[c] = -INFINITY;
+		}
+
+		if (!kernels->bounds(src, num_floats, num_comps, min, max)) {
+			return false;
+		}
+
+		for (uint c = 0; c < num_comps; c++) {
+			float step = 2.0f * ((error * FIXED_STEP_MARGIN) - (MAX(-min[c], max[c]) * FIXED_ROUNDING));
+
+			/* Also fails if the range overflows. */
+			if (!(step > 0.0f) || !((max[c] - min[c]) / step <= FIXED_MAX)) {
+				return false;
+			}
+
+			header[c] = min[c];
+			header[num_comps + c] = step;
+			inv[c] = 1.0f / step;
+		}
+
+		memcpy(dst, header, sizeof(float) * 2 * num_comps);
+
+		kernels->fixed_encode(src, num_floats, num_comps, min, inv, (uint16_t *)((char *)dst + (sizeof(float) * 2 * num_comps)));
+
+		return true;
+	}
+
+	return false;
+}
+
+/* Decode `num` elements of `num_comps` floats quantized with `quant_encode`. */
+void quant_decode(OmniQuantization quant, uint num_comps, const void *src, size_t num, float *dst)
+{
+	const quant_kernels *kernels = kernels_get();
+	size_t num_floats = (size_t)num_comps * num;
+
+	assert(num_comps > 0 && num_comps <= QUANT_MAX_COMPS);
+
+	if (quant == OMNI_QUANT_HALF) {
+		kernels->half_decode(src, num_floats, dst);
+	}
+	else if (quant == OMNI_QUANT_FIXED) {
+		float header[QUANT_MAX_COMPS * 2];
+
+		memcpy(header, src, sizeof(float) * 2 * num_comps);
+
+		kernels->fixed_decode((const uint16_t *)((const char *)src + (sizeof(float) * 2 * num_comps)), num_floats,
+		                      num_comps, header, &header[num_comps], dst);
+	}
+}
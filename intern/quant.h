@@ -0,0 +1,21 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#ifndef __OMNI_QUANT_H__
+#define __OMNI_QUANT_H__
+
+#include <stddef.h>
+
+#include "types.h"
+#include "omnicache.h"
+
+/* Largest number of floats in a quantized element (`OMNI_DATA_MAT4`). */
+#define QUANT_MAX_COMPS 16
+
+bool quant_valid(OmniQuantization quant, uint num_comps);
+size_t quant_size(OmniQuantization quant, uint num_comps, size_t num);
+bool quant_encode(OmniQuantization quant, float error, uint num_comps, const float *src, size_t num, void *dst);
+void quant_decode(OmniQuantization quant, uint num_comps, const void *src, size_t num, float *dst);
+
+#endif /* __OMNI_QUANT_H__ */
@@ -0,0 +1,192 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include "thread.h"
+
+#include "utils.h"
+
+typedef struct thread_start {
+	thread_func func;
+	void *user_data;
+} thread_start;
+
+#ifdef _WIN32
+
+static DWORD WINAPI thread_main(LPVOID arg)
+{
+	thread_start start = *(thread_start *)arg;
+
+	free(arg);
+	start.func(start.user_data);
+
+	return 0;
+}
+
+bool thread_create(thread *r_thread, thread_func func, void *user_data)
+{
+	thread_start *start = malloc(sizeof(thread_start));
+
+	start->func = func;
+	start->user_data = user_data;
+
+	*r_thread = CreateThread(NULL, 0, thread_main, start, 0, NULL);
+
+	if (!*r_thread) {
+		free(start);
+
+		return false;
+	}
+
+	return true;
+}
+
+void thread_join(thread *thrd)
+{
+	WaitForSingleObject(*thrd, INFINITE);
+	CloseHandle(*thrd);
+}
+
+void mutex_init(thread_mutex *mutex)
+{
+	InitializeCriticalSection(mutex);
+}
+
+void mutex_free(thread_mutex *mutex)
+{
+	DeleteCriticalSection(mutex);
+}
+
+void mutex_lock(thread_mutex *mutex)
+{
+	EnterCriticalSection(mutex);
+}
+
+void mutex_unlock(thread_mutex *mutex)
+{
+	LeaveCriticalSection(mutex);
+}
+
+void cond_init(thread_cond *cond)
+{
+	InitializeConditionVariable(cond);
+}
+
+void cond_free(thread_cond *UNUSED(cond))
+{
+}
+
+void cond_wait(thread_cond *cond, thread_mutex *mutex)
+{
+	SleepConditionVariableCS(cond, mutex, INFINITE);
+}
+
+void cond_signal(thread_cond *cond)
+{
+	WakeConditionVariable(cond);
+}
+
+void cond_broadcast(thread_cond *cond)
+{
+	WakeAllConditionVariable(cond);
+}
+
+size_t atomic_add_z(size_t *value, size_t add)
+{
+	return (size_t)InterlockedExchangeAddSizeT(value, add) + add;
+}
+
+size_t atomic_sub_z(size_t *value, size_t sub)
+{
+	return (size_t)InterlockedExchangeAddSizeT(value, -(SSIZE_T)sub) - sub;
+}
+
+#else
+
+static void *thread_main(void *arg)
+{
+	thread_start start = *(thread_start *)arg;
+
+	free(arg);
+	start.func(start.user_data);
+
+	return NULL;
+}
+
+bool thread_create(thread *r_thread, thread_func func, void *user_data)
+{
+	thread_start *start = malloc(sizeof(thread_start));
+
+	start->func = func;
+	start->user_data = user_data;
+
+	if (pthread_create(r_thread, NULL, thread_main, start) != 0) {
+		free(start);
+
+		return false;
+	}
+
+	return true;
+}
+
+void thread_join(thread *thrd)
+{
+	pthread_join(*thrd, NULL);
+}
+
+void mutex_init(thread_mutex *mutex)
+{
+	pthread_mutex_init(mutex, NULL);
+}
+
+void mutex_free(thread_mutex *mutex)
+{
+	pthread_mutex_destroy(mutex);
+}
+
+void mutex_lock(thread_mutex *mutex)
+{
+	pthread_mutex_lock(mutex);
+}
+
+void mutex_unlock(thread_mutex *mutex)
+{
+	pthread_mutex_unlock(mutex);
+}
+
+void cond_init(thread_cond *cond)
+{
+	pthread_cond_init(cond, NULL);
+}
+
+void cond_free(thread_cond *cond)
+{
+	pthread_cond_destroy(cond);
+}
+
+void cond_wait(thread_cond *cond, thread_mutex *mutex)
+{
+	pthread_cond_wait(cond, mutex);
+}
+
+void cond_signal(thread_cond *cond)
+{
+	pthread_cond_signal(cond);
+}
+
+void cond_broadcast(thread_cond *cond)
+{
+	pthread_cond_broadcast(cond);
+}
+
+size_t atomic_add_z(size_t *value, size_t add)
+{
+	return __atomic_add_fetch(value, add, __ATOMIC_SEQ_CST);
+}
+
+size_t atomic_sub_z(size_t *value, size_t sub)
+{
+	return __atomic_sub_fetch(value, sub, __ATOMIC_SEQ_CST);
+}
+
+#endif
@@ -0,0 +1,48 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#ifndef __OMNI_THREAD_H__
+#define __OMNI_THREAD_H__
+
+#include <stddef.h>
+
+#include "types.h"
+
+#ifdef _WIN32
+#  ifndef WIN32_LEAN_AND_MEAN
+#    define WIN32_LEAN_AND_MEAN
+#  endif
+#  include <windows.h>
+typedef HANDLE thread;
+typedef CRITICAL_SECTION thread_mutex;
+typedef CONDITION_VARIABLE thread_cond;
+#else
+#  include <pthread.h>
+typedef pthread_t thread;
+typedef pthread_mutex_t thread_mutex;
+typedef pthread_cond_t thread_cond;
+#endif
+
+typedef void (*thread_func)(void *user_data);
+
+/* Minimal portable threads, mutexes and condition variables. */
+bool thread_create(thread *r_thread, thread_func func, void *user_data);
+void thread_join(thread *thrd);
+
+void mutex_init(thread_mutex *mutex);
+void mutex_free(thread_mutex *mutex);
+void mutex_lock(thread_mutex *mutex);
+void mutex_unlock(thread_mutex *mutex);
+
+void cond_init(thread_cond *cond);
+void cond_free(thread_cond *cond);
+void cond_wait(thread_cond *cond, thread_mutex *mutex);
+void cond_signal(thread_cond *cond);
+void cond_broadcast(thread_cond *cond);
+
+/* Atomic counters (returning the new value). */
+size_t atomic_add_z(size_t *value, size_t add);
+size_t atomic_sub_z(size_t *value, size_t sub);
+
+#endif /* __OMNI_THREAD_H__ */
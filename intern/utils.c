@@ -139,3 +139,50 @@ void *dupalloc(const void *source, const size_t size)
 
 	return target;
 }
+
+/* Aligned allocation, must be freed with `alignfree`. */
+void *alignalloc(const size_t size, const size_t align)
+{
+#ifdef _WIN32
+	return _aligned_malloc(size, align);
+#else
+	return aligned_alloc(align, ALIGN_UP(size, align));
+#endif
+}
+
+/* Aligned equivalent of `dupalloc`, must be freed with `alignfree`. */
+void *aligndup(const void *source, const size_t size, const size_t align)
+{
+	void *target;
+
+	if (!source) {
+		return NULL;
+	}
+
+	target = alignalloc(size, align);
+	memcpy(target, source, size);
+
+	return target;
+}
+
+void alignfree(void *ptr)
+{
+#ifdef _WIN32
+	_aligned_free(ptr);
+#else
+	free(ptr);
+#endif
+}
+
+/* 64-bit FNV-1a hash, continuing from `hash` (`HASH_INIT` to start a new hash). */
+uint64_t hash_bytes(uint64_t hash, const void *data, size_t size)
+{
+	const unsigned char *bytes = data;
+
+	for (size_t i = 0; i < size; i++) {
+		hash ^= bytes[i];
+		hash *= 0x100000001b3ULL;
+	}
+
+	return hash;
+}
@@ -6,11 +6,16 @@
 #define __OMNI_UTILS_H__
 
 #include <stdlib.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <string.h>
 #include <assert.h>
 #include <math.h>
 
+#ifdef _WIN32
+#  include <malloc.h>
+#endif
+
 #include "types.h"
 
 #ifdef __GNUC__
@@ -19,7 +24,22 @@
 #  define UNUSED(x) UNUSED_ ## x
 #endif
 
+#if defined(__GNUC__) && (__GNUC__ >= 7)
+#  define ATTR_FALLTHROUGH __attribute__((fallthrough))
+#else
+#  define ATTR_FALLTHROUGH ((void)0)
+#endif
+
 #define MIN_ARRAY 32
+#define MIN_SUBS 4
+
+/* Alignment used for sample arenas and other bulk allocations (cache line). */
+#define ALIGN_SIZE 64
+
+#define ALIGN_UP(size, align) (((size) + ((align) - 1)) & ~((size_t)(align) - 1))
+
+/* Initial value for `hash_bytes`. */
+#define HASH_INIT 0xcbf29ce484222325ULL
 
 #define MIN(val1, val2) (val1 < val2 ? val1 : val2)
 #define MAX(val1, val2) (val1 > val2 ? val1 : val2)
@@ -51,4 +71,10 @@ uint min_array_size(uint index);
 
 void *dupalloc(const void *source, const size_t size);
 
+void *alignalloc(const size_t size, const size_t align);
+void *aligndup(const void *source, const size_t size, const size_t align);
+void alignfree(void *ptr);
+
+uint64_t hash_bytes(uint64_t hash, const void *data, size_t size);
+
 #endif /* __OMNI_UTILS_H__ */
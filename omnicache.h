@@ -6,6 +6,7 @@
 #define __OMNI_OMNICACHE_H__
 
 #include <assert.h>
+#include <stddef.h>
 
 #include "types.h"
 
@@ -35,14 +36,48 @@ typedef enum OmniDataType {
 	OMNI_NUM_DTYPES	= 10, /* Number of data types (should always be the last entry). */
 } OmniDataType;
 
+typedef enum OmniInterpMode {
+	OMNI_INTERP_LINEAR		= 0, /* Element-wise linear interpolation. */
+	OMNI_INTERP_ROTATION	= 1, /* Interpolate `OMNI_DATA_MAT4` and `OMNI_DATA_TREF` matrices as translation, rotation and scale. */
+	OMNI_INTERP_CUBIC		= 2, /* Catmull-Rom interpolation of `OMNI_DATA_FLOAT` and `OMNI_DATA_FLOAT3`, using four samples. */
+} OmniInterpMode;
+
+/* Lossless compression of the data of a block, applied when a sample is written.
+ * Data in sample arenas (`OMNICACHE_FLAG_ARENA`) that fits its allocation is not compressed. */
+typedef enum OmniCodec {
+	OMNI_CODEC_NONE			= 0, /* Stored as is. */
+	OMNI_CODEC_SHUFFLE_LZ	= 1, /* Bytes grouped by position in each 4 byte word, then LZ compressed. */
+	OMNI_CODEC_FLOAT_XOR	= 2, /* Words XORed with the matching word of the previous element, then as `OMNI_CODEC_SHUFFLE_LZ`. */
+} OmniCodec;
+
+/* Lossy storage of the data of `OMNI_DATA_FLOAT`, `OMNI_DATA_FLOAT3`, `OMNI_DATA_MAT3` and `OMNI_DATA_MAT4` blocks,
+ * applied when a sample is written, before its codec. Data that can't be quantized within the error bound
+ * (`OmniBlockTemplate.quant_error`), and data in sample arenas, is stored as is. */
+typedef enum OmniQuantization {
+	OMNI_QUANT_NONE		= 0, /* Stored as is. */
+	OMNI_QUANT_HALF		= 1, /* 16 bit floats (precision relative to the magnitude of the values). */
+	OMNI_QUANT_FIXED	= 2, /* 16 bit fixed point, relative to the bounds of each component in the sample. */
+} OmniQuantization;
+
+/* Order in which samples are evicted when a memory budget is exceeded (see `OMNI_budget_set`). */
+typedef enum OmniEvictPolicy {
+	OMNI_EVICT_NONE		= 0, /* No budget. */
+	OMNI_EVICT_LRU		= 1, /* Least recently read or written samples first. */
+	OMNI_EVICT_PLAYHEAD	= 2, /* Samples furthest from the last read or written time first. */
+	OMNI_EVICT_INTERP	= 3, /* Only samples that can be interpolated from their neighbours, keeping every other one. */
+} OmniEvictPolicy;
+
 /*********
  * Types *
  *********/
 
 typedef struct OmniCache OmniCache;
 typedef struct OmniSerial OmniSerial;
+typedef struct OmniView OmniView;
+typedef struct OmniLoad OmniLoad;
 
-/* Transformed reference. */
+/* Transformed reference.
+ * Matrices are stored with the translation in `mat[3]` (column-major). */
 typedef struct OmniTRef {
 	uint index;
 	float mat[4][4];
@@ -66,6 +101,13 @@ typedef struct OmniInterpData {
 	float_or_uint ttarget;
 	float_or_uint tprev;
 	float_or_uint tnext;
+
+	/* Valid samples before `prev` and after `next`, for higher order interpolation.
+	 * NULL if there is no such sample, or if its element count differs. */
+	OmniData *prev2;
+	OmniData *next2;
+	float_or_uint tprev2;
+	float_or_uint tnext2;
 } OmniInterpData;
 
 typedef uint (*OmniCountCallback)(void *user_data);
@@ -75,6 +117,22 @@ typedef bool (*OmniInterpCallback)(OmniInterpData *interp_data);
 
 typedef bool (*OmniMetaGenCallback)(void *user_data, void *result);
 
+typedef void (*OmniFreeCallback)(void *ptr);
+
+/* Called by `OMNI_block_scan` for each sample, in time order (must not change the cache).
+ * Returns false to stop the scan. */
+typedef bool (*OmniScanCallback)(float_or_uint time, const OmniData *omni_data, void *user_data);
+
+/* Stream callbacks for serialization.
+ * write: returns false on failure.
+ * read: reads up to `size` bytes into `data`, returning the number of bytes read (0 on failure). */
+typedef bool (*OmniStreamWriteCallback)(const void *data, size_t size, void *user_data);
+typedef size_t (*OmniStreamReadCallback)(void *data, size_t size, void *user_data);
+
+/* Called (from a loader thread) once the sample at `times[index]` of an asynchronous load is loaded,
+ * or could not be loaded (`success` false). Must not use the cache. */
+typedef void (*OmniLoadCallback)(OmniLoad *load, uint index, bool success, void *user_data);
+
 /*********
  * Flags *
  *********/
@@ -94,20 +152,23 @@ typedef enum OmniReadResult {
 
 typedef enum OmniBlockFlags {
 	OMNI_BLOCK_FLAG_CONTINUOUS	= (1 << 0), /* Continuous data that can be interpolated. */
-	OMNI_BLOCK_FLAG_CONST_COUNT	= (1 << 1), /* Element count does not change between samples. (TODO: Check constness when writing) */
+	OMNI_BLOCK_FLAG_CONST_COUNT	= (1 << 1), /* Element count does not change between samples (`count` is only called once, and the data of all samples is pooled). */
 	OMNI_BLOCK_FLAG_MANDATORY	= (1 << 2), /* This block is always present in the cache, and can't be removed. (TODO: Respect this when removing blocks) */
+	OMNI_BLOCK_FLAG_DEDUP		= (1 << 3), /* Identical data is stored once, shared between samples (instead of delta encoded). */
 } OmniBlockFlags;
 
 typedef enum OmniCacheFlags {
 	OMNICACHE_FLAG_FRAMED		= (1 << 0), /* Time in frames instead of seconds. */
 	OMNICACHE_FLAG_INTERP_ANY	= (1 << 1), /* Interpolate when reading any inexistant sample is enabled. */
 	OMNICACHE_FLAG_INTERP_SUB	= (1 << 2), /* Interpolate only when reading between `time_step` increments. */
+	OMNICACHE_FLAG_ARENA		= (1 << 3), /* Allocate the blocks, metadata and data of each sample in a single contiguous allocation. */
 } OmniCacheFlags;
 
 typedef enum OmniConsolidationFlags {
 	OMNI_CONSOL_CONSOLIDATE		= (1 << 0),
 	OMNI_CONSOL_FREE_INVALID	= (1 << 1),
 	OMNI_CONSOL_FREE_OUTDATED	= (1 << 2),
+	OMNI_CONSOL_COLUMNS		= (1 << 3), /* Repack the data of each block into a single allocation, in time order (see `OMNI_block_scan`). */
 } OmniConsolidationFlags;
 
 /*************
@@ -121,6 +182,15 @@ typedef struct OmniBlockTemplate {
 	uint data_size; /* Only required if `dtype` == `OMNI_DATA_GENERIC` */
 
 	OmniBlockFlags flags;
+	OmniInterpMode interp_mode; /* Built-in interpolation used when `interp` is not set. */
+	OmniCodec codec; /* Data is kept uncompressed if the codec does not make it smaller. */
+	/* With `OMNI_BLOCK_FLAG_CONTINUOUS`, store every `delta_interval`th sample in full (keyframes), and the samples
+	 * in between as (lossless) differences from the previous one, compressed with `codec` (`OMNI_CODEC_SHUFFLE_LZ` if none).
+	 * 0 or 1 to store all samples in full. */
+	uint delta_interval;
+	OmniQuantization quantization;
+	/* Largest error allowed by `quantization` (required for `OMNI_QUANT_FIXED`, 0 for no bound with `OMNI_QUANT_HALF`). */
+	float quant_error;
 
 	OmniCountCallback count;
 	OmniReadCallback read;
@@ -172,11 +242,55 @@ void OMNI_block_add_by_index(OmniCache *cache, const OmniCacheTemplate *cache_te
 void OMNI_block_remove_by_index(OmniCache *cache, const uint block);
 
 OmniWriteResult OMNI_sample_write(OmniCache *cache, float_or_uint time, void *data);
+
+/* Write in two steps, letting the caller fill the block data directly instead of using `write` callbacks.
+ * `acquire` allocates the data of each block (aligned to 64 bytes), sized by the `count` callbacks,
+ * and describes it in `r_blocks` (`OMNI_get_num_blocks` entries). The sample is invalid until `commit`,
+ * which also generates the metadata (`data` is passed to the `count` and `meta_gen` callbacks). */
+OmniWriteResult OMNI_sample_write_acquire(OmniCache *cache, float_or_uint time, void *data, OmniData r_blocks[]);
+OmniWriteResult OMNI_sample_write_commit(OmniCache *cache, float_or_uint time, void *data);
+
+/* Write a single block by handing over an allocated buffer of `count` elements, instead of copying it.
+ * The cache frees `buffer` with `free_func` (or `free` if NULL) once done with it,
+ * unless the write fails, in which case it remains owned by the caller
+ * (as when `count` differs from the count of other samples, with `OMNI_BLOCK_FLAG_CONST_COUNT`).
+ * The sample becomes valid once all its blocks are written, at which point `data` is passed to `meta_gen`. */
+OmniWriteResult OMNI_block_write_move(OmniCache *cache, float_or_uint time, uint block,
+                                      void *buffer, uint count, OmniFreeCallback free_func, void *data);
+
+/* A cache must only be used by one thread at a time, reads included: reading (`OMNI_sample_read`, views,
+ * `OMNI_block_scan`, `OMNI_block_fetch`) decodes encoded data into scratch buffers of the cache, and updates its
+ * delta decoding and eviction state. Separate caches can be used from separate threads. */
 OmniReadResult OMNI_sample_read(OmniCache *cache, float_or_uint time, void *data);
 
+/* Read-only views of the data of a cached sample (no interpolation).
+ * The data stays unchanged until the view is released, even if the sample is overwritten or removed,
+ * or the cache is freed. Views of the same sample are shared, and must be released once per acquire.
+ * Views are acquired and released by the thread using the cache (see `OMNI_sample_read`).
+ * Acquiring fails (`OMNI_READ_INVALID`, with no view) if the data of the sample can't be decoded. */
+OmniReadResult OMNI_view_acquire(OmniCache *cache, float_or_uint time, OmniView **r_view);
+void OMNI_view_release(OmniView *view);
+
+uint OMNI_view_get_num_blocks(const OmniView *view);
+const OmniData *OMNI_view_get_block(const OmniView *view, uint block);
+const void *OMNI_view_get_meta(const OmniView *view);
+
+/* Read a single block of all valid samples between `time_start` and `time_end` (inclusive) in one pass, in time order
+ * (no interpolation). `scan` calls `func` with the data of each sample, returning the number of samples scanned.
+ * Samples whose data can't be decoded are skipped, and counted in `r_num_failed` (optional).
+ * `fetch` copies the data of all samples back to back into `buffer`, returning its size (only the size if `buffer` is
+ * NULL), and the number of samples in `r_num_samples` (optional). It fails (returning 0, and no samples) if the data of
+ * any sample can't be decoded, instead of leaving it out.
+ * After consolidating with `OMNI_CONSOL_COLUMNS`, the data of each block is contiguous across samples. */
+uint OMNI_block_scan(OmniCache *cache, uint block, float_or_uint time_start, float_or_uint time_end,
+                     OmniScanCallback func, void *user_data, uint *r_num_failed);
+size_t OMNI_block_fetch(OmniCache *cache, uint block, float_or_uint time_start, float_or_uint time_end,
+                        void *buffer, uint *r_num_samples);
+
 void OMNI_set_range(OmniCache *cache, float_or_uint time_initial, float_or_uint time_final, float_or_uint time_step);
 void OMNI_get_range(OmniCache *cache, float_or_uint *time_initial, float_or_uint *time_final, float_or_uint *time_step);
 uint OMNI_get_num_cached(OmniCache *cache);
+uint OMNI_get_num_blocks(const OmniCache *cache);
 
 void OMNI_move_start(OmniCache *cache, float_or_uint time_initial);
 void OMNI_move_end(OmniCache *cache, float_or_uint time_final);
@@ -201,9 +315,74 @@ void OMNI_sample_mark_outdated_from(OmniCache *cache, float_or_uint time);
 void OMNI_sample_mark_invalid_from(OmniCache *cache, float_or_uint time);
 void OMNI_sample_clear_from(OmniCache *cache, float_or_uint time);
 
-uint OMNI_serial_get_size(const OmniCache *cache, bool serialize_data);
-OmniSerial *OMNI_serialize(const OmniCache *cache, bool serialize_data, uint *size);
+/* Serialize the cache definition, and optionally all the sample data (including metadata). */
+size_t OMNI_serial_get_size(const OmniCache *cache, bool serialize_data);
+OmniSerial *OMNI_serialize(const OmniCache *cache, bool serialize_data, size_t *size);
 void OMNI_serialize_to_buffer(OmniSerial *serial, const OmniCache *cache, bool serialize_data);
 OmniCache *OMNI_deserialize(OmniSerial *serial, const OmniCacheTemplate *cache_temp);
 
+/* Deserialize without copying the sample data, which keeps pointing into `serial` until it is rewritten.
+ * `serial` (preferably aligned to 16 bytes) must outlive the cache and its views. */
+OmniCache *OMNI_deserialize_borrowed(const OmniSerial *serial, const OmniCacheTemplate *cache_temp);
+
+/* Serialize through a callback, in chunks of at most 1 MB, without building the whole serial in memory.
+ * The stream deserializer never reads past the end of the serialized cache (returns NULL on failure). */
+bool OMNI_serialize_stream(const OmniCache *cache, bool serialize_data, OmniStreamWriteCallback write, void *user_data);
+OmniCache *OMNI_deserialize_stream(OmniStreamReadCallback read, void *user_data, const OmniCacheTemplate *cache_temp);
+
+/* Cache files: `OMNI_file_open` maps the file, and the data of each sample is only paged in from disk
+ * when it is accessed (paged out again by the OS under memory pressure).
+ * Rewritten samples are reallocated in memory; the file is never modified, and is kept mapped until the
+ * cache and all its views are freed. */
+bool OMNI_file_write(const OmniCache *cache, const char *path);
+OmniCache *OMNI_file_open(const char *path, const OmniCacheTemplate *cache_temp);
+
+/* Journaling: while a journal is active, each completed sample write and each invalidation (as a tombstone)
+ * is appended to the journal file, using sequential writes only.
+ * `OMNI_journal_start` (re)creates the journal, starting with the current samples of the cache.
+ * `OMNI_journal_resume` rebuilds a cache by replaying a journal up to its last complete record
+ * (e.g. after a crash mid-bake), and keeps appending to it.
+ * The journal is closed (writing its footer index) by `OMNI_journal_stop` or `OMNI_free`.
+ * Moving the time range (`OMNI_move_start`, `OMNI_move_end`) is recorded, but changing the blocks or
+ * setting the time range of a journaled cache stops its journal, which has to be started again. */
+bool OMNI_journal_start(OmniCache *cache, const char *path);
+OmniCache *OMNI_journal_resume(const char *path, const OmniCacheTemplate *cache_temp);
+void OMNI_journal_stop(OmniCache *cache);
+
+/* Write the journal from a background thread, so writes to the cache only pay the in-memory cost.
+ * Up to `max_queued` records can be waiting to be written before writes block (0 to write synchronously again).
+ * The data of queued samples stays pinned (as by a view) until written, even if the samples are rewritten. */
+void OMNI_journal_set_async(OmniCache *cache, uint max_queued);
+/* Wait until all queued records have been written to the journal. */
+void OMNI_journal_flush(OmniCache *cache);
+
+/* Asynchronous loading of samples borrowed from a cache file (see `OMNI_file_open`) or spilled (see `OMNI_budget_set`),
+ * which are paged in by background threads (with all reads started up front) instead of on first access by the caller.
+ * Completion is reported through `callback` (optional), `OMNI_load_poll` (number of samples done),
+ * or `OMNI_load_wait`. The samples (invalid ones fail) stay pinned, as by a view, until the load is released.
+ * Loads must be released (which waits for them) by the thread using the cache, before it is freed. */
+OmniLoad *OMNI_load_submit(OmniCache *cache, const float_or_uint times[], uint num_times,
+                           OmniLoadCallback callback, void *user_data);
+uint OMNI_load_poll(OmniLoad *load);
+void OMNI_load_wait(OmniLoad *load);
+void OMNI_load_release(OmniLoad *load);
+
+/* Read-ahead for file-backed (or spilled) caches. Once `OMNI_sample_read` is called with a steady step in either
+ * direction (e.g. during playback), the next samples along that step are loaded asynchronously, up to
+ * `max_samples` samples and `max_bytes` bytes (0 for no limit) ahead. 0 `max_samples` disables it. */
+void OMNI_prefetch_set(OmniCache *cache, uint max_samples, size_t max_bytes);
+
+/* Memory accounted to a cache (sample data, metadata and index), or to all caches. */
+size_t OMNI_get_memory(const OmniCache *cache);
+size_t OMNI_get_memory_global(void);
+
+/* Memory budget of a cache. When a write takes the cache past `max_bytes` (0 for no limit of its own),
+ * or all caches past the global limit, samples of the cache are evicted by `policy`, down to 7/8 of the limit.
+ * Evicted samples are dropped (left invalid), or with a `spill_path`, moved to files named after it,
+ * which stay mapped (and are paged back in on access) but no longer count against the budget.
+ * Samples pinned by views, or being written, are not evicted. */
+void OMNI_budget_set(OmniCache *cache, size_t max_bytes, OmniEvictPolicy policy, const char *spill_path);
+/* Limit to the memory of all caches (0 for none), enforced by the caches that have a budget. */
+void OMNI_budget_set_global(size_t max_bytes);
+
 #endif /* __OMNI_OMNICACHE_H__ */
@@ -0,0 +1,134 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include "test.h"
+
+static uint sample_count(void *user_data, uint index)
+{
+	test_sample *sample = user_data;
+
+	return sample->count[index];
+}
+
+static bool sample_read(OmniData *omni_data, void *user_data, uint index)
+{
+	test_sample *sample = user_data;
+
+	sample->count[index] = omni_data->dcount;
+	memcpy(sample->data[index], omni_data->data, (size_t)omni_data->dsize * omni_data->dcount);
+
+	return true;
+}
+
+static bool sample_write(OmniData *omni_data, void *user_data, uint index)
+{
+	test_sample *sample = user_data;
+
+	memcpy(omni_data->data, sample->data[index], (size_t)omni_data->dsize * omni_data->dcount);
+
+	return true;
+}
+
+static bool sample_meta_gen(void *user_data, void *result)
+{
+	test_sample *sample = user_data;
+
+	memcpy(result, &sample->meta, sizeof(float));
+
+	return true;
+}
+
+/* Callbacks don't know which block they are called for, so each block index gets its own. */
+#define TEST_BLOCK_CALLBACKS(i) \
+	static uint block_count_##i(void *user_data) { return sample_count(user_data, i); } \
+	static bool block_read_##i(OmniData *omni_data, void *user_data) { return sample_read(omni_data, user_data, i); } \
+	static bool block_write_##i(OmniData *omni_data, void *user_data) { return sample_write(omni_data, user_data, i); }
+
+TEST_BLOCK_CALLBACKS(0)
+TEST_BLOCK_CALLBACKS(1)
+TEST_BLOCK_CALLBACKS(2)
+TEST_BLOCK_CALLBACKS(3)
+
+static const OmniCountCallback block_count[TEST_MAX_BLOCKS] = {block_count_0, block_count_1, block_count_2, block_count_3};
+static const OmniReadCallback block_read[TEST_MAX_BLOCKS] = {block_read_0, block_read_1, block_read_2, block_read_3};
+static const OmniWriteCallback block_write[TEST_MAX_BLOCKS] = {block_write_0, block_write_1, block_write_2, block_write_3};
+
+OmniCacheTemplate *test_template_new(const char *id, OmniTimeType ttype, OmniCacheFlags flags, uint num_blocks)
+{
+	OmniCacheTemplate *cache_temp = calloc(1, sizeof(OmniCacheTemplate) + (sizeof(OmniBlockTemplate) * num_blocks));
+
+	TEST_CHECK(num_blocks <= TEST_MAX_BLOCKS);
+
+	strncpy(cache_temp->id, id, MAX_NAME - 1);
+	cache_temp->time_type = ttype;
+
+	if (ttype == OMNI_TIME_FLOAT) {
+		cache_temp->time_initial = OMNI_f_to_fu(0.0f);
+		cache_temp->time_final = OMNI_f_to_fu(1000.0f);
+		cache_temp->time_step = OMNI_f_to_fu(1.0f);
+	}
+	else {
+		cache_temp->time_initial = OMNI_u_to_fu(0);
+		cache_temp->time_final = OMNI_u_to_fu(1000);
+		cache_temp->time_step = OMNI_u_to_fu(1);
+	}
+
+	cache_temp->flags = flags;
+	cache_temp->meta_size = sizeof(float);
+	cache_temp->meta_gen = sample_meta_gen;
+	cache_temp->num_blocks = num_blocks;
+
+	return cache_temp;
+}
+
+void test_block_set(OmniCacheTemplate *cache_temp, uint index, const char *id, OmniDataType dtype, OmniBlockFlags flags)
+{
+	OmniBlockTemplate *b_temp = &cache_temp->blocks[index];
+
+	TEST_CHECK(index < cache_temp->num_blocks);
+
+	strncpy(b_temp->id, id, MAX_NAME - 1);
+	b_temp->data_type = dtype;
+	b_temp->flags = flags;
+	b_temp->count = block_count[index];
+	b_temp->read = block_read[index];
+	b_temp->write = block_write[index];
+}
+
+void test_sample_alloc(test_sample *sample, uint num_blocks, size_t size)
+{
+	for (uint i = 0; i < num_blocks; i++) {
+		sample->data[i] = calloc(1, size);
+	}
+}
+
+void test_sample_free(test_sample *sample, uint num_blocks)
+{
+	for (uint i = 0; i < num_blocks; i++) {
+		free(sample->data[i]);
+		sample->data[i] = NULL;
+	}
+}
+
+void test_fill(void *values, uint num, float base)
+{
+	float *fvalues = values;
+
+	for (uint i = 0; i < num; i++) {
+		fvalues[i] = base + (float)i;
+	}
+}
+
+bool test_filled(const void *values, uint num, float base)
+{
+	const float *fvalues = values;
+
+	for (uint i = 0; i < num; i++) {
+		if (fvalues[i] != base + (float)i) {
+			return false;
+		}
+	}
+
+	return true;
+}
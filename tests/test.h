@@ -0,0 +1,46 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#ifndef __OMNI_TEST_H__
+#define __OMNI_TEST_H__
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "omnicache.h"
+
+/* Exit with a failure (reported by CTest) if `cond` does not hold. */
+#define TEST_CHECK(cond) \
+	do { \
+		if (!(cond)) { \
+			fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+			exit(1); \
+		} \
+	} while (0)
+
+#define TEST_MAX_BLOCKS 4
+
+/* User data of the test caches, passed to the callbacks set by `test_block_set`.
+ * Block `i` is written from `count[i]` elements at `data[i]`, and read back into `data[i]` (which must be large
+ * enough), setting `count[i]`. The metadata (`meta_size` of `float`) is a copy of `meta`. */
+typedef struct test_sample {
+	uint count[TEST_MAX_BLOCKS];
+	void *data[TEST_MAX_BLOCKS];
+	float meta;
+} test_sample;
+
+/* Template with `num_blocks` blocks (to be set with `test_block_set`), and a time range of 0 to 1000 in steps of 1. */
+OmniCacheTemplate *test_template_new(const char *id, OmniTimeType ttype, OmniCacheFlags flags, uint num_blocks);
+void test_block_set(OmniCacheTemplate *cache_temp, uint index, const char *id, OmniDataType dtype, OmniBlockFlags flags);
+
+/* Allocate (zeroed) and free `size` bytes of data for each of the first `num_blocks` blocks of a sample. */
+void test_sample_alloc(test_sample *sample, uint num_blocks, size_t size);
+void test_sample_free(test_sample *sample, uint num_blocks);
+
+/* Fill `num` floats with `base`, `base + 1`, `base + 2`..., and check values filled that way. */
+void test_fill(void *values, uint num, float base);
+bool test_filled(const void *values, uint num, float base);
+
+#endif /* __OMNI_TEST_H__ */
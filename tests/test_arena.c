@@ -0,0 +1,93 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include "test.h"
+
+/* Samples written, rewritten (growing and shrinking), duplicated and cleared read back the same,
+ * with or without sample arenas (`OMNICACHE_FLAG_ARENA`). */
+static void test_arena(OmniCacheFlags flags)
+{
+	OmniCacheTemplate *cache_temp = test_template_new("arena", OMNI_TIME_FLOAT, flags, 2);
+	OmniCache *cache;
+	OmniCache *dup;
+	test_sample sample = {0};
+	test_sample result = {0};
+
+	test_block_set(cache_temp, 0, "pos", OMNI_DATA_FLOAT3, OMNI_BLOCK_FLAG_CONTINUOUS);
+	test_block_set(cache_temp, 1, "weight", OMNI_DATA_FLOAT, 0);
+	cache = OMNI_new(cache_temp, "pos;weight");
+
+	test_sample_alloc(&sample, 2, 1024 * sizeof(float[3]));
+	test_sample_alloc(&result, 2, 1024 * sizeof(float[3]));
+
+	for (uint frame = 0; frame < 100; frame++) {
+		for (uint sub = 0; sub < 4; sub++) {
+			float time = (float)frame + (sub * 0.25f);
+
+			sample.count[0] = 10 + (frame % 7);
+			sample.count[1] = 5;
+			sample.meta = time;
+			test_fill(sample.data[0], sample.count[0] * 3, time * 100.0f);
+			test_fill(sample.data[1], sample.count[1], -time);
+
+			TEST_CHECK(OMNI_sample_write(cache, OMNI_f_to_fu(time), &sample) == OMNI_WRITE_SUCCESS);
+		}
+	}
+
+	TEST_CHECK(OMNI_get_num_cached(cache) == 400);
+
+	for (uint frame = 0; frame < 100; frame += 3) {
+		float time = (float)frame + 0.75f;
+
+		TEST_CHECK(OMNI_sample_read(cache, OMNI_f_to_fu(time), &result) == OMNI_READ_EXACT);
+		TEST_CHECK(result.count[0] == 10 + (frame % 7) && result.count[1] == 5);
+		TEST_CHECK(test_filled(result.data[0], result.count[0] * 3, time * 100.0f));
+		TEST_CHECK(test_filled(result.data[1], result.count[1], -time));
+	}
+
+	/* Rewriting with more elements than the sample holds, then fewer. */
+	sample.count[0] = 1000;
+	test_fill(sample.data[0], sample.count[0] * 3, -5000.0f);
+	TEST_CHECK(OMNI_sample_write(cache, OMNI_f_to_fu(3.0f), &sample) == OMNI_WRITE_SUCCESS);
+	TEST_CHECK(OMNI_sample_read(cache, OMNI_f_to_fu(3.0f), &result) == OMNI_READ_EXACT);
+	TEST_CHECK(result.count[0] == 1000 && test_filled(result.data[0], 3000, -5000.0f));
+
+	sample.count[0] = 2;
+	test_fill(sample.data[0], sample.count[0] * 3, 7.0f);
+	TEST_CHECK(OMNI_sample_write(cache, OMNI_f_to_fu(3.0f), &sample) == OMNI_WRITE_SUCCESS);
+	TEST_CHECK(OMNI_sample_read(cache, OMNI_f_to_fu(3.0f), &result) == OMNI_READ_EXACT);
+	TEST_CHECK(result.count[0] == 2 && test_filled(result.data[0], 6, 7.0f));
+
+	/* Duplicates keep their own copy of the data. */
+	dup = OMNI_duplicate(cache, true);
+	OMNI_sample_clear_from(cache, OMNI_f_to_fu(50.5f));
+
+	TEST_CHECK(OMNI_get_num_cached(cache) == 202);
+	TEST_CHECK(OMNI_sample_read(cache, OMNI_f_to_fu(50.25f), &result) == OMNI_READ_EXACT);
+	TEST_CHECK(OMNI_sample_read(cache, OMNI_f_to_fu(75.25f), &result) == OMNI_READ_INVALID);
+	TEST_CHECK(OMNI_sample_read(dup, OMNI_f_to_fu(75.25f), &result) == OMNI_READ_EXACT);
+	TEST_CHECK(test_filled(result.data[0], result.count[0] * 3, 7525.0f));
+	TEST_CHECK(OMNI_sample_read(dup, OMNI_f_to_fu(3.0f), &result) == OMNI_READ_EXACT && result.count[0] == 2);
+
+	OMNI_sample_clear(cache, OMNI_f_to_fu(20.5f));
+	OMNI_consolidate(cache, OMNI_CONSOL_CONSOLIDATE | OMNI_CONSOL_FREE_INVALID);
+
+	TEST_CHECK(OMNI_sample_read(cache, OMNI_f_to_fu(20.5f), &result) == OMNI_READ_INVALID);
+	TEST_CHECK(OMNI_sample_read(cache, OMNI_f_to_fu(20.75f), &result) == OMNI_READ_EXACT);
+	TEST_CHECK(test_filled(result.data[0], result.count[0] * 3, 2075.0f));
+
+	OMNI_free(cache);
+	OMNI_free(dup);
+	test_sample_free(&sample, 2);
+	test_sample_free(&result, 2);
+	free(cache_temp);
+}
+
+int main(void)
+{
+	test_arena(0);
+	test_arena(OMNICACHE_FLAG_ARENA);
+
+	return 0;
+}
@@ -0,0 +1,102 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include "test.h"
+
+static bool points_into(const void *ptr, const void *buffer, size_t size)
+{
+	return (const char *)ptr >= (const char *)buffer && (const char *)ptr < (const char *)buffer + size;
+}
+
+/* Caches deserialized with `OMNI_deserialize_borrowed` read their data from the serial, never writing to it,
+ * and copy it once rewritten (or duplicated). */
+static void test_borrow(OmniCacheFlags flags)
+{
+	OmniCacheTemplate *cache_temp = test_template_new("borrow", OMNI_TIME_FLOAT, flags, 1);
+	OmniCache *cache;
+	OmniCache *borrowed;
+	OmniCache *dup;
+	OmniSerial *serial;
+	char *serial_copy;
+	test_sample sample = {0};
+	test_sample result = {0};
+	OmniData blocks[1];
+	OmniView *view;
+	const float *values;
+	size_t size;
+
+	test_block_set(cache_temp, 0, "value", OMNI_DATA_FLOAT, 0);
+	cache = OMNI_new(cache_temp, "value");
+
+	test_sample_alloc(&sample, 1, 100 * sizeof(float));
+	test_sample_alloc(&result, 1, 100 * sizeof(float));
+
+	for (uint k = 0; k < 10; k++) {
+		sample.count[0] = k + 3;
+		test_fill(sample.data[0], sample.count[0], k * 100.0f);
+		TEST_CHECK(OMNI_sample_write(cache, OMNI_f_to_fu(k * 0.5f), &sample) == OMNI_WRITE_SUCCESS);
+	}
+
+	serial = OMNI_serialize(cache, true, &size);
+	serial_copy = malloc(size);
+	memcpy(serial_copy, serial, size);
+
+	borrowed = OMNI_deserialize_borrowed(serial, cache_temp);
+	TEST_CHECK(borrowed);
+
+	TEST_CHECK(OMNI_view_acquire(borrowed, OMNI_f_to_fu(1.5f), &view) == OMNI_READ_EXACT);
+	values = OMNI_view_get_block(view, 0)->data;
+	TEST_CHECK(points_into(values, serial, size) && test_filled(values, 6, 300.0f));
+
+	TEST_CHECK(OMNI_sample_read(borrowed, OMNI_f_to_fu(2.0f), &result) == OMNI_READ_EXACT);
+	TEST_CHECK(result.count[0] == 7 && test_filled(result.data[0], 7, 400.0f));
+
+	/* Rewrites of all kinds leave the serial untouched. */
+	sample.count[0] = 5;
+	test_fill(sample.data[0], 5, -1.0f);
+	TEST_CHECK(OMNI_sample_write(borrowed, OMNI_f_to_fu(1.5f), &sample) == OMNI_WRITE_SUCCESS);
+	TEST_CHECK(OMNI_sample_write(borrowed, OMNI_f_to_fu(2.0f), &sample) == OMNI_WRITE_SUCCESS);
+	TEST_CHECK(OMNI_block_write_move(borrowed, OMNI_f_to_fu(2.5f), 0, calloc(2, sizeof(float)), 2, NULL, &sample) ==
+	           OMNI_WRITE_SUCCESS);
+
+	TEST_CHECK(OMNI_sample_write_acquire(borrowed, OMNI_f_to_fu(3.0f), &sample, blocks) == OMNI_WRITE_SUCCESS);
+	TEST_CHECK(!points_into(blocks[0].data, serial, size));
+	test_fill(blocks[0].data, 5, 3.0f);
+	TEST_CHECK(OMNI_sample_write_commit(borrowed, OMNI_f_to_fu(3.0f), &sample) == OMNI_WRITE_SUCCESS);
+
+	TEST_CHECK(memcmp(serial_copy, serial, size) == 0);
+	TEST_CHECK(test_filled(values, 6, 300.0f));
+
+	TEST_CHECK(OMNI_sample_read(borrowed, OMNI_f_to_fu(1.5f), &result) == OMNI_READ_EXACT);
+	TEST_CHECK(result.count[0] == 5 && test_filled(result.data[0], 5, -1.0f));
+	TEST_CHECK(OMNI_sample_read(borrowed, OMNI_f_to_fu(3.0f), &result) == OMNI_READ_EXACT);
+	TEST_CHECK(test_filled(result.data[0], 5, 3.0f));
+
+	/* Duplicates own their data, so outlive the serial. */
+	dup = OMNI_duplicate(borrowed, true);
+	OMNI_sample_clear_from(borrowed, OMNI_f_to_fu(4.0f));
+	OMNI_free(borrowed);
+	TEST_CHECK(memcmp(serial_copy, serial, size) == 0);
+
+	OMNI_view_release(view);
+	free(serial);
+
+	TEST_CHECK(OMNI_sample_read(dup, OMNI_f_to_fu(4.5f), &result) == OMNI_READ_EXACT);
+	TEST_CHECK(result.count[0] == 12 && test_filled(result.data[0], 12, 900.0f));
+
+	OMNI_free(dup);
+	OMNI_free(cache);
+	free(serial_copy);
+	test_sample_free(&sample, 1);
+	test_sample_free(&result, 1);
+	free(cache_temp);
+}
+
+int main(void)
+{
+	test_borrow(0);
+	test_borrow(OMNICACHE_FLAG_ARENA);
+
+	return 0;
+}
@@ -0,0 +1,345 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include "test.h"
+
+#include "omni_types.h"
+#include "omni_utils.h"
+
+#define PATH "test_budget.omc"
+#define PATH_SPILL "test_budget.spill"
+
+#define BUDGET 1000000
+/* Slack over the budget, for the index and metadata. */
+#define BUDGET_SLACK 16384
+
+#define COUNT 20000
+
+static void frame_write(OmniCache *cache, test_sample *sample, uint frame, float time)
+{
+	sample->count[0] = COUNT;
+	test_fill(sample->data[0], COUNT, frame * 100.0f);
+	TEST_CHECK(OMNI_sample_write(cache, OMNI_f_to_fu(time), sample) == OMNI_WRITE_SUCCESS);
+}
+
+static bool frame_check(OmniCache *cache, test_sample *result, uint frame, float time)
+{
+	return OMNI_sample_read(cache, OMNI_f_to_fu(time), result) == OMNI_READ_EXACT && result->count[0] == COUNT &&
+	       test_filled(result->data[0], COUNT, frame * 100.0f);
+}
+
+static OmniSample *sample_find(OmniCache *cache, uint tindex)
+{
+	for (OmniSample *sample = SAMPLE_FIRST(cache); sample; sample = sample_next(sample)) {
+		if (sample->tindex == tindex) {
+			return sample;
+		}
+	}
+
+	return NULL;
+}
+
+/* Number of spill files mapped by the process (only counted on Linux). */
+static uint spills_mapped(void)
+{
+	uint num = 0;
+#ifdef __linux__
+	FILE *maps = fopen("/proc/self/maps", "r");
+	char line[1024];
+
+	TEST_CHECK(maps);
+
+	while (fgets(line, sizeof(line), maps)) {
+		if (strstr(line, PATH_SPILL)) {
+			num++;
+		}
+	}
+
+	fclose(maps);
+#endif
+
+	return num;
+}
+
+/* Memory accounting follows the sample data written, duplicated and freed. */
+static void test_memory(const OmniCacheTemplate *cache_temp, test_sample *sample)
+{
+	OmniCache *cache = OMNI_new(cache_temp, "value");
+	OmniCache *dup;
+	size_t memory_base = OMNI_get_memory(cache);
+
+	for (uint frame = 0; frame < 20; frame++) {
+		frame_write(cache, sample, frame, (float)frame);
+	}
+
+	TEST_CHECK(OMNI_get_memory(cache) > memory_base + 20 * COUNT * sizeof(float));
+	TEST_CHECK(OMNI_get_memory(cache) < memory_base + 20 * (COUNT * sizeof(float) + 1000) + 4096);
+	TEST_CHECK(OMNI_get_memory_global() == OMNI_get_memory(cache) - memory_base);
+
+	dup = OMNI_duplicate(cache, true);
+	TEST_CHECK(OMNI_get_memory(dup) == OMNI_get_memory(cache));
+
+	frame_write(cache, sample, 0, 3.5f);
+	OMNI_sample_clear(cache, OMNI_f_to_fu(3.5f));
+	OMNI_sample_clear(cache, OMNI_f_to_fu(4.0f));
+	OMNI_consolidate(cache, OMNI_CONSOL_FREE_INVALID);
+	OMNI_clear(cache);
+	TEST_CHECK(OMNI_get_memory(cache) == memory_base);
+
+	OMNI_free(dup);
+	OMNI_free(cache);
+	TEST_CHECK(OMNI_get_memory_global() == 0);
+}
+
+/* Each policy keeps the cache within its budget, evicting the samples it should. */
+static void test_evict(const OmniCacheTemplate *cache_temp, test_sample *sample, test_sample *result)
+{
+	OmniCache *cache = OMNI_new(cache_temp, "value");
+	uint num_interp = 0;
+
+	OMNI_budget_set(cache, BUDGET, OMNI_EVICT_LRU, NULL);
+
+	for (uint frame = 0; frame < 40; frame++) {
+		frame_write(cache, sample, frame, (float)frame);
+		TEST_CHECK(OMNI_get_memory(cache) <= BUDGET + BUDGET_SLACK);
+
+		/* Recently read, so kept. */
+		if (frame == 5) {
+			TEST_CHECK(frame_check(cache, result, 0, 0.0f));
+		}
+	}
+
+	TEST_CHECK(OMNI_sample_is_valid(cache, OMNI_f_to_fu(39.0f)) && OMNI_sample_is_valid(cache, OMNI_f_to_fu(33.0f)));
+	TEST_CHECK(!OMNI_sample_is_valid(cache, OMNI_f_to_fu(10.0f)));
+
+	OMNI_clear(cache);
+	OMNI_budget_set(cache, BUDGET, OMNI_EVICT_PLAYHEAD, NULL);
+
+	for (uint frame = 0; frame < 12; frame++) {
+		frame_write(cache, sample, frame, (float)frame);
+	}
+
+	/* Furthest from the last write first. */
+	frame_write(cache, sample, 12, 12.0f);
+	TEST_CHECK(OMNI_get_memory(cache) <= BUDGET + BUDGET_SLACK);
+	TEST_CHECK(OMNI_sample_is_valid(cache, OMNI_f_to_fu(11.0f)) && !OMNI_sample_is_valid(cache, OMNI_f_to_fu(0.0f)));
+
+	/* Evicted samples are interpolated back from the ones kept. */
+	OMNI_clear(cache);
+	OMNI_budget_set(cache, BUDGET, OMNI_EVICT_INTERP, NULL);
+
+	for (uint frame = 0; frame < 16; frame++) {
+		frame_write(cache, sample, frame, (float)frame);
+	}
+
+	for (uint frame = 0; frame < 15; frame++) {
+		OmniReadResult res = OMNI_sample_read(cache, OMNI_f_to_fu((float)frame), result);
+
+		TEST_CHECK(!(res & OMNI_READ_INVALID) && test_filled(result->data[0], COUNT, frame * 100.0f));
+
+		if (res & OMNI_READ_INTERP) {
+			TEST_CHECK(OMNI_sample_is_valid(cache, OMNI_f_to_fu(frame - 1.0f)));
+			TEST_CHECK(OMNI_sample_is_valid(cache, OMNI_f_to_fu(frame + 1.0f)));
+			num_interp++;
+		}
+	}
+
+	TEST_CHECK(num_interp >= 4);
+
+	OMNI_free(cache);
+}
+
+/* Spilled samples read back the same, from views, duplicates and cache files too, and are rewritten in memory. */
+static void test_spill(const OmniCacheTemplate *cache_temp, test_sample *sample, test_sample *result)
+{
+	OmniCache *cache = OMNI_new(cache_temp, "value");
+	OmniCache *dup;
+	OmniCache *opened;
+	OmniView *view;
+
+	OMNI_budget_set(cache, BUDGET, OMNI_EVICT_LRU, PATH_SPILL);
+
+	for (uint frame = 0; frame < 40; frame++) {
+		frame_write(cache, sample, frame, (float)frame);
+		TEST_CHECK(OMNI_get_memory(cache) <= BUDGET + BUDGET_SLACK);
+	}
+
+	TEST_CHECK(OMNI_view_acquire(cache, OMNI_f_to_fu(2.0f), &view) == OMNI_READ_EXACT);
+
+	for (uint frame = 0; frame < 40; frame++) {
+		TEST_CHECK(frame_check(cache, result, frame, (float)frame));
+	}
+
+	frame_write(cache, sample, 77, 2.0f);
+	TEST_CHECK(OMNI_view_get_block(view, 0)->dcount == COUNT);
+	TEST_CHECK(test_filled(OMNI_view_get_block(view, 0)->data, COUNT, 200.0f));
+	TEST_CHECK(frame_check(cache, result, 77, 2.0f));
+
+	dup = OMNI_duplicate(cache, true);
+	TEST_CHECK(OMNI_file_write(cache, PATH));
+
+	OMNI_prefetch_set(cache, 4, 0);
+
+	for (uint frame = 0; frame < 40; frame++) {
+		TEST_CHECK(OMNI_sample_read(cache, OMNI_f_to_fu((float)frame), result) == OMNI_READ_EXACT);
+	}
+
+	opened = OMNI_file_open(PATH, cache_temp);
+	TEST_CHECK(opened);
+
+	for (uint frame = 0; frame < 40; frame++) {
+		uint expected = (frame == 2) ? 77 : frame;
+
+		TEST_CHECK(frame_check(opened, result, expected, (float)frame));
+		TEST_CHECK(frame_check(dup, result, expected, (float)frame));
+	}
+
+	OMNI_free(opened);
+	OMNI_free(dup);
+	OMNI_free(cache);
+	remove(PATH);
+
+	TEST_CHECK(test_filled(OMNI_view_get_block(view, 0)->data, COUNT, 200.0f));
+	OMNI_view_release(view);
+	TEST_CHECK(spills_mapped() == 0);
+}
+
+/* Spill files are unmapped once all their samples are rewritten (unless still viewed). */
+static void test_spill_rewrite(const OmniCacheTemplate *cache_temp, test_sample *sample, test_sample *result)
+{
+	OmniCache *cache = OMNI_new(cache_temp, "value");
+	OmniView *view = NULL;
+	uint max_mapped = 0;
+
+	OMNI_budget_set(cache, 100000, OMNI_EVICT_LRU, PATH_SPILL);
+	sample->count[0] = 1000;
+
+	for (uint pass = 0; pass < 10; pass++) {
+		uint num_mapped;
+
+		for (uint frame = 0; frame < 100; frame++) {
+			test_fill(sample->data[0], 1000, (float)(pass * 1000 + frame));
+			TEST_CHECK(OMNI_sample_write(cache, OMNI_f_to_fu((float)frame), sample) == OMNI_WRITE_SUCCESS);
+		}
+
+		if (pass == 2) {
+			TEST_CHECK(OMNI_view_acquire(cache, OMNI_f_to_fu(3.0f), &view) == OMNI_READ_EXACT);
+		}
+
+		num_mapped = spills_mapped();
+		max_mapped = (num_mapped > max_mapped) ? num_mapped : max_mapped;
+	}
+
+	TEST_CHECK(max_mapped < 60);
+
+	for (uint frame = 0; frame < 100; frame++) {
+		TEST_CHECK(OMNI_sample_read(cache, OMNI_f_to_fu((float)frame), result) == OMNI_READ_EXACT);
+		TEST_CHECK(result->count[0] == 1000 && test_filled(result->data[0], 1000, (float)(9000 + frame)));
+	}
+
+	TEST_CHECK(test_filled(OMNI_view_get_block(view, 0)->data, 1000, 2003.0f));
+	OMNI_view_release(view);
+	OMNI_clear(cache);
+	TEST_CHECK(spills_mapped() == 0);
+
+	OMNI_free(cache);
+}
+
+/* Moving a block into a spilled sample leaves its other blocks spilled. */
+static void test_spill_detach(test_sample *sample, test_sample *result)
+{
+	OmniCacheTemplate *cache_temp = test_template_new("budget_detach", OMNI_TIME_FLOAT, 0, 2);
+	OmniCache *cache;
+	OmniSample *moved;
+	OmniView *view;
+	float *buffer = malloc(COUNT * sizeof(float));
+
+	test_block_set(cache_temp, 0, "a", OMNI_DATA_FLOAT, 0);
+	test_block_set(cache_temp, 1, "b", OMNI_DATA_FLOAT, 0);
+	cache = OMNI_new(cache_temp, "a;b");
+	OMNI_budget_set(cache, BUDGET, OMNI_EVICT_LRU, PATH_SPILL);
+
+	sample->count[1] = COUNT;
+
+	for (uint frame = 0; frame < 20; frame++) {
+		test_fill(sample->data[1], COUNT, frame * -100.0f);
+		frame_write(cache, sample, frame, (float)frame);
+	}
+
+	moved = sample_find(cache, 2);
+	TEST_CHECK(moved && (moved->blocks[1].status & OMNI_BLOCK_STATUS_SPILLED));
+	OMNI_budget_set(cache, 0, OMNI_EVICT_NONE, NULL);
+
+	TEST_CHECK(OMNI_view_acquire(cache, OMNI_f_to_fu(2.0f), &view) == OMNI_READ_EXACT);
+	test_fill(buffer, COUNT, -1.0f);
+	TEST_CHECK(OMNI_block_write_move(cache, OMNI_f_to_fu(2.0f), 0, buffer, COUNT, free, sample) == OMNI_WRITE_SUCCESS);
+
+	moved = sample_find(cache, 2);
+	TEST_CHECK(moved && (moved->blocks[1].status & OMNI_BLOCK_STATUS_SPILLED));
+	TEST_CHECK(moved->blocks[1].status & OMNI_BLOCK_STATUS_BORROWED);
+
+	TEST_CHECK(OMNI_sample_read(cache, OMNI_f_to_fu(2.0f), result) == OMNI_READ_EXACT);
+	TEST_CHECK(test_filled(result->data[0], COUNT, -1.0f) && test_filled(result->data[1], COUNT, -200.0f));
+
+	OMNI_free(cache);
+	TEST_CHECK(test_filled(OMNI_view_get_block(view, 0)->data, COUNT, 200.0f));
+	TEST_CHECK(test_filled(OMNI_view_get_block(view, 1)->data, COUNT, -200.0f));
+	OMNI_view_release(view);
+
+	free(cache_temp);
+}
+
+/* The global budget is shared by the caches with a budget. */
+static void test_global(const OmniCacheTemplate *cache_temp, test_sample *sample)
+{
+	OmniCache *cache_a = OMNI_new(cache_temp, "value");
+	OmniCache *cache_b = OMNI_new(cache_temp, "value");
+
+	OMNI_budget_set_global(2 * BUDGET);
+	OMNI_budget_set(cache_a, 0, OMNI_EVICT_LRU, NULL);
+	OMNI_budget_set(cache_b, 0, OMNI_EVICT_LRU, NULL);
+
+	for (uint frame = 0; frame < 30; frame++) {
+		frame_write(cache_a, sample, frame, (float)frame);
+		frame_write(cache_b, sample, frame, (float)frame);
+		TEST_CHECK(OMNI_get_memory_global() <= 2 * BUDGET + 200000);
+	}
+
+	OMNI_budget_set_global(0);
+	OMNI_free(cache_a);
+	OMNI_free(cache_b);
+}
+
+static void test_budget(OmniCacheFlags flags)
+{
+	OmniCacheTemplate *cache_temp = test_template_new("budget", OMNI_TIME_FLOAT, flags | OMNICACHE_FLAG_INTERP_ANY, 1);
+	test_sample sample = {0};
+	test_sample result = {0};
+
+	test_block_set(cache_temp, 0, "value", OMNI_DATA_FLOAT, OMNI_BLOCK_FLAG_CONTINUOUS);
+
+	test_sample_alloc(&sample, 2, COUNT * sizeof(float));
+	test_sample_alloc(&result, 2, COUNT * sizeof(float));
+
+	test_memory(cache_temp, &sample);
+	test_evict(cache_temp, &sample, &result);
+	test_spill(cache_temp, &sample, &result);
+	test_spill_rewrite(cache_temp, &sample, &result);
+	test_spill_detach(&sample, &result);
+	test_global(cache_temp, &sample);
+
+	TEST_CHECK(OMNI_get_memory_global() == 0);
+
+	test_sample_free(&sample, 2);
+	test_sample_free(&result, 2);
+	free(cache_temp);
+}
+
+int main(void)
+{
+	test_budget(0);
+	test_budget(OMNICACHE_FLAG_ARENA);
+
+	return 0;
+}
@@ -0,0 +1,413 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include <math.h>
+#include <stdint.h>
+
+#include "test.h"
+
+#include "codec.h"
+
+#define PATH "test_codec.omc"
+#define PATH_COPY "test_codec_copy.omc"
+#define PATH_CORRUPT "test_codec_corrupt.omc"
+#define PATH_JOURNAL "test_codec.omj"
+#define PATH_SPILL "test_codec.spill"
+
+#define COUNT 2000
+
+static uint32_t random_next(uint32_t *state)
+{
+	*state ^= *state << 13;
+	*state ^= *state >> 17;
+	*state ^= *state << 5;
+
+	return *state;
+}
+
+/* Encoded data decodes back exactly, while truncated or damaged data fails to decode (or decodes to garbage),
+ * without reading or writing out of bounds. */
+static void test_codec_kernel(OmniCodec codec, uint stride, size_t size, uint pattern)
+{
+	uint8_t *src = malloc(size + 1);
+	uint8_t *dst = malloc(codec_bound(size));
+	uint8_t *decoded = malloc(size + 1);
+	uint8_t *work = malloc(size + 1);
+	uint32_t state = 0x12345678;
+	size_t csize;
+
+	for (size_t i = 0; i < size; i++) {
+		switch (pattern) {
+			case 0:
+				src[i] = 0;
+				break;
+			case 1:
+				src[i] = (uint8_t)(i % 7);
+				break;
+			default:
+				src[i] = (uint8_t)random_next(&state);
+				break;
+		}
+	}
+
+	/* Smooth floats. */
+	if (pattern == 3) {
+		for (size_t i = 0; i + sizeof(float) <= size; i += sizeof(float)) {
+			float value = sinf(i * 0.001f);
+
+			memcpy(&src[i], &value, sizeof(float));
+		}
+	}
+
+	csize = codec_encode(codec, stride, src, size, dst, work);
+	TEST_CHECK(csize <= codec_bound(size));
+
+	/* Random bytes don't compress. */
+	TEST_CHECK(pattern != 2 || size < 64 || csize == 0);
+
+	if (csize > 0) {
+		TEST_CHECK(csize < size);
+		TEST_CHECK(codec_decode(dst, csize, decoded, size, stride, work));
+		TEST_CHECK(memcmp(decoded, src, size) == 0);
+
+		/* Only an empty trailing sequence can be left out. */
+		if (codec_decode(dst, csize - 1, decoded, size, stride, work)) {
+			TEST_CHECK(dst[csize - 1] == 0 && memcmp(decoded, src, size) == 0);
+		}
+
+		TEST_CHECK(!codec_decode(dst, csize / 2, decoded, size, stride, work));
+		TEST_CHECK(!codec_decode(dst, csize, decoded, size + 1, stride, work));
+
+		for (size_t i = 0; i < csize; i += csize / 64 + 1) {
+			dst[i] ^= 0x5a;
+			codec_decode(dst, csize, decoded, size, stride, work);
+			dst[i] ^= 0x5a;
+		}
+	}
+
+	free(src);
+	free(dst);
+	free(decoded);
+	free(work);
+}
+
+static void sample_fill(test_sample *sample, uint frame)
+{
+	float *values = sample->data[0];
+	int *indices = sample->data[1];
+	uint8_t *bytes = sample->data[2];
+
+	for (uint i = 0; i < COUNT * 3; i++) {
+		values[i] = sinf(i * 0.001f) + frame;
+		indices[i] = (int)(i / 3 + frame);
+		bytes[i] = (uint8_t)(i % 7 + frame);
+	}
+
+	sample->count[0] = COUNT;
+	sample->count[1] = COUNT;
+	sample->count[2] = COUNT;
+}
+
+static bool sample_same(const test_sample *a, const test_sample *b)
+{
+	return a->count[0] == b->count[0] && a->count[1] == b->count[1] && a->count[2] == b->count[2] &&
+	       memcmp(a->data[0], b->data[0], a->count[0] * sizeof(float[3])) == 0 &&
+	       memcmp(a->data[1], b->data[1], a->count[1] * sizeof(int[3])) == 0 &&
+	       memcmp(a->data[2], b->data[2], a->count[2] * 3) == 0;
+}
+
+static void check_frames(OmniCache *cache, uint num_frames, test_sample *result, test_sample *expected)
+{
+	for (uint frame = 0; frame < num_frames; frame++) {
+		sample_fill(expected, frame);
+		TEST_CHECK(OMNI_sample_read(cache, OMNI_f_to_fu((float)frame), result) == OMNI_READ_EXACT);
+		TEST_CHECK(sample_same(result, expected));
+	}
+}
+
+static OmniCacheTemplate *template_new(OmniCacheFlags flags, OmniCodec codec_values, OmniCodec codec_indices)
+{
+	OmniCacheTemplate *cache_temp = test_template_new("codec", OMNI_TIME_FLOAT, flags | OMNICACHE_FLAG_INTERP_ANY, 3);
+
+	cache_temp->meta_size = 0;
+	cache_temp->meta_gen = NULL;
+
+	test_block_set(cache_temp, 0, "values", OMNI_DATA_FLOAT3, OMNI_BLOCK_FLAG_CONTINUOUS);
+	test_block_set(cache_temp, 1, "indices", OMNI_DATA_INT3, 0);
+	test_block_set(cache_temp, 2, "bytes", OMNI_DATA_GENERIC, 0);
+	cache_temp->blocks[0].codec = codec_values;
+	cache_temp->blocks[1].codec = codec_indices;
+	cache_temp->blocks[2].codec = OMNI_CODEC_FLOAT_XOR;
+	cache_temp->blocks[2].data_size = 3;
+
+	return cache_temp;
+}
+
+typedef struct stream {
+	char *data;
+	size_t size;
+	size_t pos;
+} stream;
+
+static bool stream_write(const void *data, size_t size, void *user_data)
+{
+	stream *st = user_data;
+
+	st->data = realloc(st->data, st->size + size);
+	memcpy(st->data + st->size, data, size);
+	st->size += size;
+
+	return true;
+}
+
+static size_t stream_read(void *data, size_t size, void *user_data)
+{
+	stream *st = user_data;
+
+	if (size > st->size - st->pos) {
+		size = st->size - st->pos;
+	}
+
+	memcpy(data, st->data + st->pos, size);
+	st->pos += size;
+
+	return size;
+}
+
+static bool scan_func(float_or_uint time, const OmniData *omni_data, void *user_data)
+{
+	(void)time;
+	(void)user_data;
+
+	TEST_CHECK(omni_data->data);
+
+	return true;
+}
+
+/* Damaged cache files fail the reads, views and scans of the samples that can't be decoded, consistently. */
+static void test_corrupt(const OmniCacheTemplate *cache_temp, OmniCacheFlags flags, test_sample *result)
+{
+	FILE *file = fopen(PATH, "rb");
+	OmniCache *opened;
+	OmniView *view;
+	char *data;
+	long size;
+	uint num_failed_read = 0;
+	uint num_failed_view = 0;
+	uint num_failed_scan;
+	uint num_scanned;
+
+	TEST_CHECK(file);
+	fseek(file, 0, SEEK_END);
+	size = ftell(file);
+	fseek(file, 0, SEEK_SET);
+	data = malloc((size_t)size);
+	TEST_CHECK(fread(data, 1, (size_t)size, file) == (size_t)size);
+	fclose(file);
+
+	for (long i = size / 2; i < size; i += 61) {
+		data[i] ^= 0x5a;
+	}
+
+	file = fopen(PATH_CORRUPT, "wb");
+	TEST_CHECK(file && fwrite(data, 1, (size_t)size, file) == (size_t)size);
+	fclose(file);
+	free(data);
+
+	opened = OMNI_file_open(PATH_CORRUPT, cache_temp);
+	TEST_CHECK(opened);
+
+	for (uint frame = 0; frame < 10; frame++) {
+		OMNI_sample_read(opened, OMNI_f_to_fu(frame + 0.5f), result);
+	}
+
+	for (uint frame = 0; frame < 10; frame++) {
+		OmniReadResult res;
+
+		if (OMNI_sample_read(opened, OMNI_f_to_fu((float)frame), result) != OMNI_READ_EXACT) {
+			num_failed_read++;
+		}
+
+		res = OMNI_view_acquire(opened, OMNI_f_to_fu((float)frame), &view);
+		TEST_CHECK((res == OMNI_READ_INVALID) == (view == NULL));
+
+		if (view) {
+			OMNI_view_release(view);
+		}
+		else {
+			num_failed_view++;
+		}
+	}
+
+	num_scanned = OMNI_block_scan(opened, 0, OMNI_f_to_fu(0.0f), OMNI_f_to_fu(9.0f), scan_func, NULL, &num_failed_scan);
+	TEST_CHECK(num_scanned + num_failed_scan == 10);
+
+	/* Arena data is kept uncompressed. */
+	if (!(flags & OMNICACHE_FLAG_ARENA)) {
+		TEST_CHECK(num_failed_read > 0 && num_failed_view > 0 && num_failed_scan > 0);
+	}
+
+	OMNI_free(opened);
+	remove(PATH_CORRUPT);
+}
+
+/* Compressed blocks read back (and interpolate) the same as uncompressed ones, through every path data takes in and
+ * out of a cache, using less memory. */
+static void test_codec_cache(OmniCacheFlags flags, OmniCodec codec_values, OmniCodec codec_indices)
+{
+	OmniCacheTemplate *cache_temp = template_new(flags, codec_values, codec_indices);
+	OmniCacheTemplate *raw_temp = template_new(flags, OMNI_CODEC_NONE, OMNI_CODEC_NONE);
+	OmniCache *cache = OMNI_new(cache_temp, "values;indices;bytes");
+	OmniCache *raw = OMNI_new(raw_temp, "values;indices;bytes");
+	OmniCache *loaded;
+	OmniSerial *serial;
+	OmniView *view;
+	OmniData blocks[3];
+	stream st = {0};
+	test_sample sample = {0};
+	test_sample result = {0};
+	test_sample expected = {0};
+	size_t size;
+
+	test_sample_alloc(&sample, 3, COUNT * sizeof(float[3]));
+	test_sample_alloc(&result, 3, COUNT * sizeof(float[3]));
+	test_sample_alloc(&expected, 3, COUNT * sizeof(float[3]));
+
+	for (uint frame = 0; frame < 10; frame++) {
+		sample_fill(&sample, frame);
+		TEST_CHECK(OMNI_sample_write(cache, OMNI_f_to_fu((float)frame), &sample) == OMNI_WRITE_SUCCESS);
+		TEST_CHECK(OMNI_sample_write(raw, OMNI_f_to_fu((float)frame), &sample) == OMNI_WRITE_SUCCESS);
+	}
+
+	if (!(flags & OMNICACHE_FLAG_ARENA)) {
+		TEST_CHECK(OMNI_get_memory(cache) < OMNI_get_memory(raw) / 2);
+	}
+
+	check_frames(cache, 10, &result, &expected);
+
+	TEST_CHECK(OMNI_sample_read(cache, OMNI_f_to_fu(3.25f), &result) & OMNI_READ_INTERP);
+	TEST_CHECK(OMNI_sample_read(raw, OMNI_f_to_fu(3.25f), &expected) & OMNI_READ_INTERP);
+	TEST_CHECK(sample_same(&result, &expected));
+
+	/* Views keep the decoded data across rewrites. */
+	TEST_CHECK(OMNI_view_acquire(cache, OMNI_f_to_fu(4.0f), &view) == OMNI_READ_EXACT);
+	sample_fill(&expected, 4);
+	TEST_CHECK(memcmp(OMNI_view_get_block(view, 0)->data, expected.data[0], COUNT * sizeof(float[3])) == 0);
+	sample_fill(&sample, 50);
+	TEST_CHECK(OMNI_sample_write(cache, OMNI_f_to_fu(4.0f), &sample) == OMNI_WRITE_SUCCESS);
+	TEST_CHECK(memcmp(OMNI_view_get_block(view, 1)->data, expected.data[1], COUNT * sizeof(int[3])) == 0);
+	OMNI_view_release(view);
+
+	sample_fill(&sample, 4);
+	TEST_CHECK(OMNI_sample_write(cache, OMNI_f_to_fu(4.0f), &sample) == OMNI_WRITE_SUCCESS);
+
+	sample_fill(&sample, 5);
+	TEST_CHECK(OMNI_sample_write_acquire(cache, OMNI_f_to_fu(5.0f), &sample, blocks) == OMNI_WRITE_SUCCESS);
+
+	for (uint i = 0; i < 3; i++) {
+		memcpy(blocks[i].data, sample.data[i], (size_t)blocks[i].dsize * blocks[i].dcount);
+	}
+
+	TEST_CHECK(OMNI_sample_write_commit(cache, OMNI_f_to_fu(5.0f), &sample) == OMNI_WRITE_SUCCESS);
+	check_frames(cache, 10, &result, &expected);
+
+	/* Serialized, borrowed and streamed. */
+	serial = OMNI_serialize(cache, true, &size);
+	loaded = OMNI_deserialize(serial, cache_temp);
+	check_frames(loaded, 10, &result, &expected);
+	OMNI_free(loaded);
+
+	loaded = OMNI_deserialize_borrowed(serial, cache_temp);
+	check_frames(loaded, 10, &result, &expected);
+	TEST_CHECK(OMNI_view_acquire(loaded, OMNI_f_to_fu(2.0f), &view) == OMNI_READ_EXACT);
+	OMNI_free(loaded);
+	sample_fill(&expected, 2);
+	TEST_CHECK(memcmp(OMNI_view_get_block(view, 0)->data, expected.data[0], COUNT * sizeof(float[3])) == 0);
+	OMNI_view_release(view);
+
+	TEST_CHECK(OMNI_serialize_stream(cache, true, stream_write, &st) && st.size == size);
+	loaded = OMNI_deserialize_stream(stream_read, &st, cache_temp);
+	check_frames(loaded, 10, &result, &expected);
+	OMNI_free(loaded);
+	free(st.data);
+	free(serial);
+
+	loaded = OMNI_duplicate(cache, true);
+	check_frames(loaded, 10, &result, &expected);
+	OMNI_free(loaded);
+
+	/* Cache files, written again once opened. */
+	TEST_CHECK(OMNI_file_write(cache, PATH));
+	loaded = OMNI_file_open(PATH, cache_temp);
+	check_frames(loaded, 10, &result, &expected);
+	TEST_CHECK(OMNI_file_write(loaded, PATH_COPY));
+	OMNI_free(loaded);
+	loaded = OMNI_file_open(PATH_COPY, cache_temp);
+	check_frames(loaded, 10, &result, &expected);
+	OMNI_free(loaded);
+
+	test_corrupt(cache_temp, flags, &result);
+	remove(PATH);
+	remove(PATH_COPY);
+
+	TEST_CHECK(OMNI_journal_start(cache, PATH_JOURNAL));
+	OMNI_journal_set_async(cache, 4);
+
+	for (uint frame = 10; frame < 20; frame++) {
+		sample_fill(&sample, frame);
+		TEST_CHECK(OMNI_sample_write(cache, OMNI_f_to_fu((float)frame), &sample) == OMNI_WRITE_SUCCESS);
+	}
+
+	OMNI_journal_stop(cache);
+	loaded = OMNI_journal_resume(PATH_JOURNAL, cache_temp);
+	TEST_CHECK(loaded);
+	check_frames(loaded, 20, &result, &expected);
+	OMNI_journal_stop(loaded);
+	OMNI_free(loaded);
+	remove(PATH_JOURNAL);
+
+	OMNI_budget_set(cache, OMNI_get_memory(cache) / 3, OMNI_EVICT_LRU, PATH_SPILL);
+
+	for (uint frame = 20; frame < 40; frame++) {
+		sample_fill(&sample, frame);
+		TEST_CHECK(OMNI_sample_write(cache, OMNI_f_to_fu((float)frame), &sample) == OMNI_WRITE_SUCCESS);
+	}
+
+	check_frames(cache, 40, &result, &expected);
+	loaded = OMNI_duplicate(cache, true);
+	check_frames(loaded, 40, &result, &expected);
+	OMNI_free(loaded);
+
+	OMNI_free(cache);
+	OMNI_free(raw);
+	TEST_CHECK(OMNI_get_memory_global() == 0);
+
+	test_sample_free(&sample, 3);
+	test_sample_free(&result, 3);
+	test_sample_free(&expected, 3);
+	free(cache_temp);
+	free(raw_temp);
+}
+
+int main(void)
+{
+	static const uint strides[] = {1, 3, 4, 12, 16};
+	static const size_t sizes[] = {1, 5, 63, 64, 1000, 4099, 20001};
+
+	for (uint codec = OMNI_CODEC_SHUFFLE_LZ; codec <= OMNI_CODEC_FLOAT_XOR; codec++) {
+		for (uint s = 0; s < sizeof(strides) / sizeof(*strides); s++) {
+			for (uint n = 0; n < sizeof(sizes) / sizeof(*sizes); n++) {
+				for (uint pattern = 0; pattern < 4; pattern++) {
+					test_codec_kernel((OmniCodec)codec, strides[s], sizes[n] * strides[s], pattern);
+				}
+			}
+		}
+	}
+
+	test_codec_cache(0, OMNI_CODEC_SHUFFLE_LZ, OMNI_CODEC_SHUFFLE_LZ);
+	test_codec_cache(0, OMNI_CODEC_FLOAT_XOR, OMNI_CODEC_FLOAT_XOR);
+	test_codec_cache(OMNICACHE_FLAG_ARENA, OMNI_CODEC_FLOAT_XOR, OMNI_CODEC_SHUFFLE_LZ);
+
+	return 0;
+}
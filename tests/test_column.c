@@ -0,0 +1,265 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include "test.h"
+
+#include "omni_types.h"
+#include "omni_utils.h"
+
+#define PATH "test_column.omc"
+#define PATH_CORRUPT "test_column_corrupt.omc"
+
+#define COUNT 1000
+#define NUM_FRAMES 40
+
+/* State of a scan, checking samples come in time order, with the expected data. */
+typedef struct scan_state {
+	float time_prev;
+	uint num_samples;
+	uint num_stop; /* Stop after this many samples (0 to scan all). */
+} scan_state;
+
+static float sample_base(float time)
+{
+	return time * 100.0f;
+}
+
+static void sample_write(OmniCache *cache, test_sample *sample, float time)
+{
+	test_fill(sample->data[0], COUNT * 3, sample_base(time));
+	test_fill(sample->data[1], COUNT, -sample_base(time));
+	sample->count[0] = COUNT;
+	sample->count[1] = COUNT;
+	TEST_CHECK(OMNI_sample_write(cache, OMNI_f_to_fu(time), sample) == OMNI_WRITE_SUCCESS);
+}
+
+static bool scan_func(float_or_uint time, const OmniData *omni_data, void *user_data)
+{
+	scan_state *state = user_data;
+
+	TEST_CHECK(time.f > state->time_prev);
+	TEST_CHECK(omni_data->dcount == COUNT);
+	TEST_CHECK(test_filled(omni_data->data, COUNT * 3, sample_base(time.f)));
+
+	state->time_prev = time.f;
+	state->num_samples++;
+
+	return state->num_samples != state->num_stop;
+}
+
+/* Scans and fetches of the values of the first `num_frames` frames (and the sub-sample), whole and over part of
+ * the range. */
+static void check_scan(OmniCache *cache, uint num_frames)
+{
+	uint num_samples = num_frames + 1;
+	scan_state state = {-1.0f, 0, 0};
+	float *buffer;
+	size_t size;
+	uint num;
+	uint num_failed;
+
+	TEST_CHECK(OMNI_block_scan(cache, 0, OMNI_f_to_fu(-10.0f), OMNI_f_to_fu(1000.0f), scan_func, &state, &num_failed) ==
+	           num_samples);
+	TEST_CHECK(state.num_samples == num_samples && num_failed == 0);
+
+	state = (scan_state){4.5f, 0, 0};
+	TEST_CHECK(OMNI_block_scan(cache, 0, OMNI_f_to_fu(5.0f), OMNI_f_to_fu(8.0f), scan_func, &state, NULL) == 4);
+	TEST_CHECK(state.time_prev == 8.0f);
+
+	state = (scan_state){-1.0f, 0, 3};
+	TEST_CHECK(OMNI_block_scan(cache, 0, OMNI_f_to_fu(0.0f), OMNI_f_to_fu(1000.0f), scan_func, &state, NULL) == 3);
+
+	size = OMNI_block_fetch(cache, 0, OMNI_f_to_fu(0.0f), OMNI_f_to_fu(1000.0f), NULL, &num);
+	TEST_CHECK(num == num_samples && size == num_samples * COUNT * sizeof(float[3]));
+
+	buffer = malloc(size);
+	TEST_CHECK(OMNI_block_fetch(cache, 0, OMNI_f_to_fu(0.0f), OMNI_f_to_fu(1000.0f), buffer, &num) == size);
+	TEST_CHECK(num == num_samples);
+
+	num = 0;
+	for (uint frame = 0; frame < num_frames; frame++) {
+		TEST_CHECK(test_filled(buffer + (size_t)num * COUNT * 3, COUNT * 3, sample_base((float)frame)));
+		num++;
+
+		/* Sub-sample. */
+		if (frame == 2) {
+			TEST_CHECK(test_filled(buffer + (size_t)num * COUNT * 3, COUNT * 3, sample_base(2.5f)));
+			num++;
+		}
+	}
+
+	free(buffer);
+
+	TEST_CHECK(OMNI_block_fetch(cache, 0, OMNI_f_to_fu(500.0f), OMNI_f_to_fu(1000.0f), NULL, &num) == 0 && num == 0);
+}
+
+/* Number of samples whose values directly follow those of the previous sample in memory. */
+static uint num_contiguous(OmniCache *cache)
+{
+	size_t stride = ALIGN_UP(COUNT * sizeof(float[3]), ALIGN_SIZE);
+	const char *prev = NULL;
+	uint num = 0;
+
+	for (OmniSample *sample = SAMPLE_FIRST(cache); sample; sample = sample_next(sample)) {
+		const char *data = sample->blocks[0].data;
+
+		if (prev && data == prev + stride) {
+			num++;
+		}
+
+		prev = data;
+	}
+
+	return num;
+}
+
+/* A fetch fails as a whole when the data of any sample can't be decoded, while a scan skips it. */
+static void test_fetch_corrupt(const OmniCacheTemplate *cache_temp)
+{
+	FILE *file = fopen(PATH, "rb");
+	OmniCache *opened;
+	char *data;
+	long size;
+	size_t size_fetch;
+	uint num;
+	uint num_failed;
+	uint num_scanned;
+
+	TEST_CHECK(file);
+	fseek(file, 0, SEEK_END);
+	size = ftell(file);
+	fseek(file, 0, SEEK_SET);
+	data = malloc((size_t)size);
+	TEST_CHECK(fread(data, 1, (size_t)size, file) == (size_t)size);
+	fclose(file);
+
+	for (long i = size / 2; i < size; i += 61) {
+		data[i] ^= 0x5a;
+	}
+
+	file = fopen(PATH_CORRUPT, "wb");
+	TEST_CHECK(file && fwrite(data, 1, (size_t)size, file) == (size_t)size);
+	fclose(file);
+	free(data);
+
+	opened = OMNI_file_open(PATH_CORRUPT, cache_temp);
+	TEST_CHECK(opened);
+
+	size_fetch = OMNI_block_fetch(opened, 0, OMNI_f_to_fu(0.0f), OMNI_f_to_fu(1000.0f), NULL, &num);
+	TEST_CHECK(size_fetch > 0 && num == NUM_FRAMES + 1);
+
+	num_scanned = OMNI_block_scan(opened, 0, OMNI_f_to_fu(0.0f), OMNI_f_to_fu(1000.0f), scan_func,
+	                              &(scan_state){-1.0f, 0, 0}, &num_failed);
+	TEST_CHECK(num_failed > 0 && num_scanned + num_failed == NUM_FRAMES + 1);
+
+	data = malloc(size_fetch);
+	TEST_CHECK(OMNI_block_fetch(opened, 0, OMNI_f_to_fu(0.0f), OMNI_f_to_fu(1000.0f), data, &num) == 0 && num == 0);
+	free(data);
+
+	OMNI_free(opened);
+	remove(PATH_CORRUPT);
+}
+
+/* Consolidating into columns lays the data of each sample after the previous one, leaving data pinned by views,
+ * without changing what reads, scans and fetches return, before or after rewrites, serialization and cache files. */
+static void test_columns(OmniCodec codec)
+{
+	OmniCacheTemplate *cache_temp = test_template_new("column", OMNI_TIME_FLOAT, 0, 2);
+	OmniCache *cache;
+	OmniCache *loaded;
+	OmniSerial *serial;
+	OmniView *view;
+	test_sample sample = {0};
+	test_sample result = {0};
+	void *data;
+	size_t mem;
+	size_t size;
+
+	test_block_set(cache_temp, 0, "values", OMNI_DATA_FLOAT3, 0);
+	test_block_set(cache_temp, 1, "weights", OMNI_DATA_FLOAT, 0);
+	cache_temp->blocks[0].codec = codec;
+	cache_temp->blocks[1].codec = OMNI_CODEC_SHUFFLE_LZ;
+	cache = OMNI_new(cache_temp, "values;weights");
+
+	test_sample_alloc(&sample, 2, COUNT * sizeof(float[3]));
+	test_sample_alloc(&result, 2, COUNT * sizeof(float[3]));
+
+	/* Written out of order, with a sub-sample. */
+	for (uint frame = NUM_FRAMES; frame-- > 0;) {
+		sample_write(cache, &sample, (float)frame);
+	}
+
+	sample_write(cache, &sample, 2.5f);
+	check_scan(cache, NUM_FRAMES);
+
+	TEST_CHECK(OMNI_view_acquire(cache, OMNI_f_to_fu(6.0f), &view) == OMNI_READ_EXACT);
+	mem = OMNI_get_memory(cache);
+	OMNI_consolidate(cache, OMNI_CONSOL_COLUMNS);
+
+	if (codec == OMNI_CODEC_NONE) {
+		/* All but the sample pinned by the view, which splits the column. */
+		TEST_CHECK(num_contiguous(cache) == NUM_FRAMES - 2);
+		TEST_CHECK(OMNI_get_memory(cache) <= mem + 2 * ALIGN_SIZE);
+
+		for (OmniSample *sample_iter = SAMPLE_FIRST(cache); sample_iter; sample_iter = sample_next(sample_iter)) {
+			TEST_CHECK(!(sample_iter->blocks[1].status & OMNI_BLOCK_STATUS_COLUMN));
+		}
+	}
+
+	check_scan(cache, NUM_FRAMES);
+	TEST_CHECK(test_filled(OMNI_view_get_block(view, 0)->data, COUNT * 3, sample_base(6.0f)));
+	OMNI_view_release(view);
+
+	/* Rewrites stay in place in the column. */
+	data = SAMPLE_FIRST(cache)->blocks[0].data;
+	sample_write(cache, &sample, 0.0f);
+	TEST_CHECK(codec != OMNI_CODEC_NONE || SAMPLE_FIRST(cache)->blocks[0].data == data);
+	TEST_CHECK(OMNI_sample_read(cache, OMNI_f_to_fu(2.5f), &result) == OMNI_READ_EXACT);
+	TEST_CHECK(test_filled(result.data[0], COUNT * 3, sample_base(2.5f)));
+	TEST_CHECK(test_filled(result.data[1], COUNT, -sample_base(2.5f)));
+
+	OMNI_consolidate(cache, OMNI_CONSOL_COLUMNS);
+	check_scan(cache, NUM_FRAMES);
+
+	serial = OMNI_serialize(cache, true, &size);
+	loaded = OMNI_deserialize(serial, cache_temp);
+	check_scan(loaded, NUM_FRAMES);
+	OMNI_consolidate(loaded, OMNI_CONSOL_COLUMNS);
+	check_scan(loaded, NUM_FRAMES);
+	OMNI_free(loaded);
+	free(serial);
+
+	TEST_CHECK(OMNI_file_write(cache, PATH));
+	loaded = OMNI_file_open(PATH, cache_temp);
+	TEST_CHECK(loaded);
+	check_scan(loaded, NUM_FRAMES);
+	OMNI_free(loaded);
+
+	if (codec != OMNI_CODEC_NONE) {
+		test_fetch_corrupt(cache_temp);
+	}
+
+	remove(PATH);
+
+	/* Columns are freed with the last block using them, possibly held by a view after the cache. */
+	OMNI_sample_clear_from(cache, OMNI_f_to_fu(10.0f));
+	check_scan(cache, 10);
+	TEST_CHECK(OMNI_view_acquire(cache, OMNI_f_to_fu(3.0f), &view) == OMNI_READ_EXACT);
+	OMNI_free(cache);
+	TEST_CHECK(OMNI_get_memory_global() == 0);
+	TEST_CHECK(test_filled(OMNI_view_get_block(view, 0)->data, COUNT * 3, sample_base(3.0f)));
+	OMNI_view_release(view);
+
+	test_sample_free(&sample, 2);
+	test_sample_free(&result, 2);
+	free(cache_temp);
+}
+
+int main(void)
+{
+	test_columns(OMNI_CODEC_NONE);
+	test_columns(OMNI_CODEC_SHUFFLE_LZ);
+
+	return 0;
+}
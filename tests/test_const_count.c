@@ -0,0 +1,153 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include "test.h"
+
+#include "omni_types.h"
+#include "omni_utils.h"
+#include "pool.h"
+
+#define PATH "test_const_count.omc"
+
+#define COUNT 1000
+#define NUM_FRAMES 100
+
+static uint num_count_calls;
+
+static uint count_calls(void *user_data)
+{
+	num_count_calls++;
+
+	return ((test_sample *)user_data)->count[0];
+}
+
+/* Number of consecutive samples whose block data is laid out contiguously (one slot apart). */
+static uint num_contiguous(OmniCache *cache)
+{
+	size_t stride = ALIGN_UP(COUNT * sizeof(float), ALIGN_SIZE);
+	const char *prev = NULL;
+	uint num = 0;
+
+	for (OmniSample *sample = SAMPLE_FIRST(cache); sample; sample = sample_next(sample)) {
+		const char *data = sample->blocks[0].data;
+
+		TEST_CHECK(sample->blocks[0].status & OMNI_BLOCK_STATUS_POOLED);
+
+		if (prev && data == prev + stride) {
+			num++;
+		}
+
+		prev = data;
+	}
+
+	return num;
+}
+
+static void check_frames(OmniCache *cache, test_sample *result, uint num_frames)
+{
+	for (uint frame = 0; frame < num_frames; frame++) {
+		TEST_CHECK(OMNI_sample_read(cache, OMNI_u_to_fu(frame), result) == OMNI_READ_EXACT);
+		TEST_CHECK(result->count[0] == COUNT && test_filled(result->data[0], COUNT, frame * 10.0f));
+	}
+}
+
+/* The count of constant count blocks is queried once, and their data is pooled in slots laid out in time order,
+ * reused by rewrites and released by clears, while reading back as any other data. */
+int main(void)
+{
+	OmniCacheTemplate *cache_temp = test_template_new("const_count", OMNI_TIME_INT, 0, 1);
+	OmniCache *cache;
+	OmniCache *loaded;
+	OmniSerial *serial;
+	OmniView *view;
+	test_sample sample = {0};
+	test_sample result = {0};
+	float *buffer;
+	void *data;
+	size_t mem_full;
+	size_t size;
+
+	test_block_set(cache_temp, 0, "value", OMNI_DATA_FLOAT, OMNI_BLOCK_FLAG_CONST_COUNT);
+	cache_temp->blocks[0].count = count_calls;
+	cache = OMNI_new(cache_temp, "value");
+
+	test_sample_alloc(&sample, 1, 2 * COUNT * sizeof(float));
+	test_sample_alloc(&result, 1, 2 * COUNT * sizeof(float));
+	sample.count[0] = COUNT;
+
+	for (uint frame = 0; frame < NUM_FRAMES; frame++) {
+		test_fill(sample.data[0], COUNT, frame * 10.0f);
+		TEST_CHECK(OMNI_sample_write(cache, OMNI_u_to_fu(frame), &sample) == OMNI_WRITE_SUCCESS);
+	}
+
+	TEST_CHECK(num_count_calls == 1);
+	TEST_CHECK(num_contiguous(cache) >= NUM_FRAMES - NUM_FRAMES / MEMPOOL_SLAB_ELEMS - 1);
+	check_frames(cache, &result, NUM_FRAMES);
+
+	/* Slabs are accounted to the cache, rather than the data of each sample. */
+	mem_full = OMNI_get_memory(cache);
+	TEST_CHECK(mem_full >= (size_t)NUM_FRAMES * COUNT * sizeof(float));
+	TEST_CHECK(mem_full < (size_t)NUM_FRAMES * COUNT * sizeof(float) * 2);
+
+	/* Rewrites reuse the slot of the sample. */
+	data = SAMPLE_FIRST(cache)->blocks[0].data;
+	test_fill(sample.data[0], COUNT, 0.0f);
+	TEST_CHECK(OMNI_sample_write(cache, OMNI_u_to_fu(0), &sample) == OMNI_WRITE_SUCCESS);
+	TEST_CHECK(SAMPLE_FIRST(cache)->blocks[0].data == data);
+	TEST_CHECK(OMNI_get_memory(cache) == mem_full);
+
+	/* Buffers of another count are left to the caller. */
+	buffer = malloc(2 * COUNT * sizeof(float));
+	test_fill(buffer, 2 * COUNT, 30.0f);
+	TEST_CHECK(OMNI_block_write_move(cache, OMNI_u_to_fu(3), 0, buffer, 2 * COUNT, free, &sample) ==
+	           OMNI_WRITE_INVALID);
+	TEST_CHECK(OMNI_block_write_move(cache, OMNI_u_to_fu(3), 0, buffer, COUNT, free, &sample) ==
+	           OMNI_WRITE_SUCCESS);
+	TEST_CHECK(num_count_calls == 1);
+	check_frames(cache, &result, NUM_FRAMES);
+
+	serial = OMNI_serialize(cache, true, &size);
+	loaded = OMNI_deserialize(serial, cache_temp);
+	check_frames(loaded, &result, NUM_FRAMES);
+	TEST_CHECK(num_contiguous(loaded) >= NUM_FRAMES - NUM_FRAMES / MEMPOOL_SLAB_ELEMS - 1);
+	OMNI_free(loaded);
+	free(serial);
+
+	TEST_CHECK(OMNI_file_write(cache, PATH));
+	loaded = OMNI_file_open(PATH, cache_temp);
+	TEST_CHECK(loaded);
+	check_frames(loaded, &result, NUM_FRAMES);
+	OMNI_free(loaded);
+	remove(PATH);
+
+	/* Clearing samples frees the slabs they no longer use. */
+	OMNI_sample_clear_from(cache, OMNI_u_to_fu(10));
+	TEST_CHECK(OMNI_get_memory(cache) < mem_full / 4);
+	check_frames(cache, &result, 10);
+
+	/* Views keep their slots after the cache is freed. */
+	TEST_CHECK(OMNI_view_acquire(cache, OMNI_u_to_fu(5), &view) == OMNI_READ_EXACT);
+	OMNI_free(cache);
+	TEST_CHECK(OMNI_get_memory_global() == 0);
+	TEST_CHECK(test_filled(OMNI_view_get_block(view, 0)->data, COUNT, 50.0f));
+	OMNI_view_release(view);
+
+	/* The count is queried again once the cache is cleared. */
+	cache = OMNI_new(cache_temp, "value");
+	TEST_CHECK(OMNI_sample_write(cache, OMNI_u_to_fu(0), &sample) == OMNI_WRITE_SUCCESS);
+	OMNI_clear(cache);
+	sample.count[0] = 2 * COUNT;
+	test_fill(sample.data[0], 2 * COUNT, 0.0f);
+	TEST_CHECK(OMNI_sample_write(cache, OMNI_u_to_fu(0), &sample) == OMNI_WRITE_SUCCESS);
+	TEST_CHECK(num_count_calls == 3);
+	TEST_CHECK(OMNI_sample_read(cache, OMNI_u_to_fu(0), &result) == OMNI_READ_EXACT);
+	TEST_CHECK(result.count[0] == 2 * COUNT && test_filled(result.data[0], 2 * COUNT, 0.0f));
+	OMNI_free(cache);
+
+	test_sample_free(&sample, 1);
+	test_sample_free(&result, 1);
+	free(cache_temp);
+
+	return 0;
+}
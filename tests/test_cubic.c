@@ -0,0 +1,81 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include <math.h>
+
+#include "test.h"
+
+#define NUM 37
+
+static float motion(float time, uint i)
+{
+	return (0.5f * time * time) - (3.0f * time) + (float)i;
+}
+
+static uint num_neighbours;
+
+static bool interp_neighbours(OmniInterpData *interp_data)
+{
+	num_neighbours = (interp_data->prev2 != NULL) + (interp_data->next2 != NULL);
+
+	return true;
+}
+
+/* Cubic interpolation follows accelerated motion over unevenly spaced samples, only using the outer samples
+ * (also passed to interpolation callbacks) when they hold as many elements. */
+int main(void)
+{
+	OmniCacheTemplate *cache_temp = test_template_new("cubic", OMNI_TIME_FLOAT, OMNICACHE_FLAG_INTERP_ANY, 2);
+	OmniCache *cache;
+	test_sample sample = {0};
+	test_sample result = {0};
+	const uint frames[] = {0, 1, 3, 4, 7, 8};
+	const float times[] = {0.5f, 2.0f, 3.5f, 5.0f, 6.2f, 7.5f};
+
+	test_block_set(cache_temp, 0, "value", OMNI_DATA_FLOAT, OMNI_BLOCK_FLAG_CONTINUOUS);
+	test_block_set(cache_temp, 1, "custom", OMNI_DATA_FLOAT, OMNI_BLOCK_FLAG_CONTINUOUS);
+	cache_temp->blocks[0].interp_mode = OMNI_INTERP_CUBIC;
+	cache_temp->blocks[1].interp = interp_neighbours;
+	cache = OMNI_new(cache_temp, "value;custom");
+
+	test_sample_alloc(&sample, 2, NUM * sizeof(float));
+	test_sample_alloc(&result, 2, NUM * sizeof(float));
+
+	for (uint k = 0; k < sizeof(frames) / sizeof(*frames); k++) {
+		sample.count[0] = NUM;
+		sample.count[1] = (frames[k] == 8) ? 1 : 2;
+
+		for (uint i = 0; i < NUM; i++) {
+			((float *)sample.data[0])[i] = motion((float)frames[k], i);
+		}
+
+		TEST_CHECK(OMNI_sample_write(cache, OMNI_f_to_fu((float)frames[k]), &sample) == OMNI_WRITE_SUCCESS);
+	}
+
+	for (uint k = 0; k < sizeof(times) / sizeof(*times); k++) {
+		/* One-sided tangents in the first and last intervals. */
+		bool inner = times[k] > 1.0f && times[k] < 7.0f;
+		float error = 0.0f;
+
+		TEST_CHECK(OMNI_sample_read(cache, OMNI_f_to_fu(times[k]), &result) == OMNI_READ_INTERP);
+		TEST_CHECK(result.count[0] == NUM);
+
+		for (uint i = 0; i < NUM; i++) {
+			error = fmaxf(error, fabsf(((float *)result.data[0])[i] - motion(times[k], i)));
+		}
+
+		TEST_CHECK(error < (inner ? 1e-4f : 0.2f));
+	}
+
+	TEST_CHECK(OMNI_sample_read(cache, OMNI_f_to_fu(3.5f), &result) == OMNI_READ_INTERP && num_neighbours == 2);
+	TEST_CHECK(OMNI_sample_read(cache, OMNI_f_to_fu(0.5f), &result) == OMNI_READ_INTERP && num_neighbours == 1);
+	TEST_CHECK(OMNI_sample_read(cache, OMNI_f_to_fu(5.0f), &result) == OMNI_READ_INTERP && num_neighbours == 1);
+
+	OMNI_free(cache);
+	test_sample_free(&sample, 2);
+	test_sample_free(&result, 2);
+	free(cache_temp);
+
+	return 0;
+}
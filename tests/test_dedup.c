@@ -0,0 +1,250 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include <math.h>
+#include <stdint.h>
+
+#include "test.h"
+
+#include "hash.h"
+#include "omni_dedup.h"
+
+#define PATH "test_dedup.omc"
+#define PATH_RAW "test_dedup_raw.omc"
+#define PATH_JOURNAL "test_dedup.omj"
+
+#define COUNT 2000
+#define NUM_FRAMES 30
+
+/* Size saved by sharing the faces of all frames but one per topology. */
+#define SIZE_SAVED ((NUM_FRAMES - 3) * COUNT * sizeof(int[3]))
+
+/* Topology of each frame, changing the faces (shared between frames of the same topology). */
+static uint topology[NUM_FRAMES];
+
+/* Hashes are the same for the same data wherever it is, and change with any bit of it. */
+static void test_hash(void)
+{
+	uint8_t *data = malloc(2100);
+	uint8_t *copy = malloc(2100);
+
+	for (uint i = 0; i < 2100; i++) {
+		data[i] = (uint8_t)(i * 131 + 7);
+	}
+
+	for (size_t size = 0; size < 2048; size += 1 + size / 5) {
+		uint64_t hash = hash_data(data, size);
+
+		for (uint offset = 0; offset < 4; offset++) {
+			memcpy(copy + offset, data, size);
+			TEST_CHECK(hash_data(copy + offset, size) == hash);
+		}
+
+		if (size) {
+			TEST_CHECK(hash_data(data, size - 1) != hash);
+
+			for (size_t bit = 0; bit < size * 8; bit += 1 + bit / 3) {
+				data[bit / 8] ^= (uint8_t)(1 << (bit % 8));
+				TEST_CHECK(hash_data(data, size) != hash);
+				data[bit / 8] ^= (uint8_t)(1 << (bit % 8));
+			}
+		}
+	}
+
+	free(data);
+	free(copy);
+}
+
+static void sample_fill(test_sample *sample, uint frame)
+{
+	float *positions = sample->data[0];
+	int *faces = sample->data[1];
+	float *uvs = sample->data[2];
+
+	for (uint i = 0; i < COUNT * 3; i++) {
+		positions[i] = sinf(i * 0.37f + frame * 0.1f) * 10.0f;
+		faces[i] = (int)((i + topology[frame] * 7) % (COUNT * 3));
+	}
+
+	for (uint i = 0; i < COUNT; i++) {
+		uvs[i] = i * 0.001f;
+	}
+
+	sample->count[0] = COUNT;
+	sample->count[1] = COUNT;
+	sample->count[2] = COUNT;
+}
+
+static bool sample_same(const test_sample *a, const test_sample *b)
+{
+	return a->count[0] == b->count[0] && a->count[1] == b->count[1] && a->count[2] == b->count[2] &&
+	       memcmp(a->data[0], b->data[0], COUNT * sizeof(float[3])) == 0 &&
+	       memcmp(a->data[1], b->data[1], COUNT * sizeof(int[3])) == 0 &&
+	       memcmp(a->data[2], b->data[2], COUNT * sizeof(float)) == 0;
+}
+
+static void check_frames(OmniCache *cache, test_sample *result, test_sample *expected)
+{
+	for (uint frame = 0; frame < NUM_FRAMES; frame++) {
+		sample_fill(expected, frame);
+		TEST_CHECK(OMNI_sample_read(cache, OMNI_f_to_fu((float)frame), result) == OMNI_READ_EXACT);
+		TEST_CHECK(sample_same(result, expected));
+	}
+}
+
+static void frame_write(OmniCache *cache, test_sample *sample, uint frame, uint topo)
+{
+	topology[frame] = topo;
+	sample_fill(sample, frame);
+	TEST_CHECK(OMNI_sample_write(cache, OMNI_f_to_fu((float)frame), sample) == OMNI_WRITE_SUCCESS);
+}
+
+static long file_size(const char *path)
+{
+	FILE *file = fopen(path, "rb");
+	long size;
+
+	TEST_CHECK(file);
+	fseek(file, 0, SEEK_END);
+	size = ftell(file);
+	fclose(file);
+
+	return size;
+}
+
+static OmniCacheTemplate *template_new(OmniBlockFlags flags)
+{
+	OmniCacheTemplate *cache_temp = test_template_new("dedup", OMNI_TIME_FLOAT, 0, 3);
+
+	test_block_set(cache_temp, 0, "positions", OMNI_DATA_FLOAT3, OMNI_BLOCK_FLAG_CONTINUOUS);
+	test_block_set(cache_temp, 1, "faces", OMNI_DATA_INT3, flags);
+	test_block_set(cache_temp, 2, "uvs", OMNI_DATA_FLOAT, flags);
+	cache_temp->blocks[2].codec = OMNI_CODEC_SHUFFLE_LZ;
+
+	return cache_temp;
+}
+
+/* Identical blocks of different samples are stored once (and once per topology), through rewrites, clears,
+ * serialization, cache files and journals, and views keep shared data after the cache is gone. */
+static void test_dedup_cache(void)
+{
+	OmniCacheTemplate *cache_temp = template_new(OMNI_BLOCK_FLAG_DEDUP);
+	OmniCacheTemplate *raw_temp = template_new(0);
+	OmniCache *cache = OMNI_new(cache_temp, "positions;faces;uvs");
+	OmniCache *raw = OMNI_new(raw_temp, "positions;faces;uvs");
+	OmniCache *loaded;
+	OmniSerial *serial;
+	OmniView *view;
+	int *faces;
+	test_sample sample = {0};
+	test_sample result = {0};
+	test_sample expected = {0};
+	size_t size;
+	size_t size_raw;
+
+	test_sample_alloc(&sample, 3, COUNT * sizeof(float[3]));
+	test_sample_alloc(&result, 3, COUNT * sizeof(float[3]));
+	test_sample_alloc(&expected, 3, COUNT * sizeof(float[3]));
+
+	for (uint frame = 0; frame < NUM_FRAMES; frame++) {
+		frame_write(cache, &sample, frame, frame / 10);
+		frame_write(raw, &sample, frame, frame / 10);
+	}
+
+	/* Three topologies and the uvs. */
+	TEST_CHECK(dedup_num_entries(cache) == 4);
+	TEST_CHECK(dedup_num_entries(raw) == 0);
+	TEST_CHECK(OMNI_get_memory(cache) + SIZE_SAVED <= OMNI_get_memory(raw));
+	check_frames(cache, &result, &expected);
+
+	/* Rewrites share existing data, or release data no longer used. */
+	frame_write(cache, &sample, 5, 1);
+	TEST_CHECK(dedup_num_entries(cache) == 4);
+
+	for (uint frame = 20; frame < NUM_FRAMES; frame++) {
+		frame_write(cache, &sample, frame, 0);
+	}
+
+	TEST_CHECK(dedup_num_entries(cache) == 3);
+	check_frames(cache, &result, &expected);
+
+	faces = malloc(COUNT * sizeof(int[3]));
+	memcpy(faces, sample.data[1], COUNT * sizeof(int[3]));
+	TEST_CHECK(OMNI_block_write_move(cache, OMNI_f_to_fu(12.0f), 1, faces, COUNT, free, &sample) ==
+	           OMNI_WRITE_SUCCESS);
+	topology[12] = 0;
+	TEST_CHECK(dedup_num_entries(cache) == 3);
+	check_frames(cache, &result, &expected);
+
+	/* Clearing samples leaves the data shared with others. */
+	OMNI_sample_clear(cache, OMNI_f_to_fu(0.0f));
+	frame_write(cache, &sample, 0, 0);
+	check_frames(cache, &result, &expected);
+
+	serial = OMNI_serialize(cache, true, &size);
+	free(OMNI_serialize(raw, true, &size_raw));
+	TEST_CHECK(size + SIZE_SAVED <= size_raw);
+
+	loaded = OMNI_deserialize(serial, cache_temp);
+	check_frames(loaded, &result, &expected);
+	TEST_CHECK(dedup_num_entries(loaded) == 3);
+	OMNI_free(loaded);
+
+	loaded = OMNI_deserialize_borrowed(serial, cache_temp);
+	check_frames(loaded, &result, &expected);
+	frame_write(loaded, &sample, 3, 0);
+	check_frames(loaded, &result, &expected);
+	OMNI_free(loaded);
+	free(serial);
+
+	loaded = OMNI_duplicate(cache, true);
+	check_frames(loaded, &result, &expected);
+	TEST_CHECK(dedup_num_entries(loaded) == 3);
+	OMNI_free(loaded);
+
+	TEST_CHECK(OMNI_file_write(cache, PATH));
+	TEST_CHECK(OMNI_file_write(raw, PATH_RAW));
+	TEST_CHECK((size_t)file_size(PATH) + SIZE_SAVED <= (size_t)file_size(PATH_RAW));
+	loaded = OMNI_file_open(PATH, cache_temp);
+	TEST_CHECK(loaded);
+	check_frames(loaded, &result, &expected);
+	OMNI_free(loaded);
+	remove(PATH);
+	remove(PATH_RAW);
+
+	TEST_CHECK(OMNI_journal_start(cache, PATH_JOURNAL));
+	frame_write(cache, &sample, 7, 1);
+	OMNI_journal_stop(cache);
+	loaded = OMNI_journal_resume(PATH_JOURNAL, cache_temp);
+	TEST_CHECK(loaded);
+	check_frames(loaded, &result, &expected);
+	OMNI_journal_stop(loaded);
+	OMNI_free(loaded);
+	remove(PATH_JOURNAL);
+
+	TEST_CHECK(OMNI_view_acquire(cache, OMNI_f_to_fu(7.0f), &view) == OMNI_READ_EXACT);
+	sample_fill(&expected, 7);
+	OMNI_clear(cache);
+	OMNI_free(cache);
+	TEST_CHECK(memcmp(OMNI_view_get_block(view, 1)->data, expected.data[1], COUNT * sizeof(int[3])) == 0);
+	TEST_CHECK(memcmp(OMNI_view_get_block(view, 2)->data, expected.data[2], COUNT * sizeof(float)) == 0);
+	OMNI_view_release(view);
+
+	OMNI_free(raw);
+	TEST_CHECK(OMNI_get_memory_global() == 0);
+
+	test_sample_free(&sample, 3);
+	test_sample_free(&result, 3);
+	test_sample_free(&expected, 3);
+	free(cache_temp);
+	free(raw_temp);
+}
+
+int main(void)
+{
+	test_hash();
+	test_dedup_cache();
+
+	return 0;
+}
@@ -0,0 +1,341 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include <math.h>
+
+#include "test.h"
+
+#define PATH "test_delta.omc"
+#define PATH_JOURNAL "test_delta.omj"
+#define PATH_SPILL "test_delta.spill"
+
+#define COUNT 500
+#define NUM_FRAMES 40
+
+/* Samples every half frame, by index (time * 2). */
+#define MAX_SAMPLES 200
+
+/* Samples expected in the caches, and offsets changing the data of rewritten samples. */
+static bool present[MAX_SAMPLES];
+static uint offsets[MAX_SAMPLES];
+
+static test_sample sample;
+static test_sample result;
+static test_sample expected;
+
+/* Values changing slightly from one sample to the next, as in a simulation. */
+static void sample_fill(test_sample *fill, float time)
+{
+	uint k = (uint)(time * 2.0f);
+	float *values = fill->data[0];
+	int *indices = fill->data[1];
+
+	for (uint i = 0; i < COUNT * 3; i++) {
+		values[i] = (sinf(i * 0.37f) * 10.0f) + ((i % 17 == 0) ? time * 0.01f : 0.0f) + offsets[k];
+	}
+
+	for (uint i = 0; i < COUNT; i++) {
+		indices[i] = (int)(i + ((i % 13 == 0) ? k : 0) + offsets[k]);
+	}
+
+	fill->count[0] = COUNT;
+	fill->count[1] = COUNT;
+}
+
+static void sample_write(OmniCache *cache, float time)
+{
+	sample_fill(&sample, time);
+	TEST_CHECK(OMNI_sample_write(cache, OMNI_f_to_fu(time), &sample) == OMNI_WRITE_SUCCESS);
+	present[(uint)(time * 2.0f)] = true;
+}
+
+static bool sample_same(const test_sample *a, const test_sample *b)
+{
+	return a->count[0] == b->count[0] && a->count[1] == b->count[1] &&
+	       memcmp(a->data[0], b->data[0], a->count[0] * sizeof(float[3])) == 0 &&
+	       memcmp(a->data[1], b->data[1], a->count[1] * sizeof(int)) == 0;
+}
+
+static void sample_check(OmniCache *cache, uint k)
+{
+	sample_fill(&expected, k * 0.5f);
+	TEST_CHECK(OMNI_sample_read(cache, OMNI_f_to_fu(k * 0.5f), &result) == OMNI_READ_EXACT);
+	TEST_CHECK(sample_same(&result, &expected));
+}
+
+/* Read all samples in playback order, backwards, and in random order. */
+static void check_all(OmniCache *cache)
+{
+	for (uint k = 0; k < MAX_SAMPLES; k++) {
+		if (present[k]) {
+			sample_check(cache, k);
+		}
+	}
+
+	for (uint k = MAX_SAMPLES; k-- > 0;) {
+		if (present[k]) {
+			sample_check(cache, k);
+		}
+	}
+
+	for (uint j = 0; j < MAX_SAMPLES; j++) {
+		uint k = (j * 73) % MAX_SAMPLES;
+
+		if (present[k]) {
+			sample_check(cache, k);
+		}
+	}
+}
+
+static OmniCacheTemplate *template_new(OmniCacheFlags flags, OmniCodec codec, uint delta_interval)
+{
+	OmniCacheTemplate *cache_temp = test_template_new("delta", OMNI_TIME_FLOAT, flags | OMNICACHE_FLAG_INTERP_ANY, 2);
+
+	cache_temp->meta_size = 0;
+	cache_temp->meta_gen = NULL;
+
+	test_block_set(cache_temp, 0, "values", OMNI_DATA_FLOAT3, OMNI_BLOCK_FLAG_CONTINUOUS);
+	test_block_set(cache_temp, 1, "indices", OMNI_DATA_INT, OMNI_BLOCK_FLAG_CONTINUOUS);
+	cache_temp->blocks[0].codec = codec;
+	cache_temp->blocks[0].delta_interval = delta_interval;
+	cache_temp->blocks[1].delta_interval = delta_interval;
+
+	return cache_temp;
+}
+
+static void *buffer_dup(const void *data, size_t size)
+{
+	void *buffer = malloc(size);
+
+	memcpy(buffer, data, size);
+
+	return buffer;
+}
+
+typedef struct stream {
+	char *data;
+	size_t size;
+	size_t pos;
+} stream;
+
+static bool stream_write(const void *data, size_t size, void *user_data)
+{
+	stream *st = user_data;
+
+	st->data = realloc(st->data, st->size + size);
+	memcpy(st->data + st->size, data, size);
+	st->size += size;
+
+	return true;
+}
+
+static size_t stream_read(void *data, size_t size, void *user_data)
+{
+	stream *st = user_data;
+
+	if (size > st->size - st->pos) {
+		size = st->size - st->pos;
+	}
+
+	memcpy(data, st->data + st->pos, size);
+	st->pos += size;
+
+	return size;
+}
+
+/* Delta encoded samples read back exactly, in any order, as their chains are rewritten, cut, and stored in every way,
+ * using less memory than keyframes alone. */
+static void test_delta(OmniCacheFlags flags, OmniCodec codec, uint delta_interval)
+{
+	OmniCacheTemplate *cache_temp = template_new(flags, codec, delta_interval);
+	OmniCacheTemplate *raw_temp = template_new(flags, codec, 0);
+	OmniCache *cache = OMNI_new(cache_temp, "values;indices");
+	OmniCache *raw = OMNI_new(raw_temp, "values;indices");
+	OmniCache *loaded;
+	OmniSerial *serial;
+	OmniView *view;
+	OmniData blocks[2];
+	stream st = {0};
+	size_t size;
+
+	memset(present, 0, sizeof(present));
+	memset(offsets, 0, sizeof(offsets));
+
+	for (uint frame = 0; frame < NUM_FRAMES; frame++) {
+		sample_write(cache, (float)frame);
+		TEST_CHECK(OMNI_sample_write(raw, OMNI_f_to_fu((float)frame), &sample) == OMNI_WRITE_SUCCESS);
+	}
+
+	if (delta_interval >= 4 && !(flags & OMNICACHE_FLAG_ARENA)) {
+		TEST_CHECK(OMNI_get_memory(cache) < OMNI_get_memory(raw) / 2);
+	}
+
+	check_all(cache);
+
+	TEST_CHECK(OMNI_sample_read(cache, OMNI_f_to_fu(7.25f), &result) & OMNI_READ_INTERP);
+	TEST_CHECK(OMNI_sample_read(raw, OMNI_f_to_fu(7.25f), &expected) & OMNI_READ_INTERP);
+	TEST_CHECK(sample_same(&result, &expected));
+
+	/* Views of samples whose base is rewritten, or cleared. */
+	TEST_CHECK(OMNI_view_acquire(cache, OMNI_f_to_fu(12.0f), &view) == OMNI_READ_EXACT);
+	sample_fill(&expected, 12.0f);
+	offsets[22] = 5;
+	sample_write(cache, 11.0f);
+	sample_write(cache, 12.0f);
+	offsets[24] = 3;
+	sample_write(cache, 12.0f);
+	TEST_CHECK(memcmp(OMNI_view_get_block(view, 0)->data, expected.data[0], COUNT * sizeof(float[3])) == 0);
+	OMNI_view_release(view);
+	check_all(cache);
+
+	TEST_CHECK(OMNI_view_acquire(cache, OMNI_f_to_fu(17.0f), &view) == OMNI_READ_EXACT);
+	sample_fill(&expected, 17.0f);
+	OMNI_sample_clear(cache, OMNI_f_to_fu(16.0f));
+	present[32] = false;
+	TEST_CHECK(memcmp(OMNI_view_get_block(view, 0)->data, expected.data[0], COUNT * sizeof(float[3])) == 0);
+	OMNI_view_release(view);
+	check_all(cache);
+
+	/* Sub-samples inserted into chains. */
+	sample_write(cache, 20.5f);
+	sample_write(cache, 3.5f);
+	check_all(cache);
+	OMNI_sample_clear(cache, OMNI_f_to_fu(20.5f));
+	present[41] = false;
+	check_all(cache);
+
+	offsets[50] = 9;
+	sample_fill(&sample, 25.0f);
+	TEST_CHECK(OMNI_block_write_move(cache, OMNI_f_to_fu(25.0f), 0, buffer_dup(sample.data[0], COUNT * sizeof(float[3])),
+	                                 COUNT, free, &sample) == OMNI_WRITE_SUCCESS);
+	TEST_CHECK(OMNI_block_write_move(cache, OMNI_f_to_fu(25.0f), 1, buffer_dup(sample.data[1], COUNT * sizeof(int)),
+	                                 COUNT, free, &sample) == OMNI_WRITE_SUCCESS);
+	check_all(cache);
+
+	offsets[60] = 2;
+	sample_fill(&sample, 30.0f);
+	TEST_CHECK(OMNI_sample_write_acquire(cache, OMNI_f_to_fu(30.0f), &sample, blocks) == OMNI_WRITE_SUCCESS);
+	memcpy(blocks[0].data, sample.data[0], COUNT * sizeof(float[3]));
+	memcpy(blocks[1].data, sample.data[1], COUNT * sizeof(int));
+	TEST_CHECK(OMNI_sample_write_commit(cache, OMNI_f_to_fu(30.0f), &sample) == OMNI_WRITE_SUCCESS);
+	check_all(cache);
+
+	/* Serialized, borrowed, streamed and duplicated, then rewritten. */
+	serial = OMNI_serialize(cache, true, &size);
+	loaded = OMNI_deserialize(serial, cache_temp);
+	check_all(loaded);
+	OMNI_free(loaded);
+
+	loaded = OMNI_deserialize_borrowed(serial, cache_temp);
+	check_all(loaded);
+	sample_write(loaded, 2.0f);
+	check_all(loaded);
+	OMNI_free(loaded);
+
+	TEST_CHECK(OMNI_serialize_stream(cache, true, stream_write, &st) && st.size == size);
+	loaded = OMNI_deserialize_stream(stream_read, &st, cache_temp);
+	check_all(loaded);
+	OMNI_free(loaded);
+	free(st.data);
+	free(serial);
+
+	loaded = OMNI_duplicate(cache, true);
+	check_all(loaded);
+	sample_write(loaded, 5.0f);
+	check_all(loaded);
+	OMNI_free(loaded);
+	check_all(cache);
+
+	TEST_CHECK(OMNI_file_write(cache, PATH));
+	loaded = OMNI_file_open(PATH, cache_temp);
+	TEST_CHECK(loaded);
+	check_all(loaded);
+	sample_write(loaded, 8.0f);
+	check_all(loaded);
+	OMNI_sample_clear(loaded, OMNI_f_to_fu(9.0f));
+	present[18] = false;
+	check_all(loaded);
+	OMNI_free(loaded);
+	remove(PATH);
+
+	sample_write(cache, 8.0f);
+	sample_write(cache, 9.0f);
+
+	TEST_CHECK(OMNI_journal_start(cache, PATH_JOURNAL));
+	OMNI_journal_set_async(cache, 4);
+
+	for (uint frame = NUM_FRAMES; frame < NUM_FRAMES + 10; frame++) {
+		sample_write(cache, (float)frame);
+	}
+
+	offsets[10] = 4;
+	sample_write(cache, 5.0f);
+	OMNI_journal_stop(cache);
+
+	loaded = OMNI_journal_resume(PATH_JOURNAL, cache_temp);
+	TEST_CHECK(loaded);
+	check_all(loaded);
+	OMNI_journal_stop(loaded);
+	OMNI_free(loaded);
+	remove(PATH_JOURNAL);
+
+	OMNI_sample_mark_invalid(cache, OMNI_f_to_fu(33.0f));
+	OMNI_consolidate(cache, OMNI_CONSOL_FREE_INVALID);
+	present[66] = false;
+	check_all(cache);
+
+	/* Evicted, then spilled. */
+	OMNI_budget_set(cache, OMNI_get_memory(cache) / 2, OMNI_EVICT_LRU, NULL);
+
+	for (uint frame = NUM_FRAMES + 10; frame < NUM_FRAMES + 20; frame++) {
+		sample_write(cache, (float)frame);
+	}
+
+	for (uint k = 0; k < MAX_SAMPLES; k++) {
+		present[k] = present[k] && OMNI_sample_is_valid(cache, OMNI_f_to_fu(k * 0.5f));
+	}
+
+	check_all(cache);
+
+	OMNI_budget_set(cache, OMNI_get_memory(cache) / 2, OMNI_EVICT_LRU, PATH_SPILL);
+
+	for (uint frame = NUM_FRAMES + 20; frame < NUM_FRAMES + 30; frame++) {
+		sample_write(cache, (float)frame);
+	}
+
+	check_all(cache);
+	loaded = OMNI_duplicate(cache, true);
+	check_all(loaded);
+	OMNI_free(loaded);
+
+	OMNI_sample_clear_from(cache, OMNI_f_to_fu(45.0f));
+	memset(&present[90], 0, sizeof(present) - (90 * sizeof(*present)));
+	check_all(cache);
+
+	OMNI_free(cache);
+	OMNI_free(raw);
+	TEST_CHECK(OMNI_get_memory_global() == 0);
+
+	free(cache_temp);
+	free(raw_temp);
+}
+
+int main(void)
+{
+	test_sample_alloc(&sample, 2, COUNT * sizeof(float[3]));
+	test_sample_alloc(&result, 2, COUNT * sizeof(float[3]));
+	test_sample_alloc(&expected, 2, COUNT * sizeof(float[3]));
+
+	test_delta(0, OMNI_CODEC_NONE, 8);
+	test_delta(0, OMNI_CODEC_FLOAT_XOR, 4);
+	test_delta(0, OMNI_CODEC_SHUFFLE_LZ, 2);
+	test_delta(0, OMNI_CODEC_FLOAT_XOR, 0);
+	test_delta(OMNICACHE_FLAG_ARENA, OMNI_CODEC_FLOAT_XOR, 8);
+
+	test_sample_free(&sample, 2);
+	test_sample_free(&result, 2);
+	test_sample_free(&expected, 2);
+
+	return 0;
+}
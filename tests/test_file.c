@@ -0,0 +1,221 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include <stdint.h>
+
+#include "test.h"
+
+#include "omni_types.h"
+
+#define PATH "test_file.omc"
+#define PATH_CORRUPT "test_file_corrupt.omc"
+
+static char *file_load(const char *path, size_t *r_size)
+{
+	FILE *file = fopen(path, "rb");
+	char *data;
+
+	TEST_CHECK(file);
+	fseek(file, 0, SEEK_END);
+	*r_size = (size_t)ftell(file);
+	fseek(file, 0, SEEK_SET);
+
+	data = malloc(*r_size);
+	TEST_CHECK(fread(data, 1, *r_size, file) == *r_size);
+	fclose(file);
+
+	return data;
+}
+
+static void file_save(const char *path, const char *data, size_t size)
+{
+	FILE *file = fopen(path, "wb");
+
+	TEST_CHECK(file && fwrite(data, 1, size, file) == size);
+	fclose(file);
+}
+
+/* Cache definition in serialized data (found by the cache id), followed by the block definitions. */
+static OmniCacheDef *def_find(char *data, size_t size, const char *id)
+{
+	size_t len = strlen(id) + 1;
+
+	for (size_t i = 0; i + len <= size; i++) {
+		if (memcmp(&data[i], id, len) == 0) {
+			return (OmniCacheDef *)&data[i];
+		}
+	}
+
+	return NULL;
+}
+
+typedef void (*def_corrupt_fn)(OmniCacheDef *def, OmniBlockInfoDef *b_defs);
+
+static void corrupt_index(OmniCacheDef *def, OmniBlockInfoDef *b_defs)
+{
+	(void)def;
+	b_defs[1].index = 7;
+}
+
+static void corrupt_index_swap(OmniCacheDef *def, OmniBlockInfoDef *b_defs)
+{
+	(void)def;
+	b_defs[0].index = 1;
+	b_defs[1].index = 0;
+}
+
+static void corrupt_dsize(OmniCacheDef *def, OmniBlockInfoDef *b_defs)
+{
+	(void)def;
+	b_defs[0].dsize = 4096;
+}
+
+static void corrupt_dtype(OmniCacheDef *def, OmniBlockInfoDef *b_defs)
+{
+	(void)def;
+	b_defs[1].dtype = (OmniDataType)77;
+}
+
+static void corrupt_num_blocks(OmniCacheDef *def, OmniBlockInfoDef *b_defs)
+{
+	(void)b_defs;
+	def->num_blocks = 3;
+}
+
+static void corrupt_msize(OmniCacheDef *def, OmniBlockInfoDef *b_defs)
+{
+	(void)b_defs;
+	def->msize = 64;
+}
+
+static const def_corrupt_fn corrupt_fns[] = {
+	corrupt_index,
+	corrupt_index_swap,
+	corrupt_dsize,
+	corrupt_dtype,
+	corrupt_num_blocks,
+	corrupt_msize,
+};
+
+/* Files and serials whose definitions don't match the template are rejected. */
+static void test_corrupt(OmniCache *cache, const OmniCacheTemplate *cache_temp)
+{
+	OmniSerial *serial;
+	size_t serial_size;
+
+	TEST_CHECK(OMNI_file_write(cache, PATH));
+	serial = OMNI_serialize(cache, true, &serial_size);
+
+	for (uint k = 0; k < sizeof(corrupt_fns) / sizeof(*corrupt_fns); k++) {
+		size_t size;
+		char *data = file_load(PATH, &size);
+		OmniCacheDef *def = def_find(data, size, cache_temp->id);
+
+		TEST_CHECK(def);
+		corrupt_fns[k](def, (OmniBlockInfoDef *)(def + 1));
+		file_save(PATH_CORRUPT, data, size);
+		free(data);
+
+		TEST_CHECK(OMNI_file_open(PATH_CORRUPT, cache_temp) == NULL);
+
+		data = malloc(serial_size);
+		memcpy(data, serial, serial_size);
+		def = def_find(data, serial_size, cache_temp->id);
+
+		TEST_CHECK(def);
+		corrupt_fns[k](def, (OmniBlockInfoDef *)(def + 1));
+		TEST_CHECK(OMNI_deserialize((OmniSerial *)data, cache_temp) == NULL);
+		free(data);
+	}
+
+	/* Truncated files. */
+	{
+		size_t size;
+		char *data = file_load(PATH, &size);
+
+		file_save(PATH_CORRUPT, data, size - 10);
+		TEST_CHECK(OMNI_file_open(PATH_CORRUPT, cache_temp) == NULL);
+		file_save(PATH_CORRUPT, data, 16);
+		TEST_CHECK(OMNI_file_open(PATH_CORRUPT, cache_temp) == NULL);
+		free(data);
+	}
+
+	TEST_CHECK(OMNI_file_open("test_file_missing.omc", cache_temp) == NULL);
+
+	free(serial);
+	remove(PATH_CORRUPT);
+}
+
+/* Cache files read back the same data, paged in from the mapped file, which views keep mapped. */
+static void test_file(OmniCacheFlags flags)
+{
+	OmniCacheTemplate *cache_temp = test_template_new("file_cache", OMNI_TIME_FLOAT, flags, 2);
+	OmniCache *cache;
+	OmniCache *opened;
+	test_sample sample = {0};
+	test_sample result = {0};
+	OmniView *view;
+	const float *values;
+
+	test_block_set(cache_temp, 0, "value", OMNI_DATA_FLOAT, 0);
+	test_block_set(cache_temp, 1, "pos", OMNI_DATA_FLOAT3, 0);
+	cache = OMNI_new(cache_temp, "value;pos");
+
+	test_sample_alloc(&sample, 2, 5000 * sizeof(float[3]));
+	test_sample_alloc(&result, 2, 5000 * sizeof(float[3]));
+
+	for (uint k = 0; k < 10; k++) {
+		sample.count[0] = k + 3;
+		sample.count[1] = 1;
+		sample.meta = (float)k;
+		test_fill(sample.data[0], sample.count[0], k * 100.0f);
+		TEST_CHECK(OMNI_sample_write(cache, OMNI_f_to_fu(k * 0.5f), &sample) == OMNI_WRITE_SUCCESS);
+	}
+
+	sample.count[0] = 5000;
+	sample.meta = 5000.0f;
+	test_fill(sample.data[0], sample.count[0], 0.0f);
+	TEST_CHECK(OMNI_sample_write(cache, OMNI_f_to_fu(20.0f), &sample) == OMNI_WRITE_SUCCESS);
+
+	TEST_CHECK(OMNI_file_write(cache, PATH));
+	opened = OMNI_file_open(PATH, cache_temp);
+	TEST_CHECK(opened && OMNI_get_num_cached(opened) == 11);
+
+	for (uint k = 0; k < 10; k++) {
+		TEST_CHECK(OMNI_sample_read(opened, OMNI_f_to_fu(k * 0.5f), &result) == OMNI_READ_EXACT);
+		TEST_CHECK(result.count[0] == k + 3 && test_filled(result.data[0], k + 3, k * 100.0f));
+	}
+
+	/* Block data is aligned in the file. */
+	TEST_CHECK(OMNI_view_acquire(opened, OMNI_f_to_fu(20.0f), &view) == OMNI_READ_EXACT);
+	values = OMNI_view_get_block(view, 0)->data;
+	TEST_CHECK((uintptr_t)values % 64 == 0);
+	TEST_CHECK(*(const float *)OMNI_view_get_meta(view) == 5000.0f);
+
+	sample.count[0] = 5;
+	test_fill(sample.data[0], 5, -1.0f);
+	TEST_CHECK(OMNI_sample_write(opened, OMNI_f_to_fu(20.0f), &sample) == OMNI_WRITE_SUCCESS);
+	TEST_CHECK(OMNI_sample_read(opened, OMNI_f_to_fu(20.0f), &result) == OMNI_READ_EXACT);
+	TEST_CHECK(result.count[0] == 5 && test_filled(result.data[0], 5, -1.0f));
+
+	OMNI_free(opened);
+	TEST_CHECK(test_filled(values, 5000, 0.0f));
+	OMNI_view_release(view);
+
+	test_corrupt(cache, cache_temp);
+
+	OMNI_free(cache);
+	remove(PATH);
+	test_sample_free(&sample, 2);
+	test_sample_free(&result, 2);
+	free(cache_temp);
+}
+
+int main(void)
+{
+	test_file(0);
+	test_file(OMNICACHE_FLAG_ARENA);
+
+	return 0;
+}
@@ -0,0 +1,170 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include <math.h>
+
+#include "test.h"
+
+#include "omni_interp.h"
+
+#define MAX_NUM 67
+
+static bool nearly_equal(float a, float b)
+{
+	return fabsf(a - b) <= 1e-5f * fmaxf(1.0f, fabsf(b));
+}
+
+static float value_at(uint i, uint k)
+{
+	return sinf((float)(i * 7 + k * 13)) * (float)(1 + (i % 5));
+}
+
+/* Kernels of the widest instruction set supported (used for runs of elements) give the same results as
+ * the scalar code (used for single elements, and the ends of runs), whatever the length and alignment of the run. */
+static void test_kernels(void)
+{
+	float src[4][MAX_NUM + 4];
+	float target[MAX_NUM + 5];
+	float expected;
+	float times[4] = {0.0f, 1.0f, 3.0f, 3.5f};
+
+	for (uint k = 0; k < 4; k++) {
+		for (uint i = 0; i < MAX_NUM + 4; i++) {
+			src[k][i] = value_at(i, k);
+		}
+	}
+
+	for (uint offset = 0; offset < 4; offset++) {
+		for (uint num = 0; num <= MAX_NUM; num++) {
+			const float *p0 = &src[0][offset];
+			const float *p1 = &src[1][offset];
+			const float *p2 = &src[2][offset];
+			const float *p3 = &src[3][offset];
+
+			target[num + 1] = -1.0f;
+			interp_lerp(&target[1], p1, p2, num, 0.3f);
+
+			for (uint i = 0; i < num; i++) {
+				interp_lerp(&expected, &p1[i], &p2[i], 1, 0.3f);
+				TEST_CHECK(nearly_equal(target[i + 1], expected));
+				TEST_CHECK(nearly_equal(target[i + 1], p1[i] + ((p2[i] - p1[i]) * 0.3f)));
+			}
+
+			TEST_CHECK(target[num + 1] == -1.0f);
+
+			interp_cubic(&target[1], p0, p1, p2, p3, num, times[0], times[1], times[2], times[3], 2.2f);
+
+			for (uint i = 0; i < num; i++) {
+				interp_cubic(&expected, &p0[i], &p1[i], &p2[i], &p3[i], 1,
+				             times[0], times[1], times[2], times[3], 2.2f);
+				TEST_CHECK(nearly_equal(target[i + 1], expected));
+			}
+
+			TEST_CHECK(target[num + 1] == -1.0f);
+		}
+	}
+}
+
+/* Cubic interpolation reproduces linear motion, even with uneven spacing, and with one-sided tangents. */
+static void test_cubic_linear(void)
+{
+	float times[4] = {-2.0f, 0.0f, 0.5f, 3.0f};
+	float values[4][MAX_NUM];
+	float target[MAX_NUM];
+
+	for (uint k = 0; k < 4; k++) {
+		for (uint i = 0; i < MAX_NUM; i++) {
+			values[k][i] = (float)i + (times[k] * (float)(i % 3));
+		}
+	}
+
+	interp_cubic(target, values[0], values[1], values[2], values[3], MAX_NUM,
+	             times[0], times[1], times[2], times[3], 0.2f);
+
+	for (uint i = 0; i < MAX_NUM; i++) {
+		TEST_CHECK(fabsf(target[i] - ((float)i + (0.2f * (float)(i % 3)))) < 1e-4f);
+	}
+
+	interp_cubic(target, NULL, values[1], values[2], NULL, MAX_NUM, 0.0f, times[1], times[2], 0.0f, 0.4f);
+
+	for (uint i = 0; i < MAX_NUM; i++) {
+		TEST_CHECK(fabsf(target[i] - ((float)i + (0.4f * (float)(i % 3)))) < 1e-4f);
+	}
+}
+
+static bool interp_constant(OmniInterpData *interp_data)
+{
+	test_fill(interp_data->target->data, interp_data->target->dcount, 42.0f);
+
+	return true;
+}
+
+/* Interpolated reads of continuous blocks, while other blocks take the data of the previous sample. */
+static void test_read_interp(void)
+{
+	OmniCacheTemplate *cache_temp = test_template_new("interp", OMNI_TIME_FLOAT, OMNICACHE_FLAG_INTERP_SUB, 3);
+	OmniCache *cache;
+	test_sample sample = {0};
+	test_sample result = {0};
+	uint counts[2] = {1001, 13};
+
+	test_block_set(cache_temp, 0, "pos", OMNI_DATA_FLOAT3, OMNI_BLOCK_FLAG_CONTINUOUS);
+	test_block_set(cache_temp, 1, "tag", OMNI_DATA_FLOAT, 0);
+	test_block_set(cache_temp, 2, "custom", OMNI_DATA_FLOAT, OMNI_BLOCK_FLAG_CONTINUOUS);
+	cache_temp->blocks[2].interp = interp_constant;
+	cache = OMNI_new(cache_temp, "pos;tag;custom");
+
+	test_sample_alloc(&sample, 3, 1001 * sizeof(float[3]));
+	test_sample_alloc(&result, 3, 1001 * sizeof(float[3]));
+
+	/* Reads between samples of different sizes reuse the same buffer. */
+	for (uint k = 0; k < 2; k++) {
+		for (uint frame = 1; frame <= 2; frame++) {
+			float time = (float)(k * 10 + frame);
+
+			sample.count[0] = counts[k];
+			sample.count[1] = 1;
+			sample.count[2] = 2;
+			test_fill(sample.data[0], sample.count[0] * 3, time * 1000.0f);
+			test_fill(sample.data[1], 1, time);
+			test_fill(sample.data[2], 2, time);
+			TEST_CHECK(OMNI_sample_write(cache, OMNI_f_to_fu(time), &sample) == OMNI_WRITE_SUCCESS);
+		}
+	}
+
+	for (uint k = 0; k < 2; k++) {
+		float time = (float)(k * 10) + 1.25f;
+
+		TEST_CHECK(OMNI_sample_read(cache, OMNI_f_to_fu(time), &result) == OMNI_READ_INTERP);
+		TEST_CHECK(result.count[0] == counts[k]);
+
+		for (uint i = 0; i < counts[k] * 3; i++) {
+			TEST_CHECK(fabsf(((float *)result.data[0])[i] - ((time * 1000.0f) + (float)i)) < 1e-3f);
+		}
+
+		TEST_CHECK(test_filled(result.data[1], 1, time - 0.25f));
+		TEST_CHECK(test_filled(result.data[2], 2, 42.0f));
+	}
+
+	/* Only between steps with `OMNICACHE_FLAG_INTERP_SUB`. */
+	TEST_CHECK(OMNI_sample_read(cache, OMNI_f_to_fu(5.0f), &result) == OMNI_READ_INVALID);
+	TEST_CHECK(OMNI_sample_read(cache, OMNI_f_to_fu(12.5f), &result) == OMNI_READ_INVALID);
+
+	OMNI_mark_outdated(cache);
+	TEST_CHECK(OMNI_sample_read(cache, OMNI_f_to_fu(1.5f), &result) == (OMNI_READ_INTERP | OMNI_READ_OUTDATED));
+
+	OMNI_free(cache);
+	test_sample_free(&sample, 3);
+	test_sample_free(&result, 3);
+	free(cache_temp);
+}
+
+int main(void)
+{
+	test_kernels();
+	test_cubic_linear();
+	test_read_interp();
+
+	return 0;
+}
@@ -0,0 +1,279 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include "test.h"
+
+#include "omni_types.h"
+
+#define PATH "test_journal.omj"
+#define PATH_CRASH "test_journal_crash.omj"
+
+static char *file_load(const char *path, size_t *r_size)
+{
+	FILE *file = fopen(path, "rb");
+	char *data;
+
+	TEST_CHECK(file);
+	fseek(file, 0, SEEK_END);
+	*r_size = (size_t)ftell(file);
+	fseek(file, 0, SEEK_SET);
+
+	data = malloc(*r_size);
+	TEST_CHECK(fread(data, 1, *r_size, file) == *r_size);
+	fclose(file);
+
+	return data;
+}
+
+static void file_save(const char *path, const char *data, size_t size)
+{
+	FILE *file = fopen(path, "wb");
+
+	TEST_CHECK(file && fwrite(data, 1, size, file) == size);
+	fclose(file);
+}
+
+static void sample_write(OmniCache *cache, test_sample *sample, uint k, float time)
+{
+	sample->count[0] = k + 3;
+	test_fill(sample->data[0], sample->count[0], k * 100.0f);
+	TEST_CHECK(OMNI_sample_write(cache, OMNI_f_to_fu(time), sample) == OMNI_WRITE_SUCCESS);
+}
+
+static bool sample_check(OmniCache *cache, test_sample *result, uint k, float time)
+{
+	return OMNI_sample_read(cache, OMNI_f_to_fu(time), result) == OMNI_READ_EXACT && result->count[0] == k + 3 &&
+	       test_filled(result->data[0], k + 3, k * 100.0f);
+}
+
+/* Journals replay writes, overwrites and invalidations, up to the last complete record when the journal was cut
+ * short mid-bake, and keep being appended to once resumed. */
+static void test_journal(OmniCacheFlags flags)
+{
+	OmniCacheTemplate *cache_temp = test_template_new("journal", OMNI_TIME_FLOAT, flags, 1);
+	OmniCache *cache;
+	OmniCache *resumed;
+	test_sample sample = {0};
+	test_sample result = {0};
+	char *data;
+	size_t size_crash;
+	size_t size_compact;
+	size_t size;
+
+	test_block_set(cache_temp, 0, "value", OMNI_DATA_FLOAT, 0);
+	cache = OMNI_new(cache_temp, "value");
+
+	test_sample_alloc(&sample, 1, 100 * sizeof(float));
+	test_sample_alloc(&result, 1, 100 * sizeof(float));
+
+	/* Samples written before starting are journaled too. */
+	sample_write(cache, &sample, 0, 0.0f);
+	sample_write(cache, &sample, 1, 0.5f);
+	TEST_CHECK(OMNI_journal_start(cache, PATH));
+
+	for (uint k = 2; k < 10; k++) {
+		sample_write(cache, &sample, k, k * 0.5f);
+	}
+
+	OMNI_sample_clear_from(cache, OMNI_f_to_fu(3.0f));
+	OMNI_sample_mark_invalid(cache, OMNI_f_to_fu(1.0f));
+	sample_write(cache, &sample, 50, 0.5f);
+	sample_write(cache, &sample, 60, 2.25f);
+
+	/* Crash while writing the next record: only part of it made it to disk. */
+	free(file_load(PATH, &size_crash));
+	sample_write(cache, &sample, 7, 7.0f);
+	data = file_load(PATH, &size);
+	TEST_CHECK(size > size_crash + 40);
+	file_save(PATH_CRASH, data, size_crash + 40);
+	free(data);
+
+	resumed = OMNI_journal_resume(PATH_CRASH, cache_temp);
+	TEST_CHECK(resumed);
+	TEST_CHECK(OMNI_get_num_cached(resumed) == OMNI_get_num_cached(cache) - 1);
+	TEST_CHECK(sample_check(resumed, &result, 0, 0.0f));
+	TEST_CHECK(sample_check(resumed, &result, 50, 0.5f));
+	TEST_CHECK(sample_check(resumed, &result, 60, 2.25f));
+	TEST_CHECK(sample_check(resumed, &result, 5, 2.5f));
+	TEST_CHECK(!OMNI_sample_is_valid(resumed, OMNI_f_to_fu(1.0f)));
+	TEST_CHECK(!OMNI_sample_is_valid(resumed, OMNI_f_to_fu(3.0f)));
+	TEST_CHECK(!OMNI_sample_is_valid(resumed, OMNI_f_to_fu(7.0f)));
+
+	/* Appending after the torn record. */
+	sample_write(resumed, &sample, 8, 8.0f);
+	OMNI_free(resumed);
+
+	resumed = OMNI_journal_resume(PATH_CRASH, cache_temp);
+	TEST_CHECK(resumed);
+	TEST_CHECK(sample_check(resumed, &result, 8, 8.0f));
+	TEST_CHECK(sample_check(resumed, &result, 50, 0.5f));
+	OMNI_journal_stop(resumed);
+	OMNI_free(resumed);
+
+	/* Closed cleanly (with its footer), then compacted on resume. */
+	OMNI_free(cache);
+	free(file_load(PATH, &size));
+
+	resumed = OMNI_journal_resume(PATH, cache_temp);
+	TEST_CHECK(resumed);
+	TEST_CHECK(sample_check(resumed, &result, 7, 7.0f));
+	TEST_CHECK(sample_check(resumed, &result, 0, 0.0f));
+	free(file_load(PATH, &size_compact));
+	TEST_CHECK(size_compact < size);
+
+	OMNI_sample_clear(resumed, OMNI_f_to_fu(7.0f));
+	OMNI_free(resumed);
+
+	resumed = OMNI_journal_resume(PATH, cache_temp);
+	TEST_CHECK(resumed);
+	TEST_CHECK(!OMNI_sample_is_valid(resumed, OMNI_f_to_fu(7.0f)));
+	TEST_CHECK(OMNI_sample_is_valid(resumed, OMNI_f_to_fu(0.0f)));
+	OMNI_free(resumed);
+
+	TEST_CHECK(OMNI_journal_resume("test_journal_missing.omj", cache_temp) == NULL);
+
+	remove(PATH);
+	remove(PATH_CRASH);
+	test_sample_free(&sample, 1);
+	test_sample_free(&result, 1);
+	free(cache_temp);
+}
+
+/* Moving the time range is journaled, while changing blocks stops the journal, leaving it as it was. */
+static void test_journal_range(bool async)
+{
+	OmniCacheTemplate *cache_temp = test_template_new("journal_range", OMNI_TIME_FLOAT, 0, 2);
+	OmniCache *cache;
+	OmniCache *resumed;
+	test_sample sample = {0};
+	float_or_uint time_initial;
+	float_or_uint time_final;
+
+	test_block_set(cache_temp, 0, "a", OMNI_DATA_FLOAT, 0);
+	test_block_set(cache_temp, 1, "b", OMNI_DATA_FLOAT, 0);
+	cache = OMNI_new(cache_temp, "a");
+
+	test_sample_alloc(&sample, 2, 4 * sizeof(float));
+	sample.count[0] = 4;
+	sample.count[1] = 4;
+
+	TEST_CHECK(OMNI_journal_start(cache, PATH));
+
+	if (async) {
+		OMNI_journal_set_async(cache, 8);
+	}
+
+	for (uint frame = 0; frame < 100; frame++) {
+		test_fill(sample.data[0], 4, (float)frame);
+		TEST_CHECK(OMNI_sample_write(cache, OMNI_f_to_fu((float)frame), &sample) == OMNI_WRITE_SUCCESS);
+	}
+
+	OMNI_move_end(cache, OMNI_f_to_fu(49.0f));
+	TEST_CHECK(OMNI_get_num_cached(cache) == 50);
+	OMNI_move_start(cache, OMNI_f_to_fu(-10.0f));
+	OMNI_journal_stop(cache);
+
+	resumed = OMNI_journal_resume(PATH, cache_temp);
+	TEST_CHECK(resumed && OMNI_get_num_cached(resumed) == 50);
+	OMNI_get_range(resumed, &time_initial, &time_final, NULL);
+	TEST_CHECK(time_initial.f == -10.0f && time_final.f == 39.0f);
+
+	OMNI_blocks_add(resumed, cache_temp, "b");
+	OMNI_free(resumed);
+
+	resumed = OMNI_journal_resume(PATH, cache_temp);
+	TEST_CHECK(resumed && OMNI_get_num_cached(resumed) == 50 && OMNI_get_num_blocks(resumed) == 1);
+
+	OMNI_set_range(resumed, OMNI_f_to_fu(0.0f), OMNI_f_to_fu(10.0f), OMNI_f_to_fu(1.0f));
+
+	for (uint frame = 0; frame < 5; frame++) {
+		TEST_CHECK(OMNI_sample_write(resumed, OMNI_f_to_fu((float)frame), &sample) == OMNI_WRITE_SUCCESS);
+	}
+
+	OMNI_free(resumed);
+
+	resumed = OMNI_journal_resume(PATH, cache_temp);
+	TEST_CHECK(resumed && OMNI_get_num_cached(resumed) == 50);
+	OMNI_free(resumed);
+
+	OMNI_free(cache);
+	remove(PATH);
+	test_sample_free(&sample, 2);
+	free(cache_temp);
+}
+
+/* Journals whose definition doesn't match the template are rejected. */
+static void test_journal_corrupt(void)
+{
+	OmniCacheTemplate *cache_temp = test_template_new("journal_corrupt", OMNI_TIME_FLOAT, 0, 2);
+	OmniCache *cache;
+	test_sample sample = {0};
+	char *data;
+	size_t size;
+
+	test_block_set(cache_temp, 0, "a", OMNI_DATA_FLOAT, 0);
+	test_block_set(cache_temp, 1, "b", OMNI_DATA_FLOAT3, 0);
+	cache = OMNI_new(cache_temp, "a;b");
+
+	test_sample_alloc(&sample, 2, 4 * sizeof(float[3]));
+	sample.count[0] = 4;
+	sample.count[1] = 4;
+	TEST_CHECK(OMNI_sample_write(cache, OMNI_f_to_fu(0.0f), &sample) == OMNI_WRITE_SUCCESS);
+
+	TEST_CHECK(OMNI_journal_start(cache, PATH));
+	OMNI_journal_stop(cache);
+	data = file_load(PATH, &size);
+
+	for (uint k = 0; k < 3; k++) {
+		char *corrupt = malloc(size);
+		OmniCacheDef *def = NULL;
+		OmniBlockInfoDef *b_defs;
+
+		memcpy(corrupt, data, size);
+
+		for (size_t i = 0; i + sizeof(OmniCacheDef) <= size && !def; i++) {
+			if (strcmp(&corrupt[i], cache_temp->id) == 0) {
+				def = (OmniCacheDef *)&corrupt[i];
+			}
+		}
+
+		TEST_CHECK(def);
+		b_defs = (OmniBlockInfoDef *)(def + 1);
+
+		switch (k) {
+			case 0:
+				b_defs[0].index = 1;
+				b_defs[1].index = 0;
+				break;
+			case 1:
+				b_defs[1].dsize = 4;
+				break;
+			default:
+				def->num_blocks = 3;
+				break;
+		}
+
+		file_save(PATH_CRASH, corrupt, size);
+		TEST_CHECK(OMNI_journal_resume(PATH_CRASH, cache_temp) == NULL);
+		free(corrupt);
+	}
+
+	free(data);
+	OMNI_free(cache);
+	remove(PATH);
+	remove(PATH_CRASH);
+	test_sample_free(&sample, 2);
+	free(cache_temp);
+}
+
+int main(void)
+{
+	test_journal(0);
+	test_journal(OMNICACHE_FLAG_ARENA);
+	test_journal_range(false);
+	test_journal_range(true);
+	test_journal_corrupt();
+
+	return 0;
+}
@@ -0,0 +1,188 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include "test.h"
+
+#include "omni_types.h"
+#include "omni_utils.h"
+
+#define PATH "test_journal_async.omj"
+#define PATH_FILE "test_journal_async.omc"
+
+static void sample_write(OmniCache *cache, test_sample *sample, uint k, float time)
+{
+	sample->count[0] = k + 3;
+	sample->count[1] = k + 3;
+	test_fill(sample->data[0], k + 3, k * 100.0f);
+	test_fill(sample->data[1], k + 3, k * -100.0f);
+	TEST_CHECK(OMNI_sample_write(cache, OMNI_f_to_fu(time), sample) == OMNI_WRITE_SUCCESS);
+}
+
+static bool sample_check(OmniCache *cache, test_sample *result, uint k, float time)
+{
+	return OMNI_sample_read(cache, OMNI_f_to_fu(time), result) == OMNI_READ_EXACT && result->count[0] == k + 3 &&
+	       result->count[1] == k + 3 && test_filled(result->data[0], k + 3, k * 100.0f) &&
+	       test_filled(result->data[1], k + 3, k * -100.0f);
+}
+
+static float *buffer_new(uint num, float base)
+{
+	float *buffer = malloc(num * sizeof(float));
+
+	test_fill(buffer, num, base);
+
+	return buffer;
+}
+
+/* Asynchronous journals record the same as synchronous ones, in order, including blocks moved into the cache and
+ * samples rewritten while queued, and switching between modes. */
+static void test_journal_async(OmniCacheFlags flags)
+{
+	OmniCacheTemplate *cache_temp = test_template_new("journal_async", OMNI_TIME_FLOAT, flags, 2);
+	OmniCache *cache;
+	OmniCache *resumed;
+	test_sample sample = {0};
+	test_sample result = {0};
+	OmniView *view;
+	OmniView *view_moved;
+
+	test_block_set(cache_temp, 0, "a", OMNI_DATA_FLOAT, 0);
+	test_block_set(cache_temp, 1, "b", OMNI_DATA_FLOAT, 0);
+	cache = OMNI_new(cache_temp, "a;b");
+
+	test_sample_alloc(&sample, 2, 200 * sizeof(float));
+	test_sample_alloc(&result, 2, 200 * sizeof(float));
+
+	TEST_CHECK(OMNI_journal_start(cache, PATH));
+	OMNI_journal_set_async(cache, 4);
+
+	for (uint round = 0; round < 20; round++) {
+		for (uint frame = 0; frame < 30; frame++) {
+			sample_write(cache, &sample, frame + round, frame * 0.5f);
+		}
+	}
+
+	OMNI_sample_clear_from(cache, OMNI_f_to_fu(12.0f));
+	OMNI_journal_flush(cache);
+
+	/* Moving blocks into a viewed sample. */
+	TEST_CHECK(OMNI_view_acquire(cache, OMNI_f_to_fu(2.0f), &view) == OMNI_READ_EXACT);
+	TEST_CHECK(OMNI_block_write_move(cache, OMNI_f_to_fu(2.0f), 0, buffer_new(5, 7000.0f), 5, NULL, &sample) ==
+	           OMNI_WRITE_SUCCESS);
+	TEST_CHECK(test_filled(OMNI_view_get_block(view, 0)->data, 26, 2300.0f));
+
+	TEST_CHECK(OMNI_view_acquire(cache, OMNI_f_to_fu(2.0f), &view_moved) == OMNI_READ_EXACT);
+	TEST_CHECK(test_filled(OMNI_view_get_block(view_moved, 0)->data, 5, 7000.0f));
+	TEST_CHECK(OMNI_view_get_block(view_moved, 1)->dcount == 26);
+	OMNI_view_release(view_moved);
+
+	TEST_CHECK(OMNI_block_write_move(cache, OMNI_f_to_fu(2.0f), 1, buffer_new(5, 8000.0f), 5, NULL, &sample) ==
+	           OMNI_WRITE_SUCCESS);
+	TEST_CHECK(test_filled(OMNI_view_get_block(view, 1)->data, 26, -2300.0f));
+	OMNI_view_release(view);
+
+	OMNI_journal_set_async(cache, 0);
+	sample_write(cache, &sample, 99, 3.0f);
+	OMNI_journal_set_async(cache, 2);
+	sample_write(cache, &sample, 98, 3.5f);
+	OMNI_free(cache);
+
+	resumed = OMNI_journal_resume(PATH, cache_temp);
+	TEST_CHECK(resumed);
+
+	for (uint frame = 0; frame < 24; frame++) {
+		if (frame != 4 && frame != 6 && frame != 7) {
+			TEST_CHECK(sample_check(resumed, &result, frame + 19, frame * 0.5f));
+		}
+	}
+
+	TEST_CHECK(OMNI_sample_read(resumed, OMNI_f_to_fu(2.0f), &result) == OMNI_READ_EXACT);
+	TEST_CHECK(result.count[0] == 5 && test_filled(result.data[0], 5, 7000.0f));
+	TEST_CHECK(result.count[1] == 5 && test_filled(result.data[1], 5, 8000.0f));
+	TEST_CHECK(sample_check(resumed, &result, 99, 3.0f));
+	TEST_CHECK(sample_check(resumed, &result, 98, 3.5f));
+	TEST_CHECK(!OMNI_sample_is_valid(resumed, OMNI_f_to_fu(12.5f)));
+
+	OMNI_free(resumed);
+	remove(PATH);
+	test_sample_free(&sample, 2);
+	test_sample_free(&result, 2);
+	free(cache_temp);
+}
+
+static OmniSample *sample_find(OmniCache *cache, uint tindex)
+{
+	for (OmniSample *sample = SAMPLE_FIRST(cache); sample; sample = sample_next(sample)) {
+		if (sample->tindex == tindex) {
+			return sample;
+		}
+	}
+
+	return NULL;
+}
+
+/* Moving a block into a sample read from a cache file leaves its other blocks borrowed from the file,
+ * and views of the previous data valid after the cache is freed. */
+static void test_detach(void)
+{
+	OmniCacheTemplate *cache_temp = test_template_new("journal_detach", OMNI_TIME_INT, 0, 2);
+	OmniCache *cache;
+	OmniCache *opened;
+	test_sample sample = {0};
+	test_sample result = {0};
+	OmniView *view;
+	OmniSample *moved;
+
+	test_block_set(cache_temp, 0, "a", OMNI_DATA_FLOAT, 0);
+	test_block_set(cache_temp, 1, "b", OMNI_DATA_FLOAT, 0);
+	cache = OMNI_new(cache_temp, "a;b");
+
+	test_sample_alloc(&sample, 2, 2000 * sizeof(float));
+	test_sample_alloc(&result, 2, 2000 * sizeof(float));
+	sample.count[0] = 2000;
+	sample.count[1] = 2000;
+
+	for (uint frame = 0; frame < 10; frame++) {
+		test_fill(sample.data[0], 2000, (float)frame);
+		test_fill(sample.data[1], 2000, frame * 3.0f);
+		TEST_CHECK(OMNI_sample_write(cache, OMNI_u_to_fu(frame), &sample) == OMNI_WRITE_SUCCESS);
+	}
+
+	TEST_CHECK(OMNI_file_write(cache, PATH_FILE));
+	opened = OMNI_file_open(PATH_FILE, cache_temp);
+	TEST_CHECK(opened);
+
+	TEST_CHECK(OMNI_view_acquire(opened, OMNI_u_to_fu(4), &view) == OMNI_READ_EXACT);
+	TEST_CHECK(OMNI_block_write_move(opened, OMNI_u_to_fu(4), 0, buffer_new(2000, -1.0f), 2000, free, &sample) ==
+	           OMNI_WRITE_SUCCESS);
+
+	moved = sample_find(opened, 4);
+	TEST_CHECK(moved && (moved->blocks[1].status & OMNI_BLOCK_STATUS_BORROWED));
+
+	TEST_CHECK(OMNI_sample_read(opened, OMNI_u_to_fu(4), &result) == OMNI_READ_EXACT);
+	TEST_CHECK(test_filled(result.data[0], 2000, -1.0f) && test_filled(result.data[1], 2000, 12.0f));
+	TEST_CHECK(test_filled(OMNI_view_get_block(view, 0)->data, 2000, 4.0f));
+
+	OMNI_free(opened);
+	TEST_CHECK(test_filled(OMNI_view_get_block(view, 0)->data, 2000, 4.0f));
+	TEST_CHECK(test_filled(OMNI_view_get_block(view, 1)->data, 2000, 12.0f));
+	OMNI_view_release(view);
+
+	OMNI_free(cache);
+	TEST_CHECK(OMNI_get_memory_global() == 0);
+
+	remove(PATH_FILE);
+	test_sample_free(&sample, 2);
+	test_sample_free(&result, 2);
+	free(cache_temp);
+}
+
+int main(void)
+{
+	test_journal_async(0);
+	test_journal_async(OMNICACHE_FLAG_ARENA);
+	test_detach();
+
+	return 0;
+}
@@ -0,0 +1,97 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include "test.h"
+
+#include "thread.h"
+
+#define PATH "test_load.omc"
+
+#define NUM_FRAMES 40
+#define NUM_TIMES 42
+
+typedef struct load_counts {
+	size_t num_loaded;
+	size_t num_failed;
+} load_counts;
+
+static void load_callback(OmniLoad *load, uint index, bool success, void *user_data)
+{
+	load_counts *counts = user_data;
+
+	(void)load;
+	(void)index;
+
+	atomic_add_z(success ? &counts->num_loaded : &counts->num_failed, 1);
+}
+
+/* Asynchronous loads report every requested sample, failing missing ones, including samples rewritten meanwhile,
+ * and complete straight away for samples already in memory. */
+int main(void)
+{
+	OmniCacheTemplate *cache_temp = test_template_new("load", OMNI_TIME_FLOAT, 0, 1);
+	OmniCache *cache;
+	OmniCache *opened;
+	OmniLoad *load;
+	load_counts counts = {0};
+	test_sample sample = {0};
+	test_sample result = {0};
+	float_or_uint times[NUM_TIMES];
+
+	test_block_set(cache_temp, 0, "value", OMNI_DATA_FLOAT, 0);
+	cache = OMNI_new(cache_temp, "value");
+
+	test_sample_alloc(&sample, 1, 20100 * sizeof(float));
+	test_sample_alloc(&result, 1, 20100 * sizeof(float));
+
+	for (uint frame = 0; frame < NUM_FRAMES; frame++) {
+		sample.count[0] = 20000 + frame;
+		test_fill(sample.data[0], sample.count[0], frame * 100.0f);
+		TEST_CHECK(OMNI_sample_write(cache, OMNI_f_to_fu((float)frame), &sample) == OMNI_WRITE_SUCCESS);
+	}
+
+	for (uint i = 0; i < NUM_TIMES; i++) {
+		times[i] = OMNI_f_to_fu((float)i);
+	}
+
+	TEST_CHECK(OMNI_file_write(cache, PATH));
+	opened = OMNI_file_open(PATH, cache_temp);
+	TEST_CHECK(opened);
+
+	load = OMNI_load_submit(opened, times, NUM_TIMES, load_callback, &counts);
+
+	sample.count[0] = 3;
+	test_fill(sample.data[0], 3, -1.0f);
+	TEST_CHECK(OMNI_sample_write(opened, OMNI_f_to_fu(5.0f), &sample) == OMNI_WRITE_SUCCESS);
+
+	OMNI_load_wait(load);
+	TEST_CHECK(OMNI_load_poll(load) == NUM_TIMES);
+	TEST_CHECK(counts.num_loaded == NUM_FRAMES && counts.num_failed == NUM_TIMES - NUM_FRAMES);
+	OMNI_load_release(load);
+
+	TEST_CHECK(OMNI_sample_read(opened, OMNI_f_to_fu(7.0f), &result) == OMNI_READ_EXACT);
+	TEST_CHECK(result.count[0] == 20007 && test_filled(result.data[0], 20007, 700.0f));
+	TEST_CHECK(OMNI_sample_read(opened, OMNI_f_to_fu(5.0f), &result) == OMNI_READ_EXACT);
+	TEST_CHECK(result.count[0] == 3 && test_filled(result.data[0], 3, -1.0f));
+
+	/* Released without waiting, or without a callback. */
+	load = OMNI_load_submit(opened, times, 10, NULL, NULL);
+	OMNI_load_release(load);
+
+	load = OMNI_load_submit(cache, times, 10, load_callback, &counts);
+	OMNI_load_wait(load);
+	TEST_CHECK(OMNI_load_poll(load) == 10 && counts.num_loaded == NUM_FRAMES + 10);
+	OMNI_load_release(load);
+
+	OMNI_free(opened);
+	OMNI_free(cache);
+	TEST_CHECK(OMNI_get_memory_global() == 0);
+
+	remove(PATH);
+	test_sample_free(&sample, 1);
+	test_sample_free(&result, 1);
+	free(cache_temp);
+
+	return 0;
+}
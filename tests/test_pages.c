@@ -0,0 +1,86 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include "test.h"
+
+#include "omni_types.h"
+#include "omni_utils.h"
+
+#define NUM_FRAMES 100000
+#define FRAME_STEP 500
+
+static uint num_pages_used(const OmniCache *cache)
+{
+	uint num = 0;
+
+	for (uint i = 0; i < cache->num_pages; i++) {
+		num += cache->pages[i] != NULL;
+	}
+
+	return num;
+}
+
+/* Sparse samples over a long range only allocate the pages they use, and root samples keep their address
+ * as the range grows and shrinks. */
+int main(void)
+{
+	OmniCacheTemplate *cache_temp = test_template_new("pages", OMNI_TIME_INT, 0, 1);
+	OmniCache *cache;
+	OmniCache *dup;
+	OmniSample *first;
+	test_sample sample = {0};
+	test_sample result = {0};
+
+	cache_temp->time_final = OMNI_u_to_fu(NUM_FRAMES);
+	test_block_set(cache_temp, 0, "value", OMNI_DATA_FLOAT, 0);
+	cache = OMNI_new(cache_temp, "value");
+
+	test_sample_alloc(&sample, 1, 4 * sizeof(float));
+	test_sample_alloc(&result, 1, 4 * sizeof(float));
+	sample.count[0] = 4;
+
+	for (uint frame = 0; frame < NUM_FRAMES; frame += FRAME_STEP) {
+		test_fill(sample.data[0], 4, (float)frame);
+		TEST_CHECK(OMNI_sample_write(cache, OMNI_u_to_fu(frame), &sample) == OMNI_WRITE_SUCCESS);
+	}
+
+	TEST_CHECK(FRAME_STEP > SAMPLE_PAGE_SIZE);
+	TEST_CHECK(num_pages_used(cache) == NUM_FRAMES / FRAME_STEP);
+
+	first = &cache->pages[0][0];
+	TEST_CHECK(OMNI_sample_write(cache, OMNI_u_to_fu(NUM_FRAMES - 1), &sample) == OMNI_WRITE_SUCCESS);
+	TEST_CHECK(&cache->pages[0][0] == first);
+
+	TEST_CHECK(OMNI_sample_read(cache, OMNI_u_to_fu(50000), &result) == OMNI_READ_EXACT);
+	TEST_CHECK(test_filled(result.data[0], 4, 50000.0f));
+	TEST_CHECK(OMNI_sample_read(cache, OMNI_u_to_fu(50001), &result) == OMNI_READ_INVALID);
+
+	/* Clearing frees the pages past the last sample in use. */
+	OMNI_sample_clear_from(cache, OMNI_u_to_fu(60001));
+
+	TEST_CHECK(cache->def.num_samples_array == 60001);
+	TEST_CHECK(num_pages_used(cache) == 121);
+
+	OMNI_sample_mark_invalid(cache, OMNI_u_to_fu(60000));
+	OMNI_sample_mark_invalid(cache, OMNI_u_to_fu(59500));
+	OMNI_consolidate(cache, OMNI_CONSOL_FREE_INVALID);
+
+	TEST_CHECK(cache->def.num_samples_array == 59001);
+	TEST_CHECK(OMNI_get_num_cached(cache) == 119);
+	TEST_CHECK(&cache->pages[0][0] == first);
+
+	dup = OMNI_duplicate(cache, true);
+
+	TEST_CHECK(num_pages_used(dup) == 119);
+	TEST_CHECK(OMNI_sample_read(dup, OMNI_u_to_fu(59000), &result) == OMNI_READ_EXACT);
+	TEST_CHECK(test_filled(result.data[0], 4, 59000.0f));
+
+	OMNI_free(dup);
+	OMNI_free(cache);
+	test_sample_free(&sample, 1);
+	test_sample_free(&result, 1);
+	free(cache_temp);
+
+	return 0;
+}
@@ -0,0 +1,113 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include "test.h"
+
+#define PATH "test_prefetch.omc"
+
+#define NUM_FRAMES 60
+
+static bool frame_check(OmniCache *cache, test_sample *result, uint frame)
+{
+	return OMNI_sample_read(cache, OMNI_f_to_fu((float)frame), result) == OMNI_READ_EXACT &&
+	       result->count[0] == 20000 + frame && test_filled(result->data[0], 20000 + frame, frame * 100.0f);
+}
+
+/* Reading ahead of playback (in either direction, with any step) reads the same data as without, including
+ * samples rewritten or cleared while being read ahead, and leaves in-memory caches alone. */
+int main(void)
+{
+	OmniCacheTemplate *cache_temp = test_template_new("prefetch", OMNI_TIME_FLOAT, 0, 1);
+	OmniCache *cache;
+	OmniCache *opened;
+	test_sample sample = {0};
+	test_sample result = {0};
+
+	test_block_set(cache_temp, 0, "value", OMNI_DATA_FLOAT, 0);
+	cache = OMNI_new(cache_temp, "value");
+
+	test_sample_alloc(&sample, 1, 20100 * sizeof(float));
+	test_sample_alloc(&result, 1, 20100 * sizeof(float));
+
+	for (uint frame = 0; frame < NUM_FRAMES; frame++) {
+		sample.count[0] = 20000 + frame;
+		test_fill(sample.data[0], sample.count[0], frame * 100.0f);
+		TEST_CHECK(OMNI_sample_write(cache, OMNI_f_to_fu((float)frame), &sample) == OMNI_WRITE_SUCCESS);
+	}
+
+	TEST_CHECK(OMNI_file_write(cache, PATH));
+	opened = OMNI_file_open(PATH, cache_temp);
+	TEST_CHECK(opened);
+	OMNI_prefetch_set(opened, 8, 0);
+
+	for (uint frame = 0; frame < NUM_FRAMES; frame++) {
+		TEST_CHECK(frame_check(opened, &result, frame));
+	}
+
+	/* Backwards, rewriting a sample ahead. */
+	sample.count[0] = 3;
+	test_fill(sample.data[0], 3, -1.0f);
+
+	for (int frame = NUM_FRAMES - 2; frame >= 0; frame -= 2) {
+		if (frame == 26) {
+			TEST_CHECK(OMNI_sample_read(opened, OMNI_f_to_fu(26.0f), &result) == OMNI_READ_EXACT);
+			TEST_CHECK(result.count[0] == 3 && test_filled(result.data[0], 3, -1.0f));
+		}
+		else {
+			TEST_CHECK(frame_check(opened, &result, (uint)frame));
+		}
+
+		if (frame == 30) {
+			TEST_CHECK(OMNI_sample_write(opened, OMNI_f_to_fu(26.0f), &sample) == OMNI_WRITE_SUCCESS);
+		}
+	}
+
+	/* Limited by size, then with irregular steps and a cleared cache. */
+	OMNI_prefetch_set(opened, 4, 200000);
+
+	for (uint frame = 0; frame < 20; frame++) {
+		TEST_CHECK(frame_check(opened, &result, frame));
+	}
+
+	for (float time = 0.0f; time < 20.0f; time += 0.5f) {
+		OMNI_sample_read(opened, OMNI_f_to_fu(time), &result);
+	}
+
+	OMNI_clear(opened);
+
+	for (uint frame = 0; frame < 10; frame++) {
+		TEST_CHECK(OMNI_sample_read(opened, OMNI_f_to_fu((float)frame), &result) == OMNI_READ_INVALID);
+	}
+
+	/* Freed while reading ahead. */
+	OMNI_free(opened);
+	opened = OMNI_file_open(PATH, cache_temp);
+	TEST_CHECK(opened);
+	OMNI_prefetch_set(opened, 16, 0);
+
+	for (uint frame = 0; frame < 6; frame++) {
+		TEST_CHECK(frame_check(opened, &result, frame));
+	}
+
+	OMNI_free(opened);
+
+	OMNI_prefetch_set(cache, 8, 0);
+
+	for (uint frame = 0; frame < 10; frame++) {
+		TEST_CHECK(frame_check(cache, &result, frame));
+	}
+
+	OMNI_prefetch_set(cache, 0, 0);
+	TEST_CHECK(frame_check(cache, &result, 10));
+
+	OMNI_free(cache);
+	TEST_CHECK(OMNI_get_memory_global() == 0);
+
+	remove(PATH);
+	test_sample_free(&sample, 1);
+	test_sample_free(&result, 1);
+	free(cache_temp);
+
+	return 0;
+}
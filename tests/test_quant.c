@@ -0,0 +1,309 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include <math.h>
+#include <stdint.h>
+
+#include "test.h"
+
+#include "quant.h"
+
+#define PATH "test_quant.omc"
+#define PATH_JOURNAL "test_quant.omj"
+
+#define MAX_NUM 37
+#define COUNT 2000
+#define NUM_FRAMES 20
+
+static uint32_t random_next(uint32_t *state)
+{
+	*state ^= *state << 13;
+	*state ^= *state >> 17;
+	*state ^= *state << 5;
+
+	return *state;
+}
+
+/* Uniform in [-1, 1]. */
+static float random_float(uint32_t *state)
+{
+	return ((float)(random_next(state) % 2000001) / 1000000.0f) - 1.0f;
+}
+
+/* Largest error of half-floats without a bound: half an ulp, relative to the value (absolute for subnormals). */
+static float half_error(float value)
+{
+	return fmaxf(fabsf(value) / 2048.0f, 1.0f / 33554432.0f);
+}
+
+/* Values quantized within the bound decode within it, whatever their scale and count (covering the tails of
+ * vectorized kernels), and half-floats are rounded the same in bulk as one at a time. */
+static void test_quant_kernels(void)
+{
+	static const uint comps[] = {1, 3, 9, 16};
+	uint32_t state = 7;
+	float src[MAX_NUM * QUANT_MAX_COMPS];
+	float decoded[MAX_NUM * QUANT_MAX_COMPS];
+	uint16_t dst[(MAX_NUM + 4) * QUANT_MAX_COMPS]; /* Room for the fixed point header. */
+	uint16_t single;
+	uint num_accepted[3] = {0};
+
+	for (uint iter = 0; iter < 20000; iter++) {
+		uint num_comps = comps[iter % 4];
+		size_t num = 1 + (random_next(&state) % MAX_NUM);
+		size_t num_floats = num * num_comps;
+		float scale = powf(2.0f, (float)(random_next(&state) % 50) - 40.0f);
+		float error = powf(10.0f, -(float)(random_next(&state) % 120) / 10.0f);
+
+		for (size_t i = 0; i < num_floats; i++) {
+			src[i] = random_float(&state) * scale;
+		}
+
+		if (quant_encode(OMNI_QUANT_HALF, error, num_comps, src, num, dst)) {
+			quant_decode(OMNI_QUANT_HALF, num_comps, dst, num, decoded);
+
+			for (size_t i = 0; i < num_floats; i++) {
+				TEST_CHECK(fabsf(decoded[i] - src[i]) <= error);
+			}
+
+			num_accepted[0]++;
+		}
+
+		TEST_CHECK(quant_encode(OMNI_QUANT_HALF, 0.0f, num_comps, src, num, dst));
+		quant_decode(OMNI_QUANT_HALF, num_comps, dst, num, decoded);
+
+		for (size_t i = 0; i < num_floats; i++) {
+			TEST_CHECK(fabsf(decoded[i] - src[i]) <= half_error(src[i]));
+			TEST_CHECK(quant_encode(OMNI_QUANT_HALF, 0.0f, 1, &src[i], 1, &single) && single == dst[i]);
+		}
+
+		num_accepted[1]++;
+
+		if (quant_encode(OMNI_QUANT_FIXED, error, num_comps, src, num, dst)) {
+			quant_decode(OMNI_QUANT_FIXED, num_comps, dst, num, decoded);
+
+			for (size_t i = 0; i < num_floats; i++) {
+				TEST_CHECK(fabsf(decoded[i] - src[i]) <= error);
+			}
+
+			num_accepted[2]++;
+		}
+	}
+
+	TEST_CHECK(num_accepted[0] > 1000 && num_accepted[2] > 1000);
+
+	/* Values that can't be quantized. */
+	src[0] = 1.0f;
+	src[1] = NAN;
+	TEST_CHECK(!quant_encode(OMNI_QUANT_HALF, 0.0f, 1, src, 2, dst));
+	TEST_CHECK(!quant_encode(OMNI_QUANT_FIXED, 0.1f, 1, src, 2, dst));
+
+	src[1] = INFINITY;
+	TEST_CHECK(!quant_encode(OMNI_QUANT_HALF, 0.0f, 1, src, 2, dst));
+	TEST_CHECK(!quant_encode(OMNI_QUANT_FIXED, 0.1f, 1, src, 2, dst));
+
+	src[1] = 70000.0f;
+	TEST_CHECK(!quant_encode(OMNI_QUANT_HALF, 0.0f, 1, src, 2, dst));
+	TEST_CHECK(quant_encode(OMNI_QUANT_FIXED, 1.0f, 1, src, 2, dst));
+	TEST_CHECK(!quant_encode(OMNI_QUANT_FIXED, 0.1f, 1, src, 2, dst));
+	TEST_CHECK(!quant_encode(OMNI_QUANT_HALF, 0.0f, 1, src, 0, dst));
+}
+
+static OmniQuantization cache_quant;
+static float cache_error;
+static float interp_scale = 1.0f;
+
+static bool values_close(const float *a, const float *b, uint num)
+{
+	for (uint i = 0; i < num; i++) {
+		bool relative = (cache_quant == OMNI_QUANT_HALF && cache_error == 0.0f);
+		float error = relative ? half_error(b[i]) : cache_error;
+
+		/* Interpolation weighs in the errors of neighbouring samples, possibly of larger values. */
+		if (interp_scale > 1.0f) {
+			error = interp_scale * (relative ? half_error(16.0f) : cache_error);
+		}
+
+		if (!(fabsf(a[i] - b[i]) <= error)) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+static void sample_fill(test_sample *sample, uint frame)
+{
+	float *values = sample->data[0];
+	float *weights = sample->data[1];
+	int *indices = sample->data[2];
+
+	for (uint i = 0; i < COUNT * 3; i++) {
+		values[i] = (sinf(i * 0.37f) * 10.0f) + ((i % 17 == 0) ? frame * 0.01f : 0.0f);
+	}
+
+	for (uint i = 0; i < COUNT; i++) {
+		weights[i] = cosf(i * 0.01f + frame);
+		indices[i] = (int)(i + frame);
+	}
+
+	sample->count[0] = COUNT;
+	sample->count[1] = COUNT;
+	sample->count[2] = COUNT;
+}
+
+static bool sample_close(const test_sample *a, const test_sample *b)
+{
+	return a->count[0] == b->count[0] && a->count[1] == b->count[1] && a->count[2] == b->count[2] &&
+	       values_close(a->data[0], b->data[0], COUNT * 3) && values_close(a->data[1], b->data[1], COUNT) &&
+	       memcmp(a->data[2], b->data[2], COUNT * sizeof(int)) == 0;
+}
+
+static void check_frames(OmniCache *cache, test_sample *result, test_sample *expected)
+{
+	for (uint frame = 0; frame < NUM_FRAMES; frame++) {
+		sample_fill(expected, frame);
+		TEST_CHECK(OMNI_sample_read(cache, OMNI_f_to_fu((float)frame), result) == OMNI_READ_EXACT);
+		TEST_CHECK(sample_close(result, expected));
+	}
+}
+
+static OmniCacheTemplate *template_new(OmniCacheFlags flags, OmniQuantization quant, OmniCodec codec,
+                                       uint delta_interval)
+{
+	OmniCacheTemplate *cache_temp = test_template_new("quant", OMNI_TIME_FLOAT, flags | OMNICACHE_FLAG_INTERP_ANY, 3);
+
+	cache_temp->meta_size = 0;
+	cache_temp->meta_gen = NULL;
+
+	test_block_set(cache_temp, 0, "values", OMNI_DATA_FLOAT3, OMNI_BLOCK_FLAG_CONTINUOUS);
+	test_block_set(cache_temp, 1, "weights", OMNI_DATA_FLOAT, OMNI_BLOCK_FLAG_CONTINUOUS);
+	test_block_set(cache_temp, 2, "indices", OMNI_DATA_INT, 0);
+
+	for (uint i = 0; i < 2; i++) {
+		cache_temp->blocks[i].quantization = quant;
+		cache_temp->blocks[i].quant_error = cache_error;
+		cache_temp->blocks[i].codec = codec;
+		cache_temp->blocks[i].delta_interval = delta_interval;
+	}
+
+	return cache_temp;
+}
+
+/* Quantized blocks read back within the error bound (exactly where it can't be met), through interpolation, views,
+ * serialization, cache files and journals, using less memory. */
+static void test_quant_cache(OmniCacheFlags flags, OmniQuantization quant, float error, OmniCodec codec,
+                             uint delta_interval)
+{
+	OmniCacheTemplate *cache_temp;
+	OmniCacheTemplate *raw_temp;
+	OmniCache *cache;
+	OmniCache *raw;
+	OmniCache *loaded;
+	OmniSerial *serial;
+	OmniView *view;
+	test_sample sample = {0};
+	test_sample result = {0};
+	test_sample expected = {0};
+	size_t size;
+
+	cache_quant = quant;
+	cache_error = error;
+	cache_temp = template_new(flags, quant, codec, delta_interval);
+	raw_temp = template_new(flags, OMNI_QUANT_NONE, codec, delta_interval);
+	cache = OMNI_new(cache_temp, "values;weights;indices");
+	raw = OMNI_new(raw_temp, "values;weights;indices");
+
+	test_sample_alloc(&sample, 3, COUNT * sizeof(float[3]));
+	test_sample_alloc(&result, 3, COUNT * sizeof(float[3]));
+	test_sample_alloc(&expected, 3, COUNT * sizeof(float[3]));
+
+	for (uint frame = 0; frame < NUM_FRAMES; frame++) {
+		sample_fill(&sample, frame);
+		TEST_CHECK(OMNI_sample_write(cache, OMNI_f_to_fu((float)frame), &sample) == OMNI_WRITE_SUCCESS);
+		TEST_CHECK(OMNI_sample_write(raw, OMNI_f_to_fu((float)frame), &sample) == OMNI_WRITE_SUCCESS);
+	}
+
+	/* Too small a bound leaves the data as is. */
+	if (quant == OMNI_QUANT_FIXED && error < 1e-6f) {
+		cache_error = 0.0f;
+		cache_quant = OMNI_QUANT_NONE;
+	}
+	else if (!(flags & OMNICACHE_FLAG_ARENA)) {
+		TEST_CHECK(OMNI_get_memory(cache) < OMNI_get_memory(raw));
+	}
+
+	check_frames(cache, &result, &expected);
+
+	TEST_CHECK(OMNI_sample_read(cache, OMNI_f_to_fu(7.25f), &result) & OMNI_READ_INTERP);
+	TEST_CHECK(OMNI_sample_read(raw, OMNI_f_to_fu(7.25f), &expected) & OMNI_READ_INTERP);
+	interp_scale = 2.0f;
+	TEST_CHECK(sample_close(&result, &expected));
+	interp_scale = 1.0f;
+
+	TEST_CHECK(OMNI_view_acquire(cache, OMNI_f_to_fu(4.0f), &view) == OMNI_READ_EXACT);
+	sample_fill(&expected, 4);
+	TEST_CHECK(values_close(OMNI_view_get_block(view, 0)->data, expected.data[0], COUNT * 3));
+	sample_fill(&sample, 9);
+	TEST_CHECK(OMNI_sample_write(cache, OMNI_f_to_fu(4.0f), &sample) == OMNI_WRITE_SUCCESS);
+	TEST_CHECK(values_close(OMNI_view_get_block(view, 0)->data, expected.data[0], COUNT * 3));
+	OMNI_view_release(view);
+
+	sample_fill(&sample, 4);
+	TEST_CHECK(OMNI_sample_write(cache, OMNI_f_to_fu(4.0f), &sample) == OMNI_WRITE_SUCCESS);
+
+	serial = OMNI_serialize(cache, true, &size);
+	loaded = OMNI_deserialize(serial, cache_temp);
+	check_frames(loaded, &result, &expected);
+	OMNI_free(loaded);
+
+	loaded = OMNI_deserialize_borrowed(serial, cache_temp);
+	check_frames(loaded, &result, &expected);
+	OMNI_free(loaded);
+	free(serial);
+
+	loaded = OMNI_duplicate(cache, true);
+	check_frames(loaded, &result, &expected);
+	OMNI_free(loaded);
+
+	TEST_CHECK(OMNI_file_write(cache, PATH));
+	loaded = OMNI_file_open(PATH, cache_temp);
+	TEST_CHECK(loaded);
+	check_frames(loaded, &result, &expected);
+	OMNI_free(loaded);
+	remove(PATH);
+
+	TEST_CHECK(OMNI_journal_start(cache, PATH_JOURNAL));
+	OMNI_journal_stop(cache);
+	loaded = OMNI_journal_resume(PATH_JOURNAL, cache_temp);
+	TEST_CHECK(loaded);
+	check_frames(loaded, &result, &expected);
+	OMNI_journal_stop(loaded);
+	OMNI_free(loaded);
+	remove(PATH_JOURNAL);
+
+	OMNI_free(cache);
+	OMNI_free(raw);
+	TEST_CHECK(OMNI_get_memory_global() == 0);
+
+	test_sample_free(&sample, 3);
+	test_sample_free(&result, 3);
+	test_sample_free(&expected, 3);
+	free(cache_temp);
+	free(raw_temp);
+}
+
+int main(void)
+{
+	test_quant_kernels();
+
+	test_quant_cache(0, OMNI_QUANT_HALF, 0.0f, OMNI_CODEC_NONE, 0);
+	test_quant_cache(0, OMNI_QUANT_HALF, 0.01f, OMNI_CODEC_FLOAT_XOR, 4);
+	test_quant_cache(0, OMNI_QUANT_FIXED, 0.001f, OMNI_CODEC_NONE, 0);
+	test_quant_cache(0, OMNI_QUANT_FIXED, 0.0005f, OMNI_CODEC_SHUFFLE_LZ, 8);
+	test_quant_cache(0, OMNI_QUANT_FIXED, 1e-7f, OMNI_CODEC_NONE, 4);
+	test_quant_cache(OMNICACHE_FLAG_ARENA, OMNI_QUANT_FIXED, 0.001f, OMNI_CODEC_NONE, 0);
+
+	return 0;
+}
@@ -0,0 +1,112 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include <math.h>
+
+#include "test.h"
+
+#define NUM 300
+
+/* Rotation of `angle` around Z, uniform `scale` (mirrored along X if `flip`), and translation along X and Y. */
+static void transform_make(float mat[4][4], float angle, float scale, float loc, bool flip)
+{
+	float c = cosf(angle) * scale;
+	float s = sinf(angle) * scale;
+	float sign = flip ? -1.0f : 1.0f;
+
+	memset(mat, 0, sizeof(float[4][4]));
+
+	mat[0][0] = c * sign;
+	mat[0][1] = s * sign;
+	mat[1][0] = -s;
+	mat[1][1] = c;
+	mat[2][2] = scale;
+	mat[3][0] = loc;
+	mat[3][1] = loc * 2.0f;
+	mat[3][3] = 1.0f;
+}
+
+static float transform_error(const float a[4][4], const float b[4][4])
+{
+	float error = 0.0f;
+
+	for (uint i = 0; i < 16; i++) {
+		error = fmaxf(error, fabsf(a[i / 4][i % 4] - b[i / 4][i % 4]));
+	}
+
+	return error;
+}
+
+static float angle_get(uint i, uint frame)
+{
+	return ((i % 17) * 0.1f) + (frame * (0.2f + ((i % 5) * 0.3f)));
+}
+
+/* Matrices are interpolated as translation, rotation and scale (so rotating matrices don't shrink),
+ * including mirrored ones, and transformed references only when they reference the same block. */
+int main(void)
+{
+	OmniCacheTemplate *cache_temp = test_template_new("rotation", OMNI_TIME_FLOAT, OMNICACHE_FLAG_INTERP_ANY, 2);
+	OmniCache *cache;
+	test_sample sample = {0};
+	test_sample result = {0};
+	float(*mats)[4][4];
+	OmniTRef *trefs;
+	float expected[4][4];
+	const float fac = 0.25f;
+
+	test_block_set(cache_temp, 0, "mat", OMNI_DATA_MAT4, OMNI_BLOCK_FLAG_CONTINUOUS);
+	test_block_set(cache_temp, 1, "tref", OMNI_DATA_TREF, OMNI_BLOCK_FLAG_CONTINUOUS);
+	cache_temp->blocks[0].interp_mode = OMNI_INTERP_ROTATION;
+	cache_temp->blocks[1].interp_mode = OMNI_INTERP_ROTATION;
+	cache = OMNI_new(cache_temp, "mat;tref");
+
+	test_sample_alloc(&sample, 2, NUM * sizeof(OmniTRef));
+	test_sample_alloc(&result, 2, NUM * sizeof(OmniTRef));
+	sample.count[0] = NUM;
+	sample.count[1] = NUM;
+	mats = sample.data[0];
+	trefs = sample.data[1];
+
+	for (uint frame = 0; frame <= 1; frame++) {
+		for (uint i = 0; i < NUM; i++) {
+			transform_make(mats[i], angle_get(i, frame), (float)(1 + (i % 3) + frame), frame * 10.0f, i % 7 == 0);
+
+			trefs[i].index = (frame && i % 11 == 0) ? 5000 : i;
+			transform_make(trefs[i].mat, angle_get(i, frame), 2.0f, frame * 4.0f, false);
+		}
+
+		TEST_CHECK(OMNI_sample_write(cache, OMNI_f_to_fu((float)frame), &sample) == OMNI_WRITE_SUCCESS);
+	}
+
+	TEST_CHECK(OMNI_sample_read(cache, OMNI_f_to_fu(fac), &result) == OMNI_READ_INTERP);
+
+	mats = result.data[0];
+	trefs = result.data[1];
+
+	for (uint i = 0; i < NUM; i++) {
+		float angle = angle_get(i, 0) + ((angle_get(i, 1) - angle_get(i, 0)) * fac);
+
+		transform_make(expected, angle, (float)(1 + (i % 3)) + fac, 10.0f * fac, i % 7 == 0);
+		TEST_CHECK(transform_error((const float(*)[4])mats[i], (const float(*)[4])expected) < 2e-3f);
+
+		TEST_CHECK(trefs[i].index == i);
+
+		if (i % 11 == 0) {
+			transform_make(expected, angle_get(i, 0), 2.0f, 0.0f, false);
+		}
+		else {
+			transform_make(expected, angle, 2.0f, 4.0f * fac, false);
+		}
+
+		TEST_CHECK(transform_error((const float(*)[4])trefs[i].mat, (const float(*)[4])expected) < 2e-3f);
+	}
+
+	OMNI_free(cache);
+	test_sample_free(&sample, 2);
+	test_sample_free(&result, 2);
+	free(cache_temp);
+
+	return 0;
+}
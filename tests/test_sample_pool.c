@@ -0,0 +1,96 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include "test.h"
+
+#include "omni_types.h"
+
+#define NUM_ELEMS 1000
+
+/* Elements are zeroed, distinct, reused once released, and placed next to their hint when possible. */
+static void test_mempool(void)
+{
+	mempool pool;
+	char *elems[NUM_ELEMS];
+	char *elem;
+
+	mempool_init(&pool, 40);
+
+	for (uint i = 0; i < NUM_ELEMS; i++) {
+		elems[i] = mempool_alloc(&pool, i ? elems[i - 1] : NULL);
+
+		for (uint j = 0; j < 40; j++) {
+			TEST_CHECK(elems[i][j] == 0);
+		}
+
+		memset(elems[i], 0xff, 40);
+	}
+
+	for (uint i = 1; i < NUM_ELEMS; i++) {
+		TEST_CHECK(elems[i] != elems[i - 1]);
+	}
+
+	mempool_release(&pool, elems[10]);
+	elem = mempool_alloc(&pool, elems[11]);
+	TEST_CHECK(elem == elems[10] && elem[39] == 0);
+
+	mempool_free(&pool);
+	TEST_CHECK(pool.slabs == NULL);
+}
+
+/* Sub-samples (allocated from `OmniCache.sample_pool`) written, cleared and written again. */
+static void test_sub_samples(void)
+{
+	OmniCacheTemplate *cache_temp = test_template_new("sub_samples", OMNI_TIME_FLOAT, 0, 1);
+	OmniCache *cache;
+	test_sample sample = {0};
+	test_sample result = {0};
+
+	test_block_set(cache_temp, 0, "value", OMNI_DATA_FLOAT, 0);
+	cache = OMNI_new(cache_temp, "value");
+
+	test_sample_alloc(&sample, 1, 64 * sizeof(float));
+	test_sample_alloc(&result, 1, 64 * sizeof(float));
+	sample.count[0] = 8;
+
+	for (uint pass = 0; pass < 2; pass++) {
+		for (uint frame = 0; frame < 100; frame++) {
+			for (uint sub = 0; sub < 16; sub++) {
+				float time = (float)frame + (sub / 16.0f);
+
+				test_fill(sample.data[0], sample.count[0], time * (pass + 1));
+				TEST_CHECK(OMNI_sample_write(cache, OMNI_f_to_fu(time), &sample) == OMNI_WRITE_SUCCESS);
+			}
+		}
+
+		TEST_CHECK(OMNI_get_num_cached(cache) == 1600);
+		TEST_CHECK(cache->sample_pool.num_slabs > 0);
+
+		for (uint frame = 0; frame < 100; frame += 7) {
+			float time = (float)frame + (5 / 16.0f);
+
+			TEST_CHECK(OMNI_sample_read(cache, OMNI_f_to_fu(time), &result) == OMNI_READ_EXACT);
+			TEST_CHECK(test_filled(result.data[0], 8, time * (pass + 1)));
+		}
+
+		/* Clearing all sub-samples releases all but one of the slabs. */
+		OMNI_sample_clear_from(cache, OMNI_f_to_fu(0.5f));
+
+		TEST_CHECK(OMNI_get_num_cached(cache) == 8);
+		TEST_CHECK(cache->sample_pool.num_slabs <= 1);
+	}
+
+	OMNI_free(cache);
+	test_sample_free(&sample, 1);
+	test_sample_free(&result, 1);
+	free(cache_temp);
+}
+
+int main(void)
+{
+	test_mempool();
+	test_sub_samples();
+
+	return 0;
+}
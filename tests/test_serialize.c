@@ -0,0 +1,143 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include "test.h"
+
+#include "omni_types.h"
+#include "omni_utils.h"
+
+static const float times[] = {0.0f, 0.5f, 0.25f, 1.0f, 3.0f, 300.0f, 300.75f, 301.0f};
+
+#define NUM_TIMES (sizeof(times) / sizeof(*times))
+
+/* Deserialized samples use an arena only with `OMNICACHE_FLAG_ARENA`, and the data pool of constant count blocks
+ * otherwise. */
+static void check_storage(OmniCache *cache, OmniCacheFlags flags, OmniBlockFlags b_flags)
+{
+	for (OmniSample *sample = SAMPLE_FIRST(cache); sample; sample = sample_next(sample)) {
+		bool arena = flags & OMNICACHE_FLAG_ARENA;
+
+		if (!SAMPLE_IS_VALID(sample)) {
+			continue;
+		}
+
+		TEST_CHECK((sample->arena != NULL) == arena);
+		TEST_CHECK(((sample->blocks[0].status & OMNI_BLOCK_STATUS_ARENA) != 0) == arena);
+
+		if (!arena) {
+			TEST_CHECK(((sample->blocks[0].status & OMNI_BLOCK_STATUS_POOLED) != 0) ==
+			           ((b_flags & OMNI_BLOCK_FLAG_CONST_COUNT) != 0));
+		}
+	}
+}
+
+/* Serialized caches deserialize to the same samples, states and metadata, which can then be rewritten. */
+static void test_serialize(OmniCacheFlags flags, OmniBlockFlags b_flags)
+{
+	OmniCacheTemplate *cache_temp = test_template_new("serialize", OMNI_TIME_FLOAT, flags, 2);
+	OmniCache *cache;
+	OmniCache *loaded;
+	OmniSerial *serial;
+	test_sample sample = {0};
+	test_sample result = {0};
+	test_sample expected = {0};
+	size_t size;
+
+	test_block_set(cache_temp, 0, "pos", OMNI_DATA_FLOAT3, b_flags);
+	test_block_set(cache_temp, 1, "weight", OMNI_DATA_FLOAT, 0);
+	cache = OMNI_new(cache_temp, "pos;weight");
+
+	test_sample_alloc(&sample, 2, 1000 * sizeof(float[3]));
+	test_sample_alloc(&result, 2, 1000 * sizeof(float[3]));
+	test_sample_alloc(&expected, 2, 1000 * sizeof(float[3]));
+
+	for (uint k = 0; k < NUM_TIMES; k++) {
+		sample.count[0] = (b_flags & OMNI_BLOCK_FLAG_CONST_COUNT) ? 50 : (k * 10) + 1;
+		sample.count[1] = 1;
+		sample.meta = times[k] * 7.0f;
+		test_fill(sample.data[0], sample.count[0] * 3, k * 1000.0f);
+		test_fill(sample.data[1], 1, (float)k);
+		TEST_CHECK(OMNI_sample_write(cache, OMNI_f_to_fu(times[k]), &sample) == OMNI_WRITE_SUCCESS);
+	}
+
+	OMNI_sample_mark_outdated(cache, OMNI_f_to_fu(3.0f));
+	OMNI_sample_mark_invalid(cache, OMNI_f_to_fu(1.0f));
+
+	serial = OMNI_serialize(cache, true, &size);
+	TEST_CHECK(size > OMNI_serial_get_size(cache, false));
+	TEST_CHECK(size == OMNI_serial_get_size(cache, true));
+
+	loaded = OMNI_deserialize(serial, cache_temp);
+	free(serial);
+
+	TEST_CHECK(loaded && OMNI_get_num_cached(loaded) == OMNI_get_num_cached(cache));
+	check_storage(loaded, flags, b_flags);
+
+	for (uint k = 0; k < NUM_TIMES; k++) {
+		OmniReadResult res = OMNI_sample_read(loaded, OMNI_f_to_fu(times[k]), &result);
+		OmniView *view;
+
+		TEST_CHECK(res == OMNI_sample_read(cache, OMNI_f_to_fu(times[k]), &expected));
+
+		if (res & OMNI_READ_INVALID) {
+			continue;
+		}
+
+		TEST_CHECK(result.count[0] == expected.count[0]);
+		TEST_CHECK(memcmp(result.data[0], expected.data[0], result.count[0] * sizeof(float[3])) == 0);
+		TEST_CHECK(test_filled(result.data[1], 1, (float)k));
+
+		TEST_CHECK(OMNI_view_acquire(loaded, OMNI_f_to_fu(times[k]), &view) == res);
+		TEST_CHECK(*(const float *)OMNI_view_get_meta(view) == times[k] * 7.0f);
+		OMNI_view_release(view);
+	}
+
+	TEST_CHECK(OMNI_sample_read(loaded, OMNI_f_to_fu(3.0f), &result) == OMNI_READ_OUTDATED);
+	TEST_CHECK(OMNI_sample_read(loaded, OMNI_f_to_fu(1.0f), &result) == OMNI_READ_INVALID);
+
+	/* Rewriting deserialized samples, growing them where possible. */
+	for (uint k = 0; k < NUM_TIMES; k++) {
+		sample.count[0] = (b_flags & OMNI_BLOCK_FLAG_CONST_COUNT) ? 50 : 900;
+		test_fill(sample.data[0], sample.count[0] * 3, -(float)k);
+		TEST_CHECK(OMNI_sample_write(loaded, OMNI_f_to_fu(times[k]), &sample) == OMNI_WRITE_SUCCESS);
+	}
+
+	for (uint k = 0; k < NUM_TIMES; k++) {
+		TEST_CHECK(OMNI_sample_read(loaded, OMNI_f_to_fu(times[k]), &result) == OMNI_READ_EXACT);
+		TEST_CHECK(result.count[0] == sample.count[0]);
+		TEST_CHECK(test_filled(result.data[0], result.count[0] * 3, -(float)k));
+	}
+
+	OMNI_sample_clear_from(loaded, OMNI_f_to_fu(0.3f));
+	TEST_CHECK(OMNI_get_num_cached(loaded) == 2);
+
+	OMNI_free(loaded);
+
+	/* Without data, only the definition is kept. */
+	serial = OMNI_serialize(cache, false, &size);
+	loaded = OMNI_deserialize(serial, cache_temp);
+	free(serial);
+
+	TEST_CHECK(loaded && OMNI_get_num_cached(loaded) == 0);
+	TEST_CHECK(OMNI_get_num_blocks(loaded) == 2);
+
+	OMNI_free(loaded);
+	OMNI_free(cache);
+	TEST_CHECK(OMNI_get_memory_global() == 0);
+
+	test_sample_free(&sample, 2);
+	test_sample_free(&result, 2);
+	test_sample_free(&expected, 2);
+	free(cache_temp);
+}
+
+int main(void)
+{
+	test_serialize(0, 0);
+	test_serialize(0, OMNI_BLOCK_FLAG_CONST_COUNT);
+	test_serialize(OMNICACHE_FLAG_ARENA, 0);
+	test_serialize(OMNICACHE_FLAG_ARENA, OMNI_BLOCK_FLAG_CONST_COUNT);
+
+	return 0;
+}
@@ -0,0 +1,122 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include "test.h"
+
+#define MAX_CHUNK (1 << 20)
+
+/* In-memory stream, failing writes after `max_writes` (if non-zero). */
+typedef struct stream {
+	char *data;
+	size_t size;
+	size_t pos;
+	size_t max_chunk;
+	uint num_writes;
+	uint max_writes;
+} stream;
+
+static bool stream_write(const void *data, size_t size, void *user_data)
+{
+	stream *st = user_data;
+
+	if (st->max_writes && st->num_writes == st->max_writes) {
+		return false;
+	}
+
+	st->data = realloc(st->data, st->size + size);
+	memcpy(st->data + st->size, data, size);
+	st->size += size;
+	st->num_writes++;
+
+	if (size > st->max_chunk) {
+		st->max_chunk = size;
+	}
+
+	return true;
+}
+
+static size_t stream_read(void *data, size_t size, void *user_data)
+{
+	stream *st = user_data;
+
+	if (size > st->size - st->pos) {
+		size = st->size - st->pos;
+	}
+
+	memcpy(data, st->data + st->pos, size);
+	st->pos += size;
+
+	return size;
+}
+
+/* Streamed serialization matches `OMNI_serialize` in bounded chunks, and the stream deserializer stops at the end
+ * of the cache, and fails on truncated streams. */
+int main(void)
+{
+	OmniCacheTemplate *cache_temp = test_template_new("stream", OMNI_TIME_INT, 0, 1);
+	OmniCache *cache;
+	OmniCache *loaded;
+	OmniSerial *serial;
+	stream st = {0};
+	test_sample sample = {0};
+	test_sample result = {0};
+	size_t size;
+
+	cache_temp->meta_size = 0;
+	cache_temp->meta_gen = NULL;
+	test_block_set(cache_temp, 0, "pos", OMNI_DATA_FLOAT3, 0);
+	cache = OMNI_new(cache_temp, "pos");
+
+	test_sample_alloc(&sample, 1, 150000 * sizeof(float[3]));
+	test_sample_alloc(&result, 1, 150000 * sizeof(float[3]));
+
+	/* Some samples larger than a chunk. */
+	for (uint frame = 0; frame < 40; frame++) {
+		sample.count[0] = (frame % 5 == 0) ? 150000 : (frame * 3) + 1;
+		test_fill(sample.data[0], sample.count[0] * 3, frame * 1000.0f);
+		TEST_CHECK(OMNI_sample_write(cache, OMNI_u_to_fu(frame * 2), &sample) == OMNI_WRITE_SUCCESS);
+	}
+
+	serial = OMNI_serialize(cache, true, &size);
+
+	TEST_CHECK(OMNI_serialize_stream(cache, true, stream_write, &st));
+	TEST_CHECK(st.size == size && memcmp(st.data, serial, size) == 0);
+	TEST_CHECK(st.max_chunk <= MAX_CHUNK && st.num_writes > 1);
+
+	/* Data following the cache is left unread. */
+	TEST_CHECK(stream_write("TRAILER", 7, &st));
+
+	loaded = OMNI_deserialize_stream(stream_read, &st, cache_temp);
+	TEST_CHECK(loaded && st.pos == size);
+
+	for (uint frame = 0; frame < 40; frame++) {
+		TEST_CHECK(OMNI_sample_read(loaded, OMNI_u_to_fu(frame * 2), &result) == OMNI_READ_EXACT);
+		TEST_CHECK(result.count[0] == ((frame % 5 == 0) ? 150000 : (frame * 3) + 1));
+		TEST_CHECK(test_filled(result.data[0], result.count[0] * 3, frame * 1000.0f));
+	}
+
+	OMNI_free(loaded);
+
+	/* Truncated anywhere, in the definition or the data. */
+	for (size_t end = 0; end < size; end += (end < 4096) ? 29 : 999983) {
+		st.size = end;
+		st.pos = 0;
+		TEST_CHECK(OMNI_deserialize_stream(stream_read, &st, cache_temp) == NULL);
+	}
+
+	/* Failing writes fail the stream. */
+	free(st.data);
+	memset(&st, 0, sizeof(st));
+	st.max_writes = 3;
+	TEST_CHECK(!OMNI_serialize_stream(cache, true, stream_write, &st));
+
+	free(st.data);
+	free(serial);
+	OMNI_free(cache);
+	test_sample_free(&sample, 1);
+	test_sample_free(&result, 1);
+	free(cache_temp);
+
+	return 0;
+}
@@ -0,0 +1,100 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include "test.h"
+
+#include "omni_types.h"
+
+#define NUM_SUBS 15
+
+static bool subs_sorted(const OmniSample *root)
+{
+	for (uint i = 1; i < root->num_subs; i++) {
+		if (root->subs[i - 1].toffset.f >= root->subs[i].toffset.f ||
+		    root->subs[i].sample->toffset.f != root->subs[i].toffset.f)
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+/* Sub-samples inserted out of order are found by their time, and stay sorted as they are removed. */
+int main(void)
+{
+	OmniCacheTemplate *cache_temp = test_template_new("sub_index", OMNI_TIME_FLOAT, 0, 1);
+	OmniCache *cache;
+	OmniSample *root;
+	test_sample sample = {0};
+	test_sample result = {0};
+	uint num_cached;
+
+	test_block_set(cache_temp, 0, "value", OMNI_DATA_FLOAT, 0);
+	cache = OMNI_new(cache_temp, "value");
+
+	test_sample_alloc(&sample, 1, 16 * sizeof(float));
+	test_sample_alloc(&result, 1, 16 * sizeof(float));
+	sample.count[0] = 3;
+
+	/* Odd offsets descending, then even ones ascending. */
+	for (int k = NUM_SUBS; k >= 0; k -= 2) {
+		float time = 10.0f + (k / 16.0f);
+
+		test_fill(sample.data[0], sample.count[0], time);
+		TEST_CHECK(OMNI_sample_write(cache, OMNI_f_to_fu(time), &sample) == OMNI_WRITE_SUCCESS);
+	}
+
+	for (int k = 0; k <= NUM_SUBS; k += 2) {
+		float time = 10.0f + (k / 16.0f);
+
+		test_fill(sample.data[0], sample.count[0], time);
+		TEST_CHECK(OMNI_sample_write(cache, OMNI_f_to_fu(time), &sample) == OMNI_WRITE_SUCCESS);
+	}
+
+	root = &cache->pages[0][10];
+	TEST_CHECK(root->num_subs == NUM_SUBS && subs_sorted(root));
+
+	for (int k = 0; k <= NUM_SUBS; k++) {
+		float time = 10.0f + (k / 16.0f);
+
+		TEST_CHECK(OMNI_sample_read(cache, OMNI_f_to_fu(time), &result) == OMNI_READ_EXACT);
+		TEST_CHECK(test_filled(result.data[0], 3, time));
+	}
+
+	TEST_CHECK(OMNI_sample_read(cache, OMNI_f_to_fu(10.1f), &result) == OMNI_READ_INVALID);
+
+	/* Removing every other sub-sample. */
+	for (int k = 1; k <= NUM_SUBS; k += 2) {
+		OMNI_sample_mark_invalid(cache, OMNI_f_to_fu(10.0f + (k / 16.0f)));
+	}
+
+	num_cached = OMNI_get_num_cached(cache);
+	OMNI_consolidate(cache, OMNI_CONSOL_FREE_INVALID);
+
+	TEST_CHECK(OMNI_get_num_cached(cache) == num_cached - 8);
+	TEST_CHECK(root->num_subs == 7 && subs_sorted(root));
+
+	for (int k = 2; k <= NUM_SUBS; k += 2) {
+		float time = 10.0f + (k / 16.0f);
+
+		TEST_CHECK(OMNI_sample_read(cache, OMNI_f_to_fu(time), &result) == OMNI_READ_EXACT);
+		TEST_CHECK(test_filled(result.data[0], 3, time));
+	}
+
+	OMNI_sample_mark_invalid_from(cache, OMNI_f_to_fu(10.3f));
+
+	TEST_CHECK(OMNI_sample_read(cache, OMNI_f_to_fu(10.25f), &result) == OMNI_READ_EXACT);
+	TEST_CHECK(OMNI_sample_read(cache, OMNI_f_to_fu(10.375f), &result) == OMNI_READ_INVALID);
+
+	OMNI_sample_clear_from(cache, OMNI_f_to_fu(10.2f));
+	TEST_CHECK(root->num_subs == 1 && subs_sorted(root));
+
+	OMNI_free(cache);
+	test_sample_free(&sample, 1);
+	test_sample_free(&result, 1);
+	free(cache_temp);
+
+	return 0;
+}
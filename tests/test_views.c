@@ -0,0 +1,103 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include "test.h"
+
+static const float *view_values(const OmniView *view)
+{
+	return OMNI_view_get_block(view, 0)->data;
+}
+
+static float view_meta(const OmniView *view)
+{
+	return *(const float *)OMNI_view_get_meta(view);
+}
+
+/* Views keep the data they were acquired with while the sample is overwritten or removed, or the cache freed,
+ * and are shared until released. */
+static void test_views(OmniCacheFlags flags)
+{
+	OmniCacheTemplate *cache_temp = test_template_new("views", OMNI_TIME_FLOAT, flags, 1);
+	OmniCache *cache;
+	OmniCache *dup;
+	test_sample sample = {0};
+	OmniView *views[4];
+	OmniView *view;
+
+	test_block_set(cache_temp, 0, "value", OMNI_DATA_FLOAT, 0);
+	cache = OMNI_new(cache_temp, "value");
+
+	test_sample_alloc(&sample, 1, 100 * sizeof(float));
+	sample.count[0] = 10;
+
+	for (uint k = 0; k < 4; k++) {
+		sample.meta = (float)k;
+		test_fill(sample.data[0], sample.count[0], k * 100.0f);
+		TEST_CHECK(OMNI_sample_write(cache, OMNI_f_to_fu(k * 0.5f), &sample) == OMNI_WRITE_SUCCESS);
+	}
+
+	TEST_CHECK(OMNI_view_acquire(cache, OMNI_f_to_fu(0.25f), &view) == OMNI_READ_INVALID && view == NULL);
+
+	for (uint k = 0; k < 4; k++) {
+		TEST_CHECK(OMNI_view_acquire(cache, OMNI_f_to_fu(k * 0.5f), &views[k]) == OMNI_READ_EXACT);
+	}
+
+	TEST_CHECK(OMNI_view_acquire(cache, OMNI_f_to_fu(0.5f), &view) == OMNI_READ_EXACT && view == views[1]);
+	TEST_CHECK(OMNI_view_get_num_blocks(views[1]) == 1);
+	TEST_CHECK(OMNI_view_get_block(views[1], 0)->dcount == 10);
+	TEST_CHECK(test_filled(view_values(views[1]), 10, 100.0f) && view_meta(views[1]) == 1.0f);
+
+	/* Overwriting with more and fewer elements. */
+	sample.count[0] = 50;
+	sample.meta = -1.0f;
+	test_fill(sample.data[0], sample.count[0], -100.0f);
+	TEST_CHECK(OMNI_sample_write(cache, OMNI_f_to_fu(0.5f), &sample) == OMNI_WRITE_SUCCESS);
+	sample.count[0] = 5;
+	TEST_CHECK(OMNI_sample_write(cache, OMNI_f_to_fu(0.0f), &sample) == OMNI_WRITE_SUCCESS);
+
+	TEST_CHECK(test_filled(view_values(views[0]), 10, 0.0f) && view_meta(views[0]) == 0.0f);
+	TEST_CHECK(test_filled(view_values(views[1]), 10, 100.0f) && view_meta(views[1]) == 1.0f);
+
+	/* Released once per acquire. */
+	OMNI_view_release(views[1]);
+	TEST_CHECK(test_filled(view_values(views[1]), 10, 100.0f));
+	OMNI_view_release(views[1]);
+
+	TEST_CHECK(OMNI_view_acquire(cache, OMNI_f_to_fu(0.5f), &views[1]) == OMNI_READ_EXACT);
+	TEST_CHECK(OMNI_view_get_block(views[1], 0)->dcount == 50);
+	TEST_CHECK(test_filled(view_values(views[1]), 50, -100.0f) && view_meta(views[1]) == -1.0f);
+
+	OMNI_sample_clear_from(cache, OMNI_f_to_fu(1.5f));
+	TEST_CHECK(test_filled(view_values(views[3]), 10, 300.0f));
+
+	OMNI_mark_outdated(cache);
+	TEST_CHECK(OMNI_view_acquire(cache, OMNI_f_to_fu(1.0f), &view) == OMNI_READ_OUTDATED && view == views[2]);
+	OMNI_view_release(view);
+
+	dup = OMNI_duplicate(cache, true);
+	OMNI_free(cache);
+
+	TEST_CHECK(test_filled(view_values(views[2]), 10, 200.0f) && view_meta(views[2]) == 2.0f);
+
+	for (uint k = 0; k < 4; k++) {
+		OMNI_view_release(views[k]);
+	}
+
+	TEST_CHECK(OMNI_view_acquire(dup, OMNI_f_to_fu(1.0f), &view) == OMNI_READ_OUTDATED);
+	TEST_CHECK(test_filled(view_values(view), 10, 200.0f));
+	OMNI_view_release(view);
+
+	OMNI_free(dup);
+	test_sample_free(&sample, 1);
+	free(cache_temp);
+}
+
+int main(void)
+{
+	test_views(0);
+	test_views(OMNICACHE_FLAG_ARENA);
+	test_views(OMNICACHE_FLAG_INTERP_SUB);
+
+	return 0;
+}
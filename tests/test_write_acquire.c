@@ -0,0 +1,91 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include <stdint.h>
+
+#include "test.h"
+
+/* Samples filled directly through the buffers handed out by `OMNI_sample_write_acquire` become valid on commit,
+ * leaving views of the previous data untouched. */
+static void test_write_acquire(OmniCacheFlags flags)
+{
+	OmniCacheTemplate *cache_temp = test_template_new("write_acquire", OMNI_TIME_FLOAT, flags, 2);
+	OmniCache *cache;
+	OmniCache *dup;
+	test_sample sample = {0};
+	test_sample result = {0};
+	OmniData blocks[2];
+	OmniView *view;
+
+	test_block_set(cache_temp, 0, "pos", OMNI_DATA_FLOAT3, 0);
+	test_block_set(cache_temp, 1, "weight", OMNI_DATA_FLOAT, 0);
+	cache = OMNI_new(cache_temp, "pos;weight");
+	TEST_CHECK(OMNI_get_num_blocks(cache) == 2);
+
+	test_sample_alloc(&result, 2, 1000 * sizeof(float[3]));
+	sample.count[0] = 7;
+	sample.count[1] = 2;
+	sample.meta = 7.0f;
+
+	/* Nothing to commit before acquiring. */
+	TEST_CHECK(OMNI_sample_write_commit(cache, OMNI_f_to_fu(1.0f), &sample) == OMNI_WRITE_INVALID);
+
+	TEST_CHECK(OMNI_sample_write_acquire(cache, OMNI_f_to_fu(1.0f), &sample, blocks) == OMNI_WRITE_SUCCESS);
+	TEST_CHECK(blocks[0].dcount == 7 && blocks[0].dsize == sizeof(float[3]));
+	TEST_CHECK(blocks[1].dcount == 2 && blocks[1].dsize == sizeof(float));
+	TEST_CHECK((uintptr_t)blocks[0].data % 64 == 0 && (uintptr_t)blocks[1].data % 64 == 0);
+
+	test_fill(blocks[0].data, 21, 0.0f);
+	test_fill(blocks[1].data, 2, 50.0f);
+
+	TEST_CHECK(!OMNI_sample_is_valid(cache, OMNI_f_to_fu(1.0f)));
+	TEST_CHECK(OMNI_sample_read(cache, OMNI_f_to_fu(1.0f), &result) == OMNI_READ_INVALID);
+
+	TEST_CHECK(OMNI_sample_write_commit(cache, OMNI_f_to_fu(1.0f), &sample) == OMNI_WRITE_SUCCESS);
+	TEST_CHECK(OMNI_sample_write_commit(cache, OMNI_f_to_fu(1.0f), &sample) == OMNI_WRITE_INVALID);
+	TEST_CHECK(OMNI_sample_is_current(cache, OMNI_f_to_fu(1.0f)));
+
+	TEST_CHECK(OMNI_sample_read(cache, OMNI_f_to_fu(1.0f), &result) == OMNI_READ_EXACT);
+	TEST_CHECK(result.count[0] == 7 && test_filled(result.data[0], 21, 0.0f));
+	TEST_CHECK(result.count[1] == 2 && test_filled(result.data[1], 2, 50.0f));
+
+	/* Acquiring over a viewed sample, which is then cleared before committing. */
+	TEST_CHECK(OMNI_view_acquire(cache, OMNI_f_to_fu(1.0f), &view) == OMNI_READ_EXACT);
+
+	sample.count[0] = 900;
+	sample.meta = 900.0f;
+	TEST_CHECK(OMNI_sample_write_acquire(cache, OMNI_f_to_fu(1.0f), &sample, blocks) == OMNI_WRITE_SUCCESS);
+	TEST_CHECK(blocks[0].dcount == 900);
+	memset(blocks[0].data, 0, 900 * sizeof(float[3]));
+
+	TEST_CHECK(test_filled(OMNI_view_get_block(view, 0)->data, 21, 0.0f));
+	TEST_CHECK(*(const float *)OMNI_view_get_meta(view) == 7.0f);
+
+	OMNI_sample_clear(cache, OMNI_f_to_fu(1.0f));
+	TEST_CHECK(OMNI_sample_write_commit(cache, OMNI_f_to_fu(1.0f), &sample) == OMNI_WRITE_INVALID);
+
+	/* A pending sample is duplicated as such. */
+	TEST_CHECK(OMNI_sample_write_acquire(cache, OMNI_f_to_fu(1.5f), &sample, blocks) == OMNI_WRITE_SUCCESS);
+	test_fill(blocks[0].data, 900 * 3, 1.5f);
+	dup = OMNI_duplicate(cache, true);
+	TEST_CHECK(OMNI_sample_write_commit(cache, OMNI_f_to_fu(1.5f), &sample) == OMNI_WRITE_SUCCESS);
+
+	TEST_CHECK(OMNI_sample_read(cache, OMNI_f_to_fu(1.5f), &result) == OMNI_READ_EXACT);
+	TEST_CHECK(result.count[0] == 900 && test_filled(result.data[0], 900 * 3, 1.5f));
+	TEST_CHECK(OMNI_sample_read(dup, OMNI_f_to_fu(1.5f), &result) == OMNI_READ_INVALID);
+
+	OMNI_free(cache);
+	OMNI_view_release(view);
+	OMNI_free(dup);
+	test_sample_free(&result, 2);
+	free(cache_temp);
+}
+
+int main(void)
+{
+	test_write_acquire(0);
+	test_write_acquire(OMNICACHE_FLAG_ARENA);
+
+	return 0;
+}
@@ -0,0 +1,116 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include "test.h"
+
+static uint num_freed;
+
+static void buffer_free(void *buffer)
+{
+	num_freed++;
+	free(buffer);
+}
+
+static float *buffer_new(uint num, float base)
+{
+	float *buffer = malloc(sizeof(float) * num);
+
+	test_fill(buffer, num, base);
+
+	return buffer;
+}
+
+/* Buffers handed over by `OMNI_block_write_move` are used in place, and freed with their callback once the cache
+ * (and any view) is done with them, or left to the caller when the write fails. */
+static void test_write_move(OmniCacheFlags flags)
+{
+	OmniCacheTemplate *cache_temp = test_template_new("write_move", OMNI_TIME_FLOAT, flags, 3);
+	OmniCache *cache;
+	OmniCache *dup;
+	test_sample sample = {0};
+	test_sample result = {0};
+	OmniView *view;
+	float *buffer;
+
+	test_block_set(cache_temp, 0, "a", OMNI_DATA_FLOAT, 0);
+	test_block_set(cache_temp, 1, "b", OMNI_DATA_FLOAT, 0);
+	test_block_set(cache_temp, 2, "c", OMNI_DATA_FLOAT, OMNI_BLOCK_FLAG_CONST_COUNT);
+	cache = OMNI_new(cache_temp, "a;b;c");
+
+	test_sample_alloc(&sample, 3, 100 * sizeof(float));
+	test_sample_alloc(&result, 3, 100 * sizeof(float));
+	num_freed = 0;
+	sample.meta = 5.0f;
+
+	/* The sample is valid once all its blocks are written. */
+	TEST_CHECK(OMNI_block_write_move(cache, OMNI_f_to_fu(2.0f), 0, buffer_new(10, 100.0f), 10, buffer_free, &sample) ==
+	           OMNI_WRITE_SUCCESS);
+	TEST_CHECK(OMNI_block_write_move(cache, OMNI_f_to_fu(2.0f), 1, buffer_new(3, 200.0f), 3, buffer_free, &sample) ==
+	           OMNI_WRITE_SUCCESS);
+	TEST_CHECK(!OMNI_sample_is_valid(cache, OMNI_f_to_fu(2.0f)));
+	TEST_CHECK(OMNI_block_write_move(cache, OMNI_f_to_fu(2.0f), 2, buffer_new(4, 300.0f), 4, buffer_free, &sample) ==
+	           OMNI_WRITE_SUCCESS);
+	TEST_CHECK(OMNI_sample_is_current(cache, OMNI_f_to_fu(2.0f)));
+
+	TEST_CHECK(OMNI_view_acquire(cache, OMNI_f_to_fu(2.0f), &view) == OMNI_READ_EXACT);
+	TEST_CHECK(OMNI_view_get_block(view, 0)->dcount == 10);
+	TEST_CHECK(test_filled(OMNI_view_get_block(view, 1)->data, 3, 200.0f));
+	TEST_CHECK(*(const float *)OMNI_view_get_meta(view) == 5.0f);
+
+	/* Replacing a viewed block keeps the old buffer alive for the view. */
+	TEST_CHECK(OMNI_block_write_move(cache, OMNI_f_to_fu(2.0f), 0, buffer_new(4, 400.0f), 4, buffer_free, &sample) ==
+	           OMNI_WRITE_SUCCESS);
+	TEST_CHECK(num_freed == 0 && test_filled(OMNI_view_get_block(view, 0)->data, 10, 100.0f));
+
+	TEST_CHECK(OMNI_sample_read(cache, OMNI_f_to_fu(2.0f), &result) == OMNI_READ_EXACT);
+	TEST_CHECK(result.count[0] == 4 && test_filled(result.data[0], 4, 400.0f));
+	TEST_CHECK(result.count[2] == 4 && test_filled(result.data[2], 4, 300.0f));
+
+	/* Constant count blocks reject buffers of another size, which stay owned by the caller. */
+	buffer = buffer_new(5, 0.0f);
+	TEST_CHECK(OMNI_block_write_move(cache, OMNI_f_to_fu(3.0f), 2, buffer, 5, buffer_free, &sample) !=
+	           OMNI_WRITE_SUCCESS);
+	TEST_CHECK(num_freed == 0);
+	free(buffer);
+
+	/* Regular writes over moved buffers free them. */
+	TEST_CHECK(OMNI_block_write_move(cache, OMNI_f_to_fu(3.0f), 0, buffer_new(4, 0.0f), 4, NULL, &sample) ==
+	           OMNI_WRITE_SUCCESS);
+	TEST_CHECK(OMNI_block_write_move(cache, OMNI_f_to_fu(3.0f), 1, buffer_new(4, 0.0f), 4, buffer_free, &sample) ==
+	           OMNI_WRITE_SUCCESS);
+
+	sample.count[0] = 7;
+	sample.count[1] = 7;
+	sample.count[2] = 4;
+	test_fill(sample.data[0], 7, 3.0f);
+	TEST_CHECK(OMNI_sample_write(cache, OMNI_f_to_fu(3.0f), &sample) == OMNI_WRITE_SUCCESS);
+	TEST_CHECK(num_freed == 1);
+	TEST_CHECK(OMNI_sample_read(cache, OMNI_f_to_fu(3.0f), &result) == OMNI_READ_EXACT);
+	TEST_CHECK(result.count[0] == 7 && test_filled(result.data[0], 7, 3.0f));
+
+	/* Duplicates copy moved buffers, which are freed along with the cache and the view. */
+	dup = OMNI_duplicate(cache, true);
+	OMNI_free(cache);
+	TEST_CHECK(test_filled(OMNI_view_get_block(view, 1)->data, 3, 200.0f));
+	OMNI_view_release(view);
+	TEST_CHECK(num_freed == 5);
+
+	TEST_CHECK(OMNI_sample_read(dup, OMNI_f_to_fu(2.0f), &result) == OMNI_READ_EXACT);
+	TEST_CHECK(test_filled(result.data[0], 4, 400.0f));
+
+	OMNI_free(dup);
+	TEST_CHECK(num_freed == 5);
+
+	test_sample_free(&sample, 3);
+	test_sample_free(&result, 3);
+	free(cache_temp);
+}
+
+int main(void)
+{
+	test_write_move(0);
+	test_write_move(OMNICACHE_FLAG_ARENA);
+
+	return 0;
+}